@@ -242,3 +242,152 @@ void ThreadPool::drain(WorkQueue_* wq)
   _lock.Unlock();
 }
 
+
+
+ShardedThreadPool::ShardedThreadPool(CephContext *cct_, string nm,
+				     unsigned num_shards,
+				     unsigned num_threads_per_shard)
+  : cct(cct_), name(nm),
+    num_threads_per_shard(num_threads_per_shard),
+    wq(NULL)
+{
+  assert(num_shards > 0);
+  for (unsigned i = 0; i < num_shards; i++) {
+    std::stringstream ss;
+    ss << name << "::shard" << i << "::lock";
+    shards.push_back(new Shard(ss.str()));
+  }
+}
+
+ShardedThreadPool::~ShardedThreadPool()
+{
+  for (unsigned i = 0; i < shards.size(); i++) {
+    assert(shards[i]->threads.empty());
+    delete shards[i];
+  }
+}
+
+void ShardedThreadPool::worker(unsigned shard)
+{
+  Shard *s = shards[shard];
+  s->lock.Lock();
+  ldout(cct,10) << "worker start (shard " << shard << ")" << dendl;
+
+  std::stringstream ss;
+  ss << name << " shard " << shard << " thread " << (void*)pthread_self();
+  heartbeat_handle_d *hb = cct->get_heartbeat_map()->add_worker(ss.str());
+
+  while (!s->stop) {
+    if (!s->pause && wq) {
+      void *item = wq->_void_dequeue(shard);
+      if (item) {
+	s->processing++;
+	ldout(cct,12) << "worker shard " << shard << " start processing " << item
+		      << " (" << s->processing << " active)" << dendl;
+	cct->get_heartbeat_map()->reset_timeout(hb, wq->timeout_interval, wq->suicide_interval);
+	s->lock.Unlock();
+	wq->_void_process(shard, item);
+	s->lock.Lock();
+	wq->_void_process_finish(shard, item);
+	s->processing--;
+	ldout(cct,15) << "worker shard " << shard << " done processing " << item
+		      << " (" << s->processing << " active)" << dendl;
+	if (s->pause || s->draining)
+	  s->wait_cond.Signal();
+	continue;
+      }
+    }
+
+    ldout(cct,20) << "worker shard " << shard << " waiting" << dendl;
+    cct->get_heartbeat_map()->reset_timeout(hb, 4, 0);
+    s->cond.WaitInterval(cct, s->lock, utime_t(2, 0));
+  }
+  ldout(cct,1) << "worker finish (shard " << shard << ")" << dendl;
+
+  cct->get_heartbeat_map()->remove_worker(hb);
+
+  s->lock.Unlock();
+}
+
+void ShardedThreadPool::start()
+{
+  ldout(cct,10) << "start" << dendl;
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    s->stop = false;
+    while (s->threads.size() < num_threads_per_shard) {
+      WorkThread *wt = new WorkThread(this, i);
+      ldout(cct, 10) << "start creating and starting " << wt
+		     << " for shard " << i << dendl;
+      s->threads.push_back(wt);
+      wt->create();
+    }
+  }
+  ldout(cct,15) << "started" << dendl;
+}
+
+void ShardedThreadPool::stop()
+{
+  ldout(cct,10) << "stop" << dendl;
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    s->lock.Lock();
+    s->stop = true;
+    s->cond.SignalAll();
+    s->lock.Unlock();
+  }
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    for (list<WorkThread*>::iterator p = s->threads.begin();
+	 p != s->threads.end();
+	 ++p) {
+      (*p)->join();
+      delete *p;
+    }
+    s->threads.clear();
+  }
+  ldout(cct,15) << "stopped" << dendl;
+}
+
+void ShardedThreadPool::pause()
+{
+  ldout(cct,10) << "pause" << dendl;
+  // stop every shard taking new work before waiting on any of them
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Mutex::Locker l(shards[i]->lock);
+    shards[i]->pause++;
+  }
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    while (s->processing)
+      s->wait_cond.Wait(s->lock);
+  }
+  ldout(cct,15) << "paused" << dendl;
+}
+
+void ShardedThreadPool::unpause()
+{
+  ldout(cct,10) << "unpause" << dendl;
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    assert(s->pause > 0);
+    s->pause--;
+    s->cond.SignalAll();
+  }
+}
+
+void ShardedThreadPool::drain()
+{
+  ldout(cct,10) << "drain" << dendl;
+  for (unsigned i = 0; i < shards.size(); i++) {
+    Shard *s = shards[i];
+    Mutex::Locker l(s->lock);
+    s->draining++;
+    while (s->processing || (wq && !wq->_empty(i)))
+      s->wait_cond.Wait(s->lock);
+    s->draining--;
+  }
+}
@@ -361,6 +361,172 @@ public:
   void drain(WorkQueue_* wq = 0);
 };
 
+/**
+ * Thread pool split into independent shards
+ *
+ * Each shard has its own lock, condition and threads, and a shard's
+ * threads only take work queued to that shard, so threads (and
+ * enqueuers) on different shards never contend.  The work queue
+ * picks each item's shard; items that must be processed in order
+ * have to map to the same one.
+ *
+ * A pool serves a single work queue.
+ */
+class ShardedThreadPool {
+public:
+  struct WorkQueue_ {
+    string name;
+    time_t timeout_interval, suicide_interval;
+    WorkQueue_(string n, time_t ti, time_t sti)
+      : name(n), timeout_interval(ti), suicide_interval(sti)
+    { }
+    virtual ~WorkQueue_() {}
+    // all called with the shard's lock held, except _void_process()
+    virtual bool _empty(unsigned shard) = 0;
+    virtual void *_void_dequeue(unsigned shard) = 0;
+    virtual void _void_process(unsigned shard, void *) = 0;
+    virtual void _void_process_finish(unsigned shard, void *) = 0;
+  };
+
+  /**
+   * Like ThreadPool::WorkQueueVal, with _shard() choosing where an
+   * item goes; the queue keeps one set of queues per shard, each
+   * protected by the shard's lock.
+   */
+  template<typename T, typename U>
+  class WorkQueueVal : public WorkQueue_ {
+    ShardedThreadPool *pool;
+    virtual unsigned _shard(const T&) = 0;
+    virtual void _enqueue(unsigned shard, T) = 0;
+    virtual void _enqueue_front(unsigned shard, T) = 0;
+    virtual bool _empty(unsigned shard) = 0;
+    virtual U _dequeue(unsigned shard) = 0;
+    virtual void _process(unsigned shard, U) = 0;
+    virtual void _process_finish(unsigned shard, U) {}
+
+    void *_void_dequeue(unsigned shard) {
+      if (_empty(shard))
+	return 0;
+      return new U(_dequeue(shard));
+    }
+    void _void_process(unsigned shard, void *p) {
+      _process(shard, *(U*)p);
+    }
+    void _void_process_finish(unsigned shard, void *p) {
+      _process_finish(shard, *(U*)p);
+      delete (U*)p;
+    }
+
+  public:
+    WorkQueueVal(string n, time_t ti, time_t sti, ShardedThreadPool *p)
+      : WorkQueue_(n, ti, sti), pool(p) {
+      pool->set_work_queue(this);
+    }
+    ~WorkQueueVal() {
+      pool->set_work_queue(0);
+    }
+    unsigned get_num_shards() const {
+      return pool->get_num_shards();
+    }
+    void queue(T item) {
+      unsigned shard = _shard(item);
+      pool->lock(shard);
+      _enqueue(shard, item);
+      pool->_wake(shard);
+      pool->unlock(shard);
+    }
+    void queue_front(T item) {
+      unsigned shard = _shard(item);
+      pool->lock(shard);
+      _enqueue_front(shard, item);
+      pool->_wake(shard);
+      pool->unlock(shard);
+    }
+    void drain() {
+      pool->drain();
+    }
+  protected:
+    void lock(unsigned shard) {
+      pool->lock(shard);
+    }
+    void unlock(unsigned shard) {
+      pool->unlock(shard);
+    }
+  };
+
+private:
+  CephContext *cct;
+  string name;
+  unsigned num_threads_per_shard;
+  WorkQueue_ *wq;
+
+  struct WorkThread : public Thread {
+    ShardedThreadPool *pool;
+    unsigned shard;
+    WorkThread(ShardedThreadPool *p, unsigned s) : pool(p), shard(s) {}
+    void *entry() {
+      pool->worker(shard);
+      return 0;
+    }
+  };
+
+  struct Shard {
+    string lockname;
+    Mutex lock;
+    Cond cond;       ///< work queued, or stopping or unpausing
+    Cond wait_cond;  ///< an item finished, for pause() and drain()
+    bool stop;
+    int pause;
+    int draining;
+    int processing;
+    list<WorkThread*> threads;
+    Shard(string n)
+      : lockname(n),
+	lock(lockname.c_str()),  // this should be safe due to declaration order
+	stop(false), pause(0), draining(0), processing(0) {}
+  };
+  vector<Shard*> shards;
+
+  void worker(unsigned shard);
+
+public:
+  ShardedThreadPool(CephContext *cct_, string nm, unsigned num_shards,
+		    unsigned num_threads_per_shard);
+  ~ShardedThreadPool();
+
+  unsigned get_num_shards() const {
+    return shards.size();
+  }
+
+  void set_work_queue(WorkQueue_ *w) {
+    wq = w;
+  }
+
+  /// take a shard's lock
+  void lock(unsigned shard) {
+    shards[shard]->lock.Lock();
+  }
+  /// release a shard's lock
+  void unlock(unsigned shard) {
+    shards[shard]->lock.Unlock();
+  }
+  /// wake up one of a shard's threads (with its lock held)
+  void _wake(unsigned shard) {
+    shards[shard]->cond.SignalOne();
+  }
+
+  /// start the threads of every shard
+  void start();
+  /// stop and join them
+  void stop();
+  /// stop taking new work and wait for the work in progress to finish
+  void pause();
+  /// resume work.  must match each pause() call 1:1 to resume.
+  void unpause();
+  /// wait for every shard to be empty and idle
+  void drain();
+};
+
 
 
 #endif
@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
@@ -42,6 +43,17 @@ static uint32_t simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZE
 atomic_t buffer_total_alloc;
 bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
 
+atomic_t buffer_cached_crc;
+atomic_t buffer_cached_crc_adjusted;
+bool buffer_track_crc = get_env_bool("CEPH_BUFFER_TRACK");
+
+/*
+ * only segments at least this big are worth a map lookup, and a raw
+ * buffer keeps at most this many cached crcs before starting over.
+ */
+#define CRC_CACHE_MIN_LEN     CEPH_PAGE_SIZE
+#define CRC_CACHE_MAX_ENTRIES 8
+
   void buffer::inc_total_alloc(unsigned len) {
     if (buffer_track_alloc)
       buffer_total_alloc.add(len);
@@ -54,15 +66,32 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     return buffer_total_alloc.read();
   }
 
+  int buffer::get_cached_crc() {
+    return buffer_cached_crc.read();
+  }
+  int buffer::get_cached_crc_adjusted() {
+    return buffer_cached_crc_adjusted.read();
+  }
+
   class buffer::raw {
   public:
     char *data;
     unsigned len;
     atomic_t nref;
 
-    raw(unsigned l) : data(NULL), len(l), nref(0)
+    /*
+     * crcs we have already computed over parts of this buffer:
+     * (start, end) -> (seed, crc).  any write through a ptr throws
+     * them away.
+     */
+    simple_spinlock_t crc_lock;
+    std::map<std::pair<unsigned, unsigned>, std::pair<uint32_t, uint32_t> > crc_map;
+
+    raw(unsigned l) : data(NULL), len(l), nref(0),
+		      crc_lock(SIMPLE_SPINLOCK_INITIALIZER)
     { }
-    raw(char *c, unsigned l) : data(c), len(l), nref(0)
+    raw(char *c, unsigned l) : data(c), len(l), nref(0),
+			       crc_lock(SIMPLE_SPINLOCK_INITIALIZER)
     { }
     virtual ~raw() {};
 
@@ -83,6 +112,31 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     bool is_n_page_sized() {
       return (len & ~CEPH_PAGE_MASK) == 0;
     }
+
+    bool get_crc(const std::pair<unsigned, unsigned> &range,
+		 std::pair<uint32_t, uint32_t> *crc) {
+      simple_spin_lock(&crc_lock);
+      std::map<std::pair<unsigned, unsigned>, std::pair<uint32_t, uint32_t> >::iterator p =
+	crc_map.find(range);
+      bool found = p != crc_map.end();
+      if (found)
+	*crc = p->second;
+      simple_spin_unlock(&crc_lock);
+      return found;
+    }
+    void set_crc(const std::pair<unsigned, unsigned> &range,
+		 const std::pair<uint32_t, uint32_t> &crc) {
+      simple_spin_lock(&crc_lock);
+      if (crc_map.size() >= CRC_CACHE_MAX_ENTRIES && !crc_map.count(range))
+	crc_map.clear();
+      crc_map[range] = crc;
+      simple_spin_unlock(&crc_lock);
+    }
+    void invalidate_crc() {
+      simple_spin_lock(&crc_lock);
+      crc_map.clear();
+      simple_spin_unlock(&crc_lock);
+    }
   };
 
   class buffer::raw_malloc : public buffer::raw {
@@ -353,6 +407,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(_raw);
     assert(n < _len);
+    _raw->invalidate_crc();
     return _raw->data[_off + n];
   }
 
@@ -396,6 +451,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(_raw);
     assert(1 <= unused_tail_length());
+    _raw->invalidate_crc();
     (c_str())[_len] = c;
     _len++;
   }
@@ -404,6 +460,7 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
   {
     assert(_raw);
     assert(l <= unused_tail_length());
+    _raw->invalidate_crc();
     memcpy(c_str() + _len, p, l);
     _len += l;
   }
@@ -413,20 +470,29 @@ bool buffer_track_alloc = get_env_bool("CEPH_BUFFER_TRACK");
     assert(_raw);
     assert(o <= _len);
     assert(o+l <= _len);
+    _raw->invalidate_crc();
     memcpy(c_str()+o, src, l);
   }
 
   void buffer::ptr::zero()
   {
+    _raw->invalidate_crc();
     memset(c_str(), 0, _len);
   }
 
   void buffer::ptr::zero(unsigned o, unsigned l)
   {
     assert(o+l <= _len);
+    _raw->invalidate_crc();
     memset(c_str()+o, 0, l);
   }
 
+  void buffer::ptr::invalidate_crc()
+  {
+    if (_raw)
+      _raw->invalidate_crc();
+  }
+
 
   // -- buffer::list::iterator --
   /*
@@ -1267,6 +1333,116 @@ int buffer::list::write_fd(int fd) const
   return 0;
 }
 
+/*
+ * Positional variant: doesn't use or move the file offset, so it is
+ * safe on a descriptor shared between threads.
+ */
+int buffer::list::write_fd(int fd, uint64_t offset) const
+{
+#ifdef HAVE_PWRITEV
+  iovec iov[IOV_MAX];
+  int iovlen = 0;
+  ssize_t bytes = 0;
+
+  std::list<ptr>::const_iterator p = _buffers.begin();
+  while (p != _buffers.end()) {
+    if (p->length() > 0) {
+      iov[iovlen].iov_base = (void *)p->c_str();
+      iov[iovlen].iov_len = p->length();
+      bytes += p->length();
+      iovlen++;
+    }
+    p++;
+
+    if (iovlen == IOV_MAX-1 ||
+	p == _buffers.end()) {
+      iovec *start = iov;
+      int num = iovlen;
+      ssize_t wrote;
+    retry:
+      wrote = ::pwritev(fd, start, num, offset);
+      if (wrote < 0) {
+	int err = errno;
+	if (err == EINTR)
+	  goto retry;
+	return -err;
+      }
+      offset += wrote;
+      if (wrote < bytes) {
+	// partial write, recover!
+	while ((size_t)wrote >= start[0].iov_len) {
+	  wrote -= start[0].iov_len;
+	  bytes -= start[0].iov_len;
+	  start++;
+	  num--;
+	}
+	if (wrote > 0) {
+	  start[0].iov_len -= wrote;
+	  start[0].iov_base = (char *)start[0].iov_base + wrote;
+	  bytes -= wrote;
+	}
+	goto retry;
+      }
+      iovlen = 0;
+      bytes = 0;
+    }
+  }
+#else
+  for (std::list<ptr>::const_iterator p = _buffers.begin();
+       p != _buffers.end();
+       ++p) {
+    if (p->length() == 0)
+      continue;
+    int r = safe_pwrite(fd, p->c_str(), p->length(), offset);
+    if (r < 0)
+      return r;
+    offset += p->length();
+  }
+#endif
+  return 0;
+}
+
+__u32 buffer::list::crc32c(__u32 crc) const
+{
+  for (std::list<ptr>::const_iterator it = _buffers.begin();
+       it != _buffers.end();
+       ++it) {
+    if (!it->length())
+      continue;
+    if (it->length() < CRC_CACHE_MIN_LEN) {
+      crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
+      continue;
+    }
+    raw *r = it->get_raw();
+    std::pair<unsigned, unsigned> range(it->offset(), it->offset() + it->length());
+    std::pair<uint32_t, uint32_t> cached;
+    if (r->get_crc(range, &cached)) {
+      if (cached.first == crc) {
+	crc = cached.second;
+	if (buffer_track_crc)
+	  buffer_cached_crc.inc();
+      } else {
+	// same bytes, different seed: fix up the cached value rather
+	// than rescanning the data.
+	crc = cached.second ^ ceph_crc32c_zeros(cached.first ^ crc, it->length());
+	if (buffer_track_crc)
+	  buffer_cached_crc_adjusted.inc();
+      }
+    } else {
+      uint32_t seed = crc;
+      crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
+      r->set_crc(range, std::make_pair(seed, crc));
+    }
+  }
+  return crc;
+}
+
+void buffer::list::invalidate_crc()
+{
+  for (std::list<ptr>::iterator p = _buffers.begin(); p != _buffers.end(); ++p)
+    p->invalidate_crc();
+}
+
 
 void buffer::list::hexdump(std::ostream &out) const
 {
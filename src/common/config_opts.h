@@ -94,7 +94,12 @@ OPTION(heartbeat_interval, OPT_INT, 5)
 OPTION(heartbeat_file, OPT_STR, "")
 OPTION(perf, OPT_BOOL, true)       // enable internal perf counters
 
+OPTION(ms_park_idle_pipes, OPT_BOOL, false)  // idle pipe readers/writers give up their threads until there is work again
+OPTION(ms_park_threads, OPT_INT, 2)  // epoll threads watching parked pipe sockets
+OPTION(ms_park_idle_time, OPT_INT, 1)  // seconds a pipe reader/writer waits for work before parking
 OPTION(ms_tcp_nodelay, OPT_BOOL, true)
+OPTION(ms_max_batch_messages, OPT_INT, 16)     // max queued messages the writer sends per sendmsg batch
+OPTION(ms_max_batch_bytes, OPT_U64, 4 << 20)   // stop adding messages to a batch past this many bytes
 OPTION(ms_initial_backoff, OPT_DOUBLE, .2)
 OPTION(ms_max_backoff, OPT_DOUBLE, 15.0)
 OPTION(ms_nocrc, OPT_BOOL, false)
@@ -291,6 +296,7 @@ OPTION(osd_journal_size, OPT_INT, 5120)         // in mb
 OPTION(osd_max_write_size, OPT_INT, 90)
 OPTION(osd_max_pgls, OPT_U64, 1024) // max number of pgls entries to return
 OPTION(osd_client_message_size_cap, OPT_U64, 500*1024L*1024L) // client data allowed in-memory (in bytes)
+OPTION(osd_page_aligned_rx_min_bytes, OPT_U64, 64 << 10) // receive op data at least this big into page-aligned buffers (0 to disable)
 OPTION(osd_pg_bits, OPT_INT, 6)  // bits per osd
 OPTION(osd_pgp_bits, OPT_INT, 6)  // bits per osd
 OPTION(osd_min_rep, OPT_INT, 1)
@@ -304,6 +310,13 @@ OPTION(osd_map_dedup, OPT_BOOL, true)
 OPTION(osd_map_cache_size, OPT_INT, 500)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_op_num_shards, OPT_INT, 5)  // client ops are queued to shards by pg
+OPTION(osd_op_num_threads_per_shard, OPT_INT, 2)
+OPTION(osd_fast_dispatch, OPT_BOOL, true)  // queue client ops and subops without taking osd_lock when possible
+OPTION(osd_rep_batch_max_ops, OPT_INT, 1)  // repops per replica batched into one subop while others are in flight; <= 1 disables
+OPTION(osd_rep_batch_max_bytes, OPT_U64, 1<<20)
+OPTION(osd_rep_batch_delay, OPT_DOUBLE, .002)  // seconds a batch waits for more repops
+OPTION(osd_pg_object_context_cache_count, OPT_INT, 64)  // idle object (and snapset) contexts a primary pg keeps for later ops
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
@@ -348,6 +361,7 @@ OPTION(osd_rollback_to_cluster_snap, OPT_STR, "")
 OPTION(osd_default_notify_timeout, OPT_U32, 30) // default notify timeout in seconds
 OPTION(osd_kill_backfill_at, OPT_INT, 0)
 OPTION(osd_min_pg_log_entries, OPT_U32, 1000) // number of entries to keep in the pg log when trimming it
+OPTION(osd_pg_log_cold_tail, OPT_BOOL, true) // keep only the newest osd_min_pg_log_entries complete pg log entries in memory
 OPTION(osd_op_complaint_time, OPT_FLOAT, 30) // how many seconds old makes an op complaint-worthy
 OPTION(osd_command_max_records, OPT_INT, 256)
 OPTION(osd_op_log_threshold, OPT_INT, 5) // how many op log messages to show in one go
@@ -386,9 +400,15 @@ OPTION(filestore_min_sync_interval, OPT_DOUBLE, .01)  // seconds
 OPTION(filestore_btrfs_snap, OPT_BOOL, true)
 OPTION(filestore_btrfs_clone_range, OPT_BOOL, true)
 OPTION(filestore_fsync_flushes_journal_data, OPT_BOOL, false)
+OPTION(filestore_commit_mode, OPT_STR, "auto")  // non-btrfs commits: syncfs, fd (fsync changed objects), sync, or auto (syncfs if the kernel has it, else fd)
+OPTION(filestore_commit_fd_max_objects, OPT_INT, 256)  // in fd mode, do a full sync if more objects than this changed
+OPTION(filestore_commit_fd_threads, OPT_INT, 4)  // in fd mode, fsync objects from this many threads
 OPTION(filestore_fiemap, OPT_BOOL, false)     // (try to) use fiemap
 OPTION(filestore_flusher, OPT_BOOL, true)
-OPTION(filestore_flusher_max_fds, OPT_INT, 512)
+OPTION(filestore_flusher_max_fds, OPT_INT, 512)  // max objects queued for early writeback
+OPTION(filestore_writeback_start_bytes, OPT_U64, 40 << 20)  // start writing back once this much data is pending
+OPTION(filestore_writeback_target_bytes, OPT_U64, 10 << 20)  // ...and keep going until this much is left
+OPTION(filestore_writeback_commit_bytes, OPT_U64, 400 << 20)  // commit early once this much has been written since the last commit started (0 = never)
 OPTION(filestore_flush_min, OPT_INT, 65536)
 OPTION(filestore_sync_flush, OPT_BOOL, false)
 OPTION(filestore_journal_parallel, OPT_BOOL, false)
@@ -398,28 +418,53 @@ OPTION(filestore_queue_max_ops, OPT_INT, 500)
 OPTION(filestore_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(filestore_queue_committing_max_ops, OPT_INT, 500)        // this is ON TOP of filestore_queue_max_*
 OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
-OPTION(filestore_op_threads, OPT_INT, 2)
+OPTION(filestore_op_threads, OPT_INT, 2)           // threads per op shard
+OPTION(filestore_op_shards, OPT_INT, 1)            // independent apply queues; sequencers are spread over them
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_split_async, OPT_BOOL, true)  // split and merge directories in a background thread
+OPTION(filestore_split_batch, OPT_INT, 64)  // objects a background split moves before letting ops in
+OPTION(filestore_split_rate, OPT_INT, 1000)  // max objects per second background splits move (0 = no limit)
+OPTION(filestore_list_cache_objects, OPT_INT, 100000)  // objects in cached directory listings (0 = no cache)
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_dump_file, OPT_STR, "")         // file onto which store transaction dumps
 OPTION(filestore_kill_at, OPT_INT, 0)            // inject a failure at the n'th opportunity
 OPTION(filestore_fail_eio, OPT_BOOL, true)       // fail/crash on EIO
+OPTION(filestore_fd_cache_size, OPT_INT, 1024)   // max open object fds to keep cached (0 = off)
+OPTION(filestore_fd_cache_max_bytes, OPT_INT, 1 << 20)  // max memory for fd cache entries
+OPTION(filestore_attr_cache_max_bytes, OPT_INT, 16 << 20)  // max memory for cached object xattrs (0 = off)
+OPTION(filestore_omap_backend, OPT_STR, "leveldb")  // key/value store behind the object map: leveldb or memdb
+OPTION(filestore_omap_flatten_depth, OPT_INT, 8)  // flatten omaps reached through this many clone ancestors (0 = off)
+OPTION(filestore_omap_flatten_shadow_ratio, OPT_DOUBLE, .75)  // ...or whose lookups skip this fraction of inherited keys (0 = off)
+OPTION(filestore_omap_flatten_max_keys, OPT_U64, 10000)  // but leave objects with more keys than this (0 = no limit)
+OPTION(leveldb_write_buffer_size, OPT_U64, 8 << 20)  // leveldb write buffer size (0 = leveldb default)
+OPTION(leveldb_cache_size, OPT_U64, 128 << 20)  // leveldb shared block cache size (0 = leveldb's own 8MB cache)
+OPTION(leveldb_bloom_size, OPT_INT, 10)  // leveldb bloom filter bits per key (0 = no filter)
+OPTION(leveldb_max_open_files, OPT_INT, 0)  // leveldb max open files (0 = leveldb default)
+OPTION(leveldb_compression, OPT_BOOL, true)  // compress leveldb blocks with snappy
+OPTION(leveldb_paranoid, OPT_BOOL, false)  // have leveldb check everything it reads
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, false)
+OPTION(journal_aio_max_inflight, OPT_INT, 32)  // cap on concurrent journal aio writes (0 = adaptive throttle only)
 OPTION(journal_block_align, OPT_BOOL, true)
 OPTION(journal_max_write_bytes, OPT_INT, 10 << 20)
 OPTION(journal_max_write_entries, OPT_INT, 100)
+OPTION(journal_group_commit_max_wait, OPT_DOUBLE, 0)         // max seconds to hold a partial batch open for more entries (0 = off)
+OPTION(journal_group_commit_latency_ratio, OPT_DOUBLE, .25)  // hold it open for this fraction of the observed journal write latency
 OPTION(journal_queue_max_ops, OPT_INT, 500)
 OPTION(journal_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(journal_align_min_size, OPT_INT, 64 << 10)  // align data payloads >= this.
 OPTION(journal_replay_from, OPT_INT, 0)
+OPTION(journal_replay_threads, OPT_INT, 1)         // apply replayed entries for different objects in parallel (1 = serial)
+OPTION(journal_replay_max_queued, OPT_INT, 256)    // decoded entries the replay reader may run ahead of the appliers
 OPTION(journal_zero_on_create, OPT_BOOL, false)
+OPTION(journal_compress, OPT_BOOL, false)         // create journals that lzf-compress entries
+OPTION(journal_compress_min_size, OPT_INT, 512)   // don't bother compressing entries smaller than this
 OPTION(rbd_cache, OPT_BOOL, false) // whether to enable caching (writeback unless rbd_cache_max_dirty is 0)
 OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
 OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // dirty limit in bytes - set to 0 for write-through caching
@@ -0,0 +1,99 @@
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+#include <pthread.h>
+
+#include "include/crc32c.h"
+
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+
+ceph_crc32c_func_t ceph_choose_crc32(void)
+{
+	if (ceph_crc32c_intel_fast_exists())
+		return ceph_crc32c_intel_fast;
+	if (ceph_crc32c_intel_baseline_exists())
+		return ceph_crc32c_intel_baseline;
+	return ceph_crc32c_sctp;
+}
+
+/*
+ * The first call picks the implementation.  Racing first calls all make
+ * the same choice, so there is nothing to lock; and doing it lazily
+ * means static constructors that crc something still work.
+ */
+static uint32_t crc32c_choose_and_run(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	ceph_crc32c_func = ceph_choose_crc32();
+	return ceph_crc32c_func(crc, data, length);
+}
+
+ceph_crc32c_func_t ceph_crc32c_func = crc32c_choose_and_run;
+
+uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	return ceph_crc32c_func(crc, data, length);
+}
+
+
+/*
+ * Running a raw crc over n zero bytes multiplies it by x^(8n) mod P, so
+ * we can do it in O(log n) polynomial multiplications instead of
+ * touching n bytes.  Polynomials are bit-reflected, as in the crc
+ * itself: x^0 is the top bit.
+ */
+#define CRC32C_POLY_REFLECTED 0x82f63b78
+
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t)1 << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY_REFLECTED : b >> 1;
+	}
+	return p;
+}
+
+/* x2n_table[k] = x^(2^k) mod P */
+static uint32_t x2n_table[32];
+static pthread_once_t x2n_once = PTHREAD_ONCE_INIT;
+
+static void init_x2n_table(void)
+{
+	uint32_t p = (uint32_t)1 << 30;	/* x^1 */
+	int n;
+
+	x2n_table[0] = p;
+	for (n = 1; n < 32; n++)
+		x2n_table[n] = p = multmodp(p, p);
+}
+
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length)
+{
+	uint32_t p = (uint32_t)1 << 31;	/* x^0 */
+	unsigned k = 3;			/* 2^3 bits per byte */
+
+	if (!length || !crc)
+		return crc;
+	pthread_once(&x2n_once, init_x2n_table);
+	while (length) {
+		if (length & 1)
+			p = multmodp(x2n_table[k & 31], p);
+		length >>= 1;
+		k++;
+	}
+	return multmodp(p, crc);
+}
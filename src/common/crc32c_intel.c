@@ -0,0 +1,198 @@
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+/*
+ * crc32c using the SSE 4.2 crc32 instruction.
+ *
+ * Like ceph_crc32c_sctp(), these do no pre- or post-inversion; the
+ * caller's crc is the raw running remainder.
+ *
+ * The crc32 instruction has a latency of 3 cycles but a throughput of
+ * one per cycle, so a single dependent stream only uses a third of
+ * what the cpu can do.  ceph_crc32c_intel_fast() runs three independent
+ * streams over consecutive blocks and then folds the first two into the
+ * third by multiplying them by x^(8 * bytes that follow them) mod P,
+ * which is one carry-less multiply (pclmulqdq) each plus a final crc32
+ * to reduce the 64 bit product.
+ */
+
+#include "common/crc32c_intel.h"
+
+#if defined(__x86_64__)
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <pthread.h>
+
+#define CRC32C_POLY_REFLECTED 0x82f63b78
+
+/* bytes per stream for big and medium buffers; multiples of 8 */
+#define LONG_BLOCK  8192
+#define SHORT_BLOCK 256
+
+static unsigned cpuid_ecx(void)
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return ecx;
+}
+
+int ceph_crc32c_intel_baseline_exists(void)
+{
+	return (cpuid_ecx() & bit_SSE4_2) != 0;
+}
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	unsigned ecx = cpuid_ecx();
+	return (ecx & bit_SSE4_2) && (ecx & bit_PCLMUL);
+}
+
+static inline uint64_t crc32_u64(uint64_t crc, uint64_t v)
+{
+	__asm__("crc32q %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+static inline uint32_t crc32_u8(uint32_t crc, uint8_t v)
+{
+	__asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+uint32_t ceph_crc32c_intel_baseline(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	uint64_t c = crc;
+
+	while (length && ((uintptr_t)data & 7)) {
+		c = crc32_u8(c, *data++);
+		length--;
+	}
+	while (length >= 8) {
+		c = crc32_u64(c, *(const uint64_t *)data);
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+		c = crc32_u8(c, *data++);
+	return c;
+}
+
+
+/*
+ * Shift constants.  In the bit-reflected representation the crc32
+ * instruction uses, pclmulqdq(a, k) as a 64 bit value is x*A*K, and
+ * crc32q(0, v) is V*x^32 mod P, so reducing the product yields
+ * A*K*x^33 mod P.  To shift a crc over n bytes we therefore want
+ * K = x^(8n - 33) mod P.
+ */
+static uint32_t long_shift2, long_shift1;	/* 2 and 1 LONG_BLOCKs */
+static uint32_t short_shift2, short_shift1;	/* 2 and 1 SHORT_BLOCKs */
+static pthread_once_t shift_once = PTHREAD_ONCE_INIT;
+
+static uint32_t xpow_mod(unsigned n)
+{
+	uint32_t r = 0x80000000;	/* x^0 */
+	while (n--)
+		r = (r >> 1) ^ ((r & 1) ? CRC32C_POLY_REFLECTED : 0);
+	return r;
+}
+
+static void init_shifts(void)
+{
+	long_shift2 = xpow_mod(8 * 2 * LONG_BLOCK - 33);
+	long_shift1 = xpow_mod(8 * LONG_BLOCK - 33);
+	short_shift2 = xpow_mod(8 * 2 * SHORT_BLOCK - 33);
+	short_shift1 = xpow_mod(8 * SHORT_BLOCK - 33);
+}
+
+static inline uint64_t clmul(uint32_t a, uint32_t k)
+{
+	__m128i x = _mm_cvtsi32_si128(a);
+	__m128i y = _mm_cvtsi32_si128(k);
+	__asm__("pclmulqdq $0x00, %1, %0" : "+x" (x) : "x" (y));
+	return _mm_cvtsi128_si64(x);
+}
+
+/*
+ * crc whole groups of three blocks; advances *pdata and *plen
+ */
+static uint32_t crc32c_3way(uint32_t crc, unsigned char const **pdata, unsigned *plen,
+			    unsigned block, uint32_t shift2, uint32_t shift1)
+{
+	unsigned char const *data = *pdata;
+	unsigned length = *plen;
+	unsigned n = block / 8;
+
+	while (length >= 3 * block) {
+		const uint64_t *p0 = (const uint64_t *)data;
+		const uint64_t *p1 = p0 + n;
+		const uint64_t *p2 = p1 + n;
+		uint64_t c0 = crc, c1 = 0, c2 = 0;
+		unsigned i;
+
+		for (i = 0; i < n; i++) {
+			c0 = crc32_u64(c0, p0[i]);
+			c1 = crc32_u64(c1, p1[i]);
+			c2 = crc32_u64(c2, p2[i]);
+		}
+		crc = crc32_u64(0, clmul(c0, shift2) ^ clmul(c1, shift1)) ^ c2;
+		data += 3 * block;
+		length -= 3 * block;
+	}
+	*pdata = data;
+	*plen = length;
+	return crc;
+}
+
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	pthread_once(&shift_once, init_shifts);
+
+	while (length && ((uintptr_t)data & 7)) {
+		crc = crc32_u8(crc, *data++);
+		length--;
+	}
+	if (length >= 3 * LONG_BLOCK)
+		crc = crc32c_3way(crc, &data, &length, LONG_BLOCK,
+				  long_shift2, long_shift1);
+	if (length >= 3 * SHORT_BLOCK)
+		crc = crc32c_3way(crc, &data, &length, SHORT_BLOCK,
+				  short_shift2, short_shift1);
+	return ceph_crc32c_intel_baseline(crc, data, length);
+}
+
+#else  /* !__x86_64__ */
+
+#include <assert.h>
+
+int ceph_crc32c_intel_baseline_exists(void)
+{
+	return 0;
+}
+
+int ceph_crc32c_intel_fast_exists(void)
+{
+	return 0;
+}
+
+uint32_t ceph_crc32c_intel_baseline(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	assert(0 == "no crc32 instruction on this architecture");
+	return 0;
+}
+
+uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length)
+{
+	assert(0 == "no crc32 instruction on this architecture");
+	return 0;
+}
+
+#endif
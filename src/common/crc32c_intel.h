@@ -0,0 +1,26 @@
+#ifndef CEPH_COMMON_CRC32C_INTEL_H
+#define CEPH_COMMON_CRC32C_INTEL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* true if the cpu has the SSE 4.2 crc32 instruction */
+extern int ceph_crc32c_intel_baseline_exists(void);
+
+/* true if the cpu also has pclmulqdq, needed by ceph_crc32c_intel_fast */
+extern int ceph_crc32c_intel_fast_exists(void);
+
+/* one crc32 instruction stream */
+extern uint32_t ceph_crc32c_intel_baseline(uint32_t crc, unsigned char const *data, unsigned length);
+
+/* three interleaved crc32 streams, recombined with pclmulqdq */
+extern uint32_t ceph_crc32c_intel_fast(uint32_t crc, unsigned char const *data, unsigned length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
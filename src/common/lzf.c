@@ -0,0 +1,173 @@
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ */
+
+/*
+ * LZF format.  The output is a sequence of runs, each introduced by a
+ * control byte c:
+ *
+ *   000LLLLL                        literal run of L+1 bytes, which follow
+ *   LLLooooo oooooooo               back reference, L in 1..6
+ *   111ooooo LLLLLLLL oooooooo      back reference, length 7 + L
+ *
+ * A back reference copies (length + 2) bytes starting (offset + 1)
+ * bytes back in the output; the copy may overlap itself.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "common/lzf.h"
+
+#define HLOG	13
+#define HSIZE	(1 << HLOG)
+#define MAX_LIT	(1 << 5)
+#define MAX_OFF	(1 << 13)
+#define MAX_REF	((1 << 8) + (1 << 3))
+
+static inline unsigned lzf_hash(const uint8_t *p)
+{
+	uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+	return ((v * 2654435761u) >> (32 - HLOG)) & (HSIZE - 1);
+}
+
+unsigned ceph_lzf_compress(const void *in_data, unsigned in_len,
+			   void *out_data, unsigned out_len)
+{
+	const uint8_t *in = (const uint8_t *)in_data;
+	const uint8_t *ip = in;
+	const uint8_t *in_end = in + in_len;
+	uint8_t *out = (uint8_t *)out_data;
+	uint8_t *op = out;
+	uint8_t *out_end = out + out_len;
+	uint8_t *lit_ctrl;
+	unsigned lit = 0;
+	uint32_t htab[HSIZE];	/* position + 1 of last occurrence; 0 = none */
+
+	if (!in_len || !out_len)
+		return 0;
+	memset(htab, 0, sizeof(htab));
+
+	lit_ctrl = op++;
+	while (ip + 2 < in_end) {
+		unsigned h = lzf_hash(ip);
+		uint32_t ref_pos = htab[h];
+		htab[h] = ip - in + 1;
+
+		if (ref_pos) {
+			const uint8_t *ref = in + ref_pos - 1;
+			unsigned off = ip - ref - 1;
+
+			if (off < MAX_OFF &&
+			    ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+				unsigned maxlen = in_end - ip;
+				unsigned len = 3;
+
+				if (maxlen > MAX_REF)
+					maxlen = MAX_REF;
+				while (len < maxlen && ref[len] == ip[len])
+					len++;
+
+				/* close the pending literal run */
+				if (lit)
+					*lit_ctrl = lit - 1;
+				else
+					op--;
+
+				if (op + 3 > out_end)
+					return 0;
+				len -= 2;
+				if (len < 7) {
+					*op++ = (len << 5) | (off >> 8);
+				} else {
+					*op++ = (7 << 5) | (off >> 8);
+					*op++ = len - 7;
+				}
+				*op++ = off & 0xff;
+				ip += len + 2;
+
+				if (op >= out_end)
+					return 0;
+				lit_ctrl = op++;
+				lit = 0;
+				continue;
+			}
+		}
+
+		if (op >= out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == MAX_LIT) {
+			*lit_ctrl = MAX_LIT - 1;
+			if (op >= out_end)
+				return 0;
+			lit_ctrl = op++;
+			lit = 0;
+		}
+	}
+
+	while (ip < in_end) {
+		if (op >= out_end)
+			return 0;
+		*op++ = *ip++;
+		if (++lit == MAX_LIT) {
+			*lit_ctrl = MAX_LIT - 1;
+			if (op >= out_end)
+				return 0;
+			lit_ctrl = op++;
+			lit = 0;
+		}
+	}
+	if (lit)
+		*lit_ctrl = lit - 1;
+	else
+		op--;
+
+	return op - out;
+}
+
+unsigned ceph_lzf_decompress(const void *in_data, unsigned in_len,
+			     void *out_data, unsigned out_len)
+{
+	const uint8_t *ip = (const uint8_t *)in_data;
+	const uint8_t *in_end = ip + in_len;
+	uint8_t *out = (uint8_t *)out_data;
+	uint8_t *op = out;
+	uint8_t *out_end = out + out_len;
+
+	while (ip < in_end) {
+		unsigned c = *ip++;
+
+		if (c < MAX_LIT) {
+			c++;
+			if (op + c > out_end || ip + c > in_end)
+				return 0;
+			memcpy(op, ip, c);
+			op += c;
+			ip += c;
+		} else {
+			unsigned len = c >> 5;
+			const uint8_t *ref;
+
+			if (len == 7) {
+				if (ip >= in_end)
+					return 0;
+				len += *ip++;
+			}
+			if (ip >= in_end)
+				return 0;
+			ref = op - ((c & 0x1f) << 8) - 1 - *ip++;
+			len += 2;
+			if (ref < out || op + len > out_end)
+				return 0;
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+	return op - out;
+}
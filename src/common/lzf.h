@@ -0,0 +1,37 @@
+#ifndef CEPH_COMMON_LZF_H
+#define CEPH_COMMON_LZF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small, fast LZ77 codec in the LZF format: no entropy coding, an 8k
+ * window, and byte-aligned output, so it compresses at several hundred
+ * MB/s and decompresses faster still.  Good for cheap wins on highly
+ * redundant data (encoded transactions, omap keys), not for archival.
+ */
+
+/*
+ * Compress in_len bytes from in into out.
+ *
+ * @return the compressed length, or 0 if it would not fit in out_len
+ * bytes (or in_len is 0)
+ */
+unsigned ceph_lzf_compress(const void *in, unsigned in_len,
+			   void *out, unsigned out_len);
+
+/*
+ * Decompress in_len bytes from in into out.
+ *
+ * @return the decompressed length, or 0 if the input is corrupt or
+ * would expand to more than out_len bytes
+ */
+unsigned ceph_lzf_decompress(const void *in, unsigned in_len,
+			     void *out, unsigned out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -105,6 +105,10 @@ public:
 
   static int get_total_alloc();
 
+  /* crc32c cache hits, and hits that needed a seed fix-up (CEPH_BUFFER_TRACK) */
+  static int get_cached_crc();
+  static int get_cached_crc_adjusted();
+
 private:
  
   /* hack for memory utilization debugging. */
@@ -209,6 +213,13 @@ public:
     void zero();
     void zero(unsigned o, unsigned l);
 
+    /*
+     * the raw buffer remembers crcs computed over it; anyone who
+     * writes through c_str() rather than the modifiers above must
+     * call this afterwards.
+     */
+    void invalidate_crc();
+
   };
 
   friend std::ostream& operator<<(std::ostream& out, const buffer::ptr& bp);
@@ -417,14 +428,9 @@ public:
     ssize_t read_fd(int fd, size_t len);
     int write_file(const char *fn, int mode=0644);
     int write_fd(int fd) const;
-    __u32 crc32c(__u32 crc) {
-      for (std::list<ptr>::const_iterator it = _buffers.begin(); 
-	   it != _buffers.end(); 
-	   it++)
-	if (it->length())
-	  crc = ceph_crc32c_le(crc, (unsigned char*)it->c_str(), it->length());
-      return crc;
-    }
+    int write_fd(int fd, uint64_t offset) const;
+    __u32 crc32c(__u32 crc) const;
+    void invalidate_crc();
 
   };
 
@@ -31,6 +31,13 @@
 #define CEPH_FEATURE_RECOVERY_RESERVATION (1<<24)
 #define CEPH_FEATURE_CRUSH_TUNABLES2 (1<<25)
 
+/*
+ * Features local to this tree are handed out from the top bit down,
+ * so that they never take a bit upstream assigns (from the bottom up)
+ * and a peer advertising one means what we think it means.
+ */
+#define CEPH_FEATURE_OSD_REPOP_BATCH (1ULL<<62)
+
 /*
  * Features supported.  Should be everything above.
  */
@@ -60,7 +67,8 @@
 	 CEPH_FEATURE_BACKFILL_RESERVATION | \
 	 CEPH_FEATURE_MSG_AUTH |	 \
 	 CEPH_FEATURE_RECOVERY_RESERVATION | \
-	 CEPH_FEATURE_CRUSH_TUNABLES2)
+	 CEPH_FEATURE_CRUSH_TUNABLES2 |	 \
+	 CEPH_FEATURE_OSD_REPOP_BATCH)
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
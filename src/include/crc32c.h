@@ -1,12 +1,38 @@
 #ifndef CEPH_CRC32C_H
 #define CEPH_CRC32C_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef uint32_t (*ceph_crc32c_func_t)(uint32_t crc, unsigned char const *data, unsigned length);
+
+/*
+ * Pick the fastest crc32c implementation the running cpu supports.
+ */
+extern ceph_crc32c_func_t ceph_choose_crc32(void);
+
+/* the implementation ceph_crc32c_le() dispatches to */
+extern ceph_crc32c_func_t ceph_crc32c_func;
+
+/*
+ * crc32c over length bytes of data, continuing from crc.  No pre- or
+ * post-inversion is done.
+ */
 uint32_t ceph_crc32c_le(uint32_t crc, unsigned char const *data, unsigned length);
 
+/*
+ * Equivalent to ceph_crc32c_le() over length zero bytes, but computed
+ * in O(log length) time.  Because the crc is linear,
+ *
+ *   crc(a, data) == crc(b, data) ^ ceph_crc32c_zeros(a ^ b, length)
+ *
+ * which lets a crc computed with one seed be reused for another.
+ */
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,6 +17,7 @@
 #define CEPH_MOSDSUBOP_H
 
 #include "msg/Message.h"
+#include "include/ceph_features.h"
 #include "osd/osd_types.h"
 
 /*
@@ -25,7 +26,7 @@
 
 class MOSDSubOp : public Message {
 
-  static const int HEAD_VERSION = 7;
+  static const int HEAD_VERSION = 8;
   static const int COMPAT_VERSION = 1;
 
 public:
@@ -86,6 +87,45 @@ public:
   // indicates that we must fix hobject_t encoding
   bool hobject_incorrect_pool;
 
+  /*
+   * Further repops batched behind this one, to be applied after it in
+   * order.  Their transactions follow this one's in the data payload
+   * and their log entries follow in logbl; pg_stats and pg_trim_to
+   * are the last one's.
+   */
+  struct batch_item_t {
+    osd_reqid_t reqid;
+    hobject_t poid;
+    tid_t tid;
+    eversion_t version;
+
+    batch_item_t() : tid(0) {}
+    batch_item_t(osd_reqid_t r, const hobject_t& o, tid_t t, eversion_t v)
+      : reqid(r), poid(o), tid(t), version(v) {}
+
+    void encode(bufferlist& bl) const {
+      ENCODE_START(1, 1, bl);
+      ::encode(reqid, bl);
+      ::encode(poid, bl);
+      ::encode(tid, bl);
+      ::encode(version, bl);
+      ENCODE_FINISH(bl);
+    }
+    void decode(bufferlist::iterator& bl) {
+      DECODE_START(1, bl);
+      ::decode(reqid, bl);
+      ::decode(poid, bl);
+      ::decode(tid, bl);
+      ::decode(version, bl);
+      DECODE_FINISH(bl);
+    }
+  };
+  vector<batch_item_t> batch;
+
+  eversion_t get_last_version() const {
+    return batch.empty() ? version : batch.back().version;
+  }
+
   virtual void decode_payload() {
     hobject_incorrect_pool = false;
     bufferlist::iterator p = payload.begin();
@@ -137,6 +177,8 @@ public:
       ::decode(omap_entries, p);
     if (header.version >= 6)
       ::decode(omap_header, p);
+    if (header.version >= 8)
+      ::decode(batch, p);
 
     if (header.version < 7) {
       // Handle hobject_t format change
@@ -147,6 +189,14 @@ public:
   }
 
   virtual void encode_payload(uint64_t features) {
+    // a peer that doesn't know about batch would apply only the first
+    // transaction
+    if (!batch.empty()) {
+      assert(features & CEPH_FEATURE_OSD_REPOP_BATCH);
+      header.compat_version = 8;
+    } else {
+      header.compat_version = COMPAT_VERSION;
+    }
     ::encode(map_epoch, payload);
     ::encode(reqid, payload);
     ::encode(pgid, payload);
@@ -188,6 +238,7 @@ public:
     ::encode(current_progress, payload);
     ::encode(omap_entries, payload);
     ::encode(omap_header, payload);
+    ::encode(batch, payload);
   }
 
   MOSDSubOp()
@@ -224,7 +275,10 @@ public:
       out << " first";
     if (complete)
       out << " complete";
-    out << " v " << version
+    out << " v " << version;
+    if (!batch.empty())
+      out << " + " << batch.size() << " batched to v " << batch.back().version;
+    out
 	<< " snapset=" << snapset << " snapc=" << snapc;    
     if (!data_subset.empty()) out << " subset " << data_subset;
     out << ")";
@@ -232,4 +286,6 @@ public:
 };
 
 
+WRITE_CLASS_ENCODER(MOSDSubOp::batch_item_t)
+
 #endif
@@ -71,6 +71,24 @@ public:
    * a reference to it.
    */
   virtual void ms_handle_remote_reset(Connection *con) = 0;
+
+  /**
+   * Supply memory to receive the data segment of an incoming message
+   * into, e.g. so that write data lands in buffers the backing store
+   * can use directly.  This is called from the messenger's reader
+   * with a Connection lock held, so it must not block.
+   *
+   * @param con The Connection the message is arriving on
+   * @param header The incoming message's header; data_len and
+   * data_off describe the segment
+   * @param data Output param: buffers totalling at least
+   * header.data_len bytes
+   *
+   * @return True if data was filled in, false to fall back to the
+   * messenger's default allocation.
+   */
+  virtual bool ms_get_data_buffer(Connection *con, const ceph_msg_header& header,
+				  bufferlist& data) { return false; }
   
   /**
    * @defgroup Authentication
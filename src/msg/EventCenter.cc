@@ -0,0 +1,274 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "EventCenter.h"
+
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/pipe.h"
+
+#define dout_subsys ceph_subsys_ms
+
+#undef dout_prefix
+#define dout_prefix *_dout << "EventCenter "
+
+#define EVENT_MAX_PER_WAIT 128
+
+
+/********************************************
+ * EventCenter::Worker
+ */
+
+EventCenter::Worker::Worker(EventCenter *c)
+  : center(c), epfd(-1),
+    lock("EventCenter::Worker::lock"),
+    stopping(false)
+{
+  notify_fds[0] = notify_fds[1] = -1;
+}
+
+EventCenter::Worker::~Worker()
+{
+  assert(file_events.empty());
+  assert(external_events.empty());
+  if (epfd >= 0)
+    ::close(epfd);
+  if (notify_fds[0] >= 0) {
+    ::close(notify_fds[0]);
+    ::close(notify_fds[1]);
+  }
+}
+
+int EventCenter::Worker::init()
+{
+  epfd = ::epoll_create(1024);
+  if (epfd < 0) {
+    int r = -errno;
+    lderr(center->cct) << "epoll_create failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ::fcntl(epfd, F_SETFD, FD_CLOEXEC);
+
+  int r = pipe_cloexec(notify_fds);
+  if (r < 0) {
+    lderr(center->cct) << "failed to create notify pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ::fcntl(notify_fds[0], F_SETFL, O_NONBLOCK);
+  ::fcntl(notify_fds[1], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ee;
+  memset(&ee, 0, sizeof(ee));
+  ee.events = EPOLLIN;
+  ee.data.fd = notify_fds[0];
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, notify_fds[0], &ee) < 0) {
+    r = -errno;
+    lderr(center->cct) << "failed to watch notify pipe: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void EventCenter::Worker::wakeup()
+{
+  char c = 0;
+  while (::write(notify_fds[1], &c, 1) < 0) {
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN)
+      break;  // the pipe is full, so a wakeup is already pending
+    int r = -errno;
+    lderr(center->cct) << "failed to write to notify pipe: " << cpp_strerror(r) << dendl;
+    assert(0 == "failed to write to notify pipe");
+  }
+}
+
+int EventCenter::Worker::add_file_event(int fd, EventCallback *cb)
+{
+  Mutex::Locker l(lock);
+  assert(file_events.count(fd) == 0);
+
+  struct epoll_event ee;
+  memset(&ee, 0, sizeof(ee));
+  ee.events = EPOLLIN | EPOLLRDHUP;
+  ee.data.fd = fd;
+  if (::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ee) < 0) {
+    int r = -errno;
+    ldout(center->cct, 1) << "add_file_event epoll_ctl on fd " << fd
+			  << " failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  file_events[fd] = cb;
+  return 0;
+}
+
+bool EventCenter::Worker::del_file_event(int fd)
+{
+  Mutex::Locker l(lock);
+  map<int, EventCallback*>::iterator p = file_events.find(fd);
+  if (p == file_events.end())
+    return false;
+  file_events.erase(p);
+  ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+  return true;
+}
+
+void EventCenter::Worker::dispatch(EventCallback *cb)
+{
+  Mutex::Locker l(lock);
+  bool wake = external_events.empty();
+  external_events.push_back(cb);
+  if (wake)
+    wakeup();
+}
+
+void EventCenter::Worker::stop()
+{
+  lock.Lock();
+  stopping = true;
+  wakeup();
+  lock.Unlock();
+  join();
+}
+
+void *EventCenter::Worker::entry()
+{
+  ldout(center->cct, 10) << "worker " << this << " start" << dendl;
+
+  struct epoll_event events[EVENT_MAX_PER_WAIT];
+  list<EventCallback*> fired;
+  list<int> fired_fds;
+
+  lock.Lock();
+  while (!stopping) {
+    lock.Unlock();
+    int n = ::epoll_wait(epfd, events, EVENT_MAX_PER_WAIT, -1);
+    if (n < 0 && errno != EINTR) {
+      lderr(center->cct) << "epoll_wait failed: " << cpp_strerror(errno) << dendl;
+      assert(0 == "epoll_wait failed");
+    }
+    lock.Lock();
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == notify_fds[0]) {
+	char buf[256];
+	while (::read(notify_fds[0], buf, sizeof(buf)) > 0) ;
+	continue;
+      }
+      // one-shot: the callback owns the fd again once it fires
+      map<int, EventCallback*>::iterator p = file_events.find(fd);
+      if (p == file_events.end())
+	continue;  // withdrawn before we got to it
+      fired.push_back(p->second);
+      fired_fds.push_back(fd);
+      file_events.erase(p);
+      ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+
+    list<EventCallback*> external;
+    external.swap(external_events);
+    lock.Unlock();
+
+    while (!fired.empty()) {
+      fired.front()->do_request(fired_fds.front());
+      fired.pop_front();
+      fired_fds.pop_front();
+    }
+    while (!external.empty()) {
+      external.front()->do_request(-1);
+      external.pop_front();
+    }
+
+    lock.Lock();
+  }
+  lock.Unlock();
+
+  ldout(center->cct, 10) << "worker " << this << " done" << dendl;
+  return 0;
+}
+
+
+/********************************************
+ * EventCenter
+ */
+
+EventCenter::EventCenter(CephContext *c, int nworkers)
+  : cct(c), started(false)
+{
+  if (nworkers < 1)
+    nworkers = 1;
+  for (int i = 0; i < nworkers; i++)
+    workers.push_back(new Worker(this));
+}
+
+EventCenter::~EventCenter()
+{
+  assert(!started);
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+    delete *p;
+}
+
+int EventCenter::init()
+{
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p) {
+    int r = (*p)->init();
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+void EventCenter::start()
+{
+  assert(!started);
+  ldout(cct, 1) << "start " << workers.size() << " workers" << dendl;
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+    (*p)->create();
+  started = true;
+}
+
+void EventCenter::stop()
+{
+  if (!started)
+    return;
+  ldout(cct, 1) << "stop" << dendl;
+  for (vector<Worker*>::iterator p = workers.begin(); p != workers.end(); ++p)
+    (*p)->stop();
+  started = false;
+}
+
+int EventCenter::create_file_event(int fd, EventCallback *cb)
+{
+  ldout(cct, 20) << "create_file_event fd " << fd << " cb " << cb << dendl;
+  return get_worker(fd)->add_file_event(fd, cb);
+}
+
+bool EventCenter::delete_file_event(int fd)
+{
+  bool r = get_worker(fd)->del_file_event(fd);
+  ldout(cct, 20) << "delete_file_event fd " << fd << (r ? " removed" : " already fired") << dendl;
+  return r;
+}
+
+void EventCenter::dispatch_event_external(EventCallback *cb, int hint)
+{
+  ldout(cct, 20) << "dispatch_event_external cb " << cb << " hint " << hint << dendl;
+  get_worker(hint)->dispatch(cb);
+}
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * Copyright (C) 2004-2006 Sage Weil <sage@newdream.net>
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_EVENTCENTER_H
+#define CEPH_MSG_EVENTCENTER_H
+
+#include <list>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "common/Mutex.h"
+#include "common/Thread.h"
+
+class CephContext;
+
+/**
+ * Something to run on an EventCenter worker thread, either because the
+ * file descriptor it was registered for became readable or because it
+ * was dispatched to the worker directly.
+ */
+class EventCallback {
+public:
+  /**
+   * @param fd the file descriptor that fired, or -1 for an
+   * externally dispatched event
+   */
+  virtual void do_request(int fd) = 0;
+  virtual ~EventCallback() {}
+};
+
+/**
+ * A small, fixed pool of epoll-driven worker threads.
+ *
+ * File events are one-shot: once a registered descriptor becomes
+ * readable (or hangs up) it is removed from the worker before its
+ * callback runs, and the owner must register it again if it wants to
+ * hear about more data.  That keeps the ownership rules simple: at any
+ * moment a callback is either registered (and can be withdrawn with
+ * delete_file_event()) or has been handed to a worker, never both.
+ *
+ * Callbacks run without any EventCenter lock held, so they may register
+ * new events, including for their own descriptor.
+ */
+class EventCenter {
+  class Worker : public Thread {
+    EventCenter *center;
+    int epfd;
+    int notify_fds[2];   ///< pipe used to kick epoll_wait
+    Mutex lock;
+    bool stopping;
+    map<int, EventCallback*> file_events;
+    list<EventCallback*> external_events;
+
+    void wakeup();
+
+  public:
+    Worker(EventCenter *c);
+    ~Worker();
+
+    int init();
+    void *entry();
+    void stop();
+
+    int add_file_event(int fd, EventCallback *cb);
+    bool del_file_event(int fd);
+    void dispatch(EventCallback *cb);
+  };
+
+  CephContext *cct;
+  vector<Worker*> workers;
+  bool started;
+
+  Worker *get_worker(int hint) {
+    if (hint < 0)
+      hint = -hint;
+    return workers[hint % workers.size()];
+  }
+
+public:
+  EventCenter(CephContext *c, int nworkers);
+  ~EventCenter();
+
+  /**
+   * Set up the epoll sets. This may be called (and events registered)
+   * before start(); they will be serviced once the threads are running.
+   *
+   * @return 0 on success, -errno on failure
+   */
+  int init();
+  void start();
+  void stop();
+
+  int get_num_workers() const { return workers.size(); }
+
+  /**
+   * Call cb->do_request(fd) once fd is readable or has hung up.
+   *
+   * @param fd the descriptor to watch; it must not already be registered
+   * @param cb callback to invoke; the caller retains ownership
+   * @return 0 on success, -errno on failure
+   */
+  int create_file_event(int fd, EventCallback *cb);
+
+  /**
+   * Withdraw a file event registered with create_file_event().
+   *
+   * @return true if the event was still pending and has been removed;
+   * false if it already fired (its callback is running or about to run)
+   */
+  bool delete_file_event(int fd);
+
+  /**
+   * Run cb->do_request(-1) on a worker thread as soon as possible.
+   *
+   * @param cb callback to invoke; the caller retains ownership
+   * @param hint events with the same hint go to the same worker, and
+   * run in the order they were dispatched
+   */
+  void dispatch_event_external(EventCallback *cb, int hint);
+};
+
+#endif
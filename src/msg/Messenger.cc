@@ -4,6 +4,8 @@
 
 #include "SimpleMessenger.h"
 
+#include "include/intarith.h"
+
 Messenger *Messenger::create(CephContext *cct,
 			     entity_name_t name,
 			     string lname,
@@ -11,3 +13,51 @@ Messenger *Messenger::create(CephContext *cct,
 {
   return new SimpleMessenger(cct, name, lname, nonce);
 }
+
+void Messenger::alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
+{
+  // create a buffer to read into that matches the data alignment
+  unsigned left = len;
+  unsigned head = 0;
+  if (off & ~CEPH_PAGE_MASK) {
+    // head
+    head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
+    bufferptr bp = buffer::create(head);
+    data.push_back(bp);
+    left -= head;
+  }
+  unsigned middle = left & CEPH_PAGE_MASK;
+  if (middle > 0) {
+    bufferptr bp = buffer::create_page_aligned(middle);
+    data.push_back(bp);
+    left -= middle;
+  }
+  if (left) {
+    bufferptr bp = buffer::create(left);
+    data.push_back(bp);
+  }
+}
+
+void Messenger::alloc_page_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
+{
+  unsigned pos = off & ~CEPH_PAGE_MASK;
+  bufferptr chunk = buffer::create_page_aligned(ROUND_UP_TO(pos + len, CEPH_PAGE_SIZE));
+
+  // same head/middle/tail split as alloc_aligned_buffer(), so that the
+  // middle is recognizably page aligned and sized on its own
+  unsigned left = len;
+  if (pos) {
+    unsigned head = MIN(CEPH_PAGE_SIZE - pos, left);
+    data.push_back(bufferptr(chunk, pos, head));
+    pos += head;
+    left -= head;
+  }
+  unsigned middle = left & CEPH_PAGE_MASK;
+  if (middle > 0) {
+    data.push_back(bufferptr(chunk, pos, middle));
+    pos += middle;
+    left -= middle;
+  }
+  if (left)
+    data.push_back(bufferptr(chunk, pos, left));
+}
@@ -142,6 +142,28 @@ public:
 			   string lname,
                            uint64_t nonce);
 
+  /**
+   * Allocate buffers to receive a message data segment into, laid
+   * out so that data that is page aligned at its destination (per the
+   * header's data_off) is page aligned in memory: a small head, a
+   * page-aligned middle and a small tail.  This is what you get if no
+   * Dispatcher supplies a buffer.
+   *
+   * @param data bufferlist to append the buffers to
+   * @param len data length
+   * @param off logical offset of the data (header.data_off)
+   */
+  static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off);
+
+  /**
+   * Like alloc_aligned_buffer(), but carve head, middle and tail out of
+   * a single page-aligned allocation.  The segments can be handed to
+   * O_DIRECT or page-aligned consumers (FileJournal) without bounce
+   * copies, at the cost of rounding the allocation up to whole pages,
+   * so this is best kept for large data payloads.
+   */
+  static void alloc_page_aligned_buffer(bufferlist& data, unsigned len, unsigned off);
+
   /**
    * @defgroup Accessors
    * @{
@@ -607,6 +629,24 @@ public:
 	 p++)
       (*p)->ms_handle_remote_reset(con);
   }
+  /**
+   * Ask each Dispatcher in turn to supply memory for the data segment
+   * of an incoming message.
+   *
+   * @param con The Connection the message is arriving on
+   * @param header The header of the incoming message
+   * @param data Output param: the buffers to read into
+   * @return True if a Dispatcher filled in data, false otherwise.
+   */
+  bool ms_deliver_get_data_buffer(Connection *con, const ceph_msg_header& header,
+				  bufferlist& data) {
+    for (list<Dispatcher*>::iterator p = dispatchers.begin();
+	 p != dispatchers.end();
+	 p++)
+      if ((*p)->ms_get_data_buffer(con, header, data))
+	return true;
+    return false;
+  }
   /**
    * Get the AuthAuthorizer for a new outgoing Connection.
    *
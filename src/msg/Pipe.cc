@@ -54,6 +54,7 @@ ostream& Pipe::_pipe_prefix(std::ostream *_dout) {
 
 Pipe::Pipe(SimpleMessenger *r, int st, Connection *con)
   : reader_thread(this), writer_thread(this),
+    reader_event(this),
     msgr(r),
     conn_id(r->dispatch_queue.get_id()),
     sd(-1), port(0),
@@ -63,7 +64,8 @@ Pipe::Pipe(SimpleMessenger *r, int st, Connection *con)
     session_security(NULL),
     connection_state(NULL),
     reader_running(false), reader_needs_join(false),
-    writer_running(false),
+    writer_running(false), writer_needs_join(false),
+    reader_parked(false), writer_parked(false),
     in_q(&(r->dispatch_queue)),
     keepalive(false),
     close_on_empty(false),
@@ -132,6 +134,18 @@ void Pipe::start_writer()
   assert(pipe_lock.is_locked());
   assert(!writer_running);
   writer_running = true;
+  _start_writer_thread();
+}
+
+void Pipe::_start_writer_thread()
+{
+  assert(pipe_lock.is_locked());
+  if (writer_needs_join) {
+    // the previous writer thread parked and exited; it no longer
+    // needs pipe_lock, so joining here cannot deadlock.
+    writer_thread.join();
+    writer_needs_join = false;
+  }
   writer_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
 }
 
@@ -140,12 +154,34 @@ void Pipe::join_reader()
   if (!reader_running)
     return;
   cond.Signal();
+  while (reader_parked) {
+    // withdraw the socket from the EventCenter; if it already fired,
+    // wait for reader_wakeup() to restart the thread so we can join it.
+    if (msgr->event_center->delete_file_event(sd)) {
+      ldout(msgr->cct,20) << "join_reader withdrew parked reader" << dendl;
+      reader_parked = false;
+      reader_running = false;
+    } else {
+      cond.Wait(pipe_lock);
+    }
+  }
   pipe_lock.Unlock();
   reader_thread.join();
   pipe_lock.Lock();
   reader_needs_join = false;
 }
 
+void Pipe::_wake()
+{
+  assert(pipe_lock.is_locked());
+  cond.Signal();
+  if (writer_parked) {
+    ldout(msgr->cct,20) << "restarting parked writer" << dendl;
+    writer_parked = false;
+    _start_writer_thread();
+  }
+}
+
 
 void Pipe::queue_received(Message *m, int priority)
 {
@@ -539,7 +575,7 @@ int Pipe::accept()
   if (policy.lossy)
     reply.flags = reply.flags | CEPH_MSG_CONNECT_LOSSY;
 
-  connection_state->set_features((int)reply.features & (int)connect.features);
+  connection_state->set_features((uint64_t)reply.features & (uint64_t)connect.features);
   ldout(msgr->cct,10) << "accept features " << connection_state->get_features() << dendl;
 
   delete session_security;
@@ -913,7 +949,7 @@ int Pipe::connect()
       connect_seq = cseq + 1;
       assert(connect_seq == reply.connect_seq);
       backoff = utime_t();
-      connection_state->set_features((unsigned)reply.features & (unsigned)connect.features);
+      connection_state->set_features((uint64_t)reply.features & (uint64_t)connect.features);
       ldout(msgr->cct,10) << "connect success " << connect_seq << ", lossy = " << policy.lossy
 	       << ", features " << connection_state->get_features() << dendl;
       
@@ -1025,7 +1061,7 @@ void Pipe::fault(bool onread)
 {
   const md_config_t *conf = msgr->cct->_conf;
   assert(pipe_lock.is_locked());
-  cond.Signal();
+  _wake();
 
   if (onread && state == STATE_CONNECTING) {
     ldout(msgr->cct,10) << "fault already connecting, reader shutting down" << dendl;
@@ -1139,7 +1175,7 @@ void Pipe::stop()
   ldout(msgr->cct,10) << "stop" << dendl;
   assert(pipe_lock.is_locked());
   state = STATE_CLOSED;
-  cond.Signal();
+  _wake();
   shutdown_socket();
 }
 
@@ -1161,17 +1197,45 @@ void Pipe::reader()
 
     // sleep if (re)connecting
     if (state == STATE_STANDBY) {
+      if (msgr->event_center) {
+	// whoever brings us out of standby restarts the reader
+	ldout(msgr->cct,20) << "reader exiting during reconnect|standby" << dendl;
+	break;
+      }
       ldout(msgr->cct,20) << "reader sleeping during reconnect|standby" << dendl;
       cond.Wait(pipe_lock);
       continue;
     }
 
+    // park until there is something to read?
+    char tag = -1;
+    bool have_tag = false;
+    if (msgr->event_center && state == STATE_OPEN) {
+      pipe_lock.Unlock();
+      int r = reader_idle(&tag);
+      pipe_lock.Lock();
+      if (r > 0)
+	have_tag = true;  // consumed; handle it whatever the state
+      else if (state != STATE_OPEN)
+	continue;
+      else if (r < 0) {
+	if (msgr->event_center->create_file_event(sd, &reader_event) == 0) {
+	  ldout(msgr->cct,20) << "reader parking" << dendl;
+	  reader_parked = true;
+	  reader_needs_join = true;  // our thread exits now
+	  cond.Signal();  // for join_reader()
+	  pipe_lock.Unlock();
+	  return;
+	}
+	ldout(msgr->cct,1) << "reader failed to park, staying awake" << dendl;
+      }
+    }
+
     pipe_lock.Unlock();
 
     char buf[80];
-    char tag = -1;
     ldout(msgr->cct,20) << "reader reading tag..." << dendl;
-    if (tcp_read((char*)&tag, 1) < 0) {
+    if (!have_tag && tcp_read((char*)&tag, 1) < 0) {
       pipe_lock.Lock();
       ldout(msgr->cct,2) << "reader couldn't read tag, " << strerror_r(errno, buf, sizeof(buf)) << dendl;
       fault(true);
@@ -1238,7 +1302,7 @@ void Pipe::reader()
       // note last received message.
       in_seq = m->get_seq();
 
-      cond.Signal();  // wake up writer, to ack this
+      _wake();  // wake up writer, to ack this
       
       ldout(msgr->cct,10) << "reader got message "
 	       << m->get_seq() << " " << m << " " << *m
@@ -1253,7 +1317,7 @@ void Pipe::reader()
 	state = STATE_CLOSED;
       else
 	state = STATE_CLOSING;
-      cond.Signal();
+      _wake();
       break;
     }
     else {
@@ -1267,8 +1331,55 @@ void Pipe::reader()
   // reap?
   reader_running = false;
   reader_needs_join = true;
-  unlock_maybe_reap();
   ldout(msgr->cct,10) << "reader done" << dendl;
+  unlock_maybe_reap();
+}
+
+/*
+ * Runs on an EventCenter worker once a parked reader's socket is
+ * readable (or has hung up).  Only restart the thread here; the worker
+ * must never read from the socket itself.
+ */
+void Pipe::reader_wakeup()
+{
+  pipe_lock.Lock();
+  assert(reader_parked);  // join_reader() can't withdraw a fired event
+  ldout(msgr->cct,20) << "reader_wakeup restarting reader" << dendl;
+  reader_parked = false;
+  if (reader_needs_join) {
+    // the parked thread has already dropped pipe_lock and exited
+    reader_thread.join();
+    reader_needs_join = false;
+  }
+  reader_thread.create(msgr->cct->_conf->ms_rwthread_stack_bytes);
+  cond.Signal();  // for join_reader()
+  pipe_lock.Unlock();
+}
+
+/*
+ * Try to read the next tag without blocking.  Only if that would block,
+ * wait up to ms_park_idle_time for the socket to become readable, so a
+ * busy connection doesn't pay a poll() per message.
+ *
+ * @return 1 if *tag was read, 0 if the socket is readable (or failed;
+ * tcp_read() will notice), -1 if nothing arrived and the reader may park
+ */
+int Pipe::reader_idle(char *tag)
+{
+  int got = ::recv(sd, tag, 1, MSG_DONTWAIT);
+  if (got > 0)
+    return 1;
+  if (got == 0 || (errno != EAGAIN && errno != EINTR))
+    return 0;
+
+  struct pollfd pfd;
+  pfd.fd = sd;
+  pfd.events = POLLIN;
+#if defined(__linux__)
+  pfd.events |= POLLRDHUP;
+#endif
+  int r = poll(&pfd, 1, msgr->cct->_conf->ms_park_idle_time * 1000);
+  return r == 0 ? -1 : 0;
 }
 
 /* write msgs to socket.
@@ -1277,9 +1388,13 @@ void Pipe::reader()
 void Pipe::writer()
 {
   char buf[80];
+  bool timed_out = false;
 
   pipe_lock.Lock();
   while (state != STATE_CLOSED) {// && state != STATE_WAIT) {
+    bool was_idle = timed_out;
+    timed_out = false;
+
     ldout(msgr->cct,10) << "writer: state = " << get_state_name()
 			<< " policy.server=" << policy.server << dendl;
 
@@ -1341,35 +1456,53 @@ void Pipe::writer()
 	in_seq_acked = send_seq;
       }
 
-      // grab outgoing message
-      Message *m = _get_next_outgoing();
-      if (m) {
+      // grab outgoing messages; everything queued up to the batch
+      // limits goes out in one sendmsg.  always take at least one, or a
+      // zero limit would leave us spinning.
+      list<Message*> batch;
+      uint64_t batch_bytes = 0;
+      unsigned max_batch = MAX(1, msgr->cct->_conf->ms_max_batch_messages);
+      while (batch.size() < max_batch &&
+	     (batch.empty() || batch_bytes < msgr->cct->_conf->ms_max_batch_bytes)) {
+	Message *m = _get_next_outgoing();
+	if (!m)
+	  break;
 	m->set_seq(++out_seq);
 	if (!policy.lossy || close_on_empty) {
 	  // put on sent list
 	  sent.push_back(m); 
 	  m->get();
 	}
+	// payload is usually not encoded yet; data is what matters
+	batch_bytes += m->get_payload().length() + m->get_data().length();
+	batch.push_back(m);
+      }
+      if (!batch.empty()) {
 	pipe_lock.Unlock();
 
-        ldout(msgr->cct,20) << "writer encoding " << m->get_seq() << " " << m << " " << *m << dendl;
+	for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p) {
+	  Message *m = *p;
+	  ldout(msgr->cct,20) << "writer encoding " << m->get_seq() << " " << m << " " << *m << dendl;
 
-	// associate message with Connection (for benefit of encode_payload)
-	m->set_connection(connection_state->get());
+	  // associate message with Connection (for benefit of encode_payload)
+	  m->set_connection(connection_state->get());
 
-	// encode and copy out of *m
-	m->encode(connection_state->get_features(), !msgr->cct->_conf->ms_nocrc);
+	  // encode and copy out of *m
+	  m->encode(connection_state->get_features(), !msgr->cct->_conf->ms_nocrc);
+	}
 
-        ldout(msgr->cct,20) << "writer sending " << m->get_seq() << " " << m << dendl;
-	int rc = write_message(m);
+        ldout(msgr->cct,20) << "writer sending " << batch.size() << " messages, "
+			    << batch.front()->get_seq() << ".." << batch.back()->get_seq() << dendl;
+	int rc = write_messages(batch);
 
 	pipe_lock.Lock();
 	if (rc < 0) {
-          ldout(msgr->cct,1) << "writer error sending " << m << ", "
+          ldout(msgr->cct,1) << "writer error sending " << batch.size() << " messages, "
 		  << errno << ": " << strerror_r(errno, buf, sizeof(buf)) << dendl;
 	  fault();
         }
-	m->put();
+	for (list<Message*>::iterator p = batch.begin(); p != batch.end(); ++p)
+	  (*p)->put();
       }
       continue;
     }
@@ -1380,6 +1513,22 @@ void Pipe::writer()
       continue;
     }
 
+    // idle for a full interval: park until _wake()
+    if (msgr->event_center &&
+	(state == STATE_OPEN || state == STATE_STANDBY)) {
+      if (was_idle) {
+	ldout(msgr->cct,20) << "writer parking" << dendl;
+	writer_parked = true;
+	writer_needs_join = true;  // our thread exits now
+	pipe_lock.Unlock();
+	return;
+      }
+      ldout(msgr->cct,20) << "writer sleeping" << dendl;
+      timed_out = cond.WaitInterval(msgr->cct, pipe_lock,
+				    utime_t(msgr->cct->_conf->ms_park_idle_time, 0)) == ETIMEDOUT;
+      continue;
+    }
+
     // wait
     ldout(msgr->cct,20) << "writer sleeping" << dendl;
     cond.Wait(pipe_lock);
@@ -1389,8 +1538,8 @@ void Pipe::writer()
 
   // reap?
   writer_running = false;
-  unlock_maybe_reap();
   ldout(msgr->cct,10) << "writer done" << dendl;
+  unlock_maybe_reap();
 }
 
 void Pipe::unlock_maybe_reap()
@@ -1404,30 +1553,6 @@ void Pipe::unlock_maybe_reap()
   }
 }
 
-static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
-{
-  // create a buffer to read into that matches the data alignment
-  unsigned left = len;
-  unsigned head = 0;
-  if (off & ~CEPH_PAGE_MASK) {
-    // head
-    head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
-    bufferptr bp = buffer::create(head);
-    data.push_back(bp);
-    left -= head;
-  }
-  unsigned middle = left & CEPH_PAGE_MASK;
-  if (middle > 0) {
-    bufferptr bp = buffer::create_page_aligned(middle);
-    data.push_back(bp);
-    left -= middle;
-  }
-  if (left) {
-    bufferptr bp = buffer::create(left);
-    data.push_back(bp);
-  }
-}
-
 int Pipe::read_message(Message **pm)
 {
   int ret = -1;
@@ -1552,7 +1677,9 @@ int Pipe::read_message(Message **pm)
       } else {
 	if (!newbuf.length()) {
 	  ldout(msgr->cct,20) << "reader allocating new rx buffer at offset " << offset << dendl;
-	  alloc_aligned_buffer(newbuf, data_len, data_off);
+	  if (!msgr->ms_deliver_get_data_buffer(connection_state, header, newbuf))
+	    Messenger::alloc_aligned_buffer(newbuf, data_len, data_off);
+	  assert(newbuf.length() >= data_len);
 	  blp = newbuf.begin();
 	  blp.advance(offset);
 	}
@@ -1566,6 +1693,7 @@ int Pipe::read_message(Message **pm)
       if (got < 0)
 	goto out_dethrottle;
       if (got > 0) {
+	bp.invalidate_crc();  // rx buffers may be reused
 	blp.advance(got);
 	data.append(bp, 0, got);
 	offset += got;
@@ -1648,19 +1776,19 @@ int Pipe::read_message(Message **pm)
   return ret;
 }
 
-int Pipe::do_sendmsg(struct msghdr *msg, int len, bool more)
+int Pipe::do_sendmsg(struct msghdr *msg, uint64_t len, bool more)
 {
   char buf[80];
 
   while (len > 0) {
     if (0) { // sanity
-      int l = 0;
+      uint64_t l = 0;
       for (unsigned i=0; i<msg->msg_iovlen; i++)
 	l += msg->msg_iov[i].iov_len;
       assert(l == len);
     }
 
-    int r = ::sendmsg(sd, msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    ssize_t r = ::sendmsg(sd, msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
     if (r == 0) 
       ldout(msgr->cct,10) << "do_sendmsg hmm do_sendmsg got r==0!" << dendl;
     if (r < 0) { 
@@ -1741,11 +1869,11 @@ int Pipe::write_keepalive()
 }
 
 
-int Pipe::write_message(Message *m)
+void Pipe::build_frame(Message *m, MessageFrame *f,
+			vector<struct iovec> *iov, uint64_t *len)
 {
   ceph_msg_header& header = m->get_header();
   ceph_msg_footer& footer = m->get_footer();
-  int ret;
 
   // get envelope, buffers
   header.front_len = m->get_payload().length();
@@ -1768,34 +1896,27 @@ int Pipe::write_message(Message *m)
     }
   }
 
-  bufferlist blist = m->get_payload();
-  blist.append(m->get_middle());
-  blist.append(m->get_data());
-  
+  f->blist = m->get_payload();
+  f->blist.append(m->get_middle());
+  f->blist.append(m->get_data());
+
   ldout(msgr->cct,20)  << "write_message " << m << dendl;
-  
-  // set up msghdr and iovecs
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(msg));
-  struct iovec *msgvec = new iovec[3 + blist.buffers().size()];  // conservative upper bound
-  msg.msg_iov = msgvec;
-  int msglen = 0;
-  
+
+  struct iovec v;
+
   // send tag
-  char tag = CEPH_MSGR_TAG_MSG;
-  msgvec[msg.msg_iovlen].iov_base = &tag;
-  msgvec[msg.msg_iovlen].iov_len = 1;
-  msglen++;
-  msg.msg_iovlen++;
+  f->tag = CEPH_MSGR_TAG_MSG;
+  v.iov_base = &f->tag;
+  v.iov_len = 1;
+  iov->push_back(v);
+  (*len)++;
 
   // send envelope
-  ceph_msg_header_old oldheader;
   if (connection_state->has_feature(CEPH_FEATURE_NOSRCADDR)) {
-    msgvec[msg.msg_iovlen].iov_base = (char*)&header;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(header);
-    msglen += sizeof(header);
-    msg.msg_iovlen++;
+    v.iov_base = (char*)&header;
+    v.iov_len = sizeof(header);
   } else {
+    ceph_msg_header_old& oldheader = f->oldheader;
     memcpy(&oldheader, &header, sizeof(header));
     oldheader.src.name = header.src;
     oldheader.src.addr = connection_state->get_peer_addr();
@@ -1803,91 +1924,75 @@ int Pipe::write_message(Message *m)
     oldheader.reserved = header.reserved;
     oldheader.crc = ceph_crc32c_le(0, (unsigned char*)&oldheader,
 			      sizeof(oldheader) - sizeof(oldheader.crc));
-    msgvec[msg.msg_iovlen].iov_base = (char*)&oldheader;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(oldheader);
-    msglen += sizeof(oldheader);
-    msg.msg_iovlen++;
-  }
-
-  // payload (front+data)
-  list<bufferptr>::const_iterator pb = blist.buffers().begin();
-  int b_off = 0;  // carry-over buffer offset, if any
-  int bl_pos = 0; // blist pos
-  int left = blist.length();
-
-  while (left > 0) {
-    int donow = MIN(left, (int)pb->length()-b_off);
-    if (donow == 0) {
-      ldout(msgr->cct,0) << "donow = " << donow << " left " << left << " pb->length " << pb->length()
-	      << " b_off " << b_off << dendl;
-    }
-    assert(donow > 0);
-    ldout(msgr->cct,30) << " bl_pos " << bl_pos << " b_off " << b_off
-	     << " leftinchunk " << left
-	     << " buffer len " << pb->length()
-	     << " writing " << donow 
-	     << dendl;
-    
-    if (msg.msg_iovlen >= IOV_MAX-2) {
-      if (do_sendmsg(&msg, msglen, true))
-	goto fail;
-      
-      // and restart the iov
-      msg.msg_iov = msgvec;
-      msg.msg_iovlen = 0;
-      msglen = 0;
-    }
-    
-    msgvec[msg.msg_iovlen].iov_base = (void*)(pb->c_str()+b_off);
-    msgvec[msg.msg_iovlen].iov_len = donow;
-    msglen += donow;
-    msg.msg_iovlen++;
-    
-    left -= donow;
-    assert(left >= 0);
-    b_off += donow;
-    bl_pos += donow;
-    if (left == 0)
-      break;
-    while (b_off == (int)pb->length()) {
-      pb++;
-      b_off = 0;
-    }
+    v.iov_base = (char*)&oldheader;
+    v.iov_len = sizeof(oldheader);
   }
-  assert(left == 0);
+  iov->push_back(v);
+  *len += v.iov_len;
 
-  // send footer; if receiver doesn't support signatures, use the old footer format
+  // payload (front+middle+data)
+  for (list<bufferptr>::const_iterator pb = f->blist.buffers().begin();
+       pb != f->blist.buffers().end();
+       ++pb) {
+    if (pb->length() == 0)
+      continue;
+    v.iov_base = (void*)pb->c_str();
+    v.iov_len = pb->length();
+    iov->push_back(v);
+    *len += v.iov_len;
+  }
 
-  ceph_msg_footer_old old_footer;
+  // send footer; if receiver doesn't support signatures, use the old footer format
   if (connection_state->has_feature(CEPH_FEATURE_MSG_AUTH)) {
-    msgvec[msg.msg_iovlen].iov_base = (void*)&footer;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(footer);
-    msglen += sizeof(footer);
-    msg.msg_iovlen++;
+    v.iov_base = (void*)&footer;
+    v.iov_len = sizeof(footer);
   } else {
+    ceph_msg_footer_old& old_footer = f->old_footer;
     old_footer.front_crc = footer.front_crc;   
     old_footer.middle_crc = footer.middle_crc;   
     old_footer.data_crc = footer.data_crc;   
     old_footer.flags = footer.flags;   
-    msgvec[msg.msg_iovlen].iov_base = (char*)&old_footer;
-    msgvec[msg.msg_iovlen].iov_len = sizeof(old_footer);
-    msglen += sizeof(old_footer);
-    msg.msg_iovlen++;
+    v.iov_base = (char*)&old_footer;
+    v.iov_len = sizeof(old_footer);
   }
+  iov->push_back(v);
+  *len += v.iov_len;
+}
 
-  // send
-  if (do_sendmsg(&msg, msglen))
-    goto fail;
-
-  ret = 0;
-
- out:
-  delete[] msgvec;
-  return ret;
-
- fail:
-  ret = -1;
-  goto out;
+int Pipe::write_messages(const list<Message*>& ms)
+{
+  // the iovecs point into the frames, so they must not move until
+  // everything is on the wire; hence a list.
+  list<MessageFrame> frames;
+  vector<struct iovec> iov;
+  uint64_t total = 0;
+
+  for (list<Message*>::const_iterator p = ms.begin(); p != ms.end(); ++p) {
+    frames.push_back(MessageFrame());
+    build_frame(*p, &frames.back(), &iov, &total);
+  }
+  ldout(msgr->cct,20) << "write_messages " << ms.size() << " messages, "
+		      << total << " bytes in " << iov.size() << " iovecs" << dendl;
+
+  // the kernel takes at most IOV_MAX iovecs per call; everything but
+  // the last chunk goes out with MSG_MORE so the stack can coalesce
+  // across the call boundaries.
+  unsigned pos = 0;
+  while (pos < iov.size()) {
+    unsigned n = MIN(iov.size() - pos, (unsigned)IOV_MAX);
+    uint64_t len = 0;
+    for (unsigned i = pos; i < pos + n; i++)
+      len += iov[i].iov_len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov[pos];
+    msg.msg_iovlen = n;
+    pos += n;
+    if (do_sendmsg(&msg, len, pos < iov.size()))
+      return -1;
+  }
+  return 0;
 }
 
 
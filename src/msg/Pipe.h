@@ -17,6 +17,7 @@
 
 #include "msg_types.h"
 #include "Messenger.h"
+#include "EventCenter.h"
 #include "auth/AuthSessionHandler.h"
 
 
@@ -32,6 +33,15 @@ class DispatchQueue;
    * propagating socket errors to the SimpleMessenger and then sticking
    * around in a state where it can provide enough data for the SimpleMessenger
    * to provide reliable Message delivery when it manages to reconnect.
+   *
+   * With ms_park_idle_pipes, a side that has been idle for
+   * ms_park_idle_time "parks": its thread exits, the Reader hands the
+   * socket to the SimpleMessenger's EventCenter and the Writer waits for
+   * _wake(). When there is work again the thread is simply restarted, so
+   * all socket I/O and throttle waits still happen on the Pipe's own
+   * threads and never on an EventCenter worker. This only saves the
+   * threads of idle connections; a busy one still has both.
+   * reader_running and writer_running stay true while parked.
    */
   class Pipe : public RefCountedObject {
     /**
@@ -60,6 +70,16 @@ class DispatchQueue;
     } writer_thread;
     friend class Writer;
 
+    /**
+     * Restarts a parked reader when the socket becomes readable.
+     */
+    class ReaderEvent : public EventCallback {
+      Pipe *pipe;
+    public:
+      ReaderEvent(Pipe *p) : pipe(p) {}
+      void do_request(int fd) { pipe->reader_wakeup(); }
+    } reader_event;
+
   public:
     Pipe(SimpleMessenger *r, int st, Connection *con);
     ~Pipe();
@@ -114,7 +134,9 @@ class DispatchQueue;
     utime_t backoff;         // backoff time
 
     bool reader_running, reader_needs_join;
-    bool writer_running;
+    bool writer_running, writer_needs_join;
+    bool reader_parked;   ///< socket is registered with the EventCenter
+    bool writer_parked;   ///< writer thread exited; _wake() restarts it
 
     map<int, list<Message*> > out_q;  // priority queue for outbound msgs
     DispatchQueue *in_q;
@@ -132,12 +154,35 @@ class DispatchQueue;
     int connect();  // client handshake
     void reader();
     void writer();
+    void reader_wakeup();
+    int reader_idle(char *tag);
+    void _start_writer_thread();
     void unlock_maybe_reap();
 
     int randomize_out_seq();
 
     int read_message(Message **pm);
-    int write_message(Message *m);
+
+    /**
+     * Wire framing for one outgoing message.  The iovecs built by
+     * build_frame() point into it, so it must stay put until the
+     * message has been sent.
+     */
+    struct MessageFrame {
+      char tag;
+      ceph_msg_header_old oldheader;
+      ceph_msg_footer_old old_footer;
+      bufferlist blist;
+    };
+    void build_frame(Message *m, MessageFrame *f,
+		     vector<struct iovec> *iov, uint64_t *len);
+    /**
+     * Send a batch of encoded messages with as few sendmsg calls as
+     * IOV_MAX allows.
+     *
+     * @return 0, or -1 on failure (unrecoverable -- close the socket).
+     */
+    int write_messages(const list<Message*>& ms);
     /**
      * Write the given data (of length len) to the Pipe's socket. This function
      * will loop until all passed data has been written out.
@@ -149,7 +194,7 @@ class DispatchQueue;
      * @param more Should be set true if this is one part of a larger message
      * @return 0, or -1 on failure (unrecoverable -- close the socket).
      */
-    int do_sendmsg(struct msghdr *msg, int len, bool more=false);
+    int do_sendmsg(struct msghdr *msg, uint64_t len, bool more=false);
     int write_ack(uint64_t s);
     int write_keepalive();
 
@@ -218,12 +263,16 @@ class DispatchQueue;
     }
     void _send(Message *m) {
       out_q[m->get_priority()].push_back(m);
-      cond.Signal();
+      _wake();
     }
     void _send_keepalive() {
       keepalive = true;
-      cond.Signal();
+      _wake();
     }
+    /**
+     * Wake up anyone waiting on cond, including a parked writer.
+     */
+    void _wake();
     Message *_get_next_outgoing() {
       Message *m = 0;
       while (!m && !out_q.empty()) {
@@ -50,11 +50,26 @@ SimpleMessenger::SimpleMessenger(CephContext *cct, entity_name_t name,
     policy_lock("SimpleMessenger::policy_lock"),
     dispatch_throttler(cct, string("msgr_dispatch_throttler-") + mname, cct->_conf->ms_dispatch_throttle_bytes),
     reaper_started(false), reaper_stop(false),
+    event_center(NULL),
     timeout(0),
     local_connection(new Connection)
 {
   pthread_spin_init(&global_seq_lock, PTHREAD_PROCESS_PRIVATE);
   init_local_connection();
+
+  if (cct->_conf->ms_park_idle_pipes) {
+    // Pipes may be created (and park) before start(); the workers will
+    // pick up anything registered in the meantime.
+    EventCenter *center = new EventCenter(cct, cct->_conf->ms_park_threads);
+    int r = center->init();
+    if (r < 0) {
+      lderr(cct) << "failed to set up pipe parking: " << cpp_strerror(r)
+		 << ", keeping a thread per pipe" << dendl;
+      delete center;
+    } else {
+      event_center = center;
+    }
+  }
 }
 
 /**
@@ -66,6 +81,10 @@ SimpleMessenger::~SimpleMessenger()
   assert(!did_bind); // either we didn't bind or we shut down the Accepter
   assert(rank_pipe.empty()); // we don't have any running Pipes.
   assert(reaper_stop && !reaper_started); // the reaper thread is stopped
+  if (event_center) {
+    event_center->stop();
+    delete event_center;
+  }
   local_connection->put();
 }
 
@@ -294,6 +313,12 @@ int SimpleMessenger::start()
 
   reaper_started = true;
   reaper_thread.create();
+
+  if (event_center) {
+    ldout(cct,1) << "start " << event_center->get_num_workers()
+		 << " pipe parking threads" << dendl;
+    event_center->start();
+  }
   return 0;
 }
 
@@ -531,6 +556,10 @@ void SimpleMessenger::wait()
   }
   lock.Unlock();
 
+  // every Pipe is reaped, so nothing is left parked
+  if (event_center)
+    event_center->stop();
+
   ldout(cct,10) << "wait: done." << dendl;
   ldout(cct,1) << "shutdown complete." << dendl;
   started = false;
@@ -523,6 +523,13 @@ private:
 
   friend class Pipe;
 
+  /**
+   * With ms_park_idle_pipes, idle Pipes give up their reader and writer
+   * threads and park on this until there is work for them again.
+   * NULL otherwise.
+   */
+  EventCenter *event_center;
+
 public:
 
   int timeout;
@@ -0,0 +1,254 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "AttrCache.h"
+
+/// what an attr costs beyond its name and value (map node, raw)
+#define ATTR_OVERHEAD 96
+
+AttrCache::AttrCache(size_t max_bytes)
+  : lock("AttrCache::lock"),
+    max_bytes(max_bytes), bytes(0),
+    hits(0), misses(0), evictions(0)
+{
+  for (unsigned i = 0; i < NUM_STRIPES; i++)
+    gen[i] = 0;
+}
+
+AttrCache::~AttrCache()
+{
+  clear_all();
+}
+
+AttrCache::Entry *AttrCache::_find(const coll_t& cid, const hobject_t& oid)
+{
+  map<hobject_t, map<coll_t, Entry*> >::iterator p = objects.find(oid);
+  if (p == objects.end())
+    return NULL;
+  map<coll_t, Entry*>::iterator q = p->second.find(cid);
+  if (q == p->second.end())
+    return NULL;
+  return q->second;
+}
+
+void AttrCache::_remove(Entry *e)
+{
+  map<hobject_t, map<coll_t, Entry*> >::iterator p = objects.find(e->oid);
+  assert(p != objects.end());
+  p->second.erase(e->cid);
+  if (p->second.empty())
+    objects.erase(p);
+  lru.erase(e->lru_pos);
+  bytes -= e->bytes;
+  delete e;
+}
+
+void AttrCache::_account(Entry *e)
+{
+  bytes -= e->bytes;
+  e->bytes = sizeof(Entry) + e->oid.oid.name.length() +
+    e->oid.get_key().length() + e->oid.nspace.length();
+  for (map<string, bufferptr>::iterator p = e->attrs.begin();
+       p != e->attrs.end();
+       ++p)
+    e->bytes += p->first.length() + p->second.length() + ATTR_OVERHEAD;
+  bytes += e->bytes;
+}
+
+void AttrCache::_trim()
+{
+  while (!lru.empty() && bytes > max_bytes) {
+    evictions++;
+    _remove(lru.back());
+  }
+}
+
+AttrCache::Entry *AttrCache::_start_write(const coll_t& cid,
+					  const hobject_t& oid)
+{
+  gen[stripe(oid)]++;
+  map<hobject_t, map<coll_t, Entry*> >::iterator p = objects.find(oid);
+  if (p == objects.end())
+    return NULL;
+
+  // other names may be links to the same inode; we can't tell
+  Entry *ours = NULL;
+  vector<Entry*> others;
+  for (map<coll_t, Entry*>::iterator q = p->second.begin();
+       q != p->second.end();
+       ++q) {
+    if (q->first == cid)
+      ours = q->second;
+    else
+      others.push_back(q->second);
+  }
+  for (vector<Entry*>::iterator q = others.begin(); q != others.end(); ++q)
+    _remove(*q);
+  return ours;
+}
+
+void AttrCache::set_max_bytes(size_t b)
+{
+  Mutex::Locker l(lock);
+  max_bytes = b;
+  _trim();
+}
+
+bool AttrCache::lookup(const coll_t& cid, const hobject_t& oid,
+		       const string& name, bufferptr *bp, bool *exists)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _find(cid, oid);
+  if (!e) {
+    misses++;
+    return false;
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, e->lru_pos);
+  map<string, bufferptr>::iterator p = e->attrs.find(name);
+  *exists = (p != e->attrs.end());
+  if (*exists)
+    *bp = buffer::copy(p->second.c_str(), p->second.length());
+  return true;
+}
+
+bool AttrCache::lookup(const coll_t& cid, const hobject_t& oid,
+		       map<string, bufferptr> *aset)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _find(cid, oid);
+  if (!e) {
+    misses++;
+    return false;
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, e->lru_pos);
+  for (map<string, bufferptr>::iterator p = e->attrs.begin();
+       p != e->attrs.end();
+       ++p)
+    (*aset)[p->first] = buffer::copy(p->second.c_str(), p->second.length());
+  return true;
+}
+
+uint64_t AttrCache::begin_load(const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  return gen[stripe(oid)];
+}
+
+void AttrCache::finish_load(const coll_t& cid, const hobject_t& oid,
+			    const map<string, bufferptr>& aset, uint64_t token)
+{
+  Mutex::Locker l(lock);
+  if (max_bytes == 0 || gen[stripe(oid)] != token)
+    return;
+  if (_find(cid, oid))
+    return;  // someone else loaded it first; theirs is as good
+
+  Entry *e = new Entry;
+  e->cid = cid;
+  e->oid = oid;
+  e->bytes = 0;
+  for (map<string, bufferptr>::const_iterator p = aset.begin();
+       p != aset.end();
+       ++p)
+    e->attrs[p->first] = buffer::copy(p->second.c_str(), p->second.length());
+  lru.push_front(e);
+  e->lru_pos = lru.begin();
+  objects[oid][cid] = e;
+  _account(e);
+  _trim();
+}
+
+void AttrCache::set(const coll_t& cid, const hobject_t& oid,
+		    const map<string, bufferptr>& aset)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _start_write(cid, oid);
+  if (!e)
+    return;
+  for (map<string, bufferptr>::const_iterator p = aset.begin();
+       p != aset.end();
+       ++p)
+    e->attrs[p->first] = buffer::copy(p->second.c_str(), p->second.length());
+  _account(e);
+  _trim();
+}
+
+void AttrCache::rm(const coll_t& cid, const hobject_t& oid, const string& name)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _start_write(cid, oid);
+  if (!e)
+    return;
+  e->attrs.erase(name);
+  _account(e);
+}
+
+void AttrCache::rm_all(const coll_t& cid, const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _start_write(cid, oid);
+  if (!e)
+    return;
+  e->attrs.clear();
+  _account(e);
+}
+
+void AttrCache::invalidate(const coll_t& cid, const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  Entry *e = _start_write(cid, oid);
+  if (e)
+    _remove(e);
+}
+
+void AttrCache::clear_collection(const coll_t& cid)
+{
+  Mutex::Locker l(lock);
+  for (unsigned i = 0; i < NUM_STRIPES; i++)
+    gen[i]++;
+  for (std::list<Entry*>::iterator p = lru.begin(); p != lru.end(); ) {
+    Entry *e = *p;
+    ++p;
+    if (e->cid == cid)
+      _remove(e);
+  }
+}
+
+void AttrCache::clear_all()
+{
+  Mutex::Locker l(lock);
+  for (unsigned i = 0; i < NUM_STRIPES; i++)
+    gen[i]++;
+  while (!lru.empty())
+    _remove(lru.front());
+}
+
+size_t AttrCache::get_bytes()
+{
+  Mutex::Locker l(lock);
+  return bytes;
+}
+
+void AttrCache::dump(Formatter *f)
+{
+  Mutex::Locker l(lock);
+  f->open_object_section("attr_cache");
+  f->dump_unsigned("max_bytes", max_bytes);
+  f->dump_unsigned("cached", lru.size());
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("hits", hits);
+  f->dump_unsigned("misses", misses);
+  f->dump_unsigned("evictions", evictions);
+  f->close_section();
+}
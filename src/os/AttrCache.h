@@ -0,0 +1,122 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ATTRCACHE_H
+#define CEPH_ATTRCACHE_H
+
+#include <list>
+#include <vector>
+#include <map>
+#include <string>
+
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "include/buffer.h"
+#include "osd/osd_types.h"
+#include "hobject.h"
+
+/**
+ * Write-through cache of complete object attribute sets
+ *
+ * An entry holds every attr of one (collection, object), so a lookup for
+ * a name the entry lacks is an authoritative -ENODATA.  Entries are only
+ * created by loads (begin_load()/finish_load()); writes update an entry
+ * that already exists but never create one.
+ *
+ * A load races with writes: a reader may read the old attrs from disk,
+ * and then a writer may update the disk and the cache before the reader
+ * inserts what it read.  Every write bumps a generation counter (one of
+ * a fixed set of stripes, chosen by object), and finish_load() drops the
+ * result if its stripe moved since begin_load().  Writers must update
+ * the cache only after the on-disk change is complete.
+ *
+ * The same object may be hard linked into several collections (e.g. a
+ * clone in its snap collections).  A write through one name updates
+ * that entry and drops the entries for the object under any other
+ * collection.
+ */
+class AttrCache {
+  static const unsigned NUM_STRIPES = 64;
+
+  struct Entry {
+    coll_t cid;
+    hobject_t oid;
+    map<string, bufferptr> attrs;
+    size_t bytes;
+    std::list<Entry*>::iterator lru_pos;
+  };
+
+  Mutex lock;
+  size_t max_bytes;
+  size_t bytes;
+  uint64_t gen[NUM_STRIPES];
+
+  map<hobject_t, map<coll_t, Entry*> > objects;
+  std::list<Entry*> lru;   ///< hottest first
+  uint64_t hits, misses, evictions;
+
+  unsigned stripe(const hobject_t& oid) {
+    return oid.hash % NUM_STRIPES;
+  }
+  Entry *_find(const coll_t& cid, const hobject_t& oid);
+  void _remove(Entry *e);
+  void _account(Entry *e);
+  void _trim();
+  /// bump the generation and drop entries for oid under other collections
+  Entry *_start_write(const coll_t& cid, const hobject_t& oid);
+
+public:
+  AttrCache(size_t max_bytes);
+  ~AttrCache();
+
+  void set_max_bytes(size_t b);
+  bool enabled() {
+    Mutex::Locker l(lock);
+    return max_bytes > 0;
+  }
+
+  /**
+   * look up one attr
+   *
+   * @param bp [out] a private copy of the value, if present
+   * @param exists [out] whether the object has the attr
+   * @return true if the object's attrs are cached
+   */
+  bool lookup(const coll_t& cid, const hobject_t& oid, const string& name,
+	      bufferptr *bp, bool *exists);
+  /// look up all attrs; @return true if cached
+  bool lookup(const coll_t& cid, const hobject_t& oid,
+	      map<string, bufferptr> *aset);
+
+  /// call before reading the attrs from disk; @return token for finish_load()
+  uint64_t begin_load(const hobject_t& oid);
+  /// cache a complete attr set read from disk, unless a write raced with it
+  void finish_load(const coll_t& cid, const hobject_t& oid,
+		   const map<string, bufferptr>& aset, uint64_t token);
+
+  /// attrs were set
+  void set(const coll_t& cid, const hobject_t& oid,
+	   const map<string, bufferptr>& aset);
+  /// an attr was removed
+  void rm(const coll_t& cid, const hobject_t& oid, const string& name);
+  /// all attrs were removed
+  void rm_all(const coll_t& cid, const hobject_t& oid);
+  /// the attrs changed in some way we don't track, or the name was unlinked
+  void invalidate(const coll_t& cid, const hobject_t& oid);
+  void clear_collection(const coll_t& cid);
+  void clear_all();
+
+  size_t get_bytes();
+  void dump(Formatter *f);
+};
+
+#endif
@@ -121,6 +121,17 @@ protected:
    */
   virtual int cleanup() = 0;
 
+  /**
+   * Lay out an empty collection for an expected number of objects
+   *
+   * Saves splitting directories while the collection fills.
+   *
+   * @return Error Code, 0 for success
+   */
+  virtual int pre_split(
+    uint64_t expected_objects ///< [in] Objects the collection will hold
+    ) = 0;
+
   /**
    * Call when a file is created using a path returned from lookup.
    *
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <inttypes.h>
 #include "include/buffer.h"
+#include <list>
 #include <set>
 #include <map>
 #include <string>
@@ -17,6 +18,9 @@
 
 #include "common/debug.h"
 #include "common/config.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "ObjectStore.h"
 #include "include/assert.h"
 
 #define dout_subsys ceph_subsys_filestore
@@ -36,6 +40,18 @@ const string DBObjectMap::HOBJECT_TO_SEQ = "_HOBJTOSEQ_";
 const string DBObjectMap::LEAF_PREFIX = "_LEAF_";
 const string DBObjectMap::REVERSE_LEAF_PREFIX = "_REVLEAF_";
 
+/// next() calls to try before seeking when scanning forward
+static const unsigned SCAN_MAX_NEXT = 8;
+
+/// objects waiting to be flattened
+static const unsigned FLATTEN_MAX_QUEUED = 1024;
+/// inherited entries a lookup must pass before we judge its shadow ratio
+static const uint64_t FLATTEN_MIN_ENTRIES = 64;
+/// keys flatten() hands the transaction at once
+static const unsigned FLATTEN_BATCH_KEYS = 1024;
+/// how long flatten() waits for other users of an object
+static const double FLATTEN_WAIT = 1.0;
+
 static void append_escaped(const string &in, string *out)
 {
   for (string::const_iterator i = in.begin(); i != in.end(); ++i) {
@@ -300,6 +316,7 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
       return -EINVAL;
     }
     parent_iter.reset(new DBObjectMapIteratorImpl(map, parent));
+    parent_iter->report = false;
   }
   key_iter = map->db->get_iterator(map->user_prefix(header));
   assert(key_iter);
@@ -311,6 +328,16 @@ int DBObjectMap::DBObjectMapIteratorImpl::init()
   return 0;
 }
 
+DBObjectMap::DBObjectMapIteratorImpl::~DBObjectMapIteratorImpl()
+{
+  if (!report || !parent_iter)
+    return;
+  unsigned depth = 0;
+  for (DBObjectMapIteratorImpl *p = parent_iter.get(); p; p = p->parent_iter.get())
+    depth++;
+  map->note_lookup(header->hoid, depth, shadowed, inherited);
+}
+
 ObjectMap::ObjectMapIterator DBObjectMap::get_iterator(
   const hobject_t &hoid)
 {
@@ -458,6 +485,7 @@ int DBObjectMap::DBObjectMapIteratorImpl::adjust()
   string begin, end;
   while (parent_iter && parent_iter->valid()) {
     if (in_complete_region(parent_iter->key(), &begin, &end)) {
+      shadowed++;
       if (end.size() == 0) {
 	parent_iter->seek_to_last();
 	if (parent_iter->valid())
@@ -465,6 +493,7 @@ int DBObjectMap::DBObjectMapIteratorImpl::adjust()
       } else
 	parent_iter->lower_bound(end);
     } else if (key_iter->valid() && key_iter->key() == parent_iter->key()) {
+      shadowed++;
       parent_iter->next();
     } else {
       break;
@@ -472,6 +501,7 @@ int DBObjectMap::DBObjectMapIteratorImpl::adjust()
   }
   if (valid_parent()) {
     cur_iter = parent_iter;
+    inherited++;
   } else if (key_iter->valid()) {
     cur_iter = key_iter;
   } else {
@@ -573,6 +603,7 @@ int DBObjectMap::clear(const hobject_t &hoid,
 		       const SequencerPosition *spos)
 {
   KeyValueDB::Transaction t = db->get_transaction();
+  list<Header> held;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -581,14 +612,15 @@ int DBObjectMap::clear(const hobject_t &hoid,
   remove_map_header(hoid, header, t);
   assert(header->num_children > 0);
   header->num_children--;
-  int r = _clear(header, t);
+  int r = _clear(header, t, &held);
   if (r < 0)
     return r;
   return db->submit_transaction(t);
 }
 
 int DBObjectMap::_clear(Header header,
-			KeyValueDB::Transaction t)
+			KeyValueDB::Transaction t,
+			list<Header> *held)
 {
   while (1) {
     if (header->num_children) {
@@ -604,6 +636,7 @@ int DBObjectMap::_clear(Header header,
     }
     assert(parent->num_children > 0);
     parent->num_children--;
+    held->push_back(parent);
     header.swap(parent);
   }
   return 0;
@@ -694,6 +727,7 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
 			 const set<string> &to_clear,
 			 const SequencerPosition *spos)
 {
+  list<Header> held;
   Header header = lookup_map_header(hoid);
   if (!header)
     return -ENOENT;
@@ -717,7 +751,9 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
 	i != to_clear.end();
       ) {
       copied = 0;
-      iter->lower_bound(*i);
+      // Everything before iter has been copied up or cleared already
+      if (!iter->valid() || *i > iter->key())
+	iter->lower_bound(*i);
       ++i;
       if (!iter->valid())
 	break;
@@ -756,8 +792,9 @@ int DBObjectMap::rm_keys(const hobject_t &hoid,
     Header parent = lookup_parent(header);
     if (!parent)
       return -EINVAL;
+    held.push_back(parent);
     parent->num_children--;
-    _clear(parent, t);
+    _clear(parent, t, &held);
     header->parent = 0;
     set_map_header(hoid, *header, t);
     t->rmkeys_by_prefix(complete_prefix(header));
@@ -797,26 +834,136 @@ int DBObjectMap::get_keys(const hobject_t &hoid,
   return 0;
 }
 
+/**
+ * Moves iter, which must not be past to, to the first key >= to.  The keys
+ * we look up tend to be clustered, so try a few next()s before paying for
+ * a seek.
+ */
+static void seek_forward(KeyValueDB::Iterator iter, const string &to)
+{
+  for (unsigned i = 0;
+       i < SCAN_MAX_NEXT && iter->valid() && iter->key() < to;
+       ++i)
+    iter->next();
+  if (iter->valid() && iter->key() < to)
+    iter->lower_bound(to);
+}
+
+int DBObjectMap::scan_header(Header header,
+			     const set<string> &in_keys,
+			     set<string> *out_keys,
+			     map<string, bufferlist> *out_values,
+			     set<string> *missing)
+{
+  KeyValueDB::Iterator iter = db->get_iterator(user_prefix(header));
+  if (!iter)
+    return -EINVAL;
+  set<string>::const_iterator i = in_keys.begin();
+  if (i != in_keys.end())
+    iter->lower_bound(*i);
+  for (; i != in_keys.end(); ++i) {
+    seek_forward(iter, *i);
+    if (iter->status())
+      return iter->status();
+    if (!iter->valid()) {
+      missing->insert(i, in_keys.end());
+      break;
+    }
+    if (iter->key() == *i) {
+      if (out_keys)
+	out_keys->insert(*i);
+      if (out_values)
+	out_values->insert(make_pair(*i, iter->value()));
+    } else {
+      missing->insert(missing->end(), *i);
+    }
+  }
+  return 0;
+}
+
+int DBObjectMap::filter_complete(Header header,
+				 set<string> *keys)
+{
+  KeyValueDB::Iterator iter = db->get_iterator(complete_prefix(header));
+  if (!iter)
+    return -EINVAL;
+  iter->seek_to_first();
+  // [begin, end) is the last region starting at or before *i, iter the
+  // region after it
+  bool have = false;
+  string begin, end;
+  for (set<string>::iterator i = keys->begin(); i != keys->end(); ) {
+    if (iter->valid() && iter->key() <= *i) {
+      for (unsigned steps = 0;
+	   steps < SCAN_MAX_NEXT && iter->valid() && iter->key() <= *i;
+	   ++steps) {
+	begin = iter->key();
+	end = string(iter->value().c_str());
+	iter->next();
+      }
+      if (iter->valid() && iter->key() <= *i) {
+	iter->upper_bound(*i);
+	if (iter->valid())
+	  iter->prev();
+	else
+	  iter->seek_to_last();
+	begin = iter->key();
+	end = string(iter->value().c_str());
+	iter->next();
+      }
+      if (iter->status())
+	return iter->status();
+      have = true;
+    }
+    if (have && *i >= begin && (!end.size() || *i < end))
+      keys->erase(i++);
+    else
+      ++i;
+  }
+  return 0;
+}
+
 int DBObjectMap::scan(Header header,
 		      const set<string> &in_keys,
 		      set<string> *out_keys,
 		      map<string, bufferlist> *out_values)
 {
-  ObjectMapIterator db_iter = _get_iterator(header);
-  for (set<string>::const_iterator key_iter = in_keys.begin();
-       key_iter != in_keys.end();
-       ++key_iter) {
-    db_iter->lower_bound(*key_iter);
-    if (db_iter->status())
-      return db_iter->status();
-    if (db_iter->valid() && db_iter->key() == *key_iter) {
-      if (out_keys)
-	out_keys->insert(*key_iter);
-      if (out_values)
-	out_values->insert(make_pair(db_iter->key(), db_iter->value()));
+  // Like an iterator, hold each ancestor until we're done
+  list<Header> ancestors;
+  set<string> to_find;
+  const set<string> *keys = &in_keys;
+  uint64_t shadowed = 0, inherited = 0;
+  int r = 0;
+  while (1) {
+    set<string> missing;
+    size_t found = out_keys ? out_keys->size() : out_values->size();
+    r = scan_header(header, *keys, out_keys, out_values, &missing);
+    if (r < 0)
+      break;
+    if (!ancestors.empty())
+      inherited += (out_keys ? out_keys->size() : out_values->size()) - found;
+    if (!header->parent || missing.empty())
+      break;
+    size_t looking = missing.size();
+    r = filter_complete(header, &missing);
+    if (r < 0)
+      break;
+    shadowed += looking - missing.size();
+    if (missing.empty())
+      break;
+    Header parent = lookup_parent(header);
+    if (!parent) {
+      r = -EINVAL;
+      break;
     }
+    ancestors.push_back(header);
+    header = parent;
+    to_find.swap(missing);
+    keys = &to_find;
   }
-  return 0;
+  if (!ancestors.empty())
+    note_lookup(ancestors.front()->hoid, ancestors.size(), shadowed, inherited);
+  return r;
 }
 
 int DBObjectMap::get_values(const hobject_t &hoid,
@@ -839,6 +986,35 @@ int DBObjectMap::check_keys(const hobject_t &hoid,
   return scan(header, keys, out, 0);
 }
 
+int DBObjectMap::get_vals_range(const hobject_t &hoid,
+				const string &start_after,
+				uint64_t max_bytes,
+				map<string, bufferlist> *out,
+				bool *more)
+{
+  *more = false;
+  Header header = lookup_map_header(hoid);
+  if (!header)
+    return -ENOENT;
+  ObjectMapIterator iter = _get_iterator(header);
+  uint64_t bytes = 0;
+  unsigned got = 0;
+  for (iter->upper_bound(start_after); iter->valid(); iter->next()) {
+    if (iter->status())
+      return iter->status();
+    string key = iter->key();
+    bufferlist value = iter->value();
+    if (got && bytes + key.size() + value.length() > max_bytes) {
+      *more = true;
+      break;
+    }
+    bytes += key.size() + value.length();
+    got++;
+    out->insert(make_pair(key, value));
+  }
+  return iter->status();
+}
+
 int DBObjectMap::get_xattrs(const hobject_t &hoid,
 			    const set<string> &to_get,
 			    map<string, bufferlist> *out)
@@ -899,6 +1075,10 @@ int DBObjectMap::clone(const hobject_t &hoid,
     return 0;
 
   KeyValueDB::Transaction t = db->get_transaction();
+  list<Header> held;
+  // Take hoid before target's ancestors, as flatten() takes an object
+  // before its ancestors
+  Header parent = lookup_map_header(hoid);
   {
     Header destination = lookup_map_header(target);
     if (destination) {
@@ -906,11 +1086,10 @@ int DBObjectMap::clone(const hobject_t &hoid,
       if (check_spos(target, destination, spos))
 	return 0;
       destination->num_children--;
-      _clear(destination, t);
+      _clear(destination, t, &held);
     }
   }
 
-  Header parent = lookup_map_header(hoid);
   if (!parent)
     return db->submit_transaction(t);
 
@@ -936,6 +1115,194 @@ int DBObjectMap::clone(const hobject_t &hoid,
   return db->submit_transaction(t);
 }
 
+DBObjectMap::~DBObjectMap()
+{
+  stop_flattener();
+}
+
+int DBObjectMap::flatten(const hobject_t &hoid, uint64_t max_keys)
+{
+  Header header;
+  {
+    Mutex::Locker l(header_lock);
+    utime_t until = ceph_clock_now(g_ceph_context);
+    until += FLATTEN_WAIT;
+    map_header_flatten_waiting.insert(hoid);
+    while (map_header_refs.count(hoid) || map_header_in_use.count(hoid)) {
+      if (map_header_cond.WaitUntil(header_lock, until) == ETIMEDOUT)
+	break;
+    }
+    map_header_flatten_waiting.erase(hoid);
+    if (map_header_refs.count(hoid) || map_header_in_use.count(hoid)) {
+      map_header_cond.SignalAll();
+      dout(10) << "flatten " << hoid << " busy" << dendl;
+      return -EBUSY;
+    }
+    header = _lookup_map_header(hoid);
+    if (!header) {
+      map_header_cond.SignalAll();
+      return -ENOENT;
+    }
+    map_header_in_use.insert(hoid);
+  }
+  if (!header->parent)
+    return 0;
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  KeyValueDB::Transaction t = db->get_transaction();
+  uint64_t copied = 0;
+  {
+    DBObjectMapIterator iter = _get_iterator(header);
+    iter->report = false;
+    map<string, bufferlist> to_write;
+    uint64_t seen = 0;
+    for (iter->seek_to_first(); iter->valid(); iter->next()) {
+      if (iter->status())
+	return iter->status();
+      if (max_keys && ++seen > max_keys) {
+	dout(10) << "flatten " << hoid << " has over " << max_keys
+		 << " keys, leaving it" << dendl;
+	return -E2BIG;
+      }
+      if (!iter->on_parent())
+	continue;
+      to_write.insert(make_pair(iter->key(), iter->value()));
+      if (to_write.size() >= FLATTEN_BATCH_KEYS) {
+	t->set(user_prefix(header), to_write);
+	copied += to_write.size();
+	to_write.clear();
+      }
+    }
+    if (iter->status())
+      return iter->status();
+    t->set(user_prefix(header), to_write);
+    copied += to_write.size();
+  }
+  int r = copy_up_header(header, t);
+  if (r < 0)
+    return r;
+  // parent and the ancestors _clear() updates stay in use until t is
+  // submitted, keeping clear() and rm_keys() on hoid's siblings from
+  // updating the same child counts meanwhile
+  list<Header> held;
+  Header parent = lookup_parent(header);
+  if (!parent)
+    return -EINVAL;
+  assert(parent->num_children > 0);
+  parent->num_children--;
+  r = _clear(parent, t, &held);
+  if (r < 0)
+    return r;
+  header->parent = 0;
+  set_map_header(hoid, *header, t);
+  t->rmkeys_by_prefix(complete_prefix(header));
+  r = db->submit_transaction(t);
+  if (r < 0)
+    return r;
+
+  dout(10) << "flatten " << hoid << " seq " << header->seq
+	   << " copied up " << copied << " keys" << dendl;
+  if (logger) {
+    logger->inc(l_os_omap_flatten);
+    logger->inc(l_os_omap_flatten_keys, copied);
+    logger->tinc(l_os_omap_flatten_lat, ceph_clock_now(g_ceph_context) - start);
+  }
+  return 0;
+}
+
+void DBObjectMap::start_flattener(unsigned depth, double shadow_ratio,
+				  uint64_t max_keys)
+{
+  Mutex::Locker l(flatten_lock);
+  flatten_depth = depth;
+  flatten_shadow_ratio = shadow_ratio;
+  flatten_max_keys = max_keys;
+  if (flatten_started || (!depth && shadow_ratio <= 0))
+    return;
+  flatten_stop = false;
+  flatten_started = true;
+  flatten_thread.create();
+}
+
+void DBObjectMap::stop_flattener()
+{
+  flatten_lock.Lock();
+  if (!flatten_started) {
+    flatten_lock.Unlock();
+    return;
+  }
+  flatten_stop = true;
+  flatten_cond.Signal();
+  flatten_lock.Unlock();
+  flatten_thread.join();
+
+  Mutex::Locker l(flatten_lock);
+  flatten_started = false;
+  flatten_queue.clear();
+  flatten_queued.clear();
+  flatten_skipped.clear();
+}
+
+void DBObjectMap::flatten_entry()
+{
+  flatten_lock.Lock();
+  while (!flatten_stop) {
+    if (flatten_queue.empty()) {
+      flatten_cond.Wait(flatten_lock);
+      continue;
+    }
+    hobject_t hoid = flatten_queue.front();
+    flatten_queue.pop_front();
+    flatten_queued.erase(hoid);
+    uint64_t max_keys = flatten_max_keys;
+    flatten_lock.Unlock();
+
+    int r = flatten(hoid, max_keys);
+    if (r < 0 && r != -ENOENT && r != -EBUSY && r != -E2BIG)
+      derr << "flatten " << hoid << " failed: " << cpp_strerror(r) << dendl;
+
+    flatten_lock.Lock();
+    if (r == -E2BIG) {
+      // don't scan it again for every lookup; forget them all now and
+      // then in case they shrink
+      if (flatten_skipped.size() >= FLATTEN_MAX_QUEUED)
+	flatten_skipped.clear();
+      flatten_skipped.insert(hoid);
+    }
+  }
+  flatten_lock.Unlock();
+}
+
+void DBObjectMap::note_lookup(const hobject_t &hoid, unsigned depth,
+			      uint64_t shadowed, uint64_t inherited)
+{
+  if (logger)
+    logger->inc(l_os_omap_chain_depth, depth);
+
+  Mutex::Locker l(flatten_lock);
+  if (!flatten_started || flatten_stop)
+    return;
+  bool deep = flatten_depth && depth >= flatten_depth;
+  uint64_t seen = shadowed + inherited;
+  bool shadowy = flatten_shadow_ratio > 0 && seen >= FLATTEN_MIN_ENTRIES &&
+    shadowed >= flatten_shadow_ratio * seen;
+  if (!deep && !shadowy)
+    return;
+  if (flatten_max_keys && inherited > flatten_max_keys)
+    return;
+  if (flatten_queued.count(hoid) || flatten_skipped.count(hoid) ||
+      flatten_queue.size() >= FLATTEN_MAX_QUEUED)
+    return;
+  dout(20) << "note_lookup " << hoid << " depth " << depth
+	   << " shadowed " << shadowed << "/" << seen << ", queueing flatten"
+	   << dendl;
+  flatten_queue.push_back(hoid);
+  flatten_queued.insert(hoid);
+  flatten_cond.Signal();
+  if (logger)
+    logger->inc(l_os_omap_flatten_queued);
+}
+
 int DBObjectMap::upgrade()
 {
   while (1) {
@@ -1072,8 +1439,12 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 
 DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
 {
-  while (map_header_in_use.count(hoid))
-    header_cond.Wait(header_lock);
+  // Let flatten() have hoid once it is idle, but don't block a thread that
+  // already holds it
+  while (map_header_in_use.count(hoid) ||
+	 (map_header_flatten_waiting.count(hoid) &&
+	  !map_header_refs.count(hoid)))
+    map_header_cond.Wait(header_lock);
 
   map<string, bufferlist> out;
   set<string> to_get;
@@ -1085,6 +1456,7 @@ DBObjectMap::Header DBObjectMap::_lookup_map_header(const hobject_t &hoid)
     return Header();
   
   Header ret(new _Header(), RemoveMapHeaderOnDelete(this, hoid));
+  map_header_refs[hoid]++;
   bufferlist::iterator iter = out.begin()->second.begin();
   ret->decode(iter);
   return ret;
@@ -3,6 +3,7 @@
 #define DBOBJECTMAP_DB_H
 
 #include "include/buffer.h"
+#include <list>
 #include <set>
 #include <map>
 #include <string>
@@ -16,6 +17,9 @@
 #include "osd/osd_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
+
+class PerfCounters;
 
 /**
  * DBObjectMap: Implements ObjectMap in terms of KeyValueDB
@@ -50,6 +54,11 @@
  * the complete set, we have to check the parent if we don't find it in the
  * key set.  During rm_keys, we copy keys from the parent and update the
  * complete set to reflect the change @see rm_keys.
+ *
+ * Each clone adds a level to the chain of the source object as well, so
+ * objects that are snapshotted often end up with long chains.  Lookups that
+ * walk a long chain, or skip mostly keys the object has overwritten or
+ * removed, queue the object to be flattened in the background @see flatten.
  */
 class DBObjectMap : public ObjectMap {
 public:
@@ -66,11 +75,26 @@ public:
    * Set of headers currently in use
    */
   set<uint64_t> in_use;
+  /// Objects held by flatten(), which has them to itself
   set<hobject_t> map_header_in_use;
+  /// Number of leaf Headers outstanding per object @see lookup_map_header
+  map<hobject_t, unsigned> map_header_refs;
+  /// Objects flatten() is waiting to get to itself
+  set<hobject_t> map_header_flatten_waiting;
+
+  /// Logger for chain depth and flatten counters, may be NULL
+  PerfCounters *logger;
 
   DBObjectMap(KeyValueDB *db) : db(db),
-				header_lock("DBOBjectMap")
+				header_lock("DBOBjectMap"),
+				logger(NULL),
+				flatten_lock("DBObjectMap::flatten_lock"),
+				flatten_depth(0), flatten_shadow_ratio(0),
+				flatten_max_keys(0),
+				flatten_started(false), flatten_stop(false),
+				flatten_thread(this)
     {}
+  ~DBObjectMap();
 
   int set_keys(
     const hobject_t &hoid,
@@ -123,6 +147,14 @@ public:
     set<string> *out
     );
 
+  int get_vals_range(
+    const hobject_t &hoid,
+    const string &start_after,
+    uint64_t max_bytes,
+    map<string, bufferlist> *out,
+    bool *more
+    );
+
   int get_xattrs(
     const hobject_t &hoid,
     const set<string> &to_get,
@@ -161,6 +193,31 @@ public:
   /// Consistency check, debug, there must be no parallel writes
   bool check(std::ostream &out);
 
+  /**
+   * Copy the keys hoid inherits from its ancestors into its own header
+   * and drop its parent, in one transaction
+   *
+   * hoid reads the same before and after, so this may run at any time;
+   * it waits for other users of hoid to finish first.
+   *
+   * Other users of hoid wait while flatten() copies, so max_keys
+   * bounds how long that may take.
+   *
+   * @param max_keys [in] give up on objects with more keys, 0 for no limit
+   * @return 0 on success, -EBUSY if hoid stayed in use, -E2BIG if it
+   * has more than max_keys keys, < 0 on error
+   */
+  int flatten(const hobject_t &hoid, uint64_t max_keys = 0);
+
+  /**
+   * Flatten objects in the background once a lookup walks a chain at
+   * least depth headers deep, or skips at least shadow_ratio of the
+   * inherited keys it passes over (0 disables either).  Objects with
+   * more than max_keys keys are left alone.
+   */
+  void start_flattener(unsigned depth, double shadow_ratio, uint64_t max_keys);
+  void stop_flattener();
+
   /// Ensure that all previous operations are durable
   int sync(const hobject_t *hoid=0, const SequencerPosition *spos=0);
 
@@ -320,8 +377,15 @@ private:
     /// past end
     bool invalid;
 
+    /// report chain stats on destruction @see note_lookup
+    bool report;
+    /// parent entries skipped because we override them, and returned
+    uint64_t shadowed, inherited;
+
     DBObjectMapIteratorImpl(DBObjectMap *map, Header header) :
-      map(map), header(header), r(0), ready(false), invalid(true) {}
+      map(map), header(header), r(0), ready(false), invalid(true),
+      report(true), shadowed(0), inherited(0) {}
+    ~DBObjectMapIteratorImpl();
     int seek_to_first();
     int seek_to_last();
     int upper_bound(const string &after);
@@ -407,15 +471,39 @@ private:
   /// Helpers
   int _get_header(Header header, bufferlist *bl);
 
-  /// Scan keys in header into out_keys and out_values (if nonnull)
+  /**
+   * Scan keys in header into out_keys and out_values (if nonnull)
+   *
+   * Makes one sorted pass over each header in the chain, passing on to the
+   * parent only the keys neither found in nor covered by the complete
+   * regions of its child.
+   */
   int scan(Header header,
 	   const set<string> &in_keys,
 	   set<string> *out_keys,
 	   map<string, bufferlist> *out_values);
 
-  /// Remove header and all related prefixes
+  /// Scan keys stored under header itself, adding the rest to missing
+  int scan_header(Header header,
+		  const set<string> &in_keys,
+		  set<string> *out_keys,
+		  map<string, bufferlist> *out_values,
+		  set<string> *missing);
+
+  /// Remove from keys those in a complete region of header
+  int filter_complete(Header header,
+		      set<string> *keys);
+
+  /**
+   * Remove header and all related prefixes
+   *
+   * The ancestors whose child counts are updated in t are added to held.
+   * Callers keep them until t is submitted, so that a concurrent flatten()
+   * can't read and update the same counts from under them.
+   */
   int _clear(Header header,
-	     KeyValueDB::Transaction t);
+	     KeyValueDB::Transaction t,
+	     list<Header> *held);
   /// Adds to t operations necessary to add new_complete to the complete set
   int merge_new_complete(Header header,
 			 const map<string, string> &new_complete,
@@ -437,6 +525,39 @@ private:
   void _set_header(Header header, const bufferlist &bl,
 		   KeyValueDB::Transaction t);
 
+  /// flatten
+  Mutex flatten_lock;
+  Cond flatten_cond;
+  unsigned flatten_depth;
+  double flatten_shadow_ratio;
+  uint64_t flatten_max_keys;
+  bool flatten_started, flatten_stop;
+  std::list<hobject_t> flatten_queue;
+  set<hobject_t> flatten_queued;
+  /// objects found to have more than flatten_max_keys keys
+  set<hobject_t> flatten_skipped;
+
+  struct FlattenThread : public Thread {
+    DBObjectMap *map;
+    FlattenThread(DBObjectMap *map) : map(map) {}
+    void *entry() {
+      map->flatten_entry();
+      return 0;
+    }
+  } flatten_thread;
+  void flatten_entry();
+
+  /**
+   * Account a lookup that went past hoid's own header, and queue hoid
+   * for flattening if it crosses the limits @see start_flattener
+   *
+   * @param depth [in] number of ancestors walked
+   * @param shadowed [in] inherited entries hidden by overwrites or removals
+   * @param inherited [in] inherited entries returned
+   */
+  void note_lookup(const hobject_t &hoid, unsigned depth,
+		   uint64_t shadowed, uint64_t inherited);
+
   /** 
    * Removes map header lock once Header is out of scope
    * @see lookup_map_header
@@ -449,8 +570,13 @@ private:
       db(db), obj(obj) {}
     void operator() (_Header *header) {
       Mutex::Locker l(db->header_lock);
-      db->map_header_in_use.erase(obj);
-      db->map_header_cond.Signal();
+      map<hobject_t, unsigned>::iterator p = db->map_header_refs.find(obj);
+      assert(p != db->map_header_refs.end());
+      if (--p->second == 0) {
+	db->map_header_refs.erase(p);
+	db->map_header_in_use.erase(obj);
+      }
+      db->map_header_cond.SignalAll();
       delete header;
     }
   };
@@ -468,7 +594,7 @@ private:
     void operator() (_Header *header) {
       Mutex::Locker l(db->header_lock);
       db->in_use.erase(header->seq);
-      db->header_cond.Signal();
+      db->header_cond.SignalAll();
       delete header;
     }
   };
@@ -0,0 +1,205 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "FDCache.h"
+#include "include/compat.h"
+
+FDCache::FDCache(size_t max_fds, size_t max_bytes)
+  : lock("FDCache::lock"),
+    max_fds(max_fds), max_bytes(max_bytes), bytes(0),
+    hits(0), misses(0), evictions(0)
+{}
+
+FDCache::~FDCache()
+{
+  clear_all();
+  assert(by_fd.empty());
+}
+
+void FDCache::_uncache(Entry *e)
+{
+  assert(e->cached);
+  map<coll_t, map<hobject_t, Entry*> >::iterator c = colls.find(e->cid);
+  assert(c != colls.end());
+  c->second.erase(e->oid);
+  if (c->second.empty())
+    colls.erase(c);
+  lru.erase(e->lru_pos);
+  bytes -= e->bytes;
+  e->cached = false;
+  if (e->refs == 0)
+    _release(e);
+}
+
+void FDCache::_release(Entry *e)
+{
+  assert(!e->cached && e->refs == 0);
+  by_fd.erase(e->fd);
+  TEMP_FAILURE_RETRY(::close(e->fd));
+  delete e;
+}
+
+void FDCache::_trim()
+{
+  while (!lru.empty() &&
+	 (lru.size() > max_fds || bytes > max_bytes)) {
+    evictions++;
+    _uncache(lru.back());
+  }
+}
+
+void FDCache::set_limits(size_t fds, size_t b)
+{
+  Mutex::Locker l(lock);
+  max_fds = fds;
+  max_bytes = b;
+  _trim();
+}
+
+int FDCache::lookup(const coll_t& cid, const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  Stats &s = stats[cid];
+  map<coll_t, map<hobject_t, Entry*> >::iterator c = colls.find(cid);
+  if (c != colls.end()) {
+    map<hobject_t, Entry*>::iterator p = c->second.find(oid);
+    if (p != c->second.end()) {
+      Entry *e = p->second;
+      e->refs++;
+      lru.splice(lru.begin(), lru, e->lru_pos);
+      hits++;
+      s.hits++;
+      return e->fd;
+    }
+  }
+  misses++;
+  s.misses++;
+  return -1;
+}
+
+int FDCache::add(const coll_t& cid, const hobject_t& oid, int fd)
+{
+  Mutex::Locker l(lock);
+  map<hobject_t, Entry*> &objs = colls[cid];
+  map<hobject_t, Entry*>::iterator p = objs.find(oid);
+  if (p != objs.end()) {
+    // lost a race with another opener; use theirs
+    TEMP_FAILURE_RETRY(::close(fd));
+    Entry *e = p->second;
+    e->refs++;
+    lru.splice(lru.begin(), lru, e->lru_pos);
+    return e->fd;
+  }
+
+  Entry *e = new Entry;
+  e->cid = cid;
+  e->oid = oid;
+  e->fd = fd;
+  e->refs = 1;
+  e->cached = true;
+  e->bytes = sizeof(Entry) + oid.oid.name.length() + oid.get_key().length() +
+    oid.nspace.length() + 128;  // map and list nodes
+  lru.push_front(e);
+  e->lru_pos = lru.begin();
+  objs[oid] = e;
+  assert(by_fd.count(fd) == 0);
+  by_fd[fd] = e;
+  bytes += e->bytes;
+  _trim();
+  return fd;
+}
+
+bool FDCache::put(int fd)
+{
+  Mutex::Locker l(lock);
+  map<int, Entry*>::iterator p = by_fd.find(fd);
+  if (p == by_fd.end())
+    return false;
+  Entry *e = p->second;
+  assert(e->refs > 0);
+  if (--e->refs == 0 && !e->cached)
+    _release(e);
+  return true;
+}
+
+void FDCache::clear(const coll_t& cid, const hobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  map<coll_t, map<hobject_t, Entry*> >::iterator c = colls.find(cid);
+  if (c == colls.end())
+    return;
+  map<hobject_t, Entry*>::iterator p = c->second.find(oid);
+  if (p != c->second.end())
+    _uncache(p->second);
+}
+
+void FDCache::clear_collection(const coll_t& cid)
+{
+  Mutex::Locker l(lock);
+  stats.erase(cid);
+  map<coll_t, map<hobject_t, Entry*> >::iterator c = colls.find(cid);
+  if (c == colls.end())
+    return;
+  // _uncache() erases the collection along with its last entry
+  size_t n = c->second.size();
+  while (n--)
+    _uncache(colls[cid].begin()->second);
+}
+
+void FDCache::clear_all()
+{
+  Mutex::Locker l(lock);
+  while (!lru.empty())
+    _uncache(lru.front());
+  stats.clear();
+}
+
+size_t FDCache::get_num_cached()
+{
+  Mutex::Locker l(lock);
+  return lru.size();
+}
+
+size_t FDCache::get_bytes()
+{
+  Mutex::Locker l(lock);
+  return bytes;
+}
+
+void FDCache::dump(Formatter *f)
+{
+  Mutex::Locker l(lock);
+  f->open_object_section("fd_cache");
+  f->dump_unsigned("max_fds", max_fds);
+  f->dump_unsigned("max_bytes", max_bytes);
+  f->dump_unsigned("cached", lru.size());
+  f->dump_unsigned("open", by_fd.size());
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("hits", hits);
+  f->dump_unsigned("misses", misses);
+  f->dump_unsigned("evictions", evictions);
+  f->open_array_section("collections");
+  for (map<coll_t, Stats>::iterator p = stats.begin(); p != stats.end(); ++p) {
+    f->open_object_section("collection");
+    f->dump_stream("cid") << p->first;
+    map<coll_t, map<hobject_t, Entry*> >::iterator c = colls.find(p->first);
+    f->dump_unsigned("cached", c == colls.end() ? 0 : c->second.size());
+    f->dump_unsigned("hits", p->second.hits);
+    f->dump_unsigned("misses", p->second.misses);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_FDCACHE_H
+#define CEPH_FDCACHE_H
+
+#include <list>
+#include <map>
+
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "osd/osd_types.h"
+#include "hobject.h"
+
+/**
+ * LRU cache of open object file descriptors
+ *
+ * Descriptors are handed out with a reference held; every fd returned by
+ * lookup() or add() must be given back with put().  An entry can be
+ * dropped from the cache (by clear(), clear_collection() or LRU trimming)
+ * while someone still holds it, in which case the descriptor is closed
+ * by the last put().
+ *
+ * Since an fd names an inode, not a path, cached entries survive the
+ * object file being renamed or linked elsewhere (e.g. a HashIndex
+ * directory split or collection_add).  They must be cleared whenever the
+ * (collection, object) name could come to refer to a different inode:
+ * when the object is unlinked, or the collection removed or renamed.
+ *
+ * Cached descriptors are shared between threads, so users must not rely
+ * on the file offset (use pread/pwrite).
+ */
+class FDCache {
+  struct Entry {
+    coll_t cid;
+    hobject_t oid;
+    int fd;
+    int refs;
+    bool cached;     ///< still findable in the cache
+    size_t bytes;    ///< our estimate of what the entry costs
+    std::list<Entry*>::iterator lru_pos;
+  };
+
+  struct Stats {
+    uint64_t hits, misses;
+    Stats() : hits(0), misses(0) {}
+  };
+
+  Mutex lock;
+  size_t max_fds, max_bytes;
+  size_t bytes;
+
+  map<coll_t, map<hobject_t, Entry*> > colls;
+  map<int, Entry*> by_fd;        ///< every descriptor we own, cached or not
+  std::list<Entry*> lru;         ///< idle and busy cached entries, hottest first
+  map<coll_t, Stats> stats;
+  uint64_t hits, misses, evictions;
+
+  void _uncache(Entry *e);
+  void _release(Entry *e);
+  void _trim();
+
+public:
+  FDCache(size_t max_fds, size_t max_bytes);
+  ~FDCache();
+
+  void set_limits(size_t max_fds, size_t max_bytes);
+  bool enabled() {
+    Mutex::Locker l(lock);
+    return max_fds > 0;
+  }
+
+  /**
+   * find an open fd for an object
+   *
+   * @return fd with a reference held, or -1 if not cached
+   */
+  int lookup(const coll_t& cid, const hobject_t& oid);
+
+  /**
+   * add a newly opened fd for an object
+   *
+   * The cache takes ownership of fd.  If someone else added the same
+   * object in the meantime, fd is closed and theirs is returned.
+   *
+   * @return fd to use, with a reference held
+   */
+  int add(const coll_t& cid, const hobject_t& oid, int fd);
+
+  /**
+   * drop a reference taken by lookup() or add()
+   *
+   * @return false if fd is not ours, in which case the caller closes it
+   */
+  bool put(int fd);
+
+  /// forget an object (it is about to be unlinked)
+  void clear(const coll_t& cid, const hobject_t& oid);
+  /// forget everything in a collection, including its stats
+  void clear_collection(const coll_t& cid);
+  /// forget everything
+  void clear_all();
+
+  size_t get_num_cached();
+  size_t get_bytes();
+  void dump(Formatter *f);
+};
+
+#endif
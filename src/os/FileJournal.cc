@@ -30,6 +30,7 @@
 #include <sys/mount.h>
 
 #include "common/blkdev.h"
+#include "common/lzf.h"
 
 
 #define dout_subsys ceph_subsys_journal
@@ -96,7 +97,9 @@ int FileJournal::_open(bool forwrite, bool create)
 
 #ifdef HAVE_LIBAIO
   aio_ctx = 0;
-  ret = io_setup(128, &aio_ctx);
+  // the inflight check happens before a write, and one write can queue
+  // up to two aios (a wrapped entry, or the header plus the entry)
+  ret = io_setup(MAX(128, g_conf->journal_aio_max_inflight + 2), &aio_ctx);
   if (ret < 0) {
     ret = errno;
     derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
@@ -379,6 +382,8 @@ int FileJournal::create()
   // write empty header
   header = header_t();
   header.flags = header_t::FLAG_CRC;  // enable crcs on any new journal.
+  if (g_conf->journal_compress)
+    header.flags |= header_t::FLAG_COMPRESS;
   header.fsid = fsid;
   header.max_size = max_size;
   header.block_size = block_size;
@@ -683,10 +688,17 @@ int FileJournal::read_header()
    * flag.  Probably around when we add the next flag we need to
    * remove this or else this (eventually old) code will clobber newer
    * code's flags.
+   *
+   * v3 headers always have their flags initialized, so the kludge
+   * only applies to older ones, and no v2 writer ever set
+   * FLAG_COMPRESS: in a v2 header that bit is garbage too.
    */
-  if (header.flags > 3) {
-    derr << "read_header appears to have gibberish flags; assuming 0" << dendl;
-    header.flags = 0;
+  if (header.version < 3) {
+    if (header.flags > 3) {
+      derr << "read_header appears to have gibberish flags; assuming 0" << dendl;
+      header.flags = 0;
+    }
+    header.flags &= ~(uint64_t)header_t::FLAG_COMPRESS;
   }
 
   print_header();
@@ -919,6 +931,145 @@ int FileJournal::prepare_single_write(bufferlist& bl, off64_t& queue_pos, uint64
   return 0;
 }
 
+/*
+ * Prefix an entry with a compress_header_t, compressing the payload if
+ * that saves at least an eighth of it.  Data alignment only means
+ * something for stored payloads, which shift by the prefix.
+ *
+ * The payload is compressed a segment at a time, so that an entry
+ * carrying large data buffers isn't copied into one contiguous buffer
+ * first.  Runs of small segments (the encoded ops between the data) are
+ * gathered into chunks of up to COMPRESS_CHUNK bytes.
+ */
+#define COMPRESS_CHUNK (64 << 10)
+
+void FileJournal::compress_chunk(const bufferptr& in, bufferlist& out)
+{
+  compress_chunk_t cc;
+  cc.raw_len = in.length();
+  bufferptr bp = buffer::create(in.length());
+  cc.len = ceph_lzf_compress(in.c_str(), in.length(), bp.c_str(), in.length() - 1);
+  if (!cc.len)
+    cc.len = cc.raw_len;  // doesn't compress; store it
+  out.append((const char *)&cc, sizeof(cc));
+  if (cc.len < cc.raw_len) {
+    bp.set_length(cc.len);
+    out.push_back(bp);
+  } else {
+    out.append(in);
+  }
+}
+
+void FileJournal::compress_entry(bufferlist& bl, int *alignment)
+{
+  compress_header_t ch;
+  ch.type = compress_header_t::STORED;
+  ch.raw_len = bl.length();
+
+  bufferlist out;
+  if (bl.length() >= (unsigned)g_conf->journal_compress_min_size) {
+    unsigned max = bl.length() - bl.length() / 8;
+    ch.type = compress_header_t::LZF_CHUNKS;
+    out.append((const char *)&ch, sizeof(ch));
+    bufferlist small;  // a run of small segments, compressed as one chunk
+    for (std::list<bufferptr>::const_iterator p = bl.buffers().begin();
+	 p != bl.buffers().end() && out.length() <= max;
+	 ++p) {
+      if (!p->length())
+	continue;
+      if (p->length() < COMPRESS_CHUNK) {
+	small.append(*p);
+	if (small.length() < COMPRESS_CHUNK)
+	  continue;
+      }
+      if (small.length()) {
+	small.rebuild();
+	compress_chunk(small.buffers().front(), out);
+	small.clear();
+      }
+      if (p->length() >= COMPRESS_CHUNK)
+	compress_chunk(*p, out);
+    }
+    if (small.length() && out.length() <= max) {
+      small.rebuild();
+      compress_chunk(small.buffers().front(), out);
+    }
+    if (out.length() <= max) {
+      dout(20) << "compress_entry " << ch.raw_len << " -> " << out.length() << dendl;
+      bl.swap(out);
+      *alignment = -1;
+      return;
+    }
+    ch.type = compress_header_t::STORED;
+    out.clear();
+  }
+
+  out.append((const char *)&ch, sizeof(ch));
+  out.claim_append(bl);
+  bl.swap(out);
+  if (*alignment >= 0)
+    *alignment = (*alignment - sizeof(ch)) & ~CEPH_PAGE_MASK;
+}
+
+/*
+ * Undo compress_entry().
+ *
+ * @return false if the payload is malformed
+ */
+bool FileJournal::decompress_entry(bufferlist& bl)
+{
+  compress_header_t ch;
+  if (bl.length() < sizeof(ch))
+    return false;
+  bl.copy(0, sizeof(ch), (char *)&ch);
+
+  bufferlist payload;
+  payload.substr_of(bl, sizeof(ch), bl.length() - sizeof(ch));
+  switch (ch.type) {
+  case compress_header_t::STORED:
+    if (payload.length() != ch.raw_len)
+      return false;
+    break;
+
+  case compress_header_t::LZF_CHUNKS:
+    {
+      bufferptr bp = buffer::create(ch.raw_len);
+      unsigned off = 0, pos = 0;
+      while (pos < payload.length()) {
+	compress_chunk_t cc;
+	if (payload.length() - pos < sizeof(cc))
+	  return false;
+	payload.copy(pos, sizeof(cc), (char *)&cc);
+	pos += sizeof(cc);
+	if (payload.length() - pos < cc.len ||
+	    ch.raw_len - off < cc.raw_len)
+	  return false;
+	if (cc.len == cc.raw_len) {
+	  payload.copy(pos, cc.len, bp.c_str() + off);
+	} else {
+	  bufferlist chunk;
+	  chunk.substr_of(payload, pos, cc.len);
+	  if (ceph_lzf_decompress(chunk.c_str(), cc.len, bp.c_str() + off,
+				  cc.raw_len) != cc.raw_len)
+	    return false;
+	}
+	pos += cc.len;
+	off += cc.raw_len;
+      }
+      if (off != ch.raw_len)
+	return false;
+      payload.clear();
+      payload.push_back(bp);
+    }
+    break;
+
+  default:
+    return false;
+  }
+  bl.swap(payload);
+  return true;
+}
+
 void FileJournal::align_bl(off64_t pos, bufferlist& bl)
 {
   // make sure list segments are page aligned
@@ -1050,6 +1201,7 @@ void FileJournal::do_write(bufferlist& bl)
 
   utime_t lat = ceph_clock_now(g_ceph_context) - from;    
   dout(20) << "do_write latency " << lat << dendl;
+  note_write_latency(lat);
 
   write_lock.Lock();    
 
@@ -1094,6 +1246,95 @@ void FileJournal::flush()
 }
 
 
+/*
+ * exponentially weighted so that a change in device behaviour (e.g.
+ * the disk cache filling up) is picked up within a few dozen writes.
+ * only one thread ever updates it (the writer in the sync path, the
+ * aio completion thread otherwise).
+ */
+void FileJournal::note_write_latency(utime_t lat)
+{
+  uint64_t us = lat.sec() * 1000000ull + lat.usec();
+  uint64_t avg = write_lat_us.read();
+  if (avg == 0)
+    avg = us;
+  else
+    avg = (avg * 7 + us) / 8;
+  write_lat_us.set(avg);
+}
+
+utime_t FileJournal::get_group_commit_window()
+{
+  double max = g_conf->journal_group_commit_max_wait;
+  if (max <= 0)
+    return utime_t();
+  double w = g_conf->journal_group_commit_latency_ratio *
+    (double)write_lat_us.read() / 1000000.0;
+  if (w > max)
+    w = max;
+  utime_t window;
+  window.set_from_double(w);
+  return window;
+}
+
+bool FileJournal::writeq_batch_full()
+{
+  assert(writeq_lock.is_locked());
+  if (g_conf->journal_max_write_entries &&
+      writeq.size() >= (unsigned)g_conf->journal_max_write_entries)
+    return true;
+  if (g_conf->journal_max_write_bytes) {
+    uint64_t bytes = 0;
+    for (deque<write_item>::iterator p = writeq.begin(); p != writeq.end(); ++p) {
+      bytes += p->bl.length();
+      if (bytes >= (uint64_t)g_conf->journal_max_write_bytes)
+	return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Hold a batch that is not yet full open for the group commit window,
+ * so that ops arriving just behind it share its write (and flush)
+ * instead of paying for their own.
+ */
+void FileJournal::wait_for_group_commit()
+{
+  utime_t window = get_group_commit_window();
+  if (window == utime_t())
+    return;
+
+  Mutex::Locker locker(writeq_lock);
+  if (writeq.empty() || writeq_batch_full())
+    return;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t until = start;
+  until += window;
+  dout(20) << "wait_for_group_commit holding " << writeq.size()
+	   << " entries for up to " << window << dendl;
+  while (!write_stop && !writeq_batch_full() &&
+	 ceph_clock_now(g_ceph_context) < until)
+    writeq_cond.WaitUntil(writeq_lock, until);
+  if (logger)
+    logger->tinc(l_os_j_gc_wait, ceph_clock_now(g_ceph_context) - start);
+}
+
+void FileJournal::log_batch(uint64_t ops)
+{
+  if (!logger)
+    return;
+  logger->inc(l_os_j_wr_ents, ops);
+  if (ops <= 1)
+    logger->inc(l_os_j_wr_batch_1);
+  else if (ops <= 4)
+    logger->inc(l_os_j_wr_batch_4);
+  else if (ops <= 16)
+    logger->inc(l_os_j_wr_batch_16);
+  else
+    logger->inc(l_os_j_wr_batch_big);
+}
+
 void FileJournal::write_thread_entry()
 {
   dout(10) << "write_thread_entry start" << dendl;
@@ -1113,6 +1354,14 @@ void FileJournal::write_thread_entry()
 #ifdef HAVE_LIBAIO
     if (aio) {
       Mutex::Locker locker(aio_lock);
+      // never have more than journal_aio_max_inflight aios queued
+      if (g_conf->journal_aio_max_inflight > 0 &&
+	  aio_num >= g_conf->journal_aio_max_inflight) {
+	dout(20) << "write_thread_entry " << aio_num << " aios in flight, waiting" << dendl;
+	aio_cond.Wait(aio_lock);
+	continue;
+      }
+
       // should we back off to limit aios in flight?  try to do this
       // adaptively so that we submit larger aios once we have lots of
       // them in flight.
@@ -1133,6 +1382,8 @@ void FileJournal::write_thread_entry()
     }
 #endif
 
+    wait_for_group_commit();
+
     Mutex::Locker locker(write_lock);
     uint64_t orig_ops = 0;
     uint64_t orig_bytes = 0;
@@ -1149,6 +1400,7 @@ void FileJournal::write_thread_entry()
 
     logger->inc(l_os_j_wr);
     logger->inc(l_os_j_wr_bytes, bl.length());
+    log_batch(orig_ops);
 
 #ifdef HAVE_LIBAIO
     if (aio)
@@ -1267,6 +1519,11 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
   aio_num++;
   aio_bytes += aio.len;
+  aio.start = ceph_clock_now(g_ceph_context);
+  if (logger) {
+    logger->set(l_os_j_aio_inflight, aio_num);
+    logger->set(l_os_j_aio_inflight_bytes, aio_bytes);
+  }
 
   iocb *piocb = &aio.iocb;
   int attempts = 10;
@@ -1305,8 +1562,8 @@ void FileJournal::write_finish_thread_entry()
     }
     
     dout(20) << "write_finish_thread_entry waiting for aio(s)" << dendl;
-    io_event event[16];
-    int r = io_getevents(aio_ctx, 1, 16, event, NULL);
+    io_event event[64];
+    int r = io_getevents(aio_ctx, 1, 64, event, NULL);
     if (r < 0) {
       if (r == -EINTR) {
 	dout(0) << "io_getevents got " << cpp_strerror(r) << dendl;
@@ -1318,6 +1575,7 @@ void FileJournal::write_finish_thread_entry()
     
     {
       Mutex::Locker locker(aio_lock);
+      utime_t now = ceph_clock_now(g_ceph_context);
       for (int i=0; i<r; i++) {
 	aio_info *ai = (aio_info *)event[i].obj;
 	if (event[i].res != ai->len) {
@@ -1328,6 +1586,9 @@ void FileJournal::write_finish_thread_entry()
 	dout(10) << "write_finish_thread_entry aio " << ai->off
 		 << "~" << ai->len << " done" << dendl;
 	ai->done = true;
+	note_write_latency(now - ai->start);
+	if (logger)
+	  log_aio_latency(now - ai->start);
       }
       check_aio_completion();
     }
@@ -1337,6 +1598,24 @@ void FileJournal::write_finish_thread_entry()
 }
 
 #ifdef HAVE_LIBAIO
+/**
+ * account one aio's submit-to-completion time, both in the running
+ * average and in a coarse log scale histogram.
+ */
+void FileJournal::log_aio_latency(utime_t lat)
+{
+  logger->tinc(l_os_j_aio_lat, lat);
+  double ms = (double)lat * 1000.0;
+  if (ms < 1.0)
+    logger->inc(l_os_j_aio_lat_1ms);
+  else if (ms < 10.0)
+    logger->inc(l_os_j_aio_lat_10ms);
+  else if (ms < 100.0)
+    logger->inc(l_os_j_aio_lat_100ms);
+  else
+    logger->inc(l_os_j_aio_lat_slow);
+}
+
 /**
  * check aio_wait for completed aio, and update state appropriately.
  */
@@ -1360,6 +1639,10 @@ void FileJournal::check_aio_completion()
     aio_bytes -= p->len;
     aio_queue.erase(p++);
   }
+  if (logger) {
+    logger->set(l_os_j_aio_inflight, aio_num);
+    logger->set(l_os_j_aio_inflight_bytes, aio_bytes);
+  }
 
   if (completed_something) {
     // kick finisher?  
@@ -1378,10 +1661,10 @@ void FileJournal::check_aio_completion()
 	queue_completions_thru(journaled_seq);
       }
     }
-
-    // maybe write queue was waiting for aio count to drop?
-    aio_cond.Signal();
   }
+
+  // maybe write queue was waiting for aio count to drop?
+  aio_cond.Signal();
 }
 #endif
 
@@ -1394,6 +1677,9 @@ void FileJournal::submit_entry(uint64_t seq, bufferlist& e, int alignment,
 	  << " (" << oncommit << ")" << dendl;
   assert(e.length() > 0);
 
+  if (header.flags & header_t::FLAG_COMPRESS)
+    compress_entry(e, &alignment);
+
   dout(30) << "XXX throttle take " << e.length() << dendl;
   throttle_ops.take(1);
   throttle_bytes.take(e.length());
@@ -1629,6 +1915,12 @@ bool FileJournal::read_entry(bufferlist& bl, uint64_t& seq)
     }
   }
 
+  if ((header.flags & header_t::FLAG_COMPRESS) &&
+      !decompress_entry(bl)) {
+    dout(2) << "read_entry " << read_pos << " : bad compressed payload" << dendl;
+    return false;
+  }
+
   // yay!
   dout(2) << "read_entry " << read_pos << " : seq " << h->seq
 	  << " " << h->len << " bytes"
@@ -24,6 +24,7 @@ using std::deque;
 #include "common/Mutex.h"
 #include "common/Thread.h"
 #include "common/Throttle.h"
+#include "include/atomic.h"
 
 #ifdef HAVE_LIBAIO
 # include <libaio.h>
@@ -100,8 +101,12 @@ public:
     enum {
       FLAG_CRC = (1<<0),
       // NOTE: remove kludgey weirdness in read_header() next time a flag is added.
+      FLAG_COMPRESS = (1<<1),  ///< (v3+) every entry payload starts with a compress_header_t
     };
+    /// follows the version of v4 headers, which only compressed journals use
+    static const __u32 INCOMPAT_MARKER = 0xffffffff;
 
+    __u32 version;      // encoding version; flags are only trustworthy from v3 on
     uint64_t flags;
     uuid_d fsid;
     __u32 block_size;
@@ -109,7 +114,7 @@ public:
     int64_t max_size;   // max size of journal ring buffer
     int64_t start;      // offset of first entry
 
-    header_t() : flags(0), block_size(0), alignment(0), max_size(0), start(0) {}
+    header_t() : version(3), flags(0), block_size(0), alignment(0), max_size(0), start(0) {}
 
     void clear() {
       start = block_size;
@@ -120,8 +125,21 @@ public:
     }
 
     void encode(bufferlist& bl) const {
-      __u32 v = 2;
-      ::encode(v, bl);
+      if (flags & FLAG_COMPRESS) {
+	/*
+	 * Code from before v3 decodes the embedded struct without looking
+	 * at the version or the flags, and would replay compressed entries
+	 * as transactions.  It takes the marker for the struct's length,
+	 * runs off the end of the header and refuses the journal instead.
+	 */
+	__u32 v = 4;
+	::encode(v, bl);
+	__u32 marker = INCOMPAT_MARKER;
+	::encode(marker, bl);
+      } else {
+	__u32 v = 3;
+	::encode(v, bl);
+      }
       bufferlist em;
       {
 	::encode(flags, em);
@@ -136,6 +154,7 @@ public:
     void decode(bufferlist::iterator& bl) {
       __u32 v;
       ::decode(v, bl);
+      version = v;
       if (v < 2) {  // normally 0, but concievably 1
 	// decode old header_t struct (pre v0.40).
 	bl.advance(4); // skip __u32 flags (it was unused by any old code)
@@ -150,6 +169,12 @@ public:
 	::decode(start, bl);
 	return;
       }
+      if (v >= 4) {
+	__u32 marker;
+	::decode(marker, bl);
+	if (marker != INCOMPAT_MARKER)
+	  throw buffer::malformed_input("bad journal header incompat marker");
+      }
       bufferlist em;
       ::decode(em, bl);
       bufferlist::iterator t = em.begin();
@@ -181,6 +206,29 @@ public:
     }
   } __attribute__((__packed__, aligned(4)));
 
+  /**
+   * In journals with FLAG_COMPRESS, prefixes each entry's payload (the
+   * part covered by entry_header_t::crc32c).
+   */
+  struct compress_header_t {
+    enum {
+      STORED = 0,  ///< payload follows as-is
+      // 1 is reserved
+      LZF_CHUNKS = 2,  ///< payload is a series of chunks
+    };
+    uint8_t type;
+    uint32_t raw_len;  ///< uncompressed payload length
+  } __attribute__((__packed__));
+
+  /**
+   * Prefixes each chunk of an LZF_CHUNKS payload.  A chunk is
+   * ceph_lzf_compress()ed unless len == raw_len, when it is stored.
+   */
+  struct compress_chunk_t {
+    uint32_t raw_len;
+    uint32_t len;
+  } __attribute__((__packed__));
+
 private:
   string fn;
 
@@ -204,6 +252,7 @@ private:
     bool done;
     uint64_t off, len;    ///< these are for debug only
     uint64_t seq;         ///< seq number to complete on aio completion, if non-zero
+    utime_t start;        ///< when it was submitted
 
     aio_info(bufferlist& b, uint64_t o, uint64_t s)
       : iov(NULL), done(false), off(o), len(b.length()), seq(s) {
@@ -255,6 +304,18 @@ private:
   Mutex write_lock;
   bool write_stop;
 
+  /*
+   * adaptive group commit: a small batch may be held open for a
+   * fraction of the device's observed write latency to let more
+   * entries join it.
+   */
+  atomic_t write_lat_us;  ///< smoothed journal write latency, usec
+  void note_write_latency(utime_t lat);
+  utime_t get_group_commit_window();
+  bool writeq_batch_full();
+  void wait_for_group_commit();
+  void log_batch(uint64_t ops);
+
   Cond commit_cond;
 
   int _open(bool wr, bool create=false);
@@ -277,10 +338,15 @@ private:
 
   void write_finish_thread_entry();
   void check_aio_completion();
+  void log_aio_latency(utime_t lat);
   void do_aio_write(bufferlist& bl);
   int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq);
 
 
+  void compress_entry(bufferlist& bl, int *alignment);
+  void compress_chunk(const bufferptr& in, bufferlist& out);
+  bool decompress_entry(bufferlist& bl);
+
   void align_bl(off64_t pos, bufferlist& bl);
   int write_bl(off64_t& pos, bufferlist& bl);
   void wrap_read_bl(off64_t& pos, int64_t len, bufferlist& bl);
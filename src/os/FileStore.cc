@@ -65,11 +65,13 @@
 #include "common/run_cmd.h"
 #include "common/safe_io.h"
 #include "common/perf_counters.h"
+#include "include/stringify.h"
+#include "common/admin_socket.h"
 #include "common/sync_filesystem.h"
 #include "common/fd.h"
 #include "HashIndex.h"
 #include "DBObjectMap.h"
-#include "LevelDBStore.h"
+#include "KeyValueDB.h"
 
 #include "common/ceph_crypto.h"
 using ceph::crypto::SHA1;
@@ -202,10 +204,26 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
 			Index *index) {
   Index index2;
   IndexedPath path2;
-  if (!path)
-    path = &path2;
   int fd, exist;
   int r = 0;
+
+  // Cached fds are opened read/write so that one descriptor serves every
+  // caller.  Callers that want the path or a truncate get a fresh open.
+  if (flags & O_TRUNC)
+    fdcache.clear(cid, oid);
+  bool use_cache = !path && !(flags & O_TRUNC) && fdcache.enabled();
+  if (use_cache) {
+    fd = fdcache.lookup(cid, oid);
+    if (fd >= 0) {
+      logger->inc(l_os_fdc_hit);
+      return fd;
+    }
+    logger->inc(l_os_fdc_miss);
+    flags = O_RDWR | (flags & O_CREAT);
+  }
+
+  if (!path)
+    path = &path2;
   if (!index) {
     index = &index2;
   }
@@ -234,6 +252,7 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
   fd = r;
 
   if ((flags & O_CREAT) && (!exist)) {
+    note_namespace_dirty();
     r = (*index)->created(oid, (*path)->path());
     if (r < 0) {
       TEMP_FAILURE_RETRY(::close(fd));
@@ -242,6 +261,10 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags, mode_t mode
       goto fail;
     }
   }
+  if (use_cache) {
+    fd = fdcache.add(cid, oid, fd);
+    logger->set(l_os_fdc_cached, fdcache.get_num_cached());
+  }
   return fd;
 
  fail:
@@ -266,7 +289,8 @@ int FileStore::lfn_open(coll_t cid, const hobject_t& oid, int flags)
 
 void FileStore::lfn_close(int fd)
 {
-  TEMP_FAILURE_RETRY(::close(fd));
+  if (!fdcache.put(fd))
+    TEMP_FAILURE_RETRY(::close(fd));
 }
 
 int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o) 
@@ -312,6 +336,7 @@ int FileStore::lfn_link(coll_t c, coll_t cid, const hobject_t& o)
   r = ::link(path_old->path(), path_new->path());
   if (r < 0)
     return -errno;
+  note_namespace_dirty();
 
   r = index_new->created(o, path_new->path());
   if (r < 0) {
@@ -358,6 +383,10 @@ int FileStore::lfn_unlink(coll_t cid, const hobject_t& o,
 	object_map->sync(&o, &spos);
     }
   }
+  // the name may be reused for a new inode
+  fdcache.clear(cid, o);
+  note_namespace_dirty();
+  attr_cache.invalidate(cid, o);
   return index->unlink(o);
 }
 
@@ -376,20 +405,30 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   fsid_fd(-1), op_fd(-1),
   basedir_fd(-1), current_fd(-1),
   index_manager(do_update),
+  index_observer(this),
+  fdcache(g_conf->filestore_fd_cache_size, g_conf->filestore_fd_cache_max_bytes),
+  fdcache_hook(NULL),
+  attr_cache(g_conf->filestore_attr_cache_max_bytes),
   ondisk_finisher(g_ceph_context),
   lock("FileStore::lock"),
   force_sync(false), sync_epoch(0),
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
   timer(g_ceph_context, sync_entry_timeo_lock),
   stop(false), sync_thread(this),
+  have_syncfs(false), commit_mode(COMMIT_SYNC),
+  dirty_lock("FileStore::dirty_lock"),
+  dirty_need_full_sync(true), dirty_bytes(0),
   default_osr("default"),
   op_queue_len(0), op_queue_bytes(0),
   op_throttle_lock("FileStore::op_throttle_lock"),
   op_finisher(g_ceph_context),
-  op_tp(g_ceph_context, "FileStore::op_tp", g_conf->filestore_op_threads, "filestore_op_threads"),
-  op_wq(this, g_conf->filestore_op_thread_timeout,
-	g_conf->filestore_op_thread_suicide_timeout, &op_tp),
-  flusher_queue_len(0), flusher_thread(this),
+  next_op_shard(0),
+  writeback(g_conf->filestore_flusher ? g_conf->filestore_writeback_start_bytes : 0,
+	    g_conf->filestore_writeback_target_bytes,
+	    g_conf->filestore_writeback_commit_bytes,
+	    g_conf->filestore_flusher_max_fds),
+  writeback_hook(NULL),
+  flusher_thread(this),
   logger(NULL),
   m_filestore_btrfs_clone_range(g_conf->filestore_btrfs_clone_range),
   m_filestore_btrfs_snap (g_conf->filestore_btrfs_snap ),
@@ -458,8 +497,60 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, const cha
   plb.add_time_avg(l_os_commit_len, "commitcycle_interval");
   plb.add_time_avg(l_os_commit_lat, "commitcycle_latency");
   plb.add_u64_counter(l_os_j_full, "journal_full");
+  plb.add_u64(l_os_j_aio_inflight, "journal_aio_inflight");
+  plb.add_u64(l_os_j_aio_inflight_bytes, "journal_aio_inflight_bytes");
+  plb.add_time_avg(l_os_j_aio_lat, "journal_aio_latency");
+  plb.add_u64_counter(l_os_j_aio_lat_1ms, "journal_aio_lat_under_1ms");
+  plb.add_u64_counter(l_os_j_aio_lat_10ms, "journal_aio_lat_under_10ms");
+  plb.add_u64_counter(l_os_j_aio_lat_100ms, "journal_aio_lat_under_100ms");
+  plb.add_u64_counter(l_os_j_aio_lat_slow, "journal_aio_lat_over_100ms");
+  plb.add_u64_avg(l_os_j_wr_ents, "journal_wr_entries");
+  plb.add_u64_counter(l_os_j_wr_batch_1, "journal_wr_batch_1");
+  plb.add_u64_counter(l_os_j_wr_batch_4, "journal_wr_batch_2_4");
+  plb.add_u64_counter(l_os_j_wr_batch_16, "journal_wr_batch_5_16");
+  plb.add_u64_counter(l_os_j_wr_batch_big, "journal_wr_batch_over_16");
+  plb.add_time_avg(l_os_j_gc_wait, "journal_group_commit_wait");
+  plb.add_u64_counter(l_os_fdc_hit, "fd_cache_hit");
+  plb.add_u64_counter(l_os_fdc_miss, "fd_cache_miss");
+  plb.add_u64(l_os_fdc_cached, "fd_cache_size");
+  plb.add_u64_counter(l_os_ac_hit, "attr_cache_hit");
+  plb.add_u64_counter(l_os_ac_miss, "attr_cache_miss");
+  plb.add_u64(l_os_ac_bytes, "attr_cache_bytes");
+  plb.add_u64_counter(l_os_commit_lat_10ms, "commitcycle_latency_under_10ms");
+  plb.add_u64_counter(l_os_commit_lat_100ms, "commitcycle_latency_under_100ms");
+  plb.add_u64_counter(l_os_commit_lat_1s, "commitcycle_latency_under_1s");
+  plb.add_u64_counter(l_os_commit_lat_slow, "commitcycle_latency_over_1s");
+  plb.add_time_avg(l_os_commit_syncfs_lat, "commitcycle_syncfs_latency");
+  plb.add_time_avg(l_os_commit_fd_lat, "commitcycle_fd_latency");
+  plb.add_time_avg(l_os_commit_sync_lat, "commitcycle_sync_latency");
+  plb.add_u64_counter(l_os_commit_fd_objects, "commitcycle_fd_objects");
+  plb.add_u64_counter(l_os_commit_fd_full, "commitcycle_fd_full_sync");
+  plb.add_u64_avg(l_os_commit_bytes, "commitcycle_bytes");
+  plb.add_u64_counter(l_os_commit_bytes_1m, "commitcycle_bytes_under_1m");
+  plb.add_u64_counter(l_os_commit_bytes_16m, "commitcycle_bytes_under_16m");
+  plb.add_u64_counter(l_os_commit_bytes_256m, "commitcycle_bytes_under_256m");
+  plb.add_u64_counter(l_os_commit_bytes_big, "commitcycle_bytes_over_256m");
+  plb.add_u64(l_os_wb_dirty, "dirty_bytes");
+  plb.add_u64_counter(l_os_wb_bytes, "writeback_bytes");
+  plb.add_u64_counter(l_os_wb_commits, "writeback_early_commits");
+  plb.add_u64_avg(l_os_omap_chain_depth, "omap_chain_depth");
+  plb.add_u64_counter(l_os_omap_flatten_queued, "omap_flatten_queued");
+  plb.add_u64_counter(l_os_omap_flatten, "omap_flatten");
+  plb.add_u64_counter(l_os_omap_flatten_keys, "omap_flatten_keys");
+  plb.add_time_avg(l_os_omap_flatten_lat, "omap_flatten_latency");
+  plb.add_u64_counter(l_os_split, "index_split");
+  plb.add_u64_counter(l_os_split_inline, "index_split_inline");
+  plb.add_time_avg(l_os_split_lat, "index_split_latency");
+  plb.add_u64_counter(l_os_merge, "index_merge");
+  plb.add_u64_counter(l_os_split_moved, "index_split_moved");
+  plb.add_u64_counter(l_os_lc_hit, "list_cache_hit");
+  plb.add_u64_counter(l_os_lc_miss, "list_cache_miss");
 
   logger = plb.create_perf_counters();
+
+  int nshards = MAX(1, g_conf->filestore_op_shards);
+  for (int i = 0; i < nshards; i++)
+    op_shards.push_back(new OpShard(this, i));
 }
 
 FileStore::~FileStore()
@@ -467,6 +558,8 @@ FileStore::~FileStore()
   if (journal)
     journal->logger = NULL;
   delete logger;
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    delete *p;
 
   if (m_filestore_do_dump) {
     dump_stop();
@@ -780,15 +873,22 @@ int FileStore::mkfs()
   }
 
   {
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::DB *db;
-    leveldb::Status status = leveldb::DB::Open(options, omap_dir, &db);
-    if (status.ok()) {
+    KeyValueDB *db = KeyValueDB::create(NULL, g_conf->filestore_omap_backend,
+					omap_dir);
+    stringstream err;
+    if (!db) {
+      derr << "mkfs: unknown filestore_omap_backend '"
+	   << g_conf->filestore_omap_backend << "'" << dendl;
+      ret = -EINVAL;
+      goto close_fsid_fd;
+    }
+    if (db->init(err) == 0) {
       delete db;
-      dout(1) << "leveldb db exists/created" << dendl;
+      dout(1) << g_conf->filestore_omap_backend << " db exists/created" << dendl;
     } else {
-      derr << "mkfs failed to create leveldb: " << status.ToString() << dendl;
+      delete db;
+      derr << "mkfs failed to create " << g_conf->filestore_omap_backend
+	   << ": " << err.str() << dendl;
       ret = -1;
       goto close_fsid_fd;
     }
@@ -1219,7 +1319,7 @@ int FileStore::_detect_fs()
     btrfs = false;
   }
 
-  bool have_syncfs = false;
+  have_syncfs = false;
 #ifdef HAVE_SYS_SYNCFS
   if (syncfs(fd) == 0) {
     dout(0) << "mount syncfs(2) syscall fully supported (by glibc and kernel)" << dendl;
@@ -1250,12 +1350,31 @@ int FileStore::_detect_fs()
       dout(0) << "mount no syncfs(2), but the btrfs SYNC ioctl will suffice" << dendl;
     } else if (m_filestore_fsync_flushes_journal_data) {
       dout(0) << "mount no syncfs(2), but 'filestore fsync flushes journal data = true', so fsync will suffice." << dendl;
-    } else {
+    } else if (g_conf->filestore_commit_mode == "sync") {
       dout(0) << "mount no syncfs(2), must use sync(2)." << dendl;
       dout(0) << "mount WARNING: multiple ceph-osd daemons on the same host will be slow" << dendl;
+    } else {
+      dout(0) << "mount no syncfs(2), will fsync changed objects and fall back to sync(2)" << dendl;
     }
   }
 
+  const string &mode = g_conf->filestore_commit_mode;
+  if (mode == "syncfs" && have_syncfs) {
+    commit_mode = COMMIT_SYNCFS;
+  } else if (mode == "fd") {
+    commit_mode = COMMIT_FD;
+  } else if (mode == "sync") {
+    commit_mode = COMMIT_SYNC;
+  } else {
+    if (mode != "auto" && mode != "syncfs")
+      derr << "mount unrecognized filestore_commit_mode '" << mode << "', using auto" << dendl;
+    commit_mode = have_syncfs ? COMMIT_SYNCFS : COMMIT_FD;
+  }
+  if (!btrfs && !m_filestore_fsync_flushes_journal_data)
+    dout(0) << "mount commit mode " << get_commit_mode_name(commit_mode) << dendl;
+  // we don't know what changed before we mounted
+  dirty_need_full_sync = true;
+
   TEMP_FAILURE_RETRY(::close(fd));
   return 0;
 }
@@ -1384,6 +1503,34 @@ int FileStore::write_op_seq(int fd, uint64_t seq)
   return ret;
 }
 
+class FDCacheSocketHook : public AdminSocketHook {
+  FDCache *fdcache;
+public:
+  FDCacheSocketHook(FDCache *c) : fdcache(c) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter f(true);
+    fdcache->dump(&f);
+    f.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class WritebackSocketHook : public AdminSocketHook {
+  WritebackController *writeback;
+public:
+  WritebackSocketHook(WritebackController *w) : writeback(w) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter f(true);
+    writeback->dump(&f);
+    f.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 int FileStore::mount() 
 {
   int ret;
@@ -1640,11 +1787,20 @@ int FileStore::mount()
   }
 
   {
-    LevelDBStore *omap_store = new LevelDBStore(omap_dir);
+    KeyValueDB *omap_store = KeyValueDB::create(g_ceph_context,
+						g_conf->filestore_omap_backend,
+						omap_dir);
+    if (!omap_store) {
+      derr << "unknown filestore_omap_backend '"
+	   << g_conf->filestore_omap_backend << "'" << dendl;
+      ret = -EINVAL;
+      goto close_current_fd;
+    }
     stringstream err;
     if (omap_store->init(err)) {
       delete omap_store;
-      derr << "Error initializing leveldb: " << err.str() << dendl;
+      derr << "Error initializing " << g_conf->filestore_omap_backend
+	   << ": " << err.str() << dendl;
       ret = -1;
       goto close_current_fd;
     }
@@ -1663,6 +1819,10 @@ int FileStore::mount()
       ret = -EINVAL;
       goto close_current_fd;
     }
+    dbomap->logger = logger;
+    dbomap->start_flattener(g_conf->filestore_omap_flatten_depth,
+			    g_conf->filestore_omap_flatten_shadow_ratio,
+			    g_conf->filestore_omap_flatten_max_keys);
     object_map.reset(dbomap);
   }
 
@@ -1728,6 +1888,7 @@ int FileStore::mount()
     }
   }
 
+  index_manager.start_splitter(&index_observer);
   sync_thread.create();
 
   ret = journal_replay(initial_op_seq);
@@ -1744,6 +1905,7 @@ int FileStore::mount()
     sync_cond.Signal();
     lock.Unlock();
     sync_thread.join();
+    index_manager.stop_splitter();
 
     goto close_current_fd;
   }
@@ -1759,7 +1921,8 @@ int FileStore::mount()
 
   journal_start();
 
-  op_tp.start();
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    (*p)->tp.start();
   flusher_thread.create();
   op_finisher.start();
   ondisk_finisher.start();
@@ -1767,9 +1930,29 @@ int FileStore::mount()
   timer.init();
 
   g_ceph_context->get_perfcounters_collection()->add(logger);
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    g_ceph_context->get_perfcounters_collection()->add((*p)->logger);
 
   g_ceph_context->_conf->add_observer(this);
 
+  fdcache_hook = new FDCacheSocketHook(&fdcache);
+  ret = g_ceph_context->get_admin_socket()->register_command(
+    "dump_fdcache", fdcache_hook, "show FileStore fd cache hit rates per collection");
+  if (ret < 0) {
+    // another FileStore in this process already has it
+    dout(1) << "mount failed to register dump_fdcache: " << cpp_strerror(ret) << dendl;
+    delete fdcache_hook;
+    fdcache_hook = NULL;
+  }
+  writeback_hook = new WritebackSocketHook(&writeback);
+  ret = g_ceph_context->get_admin_socket()->register_command(
+    "dump_writeback", writeback_hook, "show FileStore dirty data per collection");
+  if (ret < 0) {
+    dout(1) << "mount failed to register dump_writeback: " << cpp_strerror(ret) << dendl;
+    delete writeback_hook;
+    writeback_hook = NULL;
+  }
+
   // all okay.
   return 0;
 
@@ -1801,12 +1984,31 @@ int FileStore::umount()
   flusher_cond.Signal();
   lock.Unlock();
   sync_thread.join();
-  op_tp.stop();
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    (*p)->tp.stop();
   flusher_thread.join();
+  index_manager.stop_splitter();
 
   journal_stop();
 
+  if (fdcache_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("dump_fdcache");
+    delete fdcache_hook;
+    fdcache_hook = NULL;
+  }
+  if (writeback_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("dump_writeback");
+    delete writeback_hook;
+    writeback_hook = NULL;
+  }
+  fdcache.clear_all();
+  logger->set(l_os_fdc_cached, 0);
+  attr_cache.clear_all();
+  logger->set(l_os_ac_bytes, 0);
+
   g_ceph_context->get_perfcounters_collection()->remove(logger);
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    g_ceph_context->get_perfcounters_collection()->remove((*p)->logger);
 
   op_finisher.stop();
   ondisk_finisher.stop();
@@ -1901,7 +2103,7 @@ void FileStore::queue_op(OpSequencer *osr, Op *o)
 	  << " " << o->bytes << " bytes"
 	  << "   (queue has " << op_queue_len << " ops and " << op_queue_bytes << " bytes)"
 	  << dendl;
-  op_wq.queue(osr);
+  op_shards[osr->shard]->wq.queue(osr);
 }
 
 void FileStore::op_queue_reserve_throttle(Op *o)
@@ -1949,6 +2151,70 @@ void FileStore::op_queue_release_throttle(Op *o)
   logger->set(l_os_oq_bytes, op_queue_bytes);
 }
 
+FileStore::OpShard::OpShard(FileStore *fs, int i)
+  : tp(g_ceph_context, "FileStore::op_tp." + stringify(i),
+       g_conf->filestore_op_threads, "filestore_op_threads"),
+    wq(fs, this, g_conf->filestore_op_thread_timeout,
+       g_conf->filestore_op_thread_suicide_timeout, &tp)
+{
+  PerfCountersBuilder plb(g_ceph_context, fs->internal_name + "_shard" + stringify(i),
+			  l_os_shard_first, l_os_shard_last);
+  plb.add_u64(l_os_shard_qlen, "op_queue_ops");
+  plb.add_u64_counter(l_os_shard_ops, "ops");
+  plb.add_time_avg(l_os_shard_apply_lat, "apply_latency");
+  logger = plb.create_perf_counters();
+}
+
+FileStore::OpShard::~OpShard()
+{
+  delete logger;
+}
+
+bool FileStore::OpWQ::_enqueue(OpSequencer *osr)
+{
+  shard->queue.push_back(osr);
+  shard->logger->set(l_os_shard_qlen, shard->queue.size());
+  return true;
+}
+
+bool FileStore::OpWQ::_empty()
+{
+  return shard->queue.empty();
+}
+
+FileStore::OpSequencer *FileStore::OpWQ::_dequeue()
+{
+  // A sequencer is queued once per op.  If another thread is already
+  // applying one of its ops, leave the rest for later rather than
+  // blocking on its apply_lock.
+  for (deque<OpSequencer*>::iterator p = shard->queue.begin();
+       p != shard->queue.end();
+       ++p) {
+    OpSequencer *osr = *p;
+    if (osr->applying)
+      continue;
+    shard->queue.erase(p);
+    osr->applying = true;
+    shard->logger->set(l_os_shard_qlen, shard->queue.size());
+    return osr;
+  }
+  return NULL;
+}
+
+void FileStore::OpWQ::_process_finish(OpSequencer *osr)
+{
+  store->_finish_op(osr, shard);
+  osr->applying = false;
+  // a thread may have passed over this sequencer's next op
+  if (!shard->queue.empty())
+    _wake();
+}
+
+void FileStore::OpWQ::_clear()
+{
+  assert(shard->queue.empty());
+}
+
 void FileStore::_do_op(OpSequencer *osr)
 {
   osr->apply_lock.Lock();
@@ -1965,7 +2231,7 @@ void FileStore::_do_op(OpSequencer *osr)
   */
 }
 
-void FileStore::_finish_op(OpSequencer *osr)
+void FileStore::_finish_op(OpSequencer *osr, OpShard *shard)
 {
   Op *o = osr->dequeue();
   
@@ -1978,6 +2244,8 @@ void FileStore::_finish_op(OpSequencer *osr)
   utime_t lat = ceph_clock_now(g_ceph_context);
   lat -= o->start;
   logger->tinc(l_os_apply_lat, lat);
+  shard->logger->inc(l_os_shard_ops);
+  shard->logger->tinc(l_os_shard_apply_lat, lat);
 
   if (o->onreadable_sync) {
     o->onreadable_sync->finish(0);
@@ -2028,6 +2296,7 @@ int FileStore::queue_transactions(Sequencer *posr, list<Transaction*> &tls,
   } else {
     osr = new OpSequencer;
     osr->parent = posr;
+    osr->shard = next_op_shard.inc() % op_shards.size();
     posr->p = osr;
     dout(5) << "queue_transactions new " << *osr << "/" << osr->parent << dendl;
   }
@@ -2817,6 +3086,8 @@ int FileStore::_truncate(coll_t cid, const hobject_t& oid, uint64_t size)
 {
   dout(15) << "truncate " << cid << "/" << oid << " size " << size << dendl;
   int r = lfn_truncate(cid, oid, size);
+  if (r == 0)
+    note_dirty(cid, oid, 0, false);
   dout(10) << "truncate " << cid << "/" << oid << " size " << size << " = " << r << dendl;
   return r;
 }
@@ -2845,8 +3116,6 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
   dout(15) << "write " << cid << "/" << oid << " " << offset << "~" << len << dendl;
   int r;
 
-  int64_t actual;
-
   int flags = O_WRONLY|O_CREAT;
   int fd = lfn_open(cid, oid, flags, 0644);
   if (fd < 0) {
@@ -2856,38 +3125,20 @@ int FileStore::_write(coll_t cid, const hobject_t& oid,
     goto out;
   }
     
-  // seek
-  actual = ::lseek64(fd, offset, SEEK_SET);
-  if (actual < 0) {
-    r = -errno;
-    dout(0) << "write lseek64 to " << offset << " failed: " << cpp_strerror(r) << dendl;
-    lfn_close(fd);
-    goto out;
-  }
-  if (actual != (int64_t)offset) {
-    dout(0) << "write lseek64 to " << offset << " gave bad offset " << actual << dendl;
-    r = -EIO;
-    lfn_close(fd);
-    goto out;
-  }
-
   // write
-  r = bl.write_fd(fd);
-  if (r == 0)
+  r = bl.write_fd(fd, offset);
+  if (r == 0) {
     r = bl.length();
+    note_dirty(cid, oid, len, false);
+  }
+
+  if (r >= 0)
+    note_written(cid, oid, offset, len);
 
   // flush?
-  if ((ssize_t)len < m_filestore_flush_min ||
-#ifdef HAVE_SYNC_FILE_RANGE
-      !m_filestore_flusher || !queue_flusher(fd, offset, len)
-#else
-      true
-#endif
-      ) {
-    if (m_filestore_sync_flush)
-      ::sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
-    lfn_close(fd);
-  }
+  if ((ssize_t)len < m_filestore_flush_min && m_filestore_sync_flush)
+    ::sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+  lfn_close(fd);
 
  out:
   dout(10) << "write " << cid << "/" << oid << " " << offset << "~" << len << " = " << r << dendl;
@@ -2914,8 +3165,10 @@ int FileStore::_zero(coll_t cid, const hobject_t& oid, uint64_t offset, size_t l
     ret = -errno;
   lfn_close(fd);
 
-  if (ret == 0)
+  if (ret == 0) {
+    note_dirty(cid, oid, 0, false);
     goto out;  // yay!
+  }
   if (ret != -EOPNOTSUPP)
     goto out;  // some other error
 # endif
@@ -2991,6 +3244,8 @@ int FileStore::_clone(coll_t cid, const hobject_t& oldoid, const hobject_t& newo
  out:
   lfn_close(o);
  out2:
+  // the object map clone may have brought over xattrs too
+  attr_cache.invalidate(cid, newoid);
   dout(10) << "clone " << cid << "/" << oldoid << " -> " << cid << "/" << newoid << " = " << r << dendl;
   assert(!m_filestore_fail_eio || r != -EIO);
   return r;
@@ -3082,28 +3337,16 @@ int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, u
 {
   dout(20) << "_do_copy_range " << srcoff << "~" << len << " to " << dstoff << dendl;
   int r = 0;
-  int64_t actual;
 
-  actual = ::lseek64(from, srcoff, SEEK_SET);
-  if (actual != (int64_t)srcoff) {
-    r = errno;
-    derr << "lseek64 to " << srcoff << " got " << cpp_strerror(r) << dendl;
-    return r;
-  }
-  actual = ::lseek64(to, dstoff, SEEK_SET);
-  if (actual != (int64_t)dstoff) {
-    r = errno;
-    derr << "lseek64 to " << dstoff << " got " << cpp_strerror(r) << dendl;
-    return r;
-  }
-  
+  // from and to may be cached fds shared with other threads; don't
+  // touch their file offsets.
   loff_t pos = srcoff;
   loff_t end = srcoff + len;
   int buflen = 4096*32;
   char buf[buflen];
   while (pos < end) {
     int l = MIN(end-pos, buflen);
-    r = ::read(from, buf, l);
+    r = ::pread(from, buf, l, pos);
     dout(25) << "  read from " << pos << "~" << l << " got " << r << dendl;
     if (r < 0) {
       r = -errno;
@@ -3120,7 +3363,7 @@ int FileStore::_do_copy_range(int from, int to, uint64_t srcoff, uint64_t len, u
     }
     int op = 0;
     while (op < r) {
-      int r2 = safe_write(to, buf+op, r-op);
+      int r2 = safe_pwrite(to, buf+op, r-op, dstoff + (pos - srcoff) + op);
       dout(25) << " write to " << to << " len " << (r-op)
 	       << " got " << r2 << dendl;
       if (r2 < 0) {
@@ -3162,6 +3405,8 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
     goto out;
   }
   r = _do_clone_range(o, n, srcoff, len, dstoff);
+  if (r >= 0)
+    note_dirty(cid, newoid, len, false);
 
   // clone is non-idempotent; record our work.
   _set_replay_guard(n, spos, &newoid);
@@ -3176,65 +3421,51 @@ int FileStore::_clone_range(coll_t cid, const hobject_t& oldoid, const hobject_t
 }
 
 
-bool FileStore::queue_flusher(int fd, uint64_t off, uint64_t len)
+void FileStore::note_written(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len)
 {
-  bool queued;
-  lock.Lock();
-  if (flusher_queue_len < m_filestore_flusher_max_fds) {
-    flusher_queue.push_back(sync_epoch);
-    flusher_queue.push_back(fd);
-    flusher_queue.push_back(off);
-    flusher_queue.push_back(len);
-    flusher_queue_len++;
+  bool need_commit = false;
+  bool wake = writeback.dirtied(cid, oid, off, len, &need_commit);
+  logger->set(l_os_wb_dirty, writeback.get_dirty_bytes());
+  if (wake) {
+    Mutex::Locker l(lock);
     flusher_cond.Signal();
-    dout(10) << "queue_flusher ep " << sync_epoch << " fd " << fd << " " << off << "~" << len
-	     << " qlen " << flusher_queue_len
-	     << dendl;
-    queued = true;
-  } else {
-    dout(10) << "queue_flusher ep " << sync_epoch << " fd " << fd << " " << off << "~" << len
-	     << " qlen " << flusher_queue_len 
-	     << " hit flusher_max_fds " << m_filestore_flusher_max_fds
-	     << ", skipping async flush" << dendl;
-    queued = false;
   }
-  lock.Unlock();
-  return queued;
+  if (need_commit) {
+    dout(10) << "note_written bytes since last commit over filestore_writeback_commit_bytes, committing" << dendl;
+    logger->inc(l_os_wb_commits);
+    start_sync();
+  }
 }
 
+/*
+ * Write back the oldest pending extents once writeback says we have too
+ * much dirty data, so that the next commit has less to do.  Extents are
+ * named by object rather than fd; one unlinked since is simply skipped.
+ */
 void FileStore::flusher_entry()
 {
   lock.Lock();
   dout(20) << "flusher_entry start" << dendl;
   while (true) {
-    if (!flusher_queue.empty()) {
-#ifdef HAVE_SYNC_FILE_RANGE
-      list<uint64_t> q;
-      q.swap(flusher_queue);
-
-      int num = flusher_queue_len;  // see how many we're taking, here
-
+    if (!stop && writeback.should_flush()) {
       lock.Unlock();
-      while (!q.empty()) {
-	uint64_t ep = q.front();
-	q.pop_front();
-	int fd = q.front();
-	q.pop_front();
-	uint64_t off = q.front();
-	q.pop_front();
-	uint64_t len = q.front();
-	q.pop_front();
-	if (!stop && ep == sync_epoch) {
-	  dout(10) << "flusher_entry flushing+closing " << fd << " ep " << ep << dendl;
-	  ::sync_file_range(fd, off, len, SYNC_FILE_RANGE_WRITE);
-	} else 
-	  dout(10) << "flusher_entry JUST closing " << fd << " (stop=" << stop << ", ep=" << ep
-		   << ", sync_epoch=" << sync_epoch << ")" << dendl;
-	TEMP_FAILURE_RETRY(::close(fd));
+      WritebackController::Extent e;
+      while (!stop && writeback.get_next(&e)) {
+#ifdef HAVE_SYNC_FILE_RANGE
+	int fd = lfn_open(e.cid, e.oid, 0);
+	if (fd >= 0) {
+	  dout(10) << "flusher_entry flushing " << e.cid << "/" << e.oid
+		   << " " << e.off << "~" << e.len << dendl;
+	  ::sync_file_range(fd, e.off, e.len, SYNC_FILE_RANGE_WRITE);
+	  lfn_close(fd);
+	} else {
+	  dout(10) << "flusher_entry skipping " << e.cid << "/" << e.oid
+		   << ": " << cpp_strerror(fd) << dendl;
+	}
+#endif
+	logger->inc(l_os_wb_bytes, e.bytes);
       }
       lock.Lock();
-      flusher_queue_len -= num;   // they're definitely closed, forget
-#endif
     } else {
       if (stop)
 	break;
@@ -3267,6 +3498,122 @@ private:
   int m_commit_timeo;
 };
 
+const char *FileStore::get_commit_mode_name(int m)
+{
+  switch (m) {
+  case COMMIT_SYNCFS: return "syncfs";
+  case COMMIT_FD: return "fd";
+  case COMMIT_SYNC: return "sync";
+  default: return "???";
+  }
+}
+
+void FileStore::note_dirty(coll_t cid, const hobject_t& oid, uint64_t bytes, bool attrs)
+{
+  Mutex::Locker l(dirty_lock);
+  dirty_bytes += bytes;
+  if (commit_mode != COMMIT_FD || dirty_need_full_sync)
+    return;
+  if (dirty_objects.size() >= (unsigned)g_conf->filestore_commit_fd_max_objects) {
+    // opening them all would hold up ops longer than a syncfs takes
+    dirty_objects.clear();
+    dirty_need_full_sync = true;
+    return;
+  }
+  bool &a = dirty_objects[make_pair(cid, oid)];
+  a = a || attrs;
+}
+
+void FileStore::IndexObserver::index_moved(coll_t c, int objects)
+{
+  // the splitter renames files behind the op threads' backs
+  fs->note_namespace_dirty();
+  fs->logger->inc(l_os_split_moved, objects);
+}
+
+void FileStore::IndexObserver::index_finished(coll_t c, bool merge,
+					      bool inline_op, utime_t elapsed)
+{
+  if (merge) {
+    fs->logger->inc(l_os_merge);
+    return;
+  }
+  fs->logger->inc(inline_op ? l_os_split_inline : l_os_split);
+  fs->logger->tinc(l_os_split_lat, elapsed);
+}
+
+void FileStore::note_namespace_dirty()
+{
+  Mutex::Locker l(dirty_lock);
+  if (commit_mode != COMMIT_FD)
+    return;
+  dirty_objects.clear();
+  dirty_need_full_sync = true;
+}
+
+struct FsyncThread : public Thread {
+  const vector<int> &fds;
+  const vector<bool> &attrs;
+  unsigned first, step;
+  int r;
+  FsyncThread(const vector<int> &f, const vector<bool> &a, unsigned first, unsigned step)
+    : fds(f), attrs(a), first(first), step(step), r(0) {}
+  void *entry() {
+    for (unsigned i = first; i < fds.size() && r == 0; i += step) {
+      // attrs aren't needed to read the data back, so fdatasync may skip them
+      if (attrs[i])
+	r = ::fsync(fds[i]);
+      else
+	r = ::fdatasync(fds[i]);
+      if (r < 0)
+	r = -errno;
+    }
+    return 0;
+  }
+};
+
+/*
+ * Make everything up to the committing op_seq stable by syncing only the
+ * objects that changed since the last commit, fds[i] with fsync if
+ * attrs[i] else fdatasync, spread over filestore_commit_fd_threads
+ * threads.  Only valid if no names were created or removed.
+ */
+int FileStore::_commit_fds(const vector<int>& fds, const vector<bool>& attrs)
+{
+  int r = object_map->sync();
+  if (r < 0) {
+    derr << "_commit_fds object_map sync got " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  unsigned n = MAX(1, MIN((unsigned)g_conf->filestore_commit_fd_threads,
+			  fds.size()));
+  vector<FsyncThread*> threads;
+  for (unsigned i = 0; i < n; i++) {
+    threads.push_back(new FsyncThread(fds, attrs, i, n));
+    if (i + 1 < n)
+      threads.back()->create();
+  }
+  threads.back()->entry();  // do a share ourselves
+  for (unsigned i = 0; i < n; i++) {
+    if (i + 1 < n)
+      threads[i]->join();
+    if (threads[i]->r < 0 && r == 0)
+      r = threads[i]->r;
+    delete threads[i];
+  }
+  if (r < 0) {
+    derr << "_commit_fds object sync got " << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  if (::fsync(op_fd) < 0) {
+    r = -errno;
+    derr << "_commit_fds fsync " << current_op_seq_fn << " got " << cpp_strerror(r) << dendl;
+  }
+  return r;
+}
+
 void FileStore::sync_entry()
 {
   lock.Lock();
@@ -3320,6 +3667,7 @@ void FileStore::sync_entry()
 
       // make flusher stop flushing previously queued stuff
       sync_epoch++;
+      writeback.commit_start();
 
       dout(15) << "sync_entry committing " << cp << " sync_epoch " << sync_epoch << dendl;
       int err = write_op_seq(op_fd, cp);
@@ -3333,6 +3681,20 @@ void FileStore::sync_entry()
 	assert(0);
       }
 
+      // ops are blocked, so this is exactly what the commit covers
+      int mode = commit_mode;
+      uint64_t bytes;
+      bool full;
+      map<pair<coll_t, hobject_t>, bool> objects;
+      {
+	Mutex::Locker l(dirty_lock);
+	objects.swap(dirty_objects);
+	full = dirty_need_full_sync;
+	dirty_need_full_sync = false;
+	bytes = dirty_bytes;
+	dirty_bytes = 0;
+      }
+
       if (btrfs_stable_commits) {
 
 	if (btrfs_snap_create_v2) {
@@ -3391,6 +3753,32 @@ void FileStore::sync_entry()
 	}
       } else
       {
+	// pin the objects before ops can unlink them again
+	vector<int> fds;
+	vector<bool> attrs;
+	if (!btrfs && !m_filestore_fsync_flushes_journal_data && mode == COMMIT_FD) {
+	  for (map<pair<coll_t, hobject_t>, bool>::iterator p = objects.begin();
+	       !full && p != objects.end();
+	       ++p) {
+	    int fd = lfn_open(p->first.first, p->first.second, 0);
+	    if (fd < 0) {
+	      dout(0) << "sync_entry could not open " << p->first.first << "/" << p->first.second
+		      << ": " << cpp_strerror(fd) << ", doing a full sync" << dendl;
+	      full = true;
+	      break;
+	    }
+	    fds.push_back(fd);
+	    attrs.push_back(p->second);
+	  }
+	  if (full) {
+	    for (vector<int>::iterator p = fds.begin(); p != fds.end(); ++p)
+	      lfn_close(*p);
+	    fds.clear();
+	    mode = have_syncfs ? COMMIT_SYNCFS : COMMIT_SYNC;
+	    logger->inc(l_os_commit_fd_full);
+	  }
+	}
+
 	apply_manager.commit_started();
 
 	if (btrfs) {
@@ -3408,9 +3796,29 @@ void FileStore::sync_entry()
 	  // make the file system's journal commit.
 	  //  this works with ext3, but NOT ext4
 	  ::fsync(op_fd);  
-	} else {
+	} else if (mode == COMMIT_FD) {
+	  dout(15) << "sync_entry syncing " << fds.size() << " objects" << dendl;
+	  int r = _commit_fds(fds, attrs);
+	  if (r < 0)
+	    assert(0 == "sync_entry object sync returned error");
+	  for (vector<int>::iterator p = fds.begin(); p != fds.end(); ++p)
+	    lfn_close(*p);
+	  logger->inc(l_os_commit_fd_objects, fds.size());
+	} else if (mode == COMMIT_SYNCFS) {
 	  dout(15) << "sync_entry doing a full sync (syncfs(2) if possible)" << dendl;
 	  sync_filesystem(basedir_fd);
+	} else {
+	  dout(15) << "sync_entry doing a full sync(2)" << dendl;
+	  ::sync();
+	}
+
+	if (!btrfs && !m_filestore_fsync_flushes_journal_data) {
+	  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+	  switch (mode) {
+	  case COMMIT_SYNCFS: logger->tinc(l_os_commit_syncfs_lat, lat); break;
+	  case COMMIT_FD: logger->tinc(l_os_commit_fd_lat, lat); break;
+	  case COMMIT_SYNC: logger->tinc(l_os_commit_sync_lat, lat); break;
+	  }
 	}
       }
       
@@ -3422,8 +3830,28 @@ void FileStore::sync_entry()
       logger->inc(l_os_commit);
       logger->tinc(l_os_commit_lat, lat);
       logger->tinc(l_os_commit_len, dur);
+      double ms = (double)lat * 1000.0;
+      if (ms < 10.0)
+	logger->inc(l_os_commit_lat_10ms);
+      else if (ms < 100.0)
+	logger->inc(l_os_commit_lat_100ms);
+      else if (ms < 1000.0)
+	logger->inc(l_os_commit_lat_1s);
+      else
+	logger->inc(l_os_commit_lat_slow);
+      logger->inc(l_os_commit_bytes, bytes);
+      if (bytes < (1 << 20))
+	logger->inc(l_os_commit_bytes_1m);
+      else if (bytes < (16 << 20))
+	logger->inc(l_os_commit_bytes_16m);
+      else if (bytes < (256 << 20))
+	logger->inc(l_os_commit_bytes_256m);
+      else
+	logger->inc(l_os_commit_bytes_big);
 
       apply_manager.commit_finish();
+      writeback.commit_finish();
+      logger->set(l_os_wb_dirty, writeback.get_dirty_bytes());
 
       logger->set(l_os_committing, 0);
 
@@ -3513,8 +3941,9 @@ void FileStore::sync()
 
 void FileStore::_flush_op_queue()
 {
-  dout(10) << "_flush_op_queue draining op tp" << dendl;
-  op_wq.drain();
+  dout(10) << "_flush_op_queue draining op shards" << dendl;
+  for (vector<OpShard*>::iterator p = op_shards.begin(); p != op_shards.end(); ++p)
+    (*p)->wq.drain();
   dout(10) << "_flush_op_queue waiting for apply finisher" << dendl;
   op_finisher.wait_for_empty();
 }
@@ -3671,41 +4100,109 @@ int FileStore::_fgetattrs(int fd, map<string,bufferptr>& aset, bool user_only)
 
 // objects
 
-int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr &bp)
+/*
+ * Read every attr of an object, inline and (with filestore_xattr_use_omap)
+ * in the object map, keyed by the names the caller set them with, and
+ * offer the result to attr_cache.
+ */
+int FileStore::_load_attrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& aset)
 {
-  dout(15) << "getattr " << cid << "/" << oid << " '" << name << "'" << dendl;
-  int r;
+  uint64_t token = attr_cache.begin_load(oid);
   int fd = lfn_open(cid, oid, 0);
-  if (fd < 0) {
-    r = -errno;
-    goto out;
-  }
-  char n[CHAIN_XATTR_MAX_NAME_LEN];
-  get_attrname(name, n, CHAIN_XATTR_MAX_NAME_LEN);
-  r = _fgetattr(fd, n, bp);
+  if (fd < 0)
+    return -errno;
+  int r = _fgetattrs(fd, aset, false);
   lfn_close(fd);
-  if (r == -ENODATA && g_conf->filestore_xattr_use_omap) {
-    map<string, bufferlist> got;
-    set<string> to_get;
-    to_get.insert(string(name));
+  if (r < 0)
+    return r;
+  if (g_conf->filestore_xattr_use_omap) {
+    set<string> omap_attrs;
+    map<string, bufferlist> omap_aset;
     Index index;
     r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
-      goto out;
+      return r;
+    }
+    r = object_map->get_all_xattrs(oid, &omap_attrs);
+    if (r < 0 && r != -ENOENT) {
+      dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+      return r;
     }
-    r = object_map->get_xattrs(oid, to_get, &got);
+    r = object_map->get_xattrs(oid, omap_attrs, &omap_aset);
     if (r < 0 && r != -ENOENT) {
-      dout(10) << __func__ << " get_xattrs err r =" << r << dendl;
+      dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+      return r;
+    }
+    for (map<string, bufferlist>::iterator i = omap_aset.begin();
+	 i != omap_aset.end();
+	 ++i)
+      aset.insert(make_pair(i->first,
+			    bufferptr(i->second.c_str(), i->second.length())));
+  }
+  attr_cache.finish_load(cid, oid, aset, token);
+  logger->set(l_os_ac_bytes, attr_cache.get_bytes());
+  return 0;
+}
+
+int FileStore::getattr(coll_t cid, const hobject_t& oid, const char *name, bufferptr &bp)
+{
+  dout(15) << "getattr " << cid << "/" << oid << " '" << name << "'" << dendl;
+  int r;
+  if (attr_cache.enabled()) {
+    bool exists;
+    if (attr_cache.lookup(cid, oid, name, &bp, &exists)) {
+      logger->inc(l_os_ac_hit);
+      r = exists ? bp.length() : -ENODATA;
       goto out;
     }
-    if (!got.size()) {
-      dout(10) << __func__ << " got.size() is 0" << dendl;
-      return -ENODATA;
+    logger->inc(l_os_ac_miss);
+    map<string,bufferptr> all;
+    r = _load_attrs(cid, oid, all);
+    if (r < 0)
+      goto out;
+    map<string,bufferptr>::iterator p = all.find(name);
+    if (p == all.end()) {
+      r = -ENODATA;
+    } else {
+      bp = p->second;
+      r = bp.length();
+    }
+    goto out;
+  }
+  {
+    int fd = lfn_open(cid, oid, 0);
+    if (fd < 0) {
+      r = -errno;
+      goto out;
+    }
+    char n[CHAIN_XATTR_MAX_NAME_LEN];
+    get_attrname(name, n, CHAIN_XATTR_MAX_NAME_LEN);
+    r = _fgetattr(fd, n, bp);
+    lfn_close(fd);
+    if (r == -ENODATA && g_conf->filestore_xattr_use_omap) {
+      map<string, bufferlist> got;
+      set<string> to_get;
+      to_get.insert(string(name));
+      Index index;
+      r = get_index(cid, &index);
+      if (r < 0) {
+	dout(10) << __func__ << " could not get index r = " << r << dendl;
+	goto out;
+      }
+      r = object_map->get_xattrs(oid, to_get, &got);
+      if (r < 0 && r != -ENOENT) {
+	dout(10) << __func__ << " get_xattrs err r =" << r << dendl;
+	goto out;
+      }
+      if (!got.size()) {
+	dout(10) << __func__ << " got.size() is 0" << dendl;
+	return -ENODATA;
+      }
+      bp = bufferptr(got.begin()->second.c_str(),
+		     got.begin()->second.length());
+      r = 0;
     }
-    bp = bufferptr(got.begin()->second.c_str(),
-		   got.begin()->second.length());
-    r = 0;
   }
  out:
   dout(10) << "getattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
@@ -3717,48 +4214,69 @@ int FileStore::getattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>&
 {
   dout(15) << "getattrs " << cid << "/" << oid << dendl;
   int r;
-  int fd = lfn_open(cid, oid, 0);
-  if (fd < 0) {
-    r = -errno;
-    goto out;
-  }
-  r = _fgetattrs(fd, aset, user_only);
-  lfn_close(fd);
-  if (g_conf->filestore_xattr_use_omap) {
-    set<string> omap_attrs;
-    map<string, bufferlist> omap_aset;
-    Index index;
-    int r = get_index(cid, &index);
-    if (r < 0) {
-      dout(10) << __func__ << " could not get index r = " << r << dendl;
-      goto out;
+  if (attr_cache.enabled()) {
+    map<string,bufferptr> all;
+    if (attr_cache.lookup(cid, oid, &all)) {
+      logger->inc(l_os_ac_hit);
+    } else {
+      logger->inc(l_os_ac_miss);
+      r = _load_attrs(cid, oid, all);
+      if (r < 0)
+	goto out;
     }
-    r = object_map->get_all_xattrs(oid, &omap_attrs);
-    if (r < 0 && r != -ENOENT) {
-      dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
-      goto out;
+    for (map<string,bufferptr>::iterator p = all.begin(); p != all.end(); ++p) {
+      if (!user_only)
+	aset.insert(*p);
+      else if (p->first.length() > 1 && p->first[0] == '_')
+	aset.insert(make_pair(p->first.substr(1), p->second));
     }
-    r = object_map->get_xattrs(oid, omap_attrs, &omap_aset);
-    if (r < 0 && r != -ENOENT) {
-      dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+    r = 0;
+    goto out;
+  }
+  {
+    int fd = lfn_open(cid, oid, 0);
+    if (fd < 0) {
+      r = -errno;
       goto out;
     }
-    assert(omap_attrs.size() == omap_aset.size());
-    for (map<string, bufferlist>::iterator i = omap_aset.begin();
-	 i != omap_aset.end();
-	 ++i) {
-      string key;
-      if (user_only) {
-	if (i->first[0] != '_')
-	  continue;
-	if (i->first == "_")
-	  continue;
-	key = i->first.substr(1, i->first.size());
-      } else {
-	key = i->first;
+    r = _fgetattrs(fd, aset, user_only);
+    lfn_close(fd);
+    if (g_conf->filestore_xattr_use_omap) {
+      set<string> omap_attrs;
+      map<string, bufferlist> omap_aset;
+      Index index;
+      int r = get_index(cid, &index);
+      if (r < 0) {
+	dout(10) << __func__ << " could not get index r = " << r << dendl;
+	goto out;
+      }
+      r = object_map->get_all_xattrs(oid, &omap_attrs);
+      if (r < 0 && r != -ENOENT) {
+	dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+	goto out;
+      }
+      r = object_map->get_xattrs(oid, omap_attrs, &omap_aset);
+      if (r < 0 && r != -ENOENT) {
+	dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
+	goto out;
+      }
+      assert(omap_attrs.size() == omap_aset.size());
+      for (map<string, bufferlist>::iterator i = omap_aset.begin();
+	   i != omap_aset.end();
+	   ++i) {
+	string key;
+	if (user_only) {
+	  if (i->first[0] != '_')
+	    continue;
+	  if (i->first == "_")
+	    continue;
+	  key = i->first.substr(1, i->first.size());
+	} else {
+	  key = i->first;
+	}
+	aset.insert(make_pair(key,
+			      bufferptr(i->second.c_str(), i->second.length())));
       }
-      aset.insert(make_pair(key,
-			    bufferptr(i->second.c_str(), i->second.length())));
     }
   }
  out:
@@ -3830,9 +4348,9 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
     }
   }
 
-  if (g_conf->filestore_xattr_use_omap) {
+  if (r >= 0 && g_conf->filestore_xattr_use_omap) {
     Index index;
-    int r = get_index(cid, &index);
+    r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
       goto out_close;
@@ -3852,6 +4370,13 @@ int FileStore::_setattrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>
   }
  out_close:
   lfn_close(fd);
+  if (r < 0) {
+    attr_cache.invalidate(cid, oid);
+  } else {
+    attr_cache.set(cid, oid, aset);
+    note_dirty(cid, oid, 0, true);
+  }
+  logger->set(l_os_ac_bytes, attr_cache.get_bytes());
  out:
   dout(10) << "setattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
@@ -3889,6 +4414,12 @@ int FileStore::_rmattr(coll_t cid, const hobject_t& oid, const char *name,
   }
  out_close:
   lfn_close(fd);
+  if (r < 0) {
+    attr_cache.invalidate(cid, oid);
+  } else {
+    attr_cache.rm(cid, oid, name);
+    note_dirty(cid, oid, 0, true);
+  }
  out:
   dout(10) << "rmattr " << cid << "/" << oid << " '" << name << "' = " << r << dendl;
   return r;
@@ -3924,21 +4455,24 @@ int FileStore::_rmattrs(coll_t cid, const hobject_t& oid,
     r = get_index(cid, &index);
     if (r < 0) {
       dout(10) << __func__ << " could not get index r = " << r << dendl;
-      return r;
+      goto out;
     }
     r = object_map->get_all_xattrs(oid, &omap_attrs);
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not get omap_attrs r = " << r << dendl;
       assert(!m_filestore_fail_eio || r != -EIO);
-      return r;
+      goto out;
     }
     r = object_map->remove_xattrs(oid, omap_attrs, &spos);
     if (r < 0 && r != -ENOENT) {
       dout(10) << __func__ << " could not remove omap_attrs r = " << r << dendl;
-      return r;
+      goto out;
     }
   }
  out:
+  // rare enough that we needn't track partial failure
+  attr_cache.invalidate(cid, oid);
+  note_dirty(cid, oid, 0, true);
   dout(10) << "rmattrs " << cid << "/" << oid << " = " << r << dendl;
   return r;
 }
@@ -4028,6 +4562,7 @@ int FileStore::_collection_setattr(coll_t c, const char *name,
   get_attrname(name, n, PATH_MAX);
   r = chain_fsetxattr(fd, n, value, size);
   TEMP_FAILURE_RETRY(::close(fd));
+  note_namespace_dirty();  // the collection's attrs live on its directory
  out:
   dout(10) << "collection_setattr " << fn << " '" << name << "' len " << size << " = " << r << dendl;
   return r;
@@ -4048,6 +4583,7 @@ int FileStore::_collection_rmattr(coll_t c, const char *name)
   }
   r = chain_fremovexattr(fd, n);
   TEMP_FAILURE_RETRY(::close(fd));
+  note_namespace_dirty();  // the collection's attrs live on its directory
  out:
   dout(10) << "collection_rmattr " << fn << " = " << r << dendl;
   return r;
@@ -4075,6 +4611,7 @@ int FileStore::_collection_setattrs(coll_t cid, map<string,bufferptr>& aset)
       break;
   }
   TEMP_FAILURE_RETRY(::close(fd));
+  note_namespace_dirty();  // the collection's attrs live on its directory
  out:
   dout(10) << "collection_setattrs " << fn << " = " << r << dendl;
   return r;
@@ -4121,6 +4658,23 @@ int FileStore::_collection_rename(const coll_t &cid, const coll_t &ncid,
     return _collection_remove_recursive(cid, spos);
   }
 
+  {
+    // the splitter knows splits in progress by collection name
+    Index index;
+    if (get_index(cid, &index) == 0)
+      index->cleanup();
+  }
+
+  // cached fds for the old name stay valid, but drop them so that a new
+  // collection by that name can't find them
+  fdcache.clear_collection(cid);
+  fdcache.clear_collection(ncid);
+  attr_cache.clear_collection(cid);
+  attr_cache.clear_collection(ncid);
+  index_manager.listing_cache.clear_collection(cid);
+  index_manager.listing_cache.clear_collection(ncid);
+  note_namespace_dirty();
+
   int ret = 0;
   if (::rename(old_coll, new_coll)) {
     if (replaying && !btrfs_stable_commits &&
@@ -4293,6 +4847,19 @@ int FileStore::collection_list_range(coll_t c, hobject_t start, hobject_t end,
   return 0;
 }
 
+int FileStore::pre_split_collection(coll_t c, uint64_t expected_objects)
+{
+  Index index;
+  int r = get_index(c, &index);
+  if (r < 0)
+    return r;
+  r = index->pre_split(expected_objects);
+  note_namespace_dirty();
+  dout(10) << "pre_split_collection " << c << " for " << expected_objects
+	   << " objects = " << r << dendl;
+  return r;
+}
+
 int FileStore::collection_list_partial(coll_t c, hobject_t start,
 				       int min, int max, snapid_t seq,
 				       vector<hobject_t> *ls, hobject_t *next)
@@ -4304,6 +4871,8 @@ int FileStore::collection_list_partial(coll_t c, hobject_t start,
   r = index->collection_list_partial(start,
 				     min, max, seq,
 				     ls, next);
+  logger->set(l_os_lc_hit, index_manager.listing_cache.get_hits());
+  logger->set(l_os_lc_miss, index_manager.listing_cache.get_misses());
   if (r < 0) {
     assert(!m_filestore_fail_eio || r != -EIO);
     return r;
@@ -4404,6 +4973,27 @@ int FileStore::omap_check_keys(coll_t c, const hobject_t &hoid,
   return 0;
 }
 
+int FileStore::omap_get_vals_range(coll_t c, const hobject_t &hoid,
+				   const string &start_after,
+				   uint64_t max_bytes,
+				   map<string, bufferlist> *out,
+				   bool *more)
+{
+  dout(15) << __func__ << " " << c << "/" << hoid << " after " << start_after
+	   << " max_bytes " << max_bytes << dendl;
+  *more = false;
+  IndexedPath path;
+  int r = lfn_find(c, hoid, &path);
+  if (r < 0)
+    return r;
+  r = object_map->get_vals_range(hoid, start_after, max_bytes, out, more);
+  if (r < 0 && r != -ENOENT) {
+    assert(!m_filestore_fail_eio || r != -EIO);
+    return r;
+  }
+  return 0;
+}
+
 ObjectMap::ObjectMapIterator FileStore::get_omap_iterator(coll_t c,
 							  const hobject_t &hoid)
 {
@@ -4423,6 +5013,7 @@ int FileStore::_create_collection(coll_t c)
   int r = ::mkdir(fn, 0755);
   if (r < 0)
     r = -errno;
+  note_namespace_dirty();
   dout(10) << "create_collection " << fn << " = " << r << dendl;
 
   if (r < 0)
@@ -4435,9 +5026,18 @@ int FileStore::_destroy_collection(coll_t c)
   char fn[PATH_MAX];
   get_cdir(c, fn, sizeof(fn));
   dout(15) << "_destroy_collection " << fn << dendl;
+  {
+    Index index;
+    if (get_index(c, &index) == 0)
+      index->cleanup();
+  }
+  fdcache.clear_collection(c);
+  attr_cache.clear_collection(c);
+  index_manager.listing_cache.clear_collection(c);
   int r = ::rmdir(fn);
   if (r < 0)
     r = -errno;
+  note_namespace_dirty();
   dout(10) << "_destroy_collection " << fn << " = " << r << dendl;
   return r;
 }
@@ -4512,6 +5112,8 @@ int FileStore::_omap_clear(coll_t cid, const hobject_t &hoid,
   if (r < 0)
     return r;
   r = object_map->clear(hoid, &spos);
+  // the header holds any omap xattrs too
+  attr_cache.invalidate(cid, hoid);
   if (r < 0 && r != -ENOENT)
     return r;
   return 0;
@@ -4567,6 +5169,13 @@ const char** FileStore::get_tracked_conf_keys() const
     "filestore_dump_file",
     "filestore_kill_at",
     "filestore_fail_eio",
+    "filestore_fd_cache_size",
+    "filestore_fd_cache_max_bytes",
+    "filestore_attr_cache_max_bytes",
+    "filestore_writeback_start_bytes",
+    "filestore_writeback_target_bytes",
+    "filestore_writeback_commit_bytes",
+    "filestore_list_cache_objects",
     NULL
   };
   return KEYS;
@@ -4591,6 +5200,28 @@ void FileStore::handle_conf_change(const struct md_config_t *conf,
     m_filestore_kill_at.set(conf->filestore_kill_at);
     m_filestore_fail_eio = conf->filestore_fail_eio;
   }
+  if (changed.count("filestore_fd_cache_size") ||
+      changed.count("filestore_fd_cache_max_bytes")) {
+    fdcache.set_limits(conf->filestore_fd_cache_size,
+		       conf->filestore_fd_cache_max_bytes);
+  }
+  if (changed.count("filestore_flusher") ||
+      changed.count("filestore_flusher_max_fds") ||
+      changed.count("filestore_writeback_start_bytes") ||
+      changed.count("filestore_writeback_target_bytes") ||
+      changed.count("filestore_writeback_commit_bytes")) {
+    writeback.set_limits(conf->filestore_flusher ? conf->filestore_writeback_start_bytes : 0,
+			 conf->filestore_writeback_target_bytes,
+			 conf->filestore_writeback_commit_bytes,
+			 conf->filestore_flusher_max_fds);
+  }
+  if (changed.count("filestore_attr_cache_max_bytes")) {
+    attr_cache.set_max_bytes(conf->filestore_attr_cache_max_bytes);
+    logger->set(l_os_ac_bytes, attr_cache.get_bytes());
+  }
+  if (changed.count("filestore_list_cache_objects")) {
+    index_manager.listing_cache.set_max_objects(conf->filestore_list_cache_objects);
+  }
   if (changed.count("filestore_commit_timeout")) {
     Mutex::Locker l(sync_entry_timeo_lock);
     m_filestore_commit_timeout = conf->filestore_commit_timeout;
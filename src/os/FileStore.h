@@ -36,6 +36,9 @@ using namespace __gnu_cxx;
 #include "common/WorkQueue.h"
 
 #include "common/Mutex.h"
+#include "AttrCache.h"
+#include "FDCache.h"
+#include "WritebackController.h"
 #include "HashIndex.h"
 #include "IndexManager.h"
 #include "ObjectMap.h"
@@ -49,6 +52,8 @@ using namespace __gnu_cxx;
 # define FALLOC_FL_PUNCH_HOLE 0x2
 #endif
 
+class AdminSocketHook;
+
 class FileStore : public JournalingObjectStore,
                   public md_config_obs_t
 {
@@ -82,8 +87,23 @@ private:
   int get_index(coll_t c, Index *index);
   int init_index(coll_t c);
 
+  /// counts background index splits, and notes the renames they do
+  struct IndexObserver : public IndexManager::Observer {
+    FileStore *fs;
+    IndexObserver(FileStore *f) : fs(f) {}
+    void index_moved(coll_t c, int objects);
+    void index_finished(coll_t c, bool merge, bool inline_op, utime_t elapsed);
+  } index_observer;
+
   // ObjectMap
   boost::scoped_ptr<ObjectMap> object_map;
+
+  // open object fds, shared by lfn_open()/lfn_close() callers
+  FDCache fdcache;
+  AdminSocketHook *fdcache_hook;
+
+  // complete attr sets of recently read objects; see _load_attrs()
+  AttrCache attr_cache;
   
   Finisher ondisk_finisher;
 
@@ -119,6 +139,25 @@ private:
 
   void sync_fs(); // actuall sync underlying fs
 
+  // how sync_entry() makes a commit stable when we can't snapshot
+  enum {
+    COMMIT_SYNCFS,  ///< syncfs(2) on our filesystem
+    COMMIT_FD,      ///< fsync just the objects changed since the last commit
+    COMMIT_SYNC,    ///< sync(2) every filesystem on the host
+  };
+  static const char *get_commit_mode_name(int m);
+  bool have_syncfs;
+  int commit_mode;
+
+  // what changed since the last commit; objects are only tracked for COMMIT_FD
+  Mutex dirty_lock;
+  map<pair<coll_t, hobject_t>, bool> dirty_objects;  ///< true if attrs changed
+  bool dirty_need_full_sync;  ///< namespace changed, or too many objects
+  uint64_t dirty_bytes;
+  void note_dirty(coll_t cid, const hobject_t& oid, uint64_t bytes, bool attrs);
+  void note_namespace_dirty();
+  int _commit_fds(const vector<int>& fds, const vector<bool>& attrs);
+
   // -- op workqueue --
   struct Op {
     utime_t start;
@@ -136,6 +175,8 @@ private:
   public:
     Sequencer *parent;
     Mutex apply_lock;  // for apply mutual exclusion
+    unsigned shard;    ///< op shard we are queued on
+    bool applying;     ///< a shard thread is applying our front op (shard tp lock)
     
     void queue_journal(uint64_t s) {
       Mutex::Locker l(qlock);
@@ -186,7 +227,8 @@ private:
     OpSequencer()
       : qlock("FileStore::OpSequencer::qlock", false, false),
 	parent(0),
-	apply_lock("FileStore::OpSequencer::apply_lock", false, false) {}
+	apply_lock("FileStore::OpSequencer::apply_lock", false, false),
+	shard(0), applying(false) {}
     ~OpSequencer() {
       assert(q.empty());
     }
@@ -199,48 +241,51 @@ private:
   friend ostream& operator<<(ostream& out, const OpSequencer& s);
 
   Sequencer default_osr;
-  deque<OpSequencer*> op_queue;
   uint64_t op_queue_len, op_queue_bytes;
   Cond op_throttle_cond;
   Mutex op_throttle_lock;
   Finisher op_finisher;
 
-  ThreadPool op_tp;
+  /*
+   * Sequencers are spread over op shards, each with its own queue, lock
+   * and thread pool, so that many PGs don't contend on one queue lock.
+   * All of a sequencer's ops go through the same shard, and a shard
+   * thread skips over sequencers that another of its threads is already
+   * applying instead of blocking on their apply_lock.
+   */
+  struct OpShard;
   struct OpWQ : public ThreadPool::WorkQueue<OpSequencer> {
     FileStore *store;
-    OpWQ(FileStore *fs, time_t timeout, time_t suicide_timeout, ThreadPool *tp)
-      : ThreadPool::WorkQueue<OpSequencer>("FileStore::OpWQ", timeout, suicide_timeout, tp), store(fs) {}
+    OpShard *shard;
+    OpWQ(FileStore *fs, OpShard *sh, time_t timeout, time_t suicide_timeout, ThreadPool *tp)
+      : ThreadPool::WorkQueue<OpSequencer>("FileStore::OpWQ", timeout, suicide_timeout, tp),
+	store(fs), shard(sh) {}
 
-    bool _enqueue(OpSequencer *osr) {
-      store->op_queue.push_back(osr);
-      return true;
-    }
+    bool _enqueue(OpSequencer *osr);
     void _dequeue(OpSequencer *o) {
       assert(0);
     }
-    bool _empty() {
-      return store->op_queue.empty();
-    }
-    OpSequencer *_dequeue() {
-      if (store->op_queue.empty())
-	return NULL;
-      OpSequencer *osr = store->op_queue.front();
-      store->op_queue.pop_front();
-      return osr;
-    }
+    bool _empty();
+    OpSequencer *_dequeue();
     void _process(OpSequencer *osr) {
       store->_do_op(osr);
     }
-    void _process_finish(OpSequencer *osr) {
-      store->_finish_op(osr);
-    }
-    void _clear() {
-      assert(store->op_queue.empty());
-    }
-  } op_wq;
+    void _process_finish(OpSequencer *osr);
+    void _clear();
+  };
+  struct OpShard {
+    deque<OpSequencer*> queue;
+    ThreadPool tp;
+    OpWQ wq;
+    PerfCounters *logger;
+    OpShard(FileStore *fs, int i);
+    ~OpShard();
+  };
+  vector<OpShard*> op_shards;
+  atomic_t next_op_shard;  ///< round-robin assignment of new sequencers
 
   void _do_op(OpSequencer *o);
-  void _finish_op(OpSequencer *o);
+  void _finish_op(OpSequencer *o, OpShard *shard);
   Op *build_op(list<Transaction*>& tls,
 	       Context *onreadable, Context *onreadable_sync,
 	       TrackedOpRef osd_op);
@@ -250,10 +295,10 @@ private:
   void _journaled_ahead(OpSequencer *osr, Op *o, Context *ondisk);
   friend class C_JournaledAhead;
 
-  // flusher thread
+  // flusher thread: early writeback of data written since the last commit
+  WritebackController writeback;
+  AdminSocketHook *writeback_hook;
   Cond flusher_cond;
-  list<uint64_t> flusher_queue;
-  int flusher_queue_len;
   void flusher_entry();
   struct FlusherThread : public Thread {
     FileStore *fs;
@@ -263,7 +308,7 @@ private:
       return 0;
     }
   } flusher_thread;
-  bool queue_flusher(int fd, uint64_t off, uint64_t len);
+  void note_written(coll_t cid, const hobject_t& oid, uint64_t off, uint64_t len);
 
   int open_journal();
 
@@ -379,6 +424,7 @@ public:
 
   int _fgetattr(int fd, const char *name, bufferptr& bp);
   int _fgetattrs(int fd, map<string,bufferptr>& aset, bool user_only);
+  int _load_attrs(coll_t cid, const hobject_t& oid, map<string,bufferptr>& aset);
 
   void _start_sync();
 
@@ -434,6 +480,9 @@ public:
   int collection_list_range(coll_t c, hobject_t start, hobject_t end,
                             snapid_t seq, vector<hobject_t> *ls);
 
+  /// lay out empty collection c for expected_objects; see CollectionIndex
+  int pre_split_collection(coll_t c, uint64_t expected_objects);
+
   // omap (see ObjectStore.h for documentation)
   int omap_get(coll_t c, const hobject_t &hoid, bufferlist *header,
 	       map<string, bufferlist> *out);
@@ -443,6 +492,9 @@ public:
 		      map<string, bufferlist> *out);
   int omap_check_keys(coll_t c, const hobject_t &hoid, const set<string> &keys,
 		      set<string> *out);
+  int omap_get_vals_range(coll_t c, const hobject_t &hoid,
+			  const string &start_after, uint64_t max_bytes,
+			  map<string, bufferlist> *out, bool *more);
   ObjectMap::ObjectMapIterator get_omap_iterator(coll_t c, const hobject_t &hoid);
 
   int _create_collection(coll_t c);
@@ -57,6 +57,10 @@ int FlatIndex::cleanup() {
   return 0;
 }
 
+int FlatIndex::pre_split(uint64_t expected_objects) {
+  return -EOPNOTSUPP;
+}
+
 static inline void buf_to_hex(const unsigned char *buf, int len, char *str)
 {
   int i;
@@ -47,6 +47,9 @@ public:
   /// @see CollectionIndex
   int cleanup();
 
+  /// @see CollectionIndex
+  int pre_split(uint64_t expected_objects);
+
   /// @see CollectionIndex
   int init();
 
@@ -15,11 +15,14 @@
 #include "include/types.h"
 #include "include/buffer.h"
 #include "osd/osd_types.h"
+#include <algorithm>
 #include <errno.h>
 
 #include "HashIndex.h"
+#include "IndexManager.h"
 
 #include "common/debug.h"
+#include "common/Clock.h"
 #define dout_subsys ceph_subsys_filestore
 
 const string HashIndex::SUBDIR_ATTR = "contents";
@@ -39,11 +42,14 @@ int HashIndex::cleanup() {
   if (r < 0)
     return r;
   if (in_progress.is_split())
-    return complete_split(in_progress.path, info);
+    r = complete_split(in_progress.path, info);
   else if (in_progress.is_merge())
-    return complete_merge(in_progress.path, info);
+    r = complete_merge(in_progress.path, info);
   else
     return -EINVAL;
+  if (r >= 0 && manager)
+    manager->set_migration(coll(), NULL);
+  return r;
 }
 
 int HashIndex::_init() {
@@ -58,6 +64,7 @@ int HashIndex::_created(const vector<string> &path,
 			const string &mangled_name) {
   subdir_info_s info;
   int r;
+  listing_changed(&path);
   r = get_info(path, &info);
   if (r < 0)
     return r;
@@ -66,23 +73,44 @@ int HashIndex::_created(const vector<string> &path,
   if (r < 0)
     return r;
 
-  if (must_split(info)) {
-    int r = initiate_split(path, info);
+  if (!must_split(info))
+    return 0;
+  if (manager) {
+    if (manager->defer_splits() && !must_split_now(info)) {
+      manager->queue(coll(), get_base_path(), path, false);
+      return 0;
+    }
+    // there is only one in progress op tag
+    r = finish_migration();
     if (r < 0)
       return r;
-    return complete_split(path, info);
-  } else {
-    return 0;
+    r = get_info(path, &info);
+    if (r < 0)
+      return r;
+    if (!must_split(info))
+      return 0;
   }
+  utime_t start = ceph_clock_now(g_ceph_context);
+  r = initiate_split(path, info);
+  if (r < 0)
+    return r;
+  r = complete_split(path, info);
+  if (r >= 0 && manager)
+    manager->finished(coll(), false, true, ceph_clock_now(g_ceph_context) - start);
+  return r;
 }
 
 int HashIndex::_remove(const vector<string> &path,
 		       const hobject_t &hoid,
 		       const string &mangled_name) {
   int r;
+  listing_changed(&path);
   r = remove_object(path, hoid);
   if (r < 0)
     return r;
+  // counted when the split finishes
+  if (is_unfinished_subdir(path))
+    return 0;
   subdir_info_s info;
   r = get_info(path, &info);
   if (r < 0)
@@ -92,6 +120,13 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (manager && manager->defer_splits()) {
+      manager->queue(coll(), get_base_path(), path, true);
+      return 0;
+    }
+    r = finish_migration();
+    if (r < 0)
+      return r;
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -123,6 +158,19 @@ int HashIndex::_lookup(const hobject_t &hoid,
       break;
     path->push_back(*(next++));
   }
+  if (is_unfinished_subdir(*path)) {
+    // not moved yet, or created since the split started
+    int found;
+    r = get_mangled_name(*path, hoid, mangled_name, &found);
+    if (r < 0)
+      return r;
+    if (found) {
+      if (exists_out)
+	*exists_out = found;
+      return 0;
+    }
+    path->pop_back();
+  }
   return get_mangled_name(*path, hoid, mangled_name, exists_out);
 }
 
@@ -181,6 +229,7 @@ int HashIndex::set_info(const vector<string> &path, const subdir_info_s &info) {
 
 bool HashIndex::must_merge(const subdir_info_s &info) {
   return (info.hash_level > 0 &&
+	  !info.presplit &&
 	  info.objs < (unsigned)merge_threshold &&
 	  info.subdirs == 0);
 }
@@ -191,6 +240,236 @@ bool HashIndex::must_split(const subdir_info_s &info) {
 			    
 }
 
+bool HashIndex::must_split_now(const subdir_info_s &info) {
+  return (info.hash_level < (unsigned)MAX_HASH_LEVEL &&
+	  info.objs > ((unsigned)merge_threshold * 32 * split_multiplier));
+}
+
+bool HashIndex::is_unfinished_subdir(const vector<string> &path) {
+  vector<string> splitting;
+  if (!manager || path.empty() || !manager->get_migration(coll(), &splitting))
+    return false;
+  if (path.size() != splitting.size() + 1 ||
+      !equal(splitting.begin(), splitting.end(), path.begin()))
+    return false;
+  // the subdirs a split creates get their info when it finishes
+  subdir_info_s info;
+  return get_info(path, &info) < 0;
+}
+
+int HashIndex::finish_migration() {
+  vector<string> path;
+  if (!manager || !manager->get_migration(coll(), &path))
+    return 0;
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  r = complete_split(path, info);
+  if (r < 0)
+    return r;
+  manager->set_migration(coll(), NULL);
+  return 0;
+}
+
+int HashIndex::split_step(const vector<string> &path, int max_objects,
+			  int *moved, bool *done) {
+  *moved = 0;
+  *done = false;
+  vector<string> splitting;
+  bool in_progress = manager && manager->get_migration(coll(), &splitting);
+  if (in_progress && splitting != path) {
+    int r = finish_migration();
+    if (r < 0)
+      return r;
+    in_progress = false;
+  }
+
+  int r, exists;
+  r = path_exists(path, &exists);
+  if (r < 0)
+    return r;
+  if (!exists) {
+    // merged away since it was queued
+    *done = true;
+    return 0;
+  }
+  // objects move between path and its children
+  listing_changed(NULL);
+  subdir_info_s info;
+  r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  if (!in_progress) {
+    if (!must_split(info)) {
+      *done = true;
+      return 0;
+    }
+    r = initiate_split(path, info);
+    if (r < 0)
+      return r;
+    if (manager)
+      manager->set_migration(coll(), &path);
+  }
+
+  int level = info.hash_level;
+  map<string, hobject_t> objects;
+  r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  map<string, map<string, hobject_t> > mapped;
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> new_path;
+    get_path_components(i->second, &new_path);
+    mapped[new_path[level]][i->first] = i->second;
+  }
+
+  vector<string> dst = path;
+  dst.push_back("");
+  for (map<string, map<string, hobject_t> >::iterator i = mapped.begin();
+       i != mapped.end() && *moved < max_objects;
+       ++i) {
+    dst[level] = i->first;
+    if (subdirs.count(i->first)) {
+      // finished subdirs are complete_split's business
+      subdir_info_s temp;
+      if (!get_info(dst, &temp))
+	continue;
+    } else {
+      subdir_info_s info_new;
+      info_new.objs = i->second.size();
+      info_new.hash_level = level + 1;
+      if (must_merge(info_new))
+	continue;
+      r = create_path(dst);
+      if (r < 0)
+	return r;
+    }
+
+    map<string, hobject_t> batch;
+    for (map<string, hobject_t>::iterator j = i->second.begin();
+	 j != i->second.end() && *moved < max_objects;
+	 ++j) {
+      r = link_object(path, dst, j->second, j->first);
+      if (r < 0 && r != -EEXIST)
+	return r;
+      batch[j->first] = j->second;
+      objects.erase(j->first);
+      ++*moved;
+    }
+    // everything must be in dst before it leaves path
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+    r = remove_objects(path, batch, &objects);
+    if (r < 0)
+      return r;
+    r = fsync_dir(path);
+    if (r < 0)
+      return r;
+  }
+
+  if (*moved < max_objects) {
+    // nothing left to move; set the subdirs' info and clear the tag
+    r = complete_split(path, info);
+    if (r < 0)
+      return r;
+    if (manager)
+      manager->set_migration(coll(), NULL);
+    *done = true;
+  }
+  return 0;
+}
+
+int HashIndex::merge_step(const vector<string> &path, int *moved) {
+  *moved = 0;
+  int r = finish_migration();
+  if (r < 0)
+    return r;
+  int exists;
+  r = path_exists(path, &exists);
+  if (r < 0)
+    return r;
+  if (!exists)
+    return 0;
+  subdir_info_s info;
+  r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  if (!must_merge(info))
+    return 0;
+  *moved = info.objs;
+  r = initiate_merge(path, info);
+  if (r < 0)
+    return r;
+  return complete_merge(path, info);
+}
+
+int HashIndex::pre_split(uint64_t expected_objects) {
+  uint64_t leaf_objects = (uint64_t)merge_threshold * 16 * split_multiplier;
+  int levels = 0;
+  for (uint64_t leaves = 1;
+       leaves * leaf_objects < expected_objects && levels < MAX_HASH_LEVEL;
+       leaves *= 16)
+    ++levels;
+  if (levels == 0)
+    return 0;
+
+  vector<string> path;
+  map<string, hobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  if (!objects.empty() || !subdirs.empty())
+    return -ENOTEMPTY;
+  listing_changed(NULL);
+  return pre_split_path(path, levels);
+}
+
+int HashIndex::pre_split_path(const vector<string> &path, int levels) {
+  subdir_info_s info;
+  int r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  vector<string> dst = path;
+  dst.push_back("");
+  for (int i = 0; i < 16; ++i) {
+    char buf[2];
+    snprintf(buf, sizeof(buf), "%X", i);
+    dst.back() = buf;
+    r = create_path(dst);
+    if (r < 0 && r != -EEXIST)
+      return r;
+    subdir_info_s info_new;
+    info_new.hash_level = dst.size();
+    // an empty pool would otherwise merge it on the first remove
+    info_new.presplit = true;
+    r = set_info(dst, info_new);
+    if (r < 0)
+      return r;
+    if (levels > 1) {
+      r = pre_split_path(dst, levels - 1);
+      if (r < 0)
+	return r;
+    }
+  }
+  info.subdirs = 16;
+  r = set_info(path, info);
+  if (r < 0)
+    return r;
+  return fsync_dir(path);
+}
+
 int HashIndex::initiate_merge(const vector<string> &path, subdir_info_s info) {
   return start_merge(path);
 }
@@ -200,6 +479,7 @@ int HashIndex::complete_merge(const vector<string> &path, subdir_info_s info) {
   dst.pop_back();
   subdir_info_s dstinfo;
   int r, exists;
+  listing_changed(NULL);
   r = path_exists(path, &exists);
   if (r < 0)
     return r;
@@ -252,6 +532,7 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   map<string, hobject_t> objects;
   vector<string> dst = path;
   int r;
+  listing_changed(NULL);
   dst.push_back("");
   r = list_objects(path, 0, 0, &objects);
   if (r < 0)
@@ -324,6 +605,15 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
     if (r < 0)
       return r;
 
+    if (subdirs.count(i->first)) {
+      // a background split may have moved some already
+      map<string, hobject_t> in_dst;
+      r = list_objects(dst, 0, 0, &in_dst);
+      if (r < 0)
+	return r;
+      info_new.objs = in_dst.size();
+    }
+
     // Presence of info must imply that all objects have been copied
     r = set_info(dst, info_new);
     if (r < 0)
@@ -335,10 +625,37 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
 
     ++i;
   }
+  // subdirs a background split already filled completely
+  for (set<string>::iterator i = subdirs.begin(); i != subdirs.end(); ++i) {
+    if (mapped.count(*i))
+      continue;
+    dst[level] = *i;
+    subdir_info_s temp;
+    if (!get_info(dst, &temp))
+      continue;
+    map<string, hobject_t> in_dst;
+    r = list_objects(dst, 0, 0, &in_dst);
+    if (r < 0)
+      return r;
+    temp = subdir_info_s();
+    temp.objs = in_dst.size();
+    temp.hash_level = level + 1;
+    r = set_info(dst, temp);
+    if (r < 0)
+      return r;
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+  }
   r = remove_objects(path, moved, &objects);
   if (r < 0)
     return r;
   info.objs = objects.size();
+  subdirs.clear();
+  r = list_subdirs(path, &subdirs);
+  if (r < 0)
+    return r;
+  info.subdirs = subdirs.size();
   r = set_info(path, info);
   if (r < 0)
     return r;
@@ -387,14 +704,74 @@ uint32_t HashIndex::hash_prefix_to_hash(string prefix) {
   return hash;
 }
 
+void HashIndex::listing_changed(const vector<string> *path) {
+  if (!manager)
+    return;
+  if (path)
+    manager->listing_cache.invalidate(coll(), *path);
+  else
+    manager->listing_cache.clear_collection(coll());
+}
+
+int HashIndex::get_listing(const vector<string> &path,
+			   ListingCache::ListingRef *listing) {
+  bool use_cache = manager && manager->listing_cache.enabled();
+  if (use_cache) {
+    *listing = manager->listing_cache.lookup(coll(), path);
+    if (*listing)
+      return 0;
+  }
+  std::tr1::shared_ptr<ListingCache::Listing> l(new ListingCache::Listing);
+  map<string, hobject_t> objects;
+  int r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  r = list_subdirs(path, &l->subdirs);
+  if (r < 0)
+    return r;
+  l->objects.reserve(objects.size());
+  for (map<string, hobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i)
+    l->objects.push_back(i->second);
+  sort(l->objects.begin(), l->objects.end());
+  if (use_cache)
+    manager->listing_cache.add(coll(), path, l);
+  *listing = l;
+  return 0;
+}
+
+void HashIndex::add_objects_by_hash(const ListingCache::Listing &listing,
+				    const string *lower_bound,
+				    const hobject_t *next_object,
+				    const snapid_t *seq,
+				    unsigned max,
+				    set<pair<string, hobject_t> > *objects) {
+  // hobject_t order is hash prefix order, so we can start at next_object
+  vector<hobject_t>::const_iterator i = listing.objects.begin();
+  if (next_object)
+    i = std::lower_bound(listing.objects.begin(), listing.objects.end(),
+			 *next_object);
+  unsigned added = 0;
+  for (; i != listing.objects.end() && (!max || added < max); ++i) {
+    string hash_prefix = get_path_str(*i);
+    if (lower_bound && hash_prefix < *lower_bound)
+      continue;
+    if (seq && i->snap < *seq)
+      continue;
+    objects->insert(pair<string, hobject_t>(hash_prefix, *i));
+    ++added;
+  }
+}
+
 int HashIndex::get_path_contents_by_hash(const vector<string> &path,
 					 const string *lower_bound,
 					 const hobject_t *next_object,
 					 const snapid_t *seq,
+					 unsigned max_objects,
 					 set<string> *hash_prefixes,
 					 set<pair<string, hobject_t> > *objects) {
-  set<string> subdirs;
-  map<string, hobject_t> rev_objects;
+  ListingCache::ListingRef listing;
   int r;
   string cur_prefix;
   for (vector<string>::const_iterator i = path.begin();
@@ -402,28 +779,29 @@ int HashIndex::get_path_contents_by_hash(const vector<string> &path,
        ++i) {
     cur_prefix.append(*i);
   }
-  r = list_objects(path, 0, 0, &rev_objects);
+  r = get_listing(path, &listing);
   if (r < 0)
     return r;
-  for (map<string, hobject_t>::iterator i = rev_objects.begin();
-       i != rev_objects.end();
+  add_objects_by_hash(*listing, lower_bound, next_object, seq,
+		      max_objects, objects);
+  bool merged = false;
+  for (set<string>::const_iterator i = listing->subdirs.begin();
+       i != listing->subdirs.end();
        ++i) {
-    string hash_prefix = get_path_str(i->second);
-    if (lower_bound && hash_prefix < *lower_bound)
-      continue;
-    if (next_object && i->second < *next_object)
-      continue;
-    if (seq && i->second.snap < *seq)
+    vector<string> subdir = path;
+    subdir.push_back(*i);
+    if (is_unfinished_subdir(subdir)) {
+      // list what a background split has moved so far with path, so
+      // the objects still come out in hash order
+      ListingCache::ListingRef moved;
+      r = get_listing(subdir, &moved);
+      if (r < 0)
+	return r;
+      add_objects_by_hash(*moved, lower_bound, next_object, seq, max_objects,
+			  objects);
+      merged = true;
       continue;
-    hash_prefixes->insert(hash_prefix);
-    objects->insert(pair<string, hobject_t>(hash_prefix, i->second));
-  }
-  r = list_subdirs(path, &subdirs);
-  if (r < 0)
-    return r;
-  for (set<string>::iterator i = subdirs.begin();
-       i != subdirs.end();
-       ++i) {
+    }
     string candidate = cur_prefix + *i;
     if (lower_bound && candidate < lower_bound->substr(0, candidate.size()))
       continue;
@@ -432,6 +810,18 @@ int HashIndex::get_path_contents_by_hash(const vector<string> &path,
       continue;
     hash_prefixes->insert(cur_prefix + *i);
   }
+  if (merged && max_objects) {
+    // each source gave us its first max_objects; only the first
+    // max_objects of them all are sure to be the next in order
+    while (objects->size() > max_objects) {
+      set<pair<string, hobject_t> >::iterator last = objects->end();
+      objects->erase(--last);
+    }
+  }
+  for (set<pair<string, hobject_t> >::iterator i = objects->begin();
+       i != objects->end();
+       ++i)
+    hash_prefixes->insert(i->first);
   return 0;
 }
 
@@ -446,10 +836,15 @@ int HashIndex::list_by_hash(const vector<string> &path,
   next_path.push_back("");
   set<string> hash_prefixes;
   set<pair<string, hobject_t> > objects;
+  // one more than we can take, so we stop at an object we know is next
+  unsigned max_objects = 0;
+  if (max_count > 0)
+    max_objects = max_count + 1 - MIN(out->size(), (unsigned)max_count);
   int r = get_path_contents_by_hash(path,
 				    NULL,
 				    next,
 				    &seq,
+				    max_objects,
 				    &hash_prefixes,
 				    &objects);
   if (r < 0)
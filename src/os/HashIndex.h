@@ -18,6 +18,9 @@
 #include "include/buffer.h"
 #include "include/encoding.h"
 #include "LFNIndex.h"
+#include "ListingCache.h"
+
+class IndexManager;
 
 
 /**
@@ -45,6 +48,18 @@
  * Subdirectories are created when the number of objects in a directory
  * exceed 32*merge_threshhold.  The number of objects in a directory 
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * Given an IndexManager, splits and merges are queued there and done
+ * by its background thread rather than by the create or remove that
+ * triggered them.  A background split moves objects a batch at a time,
+ * so until it finishes an object may be in the directory being split
+ * or in one of the new subdirectories, which have no subdir_info_s
+ * yet.  Lookups and listings check both; new objects go in the
+ * directory being split.  A directory that grows to twice the split
+ * point before the background thread gets to it is split inline.
+ *
+ * Subdirs created by pre_split are marked in their subdir_info_s and
+ * are never merged, however few objects they hold.
  */
 class HashIndex : public LFNIndex {
 private:
@@ -65,31 +80,43 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+  /// Defers splits and merges and caches listings, NULL to do without
+  IndexManager *manager;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
     uint32_t subdirs;    ///< Subdirs in subdir.
     uint32_t hash_level; ///< Hashlevel of subdir.
+    bool presplit;       ///< Created by pre_split, never merged.
 
-    subdir_info_s() : objs(0), subdirs(0), hash_level(0) {}
+    subdir_info_s() : objs(0), subdirs(0), hash_level(0), presplit(false) {}
     
     void encode(bufferlist &bl) const
     {
-      __u8 v = 1;
+      // code from before v2 asserts on anything newer, so only
+      // pre-split dirs, whose flag it can't honour, get v2
+      __u8 v = presplit ? 2 : 1;
       ::encode(v, bl);
       ::encode(objs, bl);
       ::encode(subdirs, bl);
       ::encode(hash_level, bl);
+      if (v >= 2)
+	::encode(presplit, bl);
     }
     
     void decode(bufferlist::iterator &bl)
     {
       __u8 v;
       ::decode(v, bl);
-      assert(v == 1);
+      assert(v <= 2);
       ::decode(objs, bl);
       ::decode(subdirs, bl);
       ::decode(hash_level, bl);
+      if (v >= 2)
+	::decode(presplit, bl);
+      else
+	presplit = false;
     }
   };
 
@@ -134,15 +161,38 @@ public:
     const char *base_path, ///< [in] Path to the index root.
     int merge_at,          ///< [in] Merge threshhold.
     int split_multiple,	   ///< [in] Split threshhold.
-    uint32_t index_version)///< [in] Index version
+    uint32_t index_version,///< [in] Index version
+    IndexManager *manager = NULL) ///< [in] Splitter and listing cache
     : LFNIndex(collection, base_path, index_version), merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple), manager(manager) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
 
   /// @see CollectionIndex
   int cleanup();
+
+  /// @see CollectionIndex
+  int pre_split(uint64_t expected_objects);
+
+  /**
+   * Move the next batch of objects for a background split of path,
+   * starting the split if needed
+   *
+   * @param done [out] set once the split is finished (or not needed)
+   */
+  int split_step(
+    const vector<string> &path, ///< [in] Subdir to split
+    int max_objects,            ///< [in] Move at most this many objects
+    int *moved,                 ///< [out] Objects moved
+    bool *done                  ///< [out] Split finished
+    ); ///< @return Error Code, 0 on success
+
+  /// Merge path into its parent if it is still too small
+  int merge_step(
+    const vector<string> &path, ///< [in] Subdir to merge
+    int *moved                  ///< [out] Objects moved
+    ); ///< @return Error Code, 0 on success
 	
 protected:
   int _init();
@@ -209,6 +259,25 @@ private:
     const subdir_info_s &info ///< [in] Info to check
     ); /// @return True if info must be split, False otherwise
 
+  /// True if info is too big to wait for a background split
+  bool must_split_now(
+    const subdir_info_s &info ///< [in] Info to check
+    );
+
+  /// True if path is a new subdir a background split is still filling
+  bool is_unfinished_subdir(
+    const vector<string> &path ///< [in] Subdir to check
+    );
+
+  /// Complete any background split in progress
+  int finish_migration(); ///< @return Error Code, 0 on success
+
+  /// Create levels of empty subdirs under path
+  int pre_split_path(
+    const vector<string> &path, ///< [in] Subdir to split
+    int levels                  ///< [in] Levels of subdirs to create
+    ); ///< @return Error Code, 0 on success
+
   /// Initiates merge
   int initiate_merge(
     const vector<string> &path, ///< [in] Subdir to merge
@@ -258,12 +327,34 @@ private:
     string prefix ///< [in] string to convert
     ); ///< @return Hash
 
+  /// Drop cached listings of *path, or of the whole collection if NULL
+  void listing_changed(
+    const vector<string> *path ///< [in] Directory that changed
+    );
+
+  /// Get the objects and subdirs in path, from the cache if possible
+  int get_listing(
+    const vector<string> &path,       ///< [in] Path to list
+    ListingCache::ListingRef *listing ///< [out] Listing of path
+    ); ///< @return Error Code, 0 on success
+
+  /// Add the first max (0 for all) objects in listing within bounds
+  void add_objects_by_hash(
+    const ListingCache::Listing &listing,  /// [in] Listing to add from
+    const string *lower_bound,             /// [in] list > *lower_bound
+    const hobject_t *next_object,          /// [in] list >= *next_object
+    const snapid_t *seq,                   /// [in] list >= *seq
+    unsigned max,                          /// [in] add at most max
+    set<pair<string, hobject_t> > *objects /// [out] objects
+    );
+
   /// Get path contents by hash
   int get_path_contents_by_hash(
     const vector<string> &path,            /// [in] Path to list
     const string *lower_bound,             /// [in] list > *lower_bound
     const hobject_t *next_object,          /// [in] list > *next_object
     const snapid_t *seq,                   /// [in] list >= *seq
+    unsigned max_objects,                  /// [in] list at most, 0 for all
     set<string> *hash_prefixes,            /// [out] prefixes in dir
     set<pair<string, hobject_t> > *objects /// [out] objects
     );
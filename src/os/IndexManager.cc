@@ -25,6 +25,8 @@
 #include "common/Cond.h"
 #include "common/config.h"
 #include "common/debug.h"
+#include "common/errno.h"
+#include "common/Clock.h"
 #include "include/buffer.h"
 
 #include "IndexManager.h"
@@ -34,6 +36,10 @@
 
 #include "chain_xattr.h"
 
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "index_manager "
+
 static int set_version(const char *path, uint32_t version) {
   bufferlist bl;
   ::encode(version, bl);
@@ -70,6 +76,8 @@ void IndexManager::put_index(coll_t c) {
 
 int IndexManager::init_index(coll_t c, const char *path, uint32_t version) {
   Mutex::Locker l(lock);
+  // anything cached under this name is from a collection since removed
+  listing_cache.clear_collection(c);
   int r = set_version(path, version);
   if (r < 0)
     return r;
@@ -99,7 +107,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
       *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version), 
+				   g_conf->filestore_split_multiple, version,
+				   this),
 		     RemoveOnDelete(c, this));
       return 0;
     }
@@ -110,7 +119,8 @@ int IndexManager::build_index(coll_t c, const char *path, Index *index) {
     // No need to check
     *index = Index(new HashIndex(c, path, g_conf->filestore_merge_threshold,
 				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL), 
+				 CollectionIndex::HOBJECT_WITH_POOL,
+				 this),
 		   RemoveOnDelete(c, this));
     return 0;
   }
@@ -132,3 +142,143 @@ int IndexManager::get_index(coll_t c, const char *path, Index *index) {
   }
   return 0;
 }
+
+void IndexManager::start_splitter(Observer *o) {
+  Mutex::Locker l(lock);
+  assert(!split_running);
+  observer = o;
+  split_stop = false;
+  split_running = true;
+  split_thread.create();
+}
+
+void IndexManager::stop_splitter() {
+  lock.Lock();
+  if (!split_running) {
+    lock.Unlock();
+    return;
+  }
+  split_stop = true;
+  split_cond.Signal();
+  lock.Unlock();
+  split_thread.join();
+
+  Mutex::Locker l(lock);
+  split_running = false;
+  pending.clear();
+  pending_set.clear();
+  migrating.clear();
+  observer = NULL;
+}
+
+bool IndexManager::defer_splits() {
+  Mutex::Locker l(lock);
+  return split_running && !split_stop && g_conf->filestore_split_async;
+}
+
+void IndexManager::queue(coll_t c, const string &base_path,
+			 const vector<string> &path, bool merge) {
+  Mutex::Locker l(lock);
+  if (!split_running || split_stop)
+    return;
+  if (!pending_set.insert(make_pair(c, path)).second)
+    return;
+  pending_t p;
+  p.c = c;
+  p.base_path = base_path;
+  p.path = path;
+  p.merge = merge;
+  pending.push_back(p);
+  split_cond.Signal();
+}
+
+bool IndexManager::get_migration(coll_t c, vector<string> *path) {
+  Mutex::Locker l(lock);
+  map<coll_t, vector<string> >::iterator p = migrating.find(c);
+  if (p == migrating.end())
+    return false;
+  *path = p->second;
+  return true;
+}
+
+void IndexManager::set_migration(coll_t c, const vector<string> *path) {
+  Mutex::Locker l(lock);
+  if (path)
+    migrating[c] = *path;
+  else
+    migrating.erase(c);
+}
+
+void IndexManager::finished(coll_t c, bool merge, bool inline_op,
+			    utime_t elapsed) {
+  if (observer)
+    observer->index_finished(c, merge, inline_op, elapsed);
+}
+
+void IndexManager::split_entry() {
+  lock.Lock();
+  while (!split_stop) {
+    if (pending.empty()) {
+      split_cond.Wait(lock);
+      continue;
+    }
+    pending_t p = pending.front();
+    pending.pop_front();
+    lock.Unlock();
+    do_pending(p);
+    lock.Lock();
+    // creates in p.path didn't queue it again while we worked on it
+    pending_set.erase(make_pair(p.c, p.path));
+  }
+  lock.Unlock();
+}
+
+void IndexManager::do_pending(const pending_t &p) {
+  utime_t start = ceph_clock_now(g_ceph_context);
+  bool done = false;
+  while (!done) {
+    int moved = 0;
+    int r;
+    {
+      Index index;
+      r = get_index(p.c, p.base_path.c_str(), &index);
+      if (r == 0) {
+	HashIndex *hindex = dynamic_cast<HashIndex*>(index.get());
+	if (!hindex)
+	  return;
+	if (p.merge) {
+	  r = hindex->merge_step(p.path, &moved);
+	  done = true;
+	} else {
+	  r = hindex->split_step(p.path, g_conf->filestore_split_batch,
+				 &moved, &done);
+	}
+      }
+      // dropping index lets ops on the collection in between batches
+    }
+    if (r < 0) {
+      derr << (p.merge ? "merge" : "split") << " of " << p.c << " "
+	   << p.path << " failed: " << cpp_strerror(r) << dendl;
+      return;
+    }
+    if (moved && observer)
+      observer->index_moved(p.c, moved);
+    if (done)
+      break;
+
+    Mutex::Locker l(lock);
+    int rate = g_conf->filestore_split_rate;
+    if (rate > 0) {
+      // queue() signals split_cond too, so wait out the whole interval
+      utime_t until = ceph_clock_now(g_ceph_context);
+      until += (double)moved / rate;
+      while (!split_stop && ceph_clock_now(g_ceph_context) < until)
+	split_cond.WaitUntil(lock, until);
+    }
+    if (split_stop)
+      return;
+  }
+  dout(10) << (p.merge ? "merged " : "split ") << p.c << " " << p.path
+	   << " in " << (ceph_clock_now(g_ceph_context) - start) << dendl;
+  finished(p.c, p.merge, false, ceph_clock_now(g_ceph_context) - start);
+}
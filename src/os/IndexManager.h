@@ -15,9 +15,12 @@
 #define OS_INDEXMANAGER_H
 
 #include <tr1/memory>
+#include <list>
 #include <map>
+#include <set>
 
 #include "common/Mutex.h"
+#include "common/Thread.h"
 #include "common/Cond.h"
 #include "common/config.h"
 #include "common/debug.h"
@@ -25,6 +28,7 @@
 #include "CollectionIndex.h"
 #include "HashIndex.h"
 #include "FlatIndex.h"
+#include "ListingCache.h"
 
 
 /// Public type for Index
@@ -43,8 +47,29 @@ typedef std::tr1::shared_ptr<CollectionIndex> Index;
  * carry a reference to the parrent index.  Once all
  * shared_ptr<CollectionIndex> references have expired, the destructor
  * removes the weak_ptr from col_indices and wakes waiters.
+ *
+ * Once start_splitter() is called, HashIndex directory splits and
+ * merges are queued here and done by a background thread, which takes
+ * the index like anyone else and lets go of it between batches of
+ * objects so ops on the collection can proceed.
+ *
+ * HashIndexes also keep their directory listings in listing_cache,
+ * which outlives the indexes themselves.
  */
 class IndexManager {
+public:
+  /// Told about background splits and merges
+  class Observer {
+  public:
+    /// the splitter moved objects between directories of c
+    virtual void index_moved(coll_t c, int objects) = 0;
+    /// a split or merge of c finished
+    virtual void index_finished(coll_t c, bool merge, bool inline_op,
+				utime_t elapsed) = 0;
+    virtual ~Observer() {}
+  };
+
+private:
   Mutex lock; ///< Lock for Index Manager
   Cond cond;  ///< Cond for waiters on col_indices
   bool upgrade;
@@ -52,6 +77,33 @@ class IndexManager {
   /// Currently in use CollectionIndices
   map<coll_t,std::tr1::weak_ptr<CollectionIndex> > col_indices;
 
+  /// A queued split or merge
+  struct pending_t {
+    coll_t c;
+    string base_path; ///< Path to the collection
+    vector<string> path; ///< Subdir to split or merge
+    bool merge;
+  };
+  list<pending_t> pending;
+  set<pair<coll_t, vector<string> > > pending_set; ///< pending, for dedup
+  /// Subdir each collection is part way through splitting
+  map<coll_t, vector<string> > migrating;
+
+  Observer *observer;
+  Cond split_cond;
+  bool split_running, split_stop;
+  struct SplitThread : public Thread {
+    IndexManager *manager;
+    SplitThread(IndexManager *m) : manager(m) {}
+    void *entry() {
+      manager->split_entry();
+      return 0;
+    }
+  } split_thread;
+  void split_entry();
+  /// Do p, one batch at a time; called without lock
+  void do_pending(const pending_t &p);
+
   /// Cleans up state for c @see RemoveOnDelete
   void put_index(
     coll_t c ///< Put the index for c
@@ -84,9 +136,33 @@ class IndexManager {
    */
   int build_index(coll_t c, const char *path, Index *index);
 public:
+  /// Directory listings of HashIndex collections
+  ListingCache listing_cache;
+
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade), observer(NULL),
+			       split_running(false), split_stop(false),
+			       split_thread(this),
+			       listing_cache(g_conf->filestore_list_cache_objects) {}
+
+  /// Start doing splits and merges in the background
+  void start_splitter(Observer *o);
+  /// Stop the background thread; splits it leaves unfinished are
+  /// completed by HashIndex::cleanup() at the next mount
+  void stop_splitter();
+
+  /// True if HashIndex should queue splits rather than do them inline
+  bool defer_splits();
+  /// Queue a split (or merge) of path in c, if not queued already
+  void queue(coll_t c, const string &base_path, const vector<string> &path,
+	     bool merge);
+  /// Get the subdir of c a background split is part way through
+  bool get_migration(coll_t c, vector<string> *path);
+  /// Record (or, with NULL, clear) the split in progress on c
+  void set_migration(coll_t c, const vector<string> *path);
+  /// Report a finished split or merge to the observer
+  void finished(coll_t c, bool merge, bool inline_op, utime_t elapsed);
 
   /**
    * Reserve and return index for c
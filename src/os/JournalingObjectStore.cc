@@ -1,6 +1,7 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 
 #include "JournalingObjectStore.h"
+#include "ReplayPool.h"
 
 #include "common/debug.h"
 
@@ -27,6 +28,29 @@ void JournalingObjectStore::journal_stop()
   }
 }
 
+/*
+ * Replayer - a ReplayPool applying entries to this store
+ */
+class JournalingObjectStore::Replayer : public ReplayPool {
+  JournalingObjectStore *store;
+
+protected:
+  void _apply(uint64_t seq, list<Transaction*>& tls) {
+    dout(3) << "journal_replay: applying op seq " << seq << dendl;
+    store->apply_manager.op_apply_start(seq);
+    int r = store->do_transactions(tls, seq);
+    dout(3) << "journal_replay: r = " << r << ", op seq " << seq << dendl;
+  }
+  void _finish(uint64_t applied) {
+    store->apply_manager.op_apply_finish(applied);
+  }
+
+public:
+  Replayer(JournalingObjectStore *s, int nthreads, unsigned maxq)
+    : ReplayPool(nthreads, maxq), store(s) {}
+};
+
+
 int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
 {
   dout(10) << "journal_replay fs op_seq " << fs_op_seq << dendl;
@@ -56,6 +80,19 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
 
   replaying = true;
 
+  Replayer *pool = NULL;
+  if (g_conf->journal_replay_threads > 1) {
+    dout(3) << "journal_replay: applying with " << g_conf->journal_replay_threads
+	    << " threads" << dendl;
+    pool = new Replayer(this, g_conf->journal_replay_threads,
+			g_conf->journal_replay_max_queued);
+    pool->start();
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  utime_t last_report = start;
+  uint64_t entries = 0, bytes = 0;
+
   int count = 0;
   while (1) {
     bufferlist bl;
@@ -71,7 +108,9 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
     }
     assert(op_seq == seq-1);
     
-    dout(3) << "journal_replay: applying op seq " << seq << dendl;
+    entries++;
+    bytes += bl.length();
+
     bufferlist::iterator p = bl.begin();
     list<Transaction*> tls;
     while (!p.end()) {
@@ -79,19 +118,37 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
       tls.push_back(t);
     }
 
-    apply_manager.op_apply_start(seq);
-    int r = do_transactions(tls, seq);
-    apply_manager.op_apply_finish(seq);
+    if (pool) {
+      pool->queue_entry(seq, tls);
+      op_seq = seq;
+    } else {
+      dout(3) << "journal_replay: applying op seq " << seq << dendl;
+      apply_manager.op_apply_start(seq);
+      int r = do_transactions(tls, seq);
+      apply_manager.op_apply_finish(seq);
+
+      op_seq = seq;
+
+      while (!tls.empty()) {
+	delete tls.front(); 
+	tls.pop_front();
+      }
 
-    op_seq = seq;
+      dout(3) << "journal_replay: r = " << r << ", op_seq now " << op_seq << dendl;
+    }
 
-    while (!tls.empty()) {
-      delete tls.front(); 
-      tls.pop_front();
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (now - last_report >= utime_t(5, 0)) {
+      log_replay_progress(entries, bytes, start, false);
+      last_report = now;
     }
+  }
 
-    dout(3) << "journal_replay: r = " << r << ", op_seq now " << op_seq << dendl;
+  if (pool) {
+    pool->stop();
+    delete pool;
   }
+  log_replay_progress(entries, bytes, start, true);
 
   replaying = false;
 
@@ -103,6 +160,16 @@ int JournalingObjectStore::journal_replay(uint64_t fs_op_seq)
   return count;
 }
 
+void JournalingObjectStore::log_replay_progress(uint64_t entries, uint64_t bytes,
+						utime_t start, bool done)
+{
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  double mb = (double)bytes / (1024*1024);
+  dout(1) << "journal_replay: " << (done ? "replayed " : "read ")
+	  << entries << " entries, " << mb << " MB in " << elapsed
+	  << " s (" << (elapsed > 0 ? mb / elapsed : 0) << " MB/s)" << dendl;
+}
+
 
 // ------------------------------------
 
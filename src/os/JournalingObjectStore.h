@@ -104,10 +104,15 @@ protected:
 
   bool replaying;
 
+  /// applies independent replayed entries concurrently
+  class Replayer;
+
 protected:
   void journal_start();
   void journal_stop();
   int journal_replay(uint64_t fs_op_seq);
+  void log_replay_progress(uint64_t entries, uint64_t bytes, utime_t start,
+			   bool done);
 
   void _op_journal_transactions(list<ObjectStore::Transaction*>& tls, uint64_t op,
 				Context *onjournal, TrackedOpRef osd_op);
@@ -0,0 +1,15 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "KeyValueDB.h"
+#include "LevelDBStore.h"
+#include "MemDBStore.h"
+
+KeyValueDB *KeyValueDB::create(CephContext *cct, const string &type,
+			       const string &dir)
+{
+  if (type == "leveldb")
+    return new LevelDBStore(dir, cct);
+  if (type == "memdb")
+    return new MemDBStore(dir);
+  return NULL;
+}
@@ -12,6 +12,8 @@
 #include "ObjectMap.h"
 
 using std::string;
+class CephContext;
+
 /**
  * Defines virtual interface to be implemented by key value store
  *
@@ -64,6 +66,18 @@ public:
   };
   typedef std::tr1::shared_ptr< TransactionImpl > Transaction;
 
+  /**
+   * Create a store of the given type
+   *
+   * @param type [in] "leveldb" or "memdb"
+   * @return NULL if type is unknown
+   */
+  static KeyValueDB *create(CephContext *cct, const string &type,
+			    const string &dir);
+
+  /// Opens the store; call before anything else
+  virtual int init(ostream &out) = 0;
+
   virtual Transaction get_transaction() = 0;
   virtual int submit_transaction(Transaction) = 0;
   virtual int submit_transaction_sync(Transaction t) {
@@ -329,6 +329,9 @@ protected:
     const string &attr_name	///< [in] attr to remove
     ); ///< @return Error code, 0 on success
 
+  /// Gets the base path
+  const string &get_base_path(); ///< @return Index base_path
+
 private:
   /* lfn translation functions */
 
@@ -441,9 +444,6 @@ private:
     ); ///< @return Hashed filename.
 
   /* other common methods */
-  /// Gets the base path
-  const string &get_base_path(); ///< @return Index base_path
-
   /// Get full path the subdir
   string get_full_path_subdir(
     const vector<string> &rel ///< [in] The subdir.
@@ -5,25 +5,250 @@
 #include <set>
 #include <map>
 #include <string>
+#include <sstream>
 #include <tr1/memory>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
+#include "leveldb/cache.h"
+#ifdef HAVE_LEVELDB_FILTER_POLICY
+#include "leveldb/filter_policy.h"
+#endif
 #include <errno.h>
+#include <stdio.h>
+#include "common/admin_socket.h"
+#include "common/ceph_context.h"
+#include "common/config.h"
+#include "common/perf_counters.h"
+#include "common/Clock.h"
+#include "common/debug.h"
 using std::string;
 
+/// writes taking longer than this are counted as stalls
+static const double STALL_THRESHOLD = 0.01;
+
+class LevelDBSocketHook : public AdminSocketHook {
+  LevelDBStore *store;
+public:
+  LevelDBSocketHook(LevelDBStore *s) : store(s) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter f(true);
+    store->dump_stats(&f);
+    f.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+LevelDBStore::LevelDBStore(const string &path, CephContext *cct)
+  : cct(cct), path(path), logger(NULL), asok_hook(NULL),
+    stats_lock("LevelDBStore::stats_lock")
+{
+  if (cct) {
+    options.write_buffer_size = cct->_conf->leveldb_write_buffer_size;
+    options.cache_size = cct->_conf->leveldb_cache_size;
+    options.bloom_size = cct->_conf->leveldb_bloom_size;
+    options.max_open_files = cct->_conf->leveldb_max_open_files;
+    options.compression_enabled = cct->_conf->leveldb_compression;
+    options.paranoid = cct->_conf->leveldb_paranoid;
+  }
+}
+
+LevelDBStore::~LevelDBStore()
+{
+  if (asok_hook) {
+    cct->get_admin_socket()->unregister_command(asok_command);
+    delete asok_hook;
+  }
+  if (logger) {
+    cct->get_perfcounters_collection()->remove(logger);
+    delete logger;
+  }
+}
+
 int LevelDBStore::init(ostream &out)
 {
-  leveldb::Options options;
-  options.create_if_missing = true;
+  leveldb::Options ldoptions;
+  ldoptions.create_if_missing = true;
+  if (options.write_buffer_size)
+    ldoptions.write_buffer_size = options.write_buffer_size;
+  if (options.max_open_files)
+    ldoptions.max_open_files = options.max_open_files;
+  if (options.cache_size) {
+    db_cache.reset(leveldb::NewLRUCache(options.cache_size));
+    ldoptions.block_cache = db_cache.get();
+  }
+  if (options.bloom_size) {
+#ifdef HAVE_LEVELDB_FILTER_POLICY
+    filter_policy.reset(leveldb::NewBloomFilterPolicy(options.bloom_size));
+    ldoptions.filter_policy = filter_policy.get();
+#else
+    if (cct)
+      lgeneric_derr(cct) << "leveldb: this leveldb has no bloom filters, "
+			 << "ignoring leveldb_bloom_size" << dendl;
+#endif
+  }
+  if (!options.compression_enabled)
+    ldoptions.compression = leveldb::kNoCompression;
+  ldoptions.paranoid_checks = options.paranoid;
+
   leveldb::DB *_db;
-  leveldb::Status status = leveldb::DB::Open(options, path, &_db);
+  leveldb::Status status = leveldb::DB::Open(ldoptions, path, &_db);
   db.reset(_db);
   if (!status.ok()) {
     out << status.ToString() << std::endl;
     return -EINVAL;
-  } else
-    return 0;
+  }
+
+  if (cct && !logger) {
+    PerfCountersBuilder plb(cct, "leveldb", l_leveldb_first, l_leveldb_last);
+    plb.add_u64_counter(l_leveldb_gets, "leveldb_get");
+    plb.add_u64_counter(l_leveldb_txns, "leveldb_transaction");
+    plb.add_time_avg(l_leveldb_submit_latency, "leveldb_submit_latency");
+    plb.add_time_avg(l_leveldb_submit_sync_latency, "leveldb_submit_sync_latency");
+    plb.add_time_avg(l_leveldb_stall, "leveldb_write_stall");
+    plb.add_u64(l_leveldb_files, "leveldb_files");
+    plb.add_u64(l_leveldb_bytes, "leveldb_bytes");
+    plb.add_u64(l_leveldb_level0_files, "leveldb_level0_files");
+    plb.add_u64(l_leveldb_level0_bytes, "leveldb_level0_bytes");
+    plb.add_u64(l_leveldb_level1_bytes, "leveldb_level1_bytes");
+    plb.add_u64(l_leveldb_level2_bytes, "leveldb_level2_bytes");
+    plb.add_u64(l_leveldb_level3_bytes, "leveldb_level3_bytes");
+    plb.add_u64(l_leveldb_level4_bytes, "leveldb_level4_bytes");
+    plb.add_u64(l_leveldb_level5_bytes, "leveldb_level5_bytes");
+    plb.add_u64(l_leveldb_level6_bytes, "leveldb_level6_bytes");
+    plb.add_u64(l_leveldb_compact_time, "leveldb_compact_seconds");
+    plb.add_u64(l_leveldb_compact_read_bytes, "leveldb_compact_read_bytes");
+    plb.add_u64(l_leveldb_compact_write_bytes, "leveldb_compact_write_bytes");
+    logger = plb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(logger);
+    update_stats(true);
+
+    asok_command = "dump_leveldb";
+    asok_hook = new LevelDBSocketHook(this);
+    int r = cct->get_admin_socket()->register_command(
+      asok_command, asok_hook, "show leveldb level sizes and compaction stats");
+    if (r < 0) {
+      delete asok_hook;
+      asok_hook = NULL;
+    }
+  }
+  return 0;
+}
+
+int LevelDBStore::_submit(LevelDBTransactionImpl *t, bool sync)
+{
+  utime_t start;
+  if (logger)
+    start = ceph_clock_now(cct);
+  leveldb::WriteOptions woptions;
+  woptions.sync = sync;
+  leveldb::Status s = db->Write(woptions, &(t->bat));
+  if (logger) {
+    utime_t lat = ceph_clock_now(cct) - start;
+    logger->inc(l_leveldb_txns);
+    logger->tinc(sync ? l_leveldb_submit_sync_latency : l_leveldb_submit_latency, lat);
+    if ((double)lat > STALL_THRESHOLD)
+      logger->tinc(l_leveldb_stall, lat);
+    update_stats();
+  }
+  return s.ok() ? 0 : -1;
+}
+
+int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
+{
+  return _submit(static_cast<LevelDBTransactionImpl *>(t.get()), false);
+}
+
+int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  return _submit(static_cast<LevelDBTransactionImpl *>(t.get()), true);
+}
+
+void LevelDBStore::get_level_stats(vector<LevelStats> *levels)
+{
+  string stats;
+  if (!db->GetProperty("leveldb.stats", &stats))
+    return;
+  // rows after the header look like
+  //   "  1        5        9         0        0         9"
+  // for each level with files or compaction history
+  std::istringstream in(stats);
+  string line;
+  while (std::getline(in, line)) {
+    LevelStats l;
+    if (sscanf(line.c_str(), "%d %d %lf %lf %lf %lf",
+	       &l.level, &l.files, &l.size_mb, &l.compact_sec,
+	       &l.read_mb, &l.write_mb) == 6)
+      levels->push_back(l);
+  }
+}
+
+void LevelDBStore::update_stats(bool force)
+{
+  Mutex::Locker l(stats_lock);
+  utime_t now = ceph_clock_now(cct);
+  if (!force && now - stats_stamp < utime_t(1, 0))
+    return;
+  stats_stamp = now;
+
+  vector<LevelStats> levels;
+  get_level_stats(&levels);
+  uint64_t files = 0, bytes = 0, compact_sec = 0, read = 0, written = 0;
+  uint64_t level_bytes[7] = { 0, 0, 0, 0, 0, 0, 0 };
+  uint64_t level0_files = 0;
+  for (vector<LevelStats>::iterator p = levels.begin(); p != levels.end(); ++p) {
+    uint64_t b = p->size_mb * (1 << 20);
+    files += p->files;
+    bytes += b;
+    compact_sec += p->compact_sec;
+    read += p->read_mb * (1 << 20);
+    written += p->write_mb * (1 << 20);
+    if (p->level >= 0 && p->level < 7)
+      level_bytes[p->level] = b;
+    if (p->level == 0)
+      level0_files = p->files;
+  }
+  logger->set(l_leveldb_files, files);
+  logger->set(l_leveldb_bytes, bytes);
+  logger->set(l_leveldb_level0_files, level0_files);
+  for (int i = 0; i < 7; ++i)
+    logger->set(l_leveldb_level0_bytes + i, level_bytes[i]);
+  logger->set(l_leveldb_compact_time, compact_sec);
+  logger->set(l_leveldb_compact_read_bytes, read);
+  logger->set(l_leveldb_compact_write_bytes, written);
+}
+
+void LevelDBStore::dump_stats(Formatter *f)
+{
+  if (logger)
+    update_stats(true);
+  f->open_object_section("leveldb");
+  f->dump_string("path", path);
+  f->open_object_section("options");
+  f->dump_unsigned("write_buffer_size", options.write_buffer_size);
+  f->dump_unsigned("cache_size", options.cache_size);
+  f->dump_int("bloom_size", options.bloom_size);
+  f->dump_int("max_open_files", options.max_open_files);
+  f->dump_int("compression", options.compression_enabled);
+  f->dump_int("paranoid", options.paranoid);
+  f->close_section();
+  vector<LevelStats> levels;
+  get_level_stats(&levels);
+  f->open_array_section("levels");
+  for (vector<LevelStats>::iterator p = levels.begin(); p != levels.end(); ++p) {
+    f->open_object_section("level");
+    f->dump_int("level", p->level);
+    f->dump_int("files", p->files);
+    f->dump_float("size_mb", p->size_mb);
+    f->dump_float("compact_seconds", p->compact_sec);
+    f->dump_float("compact_read_mb", p->read_mb);
+    f->dump_float("compact_write_mb", p->write_mb);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
 }
 
 void LevelDBStore::LevelDBTransactionImpl::set(
@@ -66,6 +291,8 @@ int LevelDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  if (logger)
+    logger->inc(l_leveldb_gets);
   KeyValueDB::Iterator it = get_iterator(prefix);
   for (std::set<string>::const_iterator i = keys.begin();
        i != keys.end();
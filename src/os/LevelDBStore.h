@@ -14,19 +14,88 @@
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
 #include "leveldb/slice.h"
+#include "leveldb/cache.h"
+#ifdef HAVE_LEVELDB_FILTER_POLICY
+#include "leveldb/filter_policy.h"
+#endif
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+
+class CephContext;
+class PerfCounters;
+class AdminSocketHook;
+
+enum {
+  l_leveldb_first = 34300,
+  l_leveldb_gets,
+  l_leveldb_txns,
+  l_leveldb_submit_latency,
+  l_leveldb_submit_sync_latency,
+  l_leveldb_stall,
+  l_leveldb_files,
+  l_leveldb_bytes,
+  l_leveldb_level0_files,
+  l_leveldb_level0_bytes,
+  l_leveldb_level1_bytes,
+  l_leveldb_level2_bytes,
+  l_leveldb_level3_bytes,
+  l_leveldb_level4_bytes,
+  l_leveldb_level5_bytes,
+  l_leveldb_level6_bytes,
+  l_leveldb_compact_time,
+  l_leveldb_compact_read_bytes,
+  l_leveldb_compact_write_bytes,
+  l_leveldb_last,
+};
 
 /**
  * Uses LevelDB to implement the KeyValueDB interface
  */
 class LevelDBStore : public KeyValueDB {
+  CephContext *cct;
   string path;
+  // the db refers to these, so they must outlive it
+  boost::scoped_ptr<leveldb::Cache> db_cache;
+#ifdef HAVE_LEVELDB_FILTER_POLICY
+  boost::scoped_ptr<const leveldb::FilterPolicy> filter_policy;
+#endif
   boost::scoped_ptr<leveldb::DB> db;
+
+  PerfCounters *logger;
+  AdminSocketHook *asok_hook;
+  string asok_command;
+
+  Mutex stats_lock;
+  utime_t stats_stamp;
+
 public:
-  LevelDBStore(const string &path) : path(path) {}
+  /// Tuning, read before init(); zeros leave leveldb's own defaults
+  struct options_t {
+    uint64_t write_buffer_size;
+    uint64_t cache_size;     ///< shared LRU block cache
+    int bloom_size;          ///< bloom filter bits per key, 0 for none
+    int max_open_files;
+    bool compression_enabled;
+    bool paranoid;
+
+    options_t() :
+      write_buffer_size(0), cache_size(0), bloom_size(0), max_open_files(0),
+      compression_enabled(true), paranoid(false) {}
+  } options;
+
+  /**
+   * @param cct [in] if set, take options from its config, and publish
+   *                 perf counters and a dump_leveldb admin socket command
+   */
+  LevelDBStore(const string &path, CephContext *cct = NULL);
+  ~LevelDBStore();
 
   /// Opens underlying db
   int init(ostream &out);
 
+  /// Level sizes, compaction totals and our options
+  void dump_stats(Formatter *f);
+
   class LevelDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     leveldb::WriteBatch bat;
@@ -52,21 +121,8 @@ public:
       new LevelDBTransactionImpl(this));
   }
 
-  int submit_transaction(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
-
-  int submit_transaction_sync(KeyValueDB::Transaction t) {
-    LevelDBTransactionImpl * _t =
-      static_cast<LevelDBTransactionImpl *>(t.get());
-    leveldb::WriteOptions options;
-    options.sync = true;
-    leveldb::Status s = db->Write(options, &(_t->bat));
-    return s.ok() ? 0 : -1;
-  }
+  int submit_transaction(KeyValueDB::Transaction t);
+  int submit_transaction_sync(KeyValueDB::Transaction t);
 
   int get(
     const string &prefix,
@@ -182,6 +238,17 @@ public:
     return limit;
   }
 
+private:
+  struct LevelStats {
+    int level, files;
+    double size_mb, compact_sec, read_mb, write_mb;
+  };
+  /// parse the leveldb.stats property
+  void get_level_stats(vector<LevelStats> *levels);
+  /// refresh the perf counters from leveldb at most once a second
+  void update_stats(bool force = false);
+  int _submit(LevelDBTransactionImpl *t, bool sync);
+
 protected:
   WholeSpaceIterator _get_iterator() {
     return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
@@ -0,0 +1,112 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "ListingCache.h"
+
+ListingCache::ListingCache(size_t max_objects)
+  : lock("ListingCache::lock"),
+    max_objects(max_objects), size(0),
+    hits(0), misses(0), evictions(0)
+{}
+
+void ListingCache::_remove(map<key_t, Entry>::iterator p)
+{
+  lru.erase(p->second.lru_pos);
+  size -= p->second.size;
+  entries.erase(p);
+}
+
+void ListingCache::_trim()
+{
+  while (!lru.empty() && size > max_objects) {
+    evictions++;
+    _remove(entries.find(lru.back()));
+  }
+}
+
+void ListingCache::set_max_objects(size_t m)
+{
+  Mutex::Locker l(lock);
+  max_objects = m;
+  _trim();
+}
+
+ListingCache::ListingRef ListingCache::lookup(const coll_t& c,
+					      const vector<string>& path)
+{
+  Mutex::Locker l(lock);
+  map<key_t, Entry>::iterator p = entries.find(key_t(c, path));
+  if (p == entries.end()) {
+    misses++;
+    return ListingRef();
+  }
+  hits++;
+  lru.splice(lru.begin(), lru, p->second.lru_pos);
+  return p->second.listing;
+}
+
+void ListingCache::add(const coll_t& c, const vector<string>& path,
+		       ListingRef listing)
+{
+  Mutex::Locker l(lock);
+  // count the directory itself, so empty ones still take up room
+  size_t s = listing->objects.size() + listing->subdirs.size() + 1;
+  if (s > max_objects)
+    return;
+  key_t key(c, path);
+  map<key_t, Entry>::iterator p = entries.find(key);
+  if (p != entries.end())
+    _remove(p);
+  lru.push_front(key);
+  Entry &e = entries[key];
+  e.listing = listing;
+  e.size = s;
+  e.lru_pos = lru.begin();
+  size += s;
+  _trim();
+}
+
+void ListingCache::invalidate(const coll_t& c, const vector<string>& path)
+{
+  Mutex::Locker l(lock);
+  map<key_t, Entry>::iterator p = entries.find(key_t(c, path));
+  if (p != entries.end())
+    _remove(p);
+}
+
+void ListingCache::clear_collection(const coll_t& c)
+{
+  Mutex::Locker l(lock);
+  // the empty path sorts first among c's directories
+  map<key_t, Entry>::iterator p = entries.lower_bound(key_t(c, vector<string>()));
+  while (p != entries.end() && p->first.first == c)
+    _remove(p++);
+}
+
+void ListingCache::clear_all()
+{
+  Mutex::Locker l(lock);
+  while (!lru.empty())
+    _remove(entries.find(lru.front()));
+}
+
+uint64_t ListingCache::get_hits()
+{
+  Mutex::Locker l(lock);
+  return hits;
+}
+
+uint64_t ListingCache::get_misses()
+{
+  Mutex::Locker l(lock);
+  return misses;
+}
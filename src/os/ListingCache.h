@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_LISTINGCACHE_H
+#define CEPH_LISTINGCACHE_H
+
+#include <list>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <tr1/memory>
+
+#include "common/Mutex.h"
+#include "osd/osd_types.h"
+#include "hobject.h"
+
+/**
+ * LRU cache of collection directory listings
+ *
+ * An entry holds the objects (in hobject_t order) and subdirectories of
+ * one directory of a collection, as the index read them from disk, so
+ * that paging through a collection with collection_list_partial()
+ * doesn't readdir, sort and demangle the same directories for every
+ * chunk.
+ *
+ * The cache does no locking against the index: callers fill and
+ * invalidate entries for a collection only while holding its index
+ * (see IndexManager), and must invalidate a directory whenever an
+ * object is created in or removed from it, and the whole collection
+ * whenever directories are split, merged or moved.
+ *
+ * The size limit is in objects; entries are immutable once added and
+ * are handed out by reference, so an entry evicted while in use stays
+ * valid for its user.
+ */
+class ListingCache {
+public:
+  struct Listing {
+    vector<hobject_t> objects;  ///< sorted
+    set<string> subdirs;
+  };
+  typedef std::tr1::shared_ptr<const Listing> ListingRef;
+
+private:
+  typedef pair<coll_t, vector<string> > key_t;
+  struct Entry {
+    ListingRef listing;
+    size_t size;
+    std::list<key_t>::iterator lru_pos;
+  };
+
+  Mutex lock;
+  size_t max_objects;
+  size_t size;
+  map<key_t, Entry> entries;
+  std::list<key_t> lru;  ///< hottest first
+  uint64_t hits, misses, evictions;
+
+  void _remove(map<key_t, Entry>::iterator p);
+  void _trim();
+
+public:
+  ListingCache(size_t max_objects);
+
+  void set_max_objects(size_t m);
+  bool enabled() {
+    Mutex::Locker l(lock);
+    return max_objects > 0;
+  }
+
+  /// @return the cached listing of path in c, or NULL
+  ListingRef lookup(const coll_t& c, const vector<string>& path);
+  /// cache the listing of path in c
+  void add(const coll_t& c, const vector<string>& path, ListingRef listing);
+
+  /// an object was created in or removed from path
+  void invalidate(const coll_t& c, const vector<string>& path);
+  void clear_collection(const coll_t& c);
+  void clear_all();
+
+  uint64_t get_hits();
+  uint64_t get_misses();
+};
+
+#endif
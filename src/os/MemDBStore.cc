@@ -0,0 +1,311 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "MemDBStore.h"
+
+#include <set>
+#include <map>
+#include <string>
+#include <tr1/memory>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "include/ceph_hash.h"
+#include "include/encoding.h"
+#include "common/errno.h"
+using std::string;
+
+MemDBStore::MemDBStore(const string &path, unsigned num_stripes)
+  : path(path), save_lock("MemDBStore::save_lock"), loaded(false)
+{
+  assert(num_stripes > 0);
+  for (unsigned i = 0; i < num_stripes; ++i)
+    stripes.push_back(new Stripe);
+}
+
+MemDBStore::~MemDBStore()
+{
+  // don't overwrite a snapshot we failed to load
+  if (loaded && !path.empty())
+    save();
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    delete stripes[i];
+}
+
+unsigned MemDBStore::stripe_of(const string &prefix) const
+{
+  return ceph_str_hash_linux(prefix.data(), prefix.length()) % stripes.size();
+}
+
+void MemDBStore::lock_all_read()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->lock.get_read();
+}
+
+void MemDBStore::unlock_all()
+{
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    stripes[i]->lock.unlock();
+}
+
+int MemDBStore::init(ostream &out)
+{
+  if (!path.empty()) {
+    if (::mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+      int r = -errno;
+      out << "unable to create " << path << ": " << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    int r = load(out);
+    if (r < 0)
+      return r;
+  }
+  loaded = true;
+  return 0;
+}
+
+int MemDBStore::load(ostream &out)
+{
+  string fn = snapshot_file();
+  bufferlist bl;
+  string error;
+  int r = bl.read_file(fn.c_str(), &error);
+  if (r == -ENOENT)
+    return 0;
+  if (r < 0) {
+    out << "unable to read " << fn << ": " << error << std::endl;
+    return r;
+  }
+
+  map_t all;
+  try {
+    bufferlist::iterator p = bl.begin();
+    DECODE_START(1, p);
+    ::decode(all, p);
+    DECODE_FINISH(p);
+  } catch (buffer::error& e) {
+    out << "unable to decode " << fn << ": " << e.what() << std::endl;
+    return -EINVAL;
+  }
+
+  for (map_t::iterator i = all.begin(); i != all.end(); ++i)
+    stripes[stripe_of(i->first.first)]->data.insert(*i);
+  return 0;
+}
+
+int MemDBStore::save()
+{
+  Mutex::Locker l(save_lock);
+  map_t all;
+  copy_all(&all);
+
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  ::encode(all, bl);
+  ENCODE_FINISH(bl);
+
+  // write a new file and rename it over the old one, so a crash leaves
+  // one or the other
+  string fn = snapshot_file();
+  string tmp = fn + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    return -errno;
+  int r = bl.write_fd(fd);
+  if (r == 0 && ::fsync(fd) < 0)
+    r = -errno;
+  ::close(fd);
+  if (r == 0 && ::rename(tmp.c_str(), fn.c_str()) < 0)
+    r = -errno;
+  return r;
+}
+
+void MemDBStore::copy_all(map_t *out)
+{
+  lock_all_read();
+  for (unsigned i = 0; i < stripes.size(); ++i)
+    out->insert(stripes[i]->data.begin(), stripes[i]->data.end());
+  unlock_all();
+}
+
+void MemDBStore::MemDBTransactionImpl::set(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  ops.push_back(Op(OP_SET, prefix, k));
+  ops.back().bl = to_set_bl;
+  stripes.insert(db->stripe_of(prefix));
+}
+
+void MemDBStore::MemDBTransactionImpl::rmkey(const string &prefix,
+					     const string &k)
+{
+  ops.push_back(Op(OP_RMKEY, prefix, k));
+  stripes.insert(db->stripe_of(prefix));
+}
+
+void MemDBStore::MemDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
+{
+  ops.push_back(Op(OP_RMPREFIX, prefix, string()));
+  stripes.insert(db->stripe_of(prefix));
+}
+
+int MemDBStore::submit_transaction(KeyValueDB::Transaction t)
+{
+  MemDBTransactionImpl * _t =
+    static_cast<MemDBTransactionImpl *>(t.get());
+
+  // std::set iterates in order, so concurrent submits can't deadlock
+  for (std::set<unsigned>::iterator i = _t->stripes.begin();
+       i != _t->stripes.end();
+       ++i)
+    stripes[*i]->lock.get_write();
+
+  for (std::list<MemDBTransactionImpl::Op>::iterator i = _t->ops.begin();
+       i != _t->ops.end();
+       ++i) {
+    map_t &data = stripes[stripe_of(i->prefix)]->data;
+    switch (i->type) {
+    case MemDBTransactionImpl::OP_SET:
+      data[key_t(i->prefix, i->key)] = i->bl;
+      break;
+    case MemDBTransactionImpl::OP_RMKEY:
+      data.erase(key_t(i->prefix, i->key));
+      break;
+    case MemDBTransactionImpl::OP_RMPREFIX:
+      {
+	string limit = i->prefix;
+	limit.push_back(0);
+	data.erase(data.lower_bound(key_t(i->prefix, "")),
+		   data.lower_bound(key_t(limit, "")));
+      }
+      break;
+    }
+  }
+
+  for (std::set<unsigned>::iterator i = _t->stripes.begin();
+       i != _t->stripes.end();
+       ++i)
+    stripes[*i]->lock.unlock();
+  return 0;
+}
+
+int MemDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
+{
+  int r = submit_transaction(t);
+  if (r == 0 && !path.empty())
+    r = save();
+  return r;
+}
+
+int MemDBStore::get(
+  const string &prefix,
+  const std::set<string> &keys,
+  std::map<string, bufferlist> *out)
+{
+  Stripe *s = stripes[stripe_of(prefix)];
+  s->lock.get_read();
+  for (std::set<string>::const_iterator i = keys.begin();
+       i != keys.end();
+       ++i) {
+    map_t::iterator p = s->data.find(key_t(prefix, *i));
+    if (p != s->data.end())
+      out->insert(make_pair(*i, p->second));
+  }
+  s->lock.unlock();
+  return 0;
+}
+
+bool MemDBStore::find_next(const key_t &k, bool inclusive,
+			   key_t *out, bufferlist *val)
+{
+  // the next key in k's own prefix can only be in k's stripe
+  unsigned home = stripe_of(k.first);
+  bool found = false;
+  key_t best;
+  bufferlist best_val;
+  for (unsigned n = 0; n <= stripes.size(); ++n) {
+    unsigned i = n == 0 ? home : n - 1;
+    if (n > 0 && i == home)
+      continue;
+    Stripe *s = stripes[i];
+    s->lock.get_read();
+    map_t::iterator p = inclusive ?
+      s->data.lower_bound(k) : s->data.upper_bound(k);
+    if (p != s->data.end() && (!found || p->first < best)) {
+      found = true;
+      best = p->first;
+      best_val = p->second;
+    }
+    s->lock.unlock();
+    if (n == 0 && found && best.first == k.first)
+      break;
+  }
+  if (found) {
+    *out = best;
+    *val = best_val;
+  }
+  return found;
+}
+
+bool MemDBStore::find_prev(const key_t &k, key_t *out, bufferlist *val)
+{
+  unsigned home = stripe_of(k.first);
+  bool found = false;
+  key_t best;
+  bufferlist best_val;
+  for (unsigned n = 0; n <= stripes.size(); ++n) {
+    unsigned i = n == 0 ? home : n - 1;
+    if (n > 0 && i == home)
+      continue;
+    Stripe *s = stripes[i];
+    s->lock.get_read();
+    map_t::iterator p = s->data.lower_bound(k);
+    if (p != s->data.begin()) {
+      --p;
+      if (!found || best < p->first) {
+	found = true;
+	best = p->first;
+	best_val = p->second;
+      }
+    }
+    s->lock.unlock();
+    if (n == 0 && found && best.first == k.first)
+      break;
+  }
+  if (found) {
+    *out = best;
+    *val = best_val;
+  }
+  return found;
+}
+
+bool MemDBStore::find_last(key_t *out, bufferlist *val)
+{
+  bool found = false;
+  for (unsigned i = 0; i < stripes.size(); ++i) {
+    Stripe *s = stripes[i];
+    s->lock.get_read();
+    if (!s->data.empty()) {
+      map_t::reverse_iterator p = s->data.rbegin();
+      if (!found || *out < p->first) {
+	found = true;
+	*out = p->first;
+	*val = p->second;
+      }
+    }
+    s->lock.unlock();
+  }
+  return found;
+}
+
+KeyValueDB::WholeSpaceIterator MemDBStore::_get_snapshot_iterator()
+{
+  std::tr1::shared_ptr<MemDBStore> snap(new MemDBStore(string(), 1));
+  copy_all(&snap->stripes[0]->data);
+  return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+    new MemDBWholeSpaceIteratorImpl(snap.get(), snap));
+}
@@ -0,0 +1,208 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef MEM_DB_STORE_H
+#define MEM_DB_STORE_H
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "KeyValueDB.h"
+#include <set>
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+#include "common/Mutex.h"
+#include "common/RWLock.h"
+
+/**
+ * Implements the KeyValueDB interface in memory
+ *
+ * Keys are kept sorted in a number of stripes, each behind its own
+ * RWLock; all keys with a given prefix live in the same stripe, so
+ * DBObjectMap operations on different objects mostly don't contend.
+ * Transactions take the write locks of every stripe they touch (in
+ * stripe order) and are applied atomically with respect to get() and
+ * to snapshot iterators.
+ *
+ * Plain iterators don't pin a version of the store: each step looks
+ * up the next key under the stripe locks, so they see writes made
+ * while they are open but never an invalidated position.  Snapshot
+ * iterators work on a copy of the store (values are shared, not
+ * copied).
+ *
+ * If a path is given, init() loads the store from a snapshot file
+ * there and submit_transaction_sync() and the destructor rewrite it,
+ * so only synced transactions survive a crash.  Each sync writes the
+ * whole store, so this is meant for tests and benchmarks, not large
+ * stores.
+ */
+class MemDBStore : public KeyValueDB {
+public:
+  typedef pair<string,string> key_t;
+  typedef std::map<key_t, bufferlist> map_t;
+
+private:
+  struct Stripe {
+    RWLock lock;
+    map_t data;
+    Stripe() : lock("MemDBStore::Stripe::lock") {}
+  };
+
+  string path;
+  std::vector<Stripe*> stripes;
+  Mutex save_lock;  ///< serializes snapshot file writes
+  bool loaded;      ///< init() succeeded, so we may write the snapshot
+
+  unsigned stripe_of(const string &prefix) const;
+  void lock_all_read();
+  void unlock_all();
+
+  /// smallest key >= k (> k if !inclusive); @return false if none
+  bool find_next(const key_t &k, bool inclusive,
+		 key_t *out, bufferlist *val);
+  /// largest key < k; @return false if none
+  bool find_prev(const key_t &k, key_t *out, bufferlist *val);
+  /// largest key in the store; @return false if empty
+  bool find_last(key_t *out, bufferlist *val);
+
+  /// copy of the whole store, taken atomically
+  void copy_all(map_t *out);
+
+  string snapshot_file() const {
+    return path + "/memdb.snap";
+  }
+  int load(ostream &out);
+  int save();
+
+public:
+  /**
+   * @param path [in] directory for the snapshot file, empty for none
+   * @param num_stripes [in] number of independently locked stripes
+   */
+  MemDBStore(const string &path, unsigned num_stripes = 16);
+  ~MemDBStore();
+
+  /// Loads the snapshot file, if any
+  int init(ostream &out);
+
+  class MemDBTransactionImpl : public KeyValueDB::TransactionImpl {
+  public:
+    enum op_type_t { OP_SET, OP_RMKEY, OP_RMPREFIX };
+    struct Op {
+      op_type_t type;
+      string prefix, key;
+      bufferlist bl;
+      Op(op_type_t t, const string &p, const string &k)
+	: type(t), prefix(p), key(k) {}
+    };
+    std::list<Op> ops;
+    std::set<unsigned> stripes;  ///< stripes ops touch
+    MemDBStore *db;
+
+    MemDBTransactionImpl(MemDBStore *db) : db(db) {}
+    void set(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
+    void rmkey(
+      const string &prefix,
+      const string &k);
+    void rmkeys_by_prefix(
+      const string &prefix
+      );
+  };
+
+  KeyValueDB::Transaction get_transaction() {
+    return std::tr1::shared_ptr< MemDBTransactionImpl >(
+      new MemDBTransactionImpl(this));
+  }
+
+  int submit_transaction(KeyValueDB::Transaction t);
+  int submit_transaction_sync(KeyValueDB::Transaction t);
+
+  int get(
+    const string &prefix,
+    const std::set<string> &key,
+    std::map<string, bufferlist> *out
+    );
+
+  class MemDBWholeSpaceIteratorImpl :
+    public KeyValueDB::WholeSpaceIteratorImpl {
+    MemDBStore *db;
+    /// owns db for snapshot iterators
+    std::tr1::shared_ptr<MemDBStore> snap;
+    bool is_valid;
+    key_t cur;
+    bufferlist cur_val;
+  public:
+    MemDBWholeSpaceIteratorImpl(MemDBStore *db,
+				std::tr1::shared_ptr<MemDBStore> snap =
+				std::tr1::shared_ptr<MemDBStore>()) :
+      db(db), snap(snap), is_valid(false) { }
+
+    int seek_to_first() {
+      is_valid = db->find_next(key_t(), true, &cur, &cur_val);
+      return 0;
+    }
+    int seek_to_first(const string &prefix) {
+      is_valid = db->find_next(key_t(prefix, ""), true, &cur, &cur_val);
+      return 0;
+    }
+    int seek_to_last() {
+      is_valid = db->find_last(&cur, &cur_val);
+      return 0;
+    }
+    int seek_to_last(const string &prefix) {
+      // (prefix + '\0', "") sorts after every key in prefix and before
+      // every key in any later prefix
+      string limit = prefix;
+      limit.push_back(0);
+      is_valid = db->find_prev(key_t(limit, ""), &cur, &cur_val);
+      return 0;
+    }
+    int upper_bound(const string &prefix, const string &after) {
+      is_valid = db->find_next(key_t(prefix, after), false, &cur, &cur_val);
+      return 0;
+    }
+    int lower_bound(const string &prefix, const string &to) {
+      is_valid = db->find_next(key_t(prefix, to), true, &cur, &cur_val);
+      return 0;
+    }
+    bool valid() {
+      return is_valid;
+    }
+    int next() {
+      if (is_valid)
+	is_valid = db->find_next(cur, false, &cur, &cur_val);
+      return 0;
+    }
+    int prev() {
+      if (is_valid)
+	is_valid = db->find_prev(cur, &cur, &cur_val);
+      return 0;
+    }
+    string key() {
+      return is_valid ? cur.second : string();
+    }
+    pair<string,string> raw_key() {
+      return is_valid ? cur : key_t();
+    }
+    bufferlist value() {
+      return is_valid ? cur_val : bufferlist();
+    }
+    int status() {
+      return 0;
+    }
+  };
+
+protected:
+  WholeSpaceIterator _get_iterator() {
+    return std::tr1::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new MemDBWholeSpaceIteratorImpl(this));
+  }
+
+  WholeSpaceIterator _get_snapshot_iterator();
+};
+
+#endif
@@ -88,6 +88,20 @@ public:
     set<string> *out                   ///< [out] Subset of keys defined on hoid
     ) = 0;
 
+  /**
+   * Get keys and values in order, starting after start_after
+   *
+   * Stops before the entry that would take the keys and values returned
+   * past max_bytes, but always returns at least one entry if any are left.
+   */
+  virtual int get_vals_range(
+    const hobject_t &hoid,             ///< [in] object containing map
+    const string &start_after,         ///< [in] return keys after this
+    uint64_t max_bytes,                ///< [in] byte budget
+    map<string, bufferlist> *out,      ///< [out] Returned keys and values
+    bool *more                         ///< [out] true if keys remain
+    ) = 0;
+
   /// Get xattrs
   virtual int get_xattrs(
     const hobject_t &hoid,             ///< [in] object
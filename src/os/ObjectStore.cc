@@ -20,6 +20,194 @@ ostream& operator<<(ostream& out, const ObjectStore::Sequencer& s)
   return out << "osr(" << s.get_name() << " " << &s << ")";
 }
 
+template <typename T>
+static bool sets_intersect(const set<T>& a, const set<T>& b)
+{
+  typename set<T>::const_iterator p = a.begin(), q = b.begin();
+  while (p != a.end() && q != b.end()) {
+    if (*p < *q)
+      ++p;
+    else if (*q < *p)
+      ++q;
+    else
+      return true;
+  }
+  return false;
+}
+
+bool ObjectStore::Transaction::Footprint::conflicts(const Footprint& o) const
+{
+  return sets_intersect(objects, o.objects) ||
+    sets_intersect(coll_attrs, o.coll_attrs) ||
+    sets_intersect(colls, o.colls) ||
+    sets_intersect(colls, o.object_colls) ||
+    sets_intersect(colls, o.coll_attrs) ||
+    sets_intersect(o.colls, object_colls) ||
+    sets_intersect(o.colls, coll_attrs);
+}
+
+void ObjectStore::Transaction::Footprint::merge(const Footprint& o)
+{
+  objects.insert(o.objects.begin(), o.objects.end());
+  object_colls.insert(o.object_colls.begin(), o.object_colls.end());
+  coll_attrs.insert(o.coll_attrs.begin(), o.coll_attrs.end());
+  colls.insert(o.colls.begin(), o.colls.end());
+}
+
+bool ObjectStore::Transaction::get_footprint(Footprint *fp)
+{
+  // the argument decoding here must stay in step with
+  // FileStore::_do_transaction()
+  iterator i = begin();
+  while (i.have_op()) {
+    int op = i.get_op();
+    switch (op) {
+    case Transaction::OP_NOP:
+      break;
+
+    case Transaction::OP_TOUCH:
+    case Transaction::OP_REMOVE:
+    case Transaction::OP_RMATTRS:
+    case Transaction::OP_COLL_REMOVE:
+    case Transaction::OP_OMAP_CLEAR:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+      }
+      break;
+
+    case Transaction::OP_WRITE:
+    case Transaction::OP_OMAP_SETHEADER:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	if (op == Transaction::OP_WRITE) {
+	  i.get_length();
+	  i.get_length();
+	}
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_ZERO:
+    case Transaction::OP_TRIMCACHE:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	i.get_length();
+	i.get_length();
+      }
+      break;
+
+    case Transaction::OP_TRUNCATE:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	i.get_length();
+      }
+      break;
+
+    case Transaction::OP_SETATTR:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_SETATTRS:
+    case Transaction::OP_OMAP_SETKEYS:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	map<string, bufferlist> aset;
+	i.get_attrset(aset);
+      }
+      break;
+
+    case Transaction::OP_RMATTR:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	i.get_attrname();
+      }
+      break;
+
+    case Transaction::OP_CLONE:
+    case Transaction::OP_CLONERANGE:
+    case Transaction::OP_CLONERANGE2:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	fp->add_object(cid, i.get_oid());
+	if (op != Transaction::OP_CLONE) {
+	  i.get_length();
+	  i.get_length();
+	}
+	if (op == Transaction::OP_CLONERANGE2)
+	  i.get_length();
+      }
+      break;
+
+    case Transaction::OP_MKCOLL:
+    case Transaction::OP_RMCOLL:
+      fp->colls.insert(i.get_cid());
+      break;
+
+    case Transaction::OP_COLL_ADD:
+    case Transaction::OP_COLL_MOVE:
+      {
+	// the object keeps its name in both collections
+	coll_t cid = i.get_cid();
+	coll_t ocid = i.get_cid();
+	hobject_t oid = i.get_oid();
+	fp->add_object(cid, oid);
+	fp->add_object(ocid, oid);
+      }
+      break;
+
+    case Transaction::OP_COLL_SETATTR:
+      {
+	fp->coll_attrs.insert(i.get_cid());
+	i.get_attrname();
+	bufferlist bl;
+	i.get_bl(bl);
+      }
+      break;
+
+    case Transaction::OP_COLL_RMATTR:
+      fp->coll_attrs.insert(i.get_cid());
+      i.get_attrname();
+      break;
+
+    case Transaction::OP_COLL_SETATTRS:
+      {
+	fp->coll_attrs.insert(i.get_cid());
+	map<string, bufferlist> aset;
+	i.get_attrset(aset);
+      }
+      break;
+
+    case Transaction::OP_OMAP_RMKEYS:
+      {
+	coll_t cid = i.get_cid();
+	fp->add_object(cid, i.get_oid());
+	set<string> keys;
+	i.get_keyset(keys);
+      }
+      break;
+
+    default:
+      // OP_STARTSYNC, OP_COLL_RENAME, or something we don't know
+      return false;
+    }
+  }
+  return true;
+}
+
 void ObjectStore::Transaction::dump(ceph::Formatter *f)
 {
   f->open_array_section("ops");
@@ -67,9 +67,66 @@ enum {
   l_os_commit_len,
   l_os_commit_lat,
   l_os_j_full,
+  l_os_j_aio_inflight,
+  l_os_j_aio_inflight_bytes,
+  l_os_j_aio_lat,
+  l_os_j_aio_lat_1ms,
+  l_os_j_aio_lat_10ms,
+  l_os_j_aio_lat_100ms,
+  l_os_j_aio_lat_slow,
+  l_os_j_wr_ents,
+  l_os_j_wr_batch_1,
+  l_os_j_wr_batch_4,
+  l_os_j_wr_batch_16,
+  l_os_j_wr_batch_big,
+  l_os_j_gc_wait,
+  l_os_fdc_hit,
+  l_os_fdc_miss,
+  l_os_fdc_cached,
+  l_os_ac_hit,
+  l_os_ac_miss,
+  l_os_ac_bytes,
+  l_os_commit_lat_10ms,
+  l_os_commit_lat_100ms,
+  l_os_commit_lat_1s,
+  l_os_commit_lat_slow,
+  l_os_commit_syncfs_lat,
+  l_os_commit_fd_lat,
+  l_os_commit_sync_lat,
+  l_os_commit_fd_objects,
+  l_os_commit_fd_full,
+  l_os_commit_bytes,
+  l_os_commit_bytes_1m,
+  l_os_commit_bytes_16m,
+  l_os_commit_bytes_256m,
+  l_os_commit_bytes_big,
+  l_os_wb_dirty,
+  l_os_wb_bytes,
+  l_os_wb_commits,
+  l_os_omap_chain_depth,
+  l_os_omap_flatten_queued,
+  l_os_omap_flatten,
+  l_os_omap_flatten_keys,
+  l_os_omap_flatten_lat,
+  l_os_split,
+  l_os_split_inline,
+  l_os_split_lat,
+  l_os_merge,
+  l_os_split_moved,
+  l_os_lc_hit,
+  l_os_lc_miss,
   l_os_last,
 };
 
+// per FileStore op shard
+enum {
+  l_os_shard_first = 84500,
+  l_os_shard_qlen,
+  l_os_shard_ops,
+  l_os_shard_apply_lat,
+  l_os_shard_last,
+};
+
 
 static inline void encode(const map<string,bufferptr> *attrset, bufferlist &bl) {
   ::encode(*attrset, bl);
@@ -590,6 +647,40 @@ public:
       }
     }
 
+    /**
+     * what transactions touch, as far as ordering them goes
+     *
+     * Object ops are keyed by object name alone, whatever collection
+     * they name it in: collection_add links an object into another
+     * collection under the same name, and omap data is keyed by name
+     * too, so two names for one object always conflict.  Collection
+     * attrs conflict only with each other, and creating or removing a
+     * collection conflicts with everything in it.
+     */
+    struct Footprint {
+      set<hobject_t> objects;    ///< objects, in any collection
+      set<coll_t> object_colls;  ///< collections those are named in
+      set<coll_t> coll_attrs;    ///< collections whose attrs change
+      set<coll_t> colls;         ///< collections created or removed
+
+      void add_object(const coll_t& cid, const hobject_t& oid) {
+	objects.insert(oid);
+	object_colls.insert(cid);
+      }
+      bool conflicts(const Footprint& o) const;
+      void merge(const Footprint& o);
+    };
+
+    /**
+     * add what this transaction touches to a footprint
+     *
+     * @param fp [out] footprint to add to
+     * @return false if some op can't be attributed to objects or
+     * collections (e.g. OP_STARTSYNC), in which case the caller must
+     * not assume the transaction is independent of any other
+     */
+    bool get_footprint(Footprint *fp);
+
     void dump(ceph::Formatter *f);
     static void generate_test_instances(list<Transaction*>& o);
   };
@@ -756,6 +847,25 @@ public:
     set<string> *out         ///< [out] Subset of keys defined on hoid
     ) = 0;
 
+  /**
+   * Get key values in order, starting after start_after
+   *
+   * Returns keys and values until the next one would take the total past
+   * max_bytes (but always at least one), so that large omaps can be read
+   * in pieces without holding an iterator across calls.  Resume from
+   * out->rbegin()->first while *more is set.
+   *
+   * @return zero on success, or negative error
+   */
+  virtual int omap_get_vals_range(
+    coll_t c,                     ///< [in] Collection containing hoid
+    const hobject_t &hoid,        ///< [in] Object containing omap
+    const string &start_after,    ///< [in] Return keys after this
+    uint64_t max_bytes,           ///< [in] Byte budget for keys and values
+    map<string, bufferlist> *out, ///< [out] Returned keys and values
+    bool *more                    ///< [out] True if keys remain
+    ) = 0;
+
   /**
    * Returns an object map iterator
    *
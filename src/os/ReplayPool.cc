@@ -0,0 +1,145 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "ReplayPool.h"
+
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_journal
+#undef dout_prefix
+#define dout_prefix *_dout << "journal "
+
+ReplayPool::ReplayPool(int nthreads, unsigned maxq)
+  : max_queued(MAX(maxq, 1)),
+    lock("ReplayPool::lock"),
+    last_queued(0), barrier_running(false), stopping(false)
+{
+  for (int i = 0; i < nthreads; i++)
+    threads.push_back(new ApplyThread(this));
+}
+
+ReplayPool::~ReplayPool()
+{
+  assert(queue.empty());
+  for (vector<ApplyThread*>::iterator p = threads.begin(); p != threads.end(); ++p)
+    delete *p;
+}
+
+void ReplayPool::start()
+{
+  for (vector<ApplyThread*>::iterator p = threads.begin(); p != threads.end(); ++p)
+    (*p)->create();
+}
+
+void ReplayPool::stop()
+{
+  lock.Lock();
+  stopping = true;
+  cond.SignalAll();
+  lock.Unlock();
+  for (vector<ApplyThread*>::iterator p = threads.begin(); p != threads.end(); ++p)
+    (*p)->join();
+}
+
+void ReplayPool::queue_entry(uint64_t seq, list<ObjectStore::Transaction*>& tls)
+{
+  Entry *e = new Entry;
+  e->seq = seq;
+  e->tls.swap(tls);
+  e->barrier = false;
+  for (list<ObjectStore::Transaction*>::iterator p = e->tls.begin();
+       p != e->tls.end();
+       ++p) {
+    if (!(*p)->get_footprint(&e->fp)) {
+      e->barrier = true;
+      break;
+    }
+  }
+  dout(20) << "replay queue " << seq << (e->barrier ? " barrier" : "")
+	   << " " << e->fp.objects.size() << " objects in "
+	   << e->fp.object_colls << dendl;
+
+  Mutex::Locker l(lock);
+  while (queue.size() >= max_queued)
+    cond.Wait(lock);
+  queue.push_back(e);
+  pending.insert(seq);
+  last_queued = seq;
+  cond.SignalAll();
+}
+
+ReplayPool::Entry *ReplayPool::_get_next()
+{
+  if (barrier_running)
+    return NULL;
+
+  // everything claimed by running entries and earlier waiting ones
+  ObjectStore::Transaction::Footprint blocked;
+  for (std::list<Entry*>::iterator p = running.begin(); p != running.end(); ++p)
+    blocked.merge((*p)->fp);
+
+  for (deque<Entry*>::iterator p = queue.begin(); p != queue.end(); ++p) {
+    Entry *e = *p;
+    if (e->barrier) {
+      if (p == queue.begin() && running.empty()) {
+	queue.pop_front();
+	barrier_running = true;
+	return e;
+      }
+      return NULL;  // nothing may pass a barrier
+    }
+    if (!e->fp.conflicts(blocked)) {
+      queue.erase(p);
+      return e;
+    }
+    blocked.merge(e->fp);
+  }
+  return NULL;
+}
+
+void ReplayPool::apply_entry()
+{
+  lock.Lock();
+  while (true) {
+    Entry *e = _get_next();
+    if (!e) {
+      if (stopping && queue.empty())
+	break;
+      cond.Wait(lock);
+      continue;
+    }
+    std::list<Entry*>::iterator pos = running.insert(running.end(), e);
+    cond.SignalAll();  // the reader may be waiting for room
+    lock.Unlock();
+
+    _apply(e->seq, e->tls);
+
+    lock.Lock();
+    running.erase(pos);
+    if (e->barrier)
+      barrier_running = false;
+    pending.erase(e->seq);
+    uint64_t applied = pending.empty() ? last_queued : *pending.begin() - 1;
+    _finish(applied);
+    cond.SignalAll();
+    lock.Unlock();
+
+    while (!e->tls.empty()) {
+      delete e->tls.front();
+      e->tls.pop_front();
+    }
+    delete e;
+
+    lock.Lock();
+  }
+  lock.Unlock();
+}
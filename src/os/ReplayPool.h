@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_REPLAYPOOL_H
+#define CEPH_REPLAYPOOL_H
+
+#include <deque>
+#include <list>
+#include <set>
+#include <vector>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "ObjectStore.h"
+
+/**
+ * ReplayPool - apply journal entries concurrently, in a safe order
+ *
+ * The replay reader decodes entries and queues them here in journal
+ * order; a few threads apply them.  An entry may start once no earlier
+ * entry it conflicts with (see ObjectStore::Transaction::Footprint) is
+ * queued or running, so every object and collection sees its updates
+ * in the original order, and the replay guards FileStore checks per
+ * object and per collection behave exactly as they do for a serial
+ * replay.  Entries we can't attribute are barriers: they run alone,
+ * after everything before them and before anything after them.
+ *
+ * Objects are linked into several collections under the same name, so
+ * keying on the name also covers links made before the replayed part of
+ * the journal.
+ *
+ * Entries complete out of order, but _finish() is only ever told the
+ * highest seq below which everything has been applied.
+ */
+class ReplayPool {
+  struct Entry {
+    uint64_t seq;
+    list<ObjectStore::Transaction*> tls;
+    ObjectStore::Transaction::Footprint fp;
+    bool barrier;
+  };
+
+  class ApplyThread : public Thread {
+    ReplayPool *pool;
+  public:
+    ApplyThread(ReplayPool *p) : pool(p) {}
+    void *entry() {
+      pool->apply_entry();
+      return 0;
+    }
+  };
+
+  vector<ApplyThread*> threads;
+  unsigned max_queued;
+
+  Mutex lock;
+  Cond cond;
+  deque<Entry*> queue;
+  std::list<Entry*> running;
+  set<uint64_t> pending;    ///< seqs queued or running
+  uint64_t last_queued;
+  bool barrier_running;
+  bool stopping;
+
+  Entry *_get_next();
+  void apply_entry();
+
+protected:
+  /// apply one entry; independent entries are applied concurrently
+  virtual void _apply(uint64_t seq, list<ObjectStore::Transaction*>& tls) = 0;
+  /**
+   * called once per applied entry, under the pool's lock
+   *
+   * @param applied every entry up to and including this seq is applied
+   */
+  virtual void _finish(uint64_t applied) = 0;
+
+public:
+  ReplayPool(int nthreads, unsigned maxq);
+  virtual ~ReplayPool();
+
+  void start();
+  /// wait for everything queued to be applied, and stop the threads
+  void stop();
+
+  /// queue a decoded entry, blocking while too far ahead of the appliers
+  void queue_entry(uint64_t seq, list<ObjectStore::Transaction*>& tls);
+};
+
+#endif
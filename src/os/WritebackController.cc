@@ -0,0 +1,176 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "WritebackController.h"
+
+WritebackController::WritebackController(uint64_t start, uint64_t target,
+					 uint64_t commit, size_t objects)
+  : lock("WritebackController::lock"),
+    start_bytes(start), target_bytes(target), commit_bytes(commit),
+    max_objects(objects),
+    pending(0), writeback(0), untracked(0), committing(0),
+    flushing(false), commit_requested(false),
+    total_written_back(0), early_commits(0)
+{}
+
+void WritebackController::set_limits(uint64_t start, uint64_t target,
+				     uint64_t commit, size_t objects)
+{
+  Mutex::Locker l(lock);
+  start_bytes = start;
+  target_bytes = target;
+  commit_bytes = commit;
+  max_objects = objects;
+  if (start_bytes == 0)
+    flushing = false;
+}
+
+bool WritebackController::dirtied(const coll_t& cid, const hobject_t& oid,
+				  uint64_t off, uint64_t len, bool *need_commit)
+{
+  Mutex::Locker l(lock);
+  coll_dirty[cid] += len;
+
+  pair<coll_t, hobject_t> key(cid, oid);
+  map<pair<coll_t, hobject_t>, std::list<Extent>::iterator>::iterator p =
+    queued.find(key);
+  if (p != queued.end()) {
+    Extent &e = *p->second;
+    uint64_t end = MAX(e.off + e.len, off + len);
+    e.off = MIN(e.off, off);
+    e.len = end - e.off;
+    e.bytes += len;
+    pending += len;
+  } else if (start_bytes && queued.size() < max_objects) {
+    Extent e;
+    e.cid = cid;
+    e.oid = oid;
+    e.off = off;
+    e.len = len;
+    e.bytes = len;
+    queue.push_back(e);
+    queued[key] = --queue.end();
+    pending += len;
+  } else {
+    untracked += len;
+  }
+
+  // what the running commit already covers doesn't need another one
+  if (commit_bytes && !commit_requested && _uncommitted() >= commit_bytes) {
+    commit_requested = true;
+    early_commits++;
+    *need_commit = true;
+  }
+  if (start_bytes && !flushing && pending >= start_bytes) {
+    flushing = true;
+    return true;
+  }
+  return false;
+}
+
+bool WritebackController::should_flush()
+{
+  Mutex::Locker l(lock);
+  return flushing && !queue.empty();
+}
+
+bool WritebackController::get_next(Extent *e)
+{
+  Mutex::Locker l(lock);
+  if (!flushing || queue.empty()) {
+    flushing = false;
+    return false;
+  }
+  *e = queue.front();
+  queued.erase(make_pair(e->cid, e->oid));
+  queue.pop_front();
+  pending -= e->bytes;
+  writeback += e->bytes;
+  total_written_back += e->bytes;
+  if (pending <= target_bytes)
+    flushing = false;
+  return true;
+}
+
+void WritebackController::commit_start()
+{
+  Mutex::Locker l(lock);
+  committing += pending + writeback + untracked;
+  pending = writeback = untracked = 0;
+  queue.clear();
+  queued.clear();
+  for (map<coll_t, uint64_t>::iterator p = coll_dirty.begin();
+       p != coll_dirty.end();
+       ++p)
+    coll_committing[p->first] += p->second;
+  coll_dirty.clear();
+  flushing = false;
+  commit_requested = false;
+}
+
+void WritebackController::commit_finish()
+{
+  Mutex::Locker l(lock);
+  committing = 0;
+  coll_committing.clear();
+}
+
+uint64_t WritebackController::get_dirty_bytes()
+{
+  Mutex::Locker l(lock);
+  return _dirty();
+}
+
+uint64_t WritebackController::get_written_back()
+{
+  Mutex::Locker l(lock);
+  return total_written_back;
+}
+
+uint64_t WritebackController::get_early_commits()
+{
+  Mutex::Locker l(lock);
+  return early_commits;
+}
+
+void WritebackController::dump(Formatter *f)
+{
+  Mutex::Locker l(lock);
+  f->open_object_section("writeback");
+  f->dump_unsigned("start_bytes", start_bytes);
+  f->dump_unsigned("target_bytes", target_bytes);
+  f->dump_unsigned("commit_bytes", commit_bytes);
+  f->dump_unsigned("dirty", _dirty());
+  f->dump_unsigned("pending", pending);
+  f->dump_unsigned("writeback", writeback);
+  f->dump_unsigned("untracked", untracked);
+  f->dump_unsigned("committing", committing);
+  f->dump_unsigned("queued_objects", queue.size());
+  f->dump_int("flushing", flushing);
+  f->dump_unsigned("written_back", total_written_back);
+  f->dump_unsigned("early_commits", early_commits);
+  f->open_array_section("collections");
+  set<coll_t> colls;
+  for (map<coll_t, uint64_t>::iterator p = coll_dirty.begin(); p != coll_dirty.end(); ++p)
+    colls.insert(p->first);
+  for (map<coll_t, uint64_t>::iterator p = coll_committing.begin(); p != coll_committing.end(); ++p)
+    colls.insert(p->first);
+  for (set<coll_t>::iterator p = colls.begin(); p != colls.end(); ++p) {
+    f->open_object_section("collection");
+    f->dump_stream("cid") << *p;
+    f->dump_unsigned("dirty", coll_dirty.count(*p) ? coll_dirty[*p] : 0);
+    f->dump_unsigned("committing", coll_committing.count(*p) ? coll_committing[*p] : 0);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
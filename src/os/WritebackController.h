@@ -0,0 +1,112 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_WRITEBACKCONTROLLER_H
+#define CEPH_WRITEBACKCONTROLLER_H
+
+#include <list>
+#include <map>
+
+#include "common/Formatter.h"
+#include "common/Mutex.h"
+#include "osd/osd_types.h"
+#include "hobject.h"
+
+/**
+ * Accounting for FileStore data written since the last commit
+ *
+ * Written bytes go through three states:
+ *
+ *  - pending: written, and queued for early writeback (one merged extent
+ *    per object, oldest first)
+ *  - writeback: handed to the kernel with sync_file_range(), but not
+ *    known to be stable
+ *  - committing: covered by a commit that has started but not finished
+ *
+ * (plus untracked: written while the queue was full, so only the commit
+ * will write them.)  Their sum is our estimate of dirty page cache; it
+ * counts overwrites of the same range twice.
+ *
+ * Once pending crosses start_bytes the flusher should pull extents with
+ * get_next() until pending drops to target_bytes.  Once the bytes written
+ * since the last commit started (everything but committing) cross
+ * commit_bytes the caller should start a commit, which bounds how much
+ * any one commit has to write.
+ *
+ * The controller only keeps the books; FileStore's flusher thread does
+ * the I/O.
+ */
+class WritebackController {
+public:
+  struct Extent {
+    coll_t cid;
+    hobject_t oid;
+    uint64_t off, len;  ///< range covering every write queued for oid
+    uint64_t bytes;     ///< bytes written to it
+  };
+
+private:
+  Mutex lock;
+  uint64_t start_bytes, target_bytes, commit_bytes;
+  size_t max_objects;
+
+  std::list<Extent> queue;
+  map<pair<coll_t, hobject_t>, std::list<Extent>::iterator> queued;
+  uint64_t pending, writeback, untracked, committing;
+  map<coll_t, uint64_t> coll_dirty, coll_committing;
+
+  bool flushing;          ///< between start_bytes and target_bytes
+  bool commit_requested;  ///< already asked for a commit this interval
+  uint64_t total_written_back, early_commits;
+
+  /// written since the last commit started
+  uint64_t _uncommitted() {
+    return pending + writeback + untracked;
+  }
+  uint64_t _dirty() {
+    return _uncommitted() + committing;
+  }
+
+public:
+  WritebackController(uint64_t start_bytes, uint64_t target_bytes,
+		      uint64_t commit_bytes, size_t max_objects);
+
+  /// start_bytes == 0 disables early writeback, commit_bytes == 0 early commits
+  void set_limits(uint64_t start_bytes, uint64_t target_bytes,
+		  uint64_t commit_bytes, size_t max_objects);
+
+  /**
+   * account a write
+   *
+   * @param need_commit [out] set if the caller should start a commit
+   * @return true if the flusher should wake up
+   */
+  bool dirtied(const coll_t& cid, const hobject_t& oid,
+	       uint64_t off, uint64_t len, bool *need_commit);
+
+  /// true if get_next() has something to hand out
+  bool should_flush();
+  /// take the oldest extent for writeback; @return false if we're done
+  bool get_next(Extent *e);
+
+  /// a commit is starting; call with ops blocked
+  void commit_start();
+  /// the commit started by commit_start() is stable
+  void commit_finish();
+
+  uint64_t get_dirty_bytes();
+  uint64_t get_written_back();
+  uint64_t get_early_commits();
+  void dump(Formatter *f);
+};
+
+#endif
@@ -159,6 +159,7 @@ OSDService::OSDService(OSD *osd) :
   class_handler(osd->class_handler),
   publish_lock("OSDService::publish_lock"),
   pre_publish_lock("OSDService::pre_publish_lock"),
+  active(false), up_epoch(0),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
   watch_lock("OSD::watch_lock"),
@@ -166,6 +167,8 @@ OSDService::OSDService(OSD *osd) :
   watch(NULL),
   backfill_request_lock("OSD::backfill_request_lock"),
   backfill_request_timer(g_ceph_context, backfill_request_lock, false),
+  rep_batch_lock("OSD::rep_batch_lock"),
+  rep_batch_timer(g_ceph_context, rep_batch_lock, false),
   last_tid(0),
   tid_lock("OSDService::tid_lock"),
   reserver_finisher(g_ceph_context),
@@ -693,7 +696,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
 	 Messenger *hbclientm, Messenger *hbserverm, MonClient *mc,
 	 const std::string &dev, const std::string &jdev) :
   Dispatcher(external_messenger->cct),
-  osd_lock("OSD::osd_lock"),
+  osd_lock("OSD::osd_lock", false, true, false, external_messenger->cct),
   timer(external_messenger->cct, osd_lock),
   authorize_handler_cluster_registry(new AuthAuthorizeHandlerRegistry(external_messenger->cct,
 								      cct->_conf->auth_cluster_required.length() ?
@@ -715,6 +718,9 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   osd_compat(get_osd_compat_set()),
   state(STATE_INITIALIZING), boot_epoch(0), up_epoch(0), bind_epoch(0),
   op_tp(external_messenger->cct, "OSD::op_tp", g_conf->osd_op_threads, "osd_op_threads"),
+  op_sharded_tp(external_messenger->cct, "OSD::op_sharded_tp",
+		MAX(g_conf->osd_op_num_shards, 1),
+		MAX(g_conf->osd_op_num_threads_per_shard, 1)),
   recovery_tp(external_messenger->cct, "OSD::recovery_tp", g_conf->osd_recovery_threads, "osd_recovery_threads"),
   disk_tp(external_messenger->cct, "OSD::disk_tp", g_conf->osd_disk_threads, "osd_disk_threads"),
   command_tp(external_messenger->cct, "OSD::command_tp", 1),
@@ -729,10 +735,12 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
+  context_cache_hook(NULL),
+  op_wq(this, g_conf->osd_op_thread_timeout, &op_sharded_tp),
   peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
+  pg_map_lock("OSD::pg_map_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
   debug_drop_pg_create_duration(g_conf->osd_debug_drop_pg_create_duration),
   debug_drop_pg_create_left(-1),
@@ -820,12 +828,70 @@ public:
   }
 };
 
+class ContextCacheSocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  ContextCacheSocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    stringstream ss;
+    JSONFormatter f(true);
+    osd->dump_context_cache_stats(&f);
+    f.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+void OSD::dump_context_cache_stats(Formatter *f)
+{
+  // the pgs count under their own locks; don't hold pg_map_lock while
+  // taking them
+  vector<PGRef> pgs;
+  pg_map_lock.get_read();
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin(); p != pg_map.end(); ++p)
+    pgs.push_back(p->second);
+  pg_map_lock.put_read();
+
+  map<int64_t, ReplicatedPG::ContextCacheStats> by_pool;
+  for (vector<PGRef>::iterator p = pgs.begin(); p != pgs.end(); ++p) {
+    (*p)->lock();
+    ReplicatedPG *pg = static_cast<ReplicatedPG*>(p->get());
+    by_pool[pg->info.pgid.pool()].add(pg->context_cache_stats);
+    (*p)->unlock();
+  }
+
+  f->open_object_section("context_cache");
+  f->dump_int("cache_count", g_conf->osd_pg_object_context_cache_count);
+  f->open_array_section("pools");
+  for (map<int64_t, ReplicatedPG::ContextCacheStats>::iterator p = by_pool.begin();
+       p != by_pool.end();
+       ++p) {
+    ReplicatedPG::ContextCacheStats& s = p->second;
+    f->open_object_section("pool");
+    f->dump_int("pool", p->first);
+    f->dump_unsigned("object_hits", s.obc_hits);
+    f->dump_unsigned("object_misses", s.obc_misses);
+    if (s.obc_hits + s.obc_misses)
+      f->dump_float("object_hit_rate",
+		    (double)s.obc_hits / (double)(s.obc_hits + s.obc_misses));
+    f->dump_unsigned("snapset_hits", s.ssc_hits);
+    f->dump_unsigned("snapset_misses", s.ssc_misses);
+    if (s.ssc_hits + s.ssc_misses)
+      f->dump_float("snapset_hit_rate",
+		    (double)s.ssc_hits / (double)(s.ssc_hits + s.ssc_misses));
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
 int OSD::init()
 {
   Mutex::Locker lock(osd_lock);
 
   timer.init();
   service.backfill_request_timer.init();
+  service.rep_batch_timer.init();
 
   // mount.
   dout(2) << "mounting " << dev_path << " "
@@ -874,6 +940,9 @@ int OSD::init()
 
   bind_epoch = osdmap->get_epoch();
 
+  // before load_pgs, which reports pg log sizes
+  create_logger();
+
   // load up pgs (as they previously existed)
   load_pgs();
 
@@ -885,8 +954,6 @@ int OSD::init()
     return -EINVAL;
   }
 
-  create_logger();
-    
   // i'm ready!
   client_messenger->add_dispatcher_head(this);
   cluster_messenger->add_dispatcher_head(this);
@@ -903,6 +970,7 @@ int OSD::init()
   monc->set_log_client(&clog);
 
   op_tp.start();
+  op_sharded_tp.start();
   recovery_tp.start();
   disk_tp.start();
   command_tp.start();
@@ -921,6 +989,11 @@ int OSD::init()
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  context_cache_hook = new ContextCacheSocketHook(this);
+  r = admin_socket->register_command("dump_object_context_cache",
+				     context_cache_hook,
+				     "show object context cache hits by pool");
+  assert(r == 0);
 
   service.init();
   service.publish_map(osdmap);
@@ -986,16 +1059,23 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_sop_push,     "subop_push");       // push (write)
   osd_plb.add_u64_counter(l_osd_sop_push_inb, "subop_push_in_bytes");
   osd_plb.add_time_avg(l_osd_sop_push_lat, "subop_push_latency");
+  osd_plb.add_u64_avg(l_osd_sop_batch, "subop_batch");   // repops per replicated write subop received
 
   osd_plb.add_u64_counter(l_osd_pull,      "pull");       // pull requests sent
   osd_plb.add_u64_counter(l_osd_push,      "push");       // push messages
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes");  // pushed bytes
 
+  osd_plb.add_u64_avg(l_osd_rep_batch, "rep_batch");    // repops per batched subop sent
+  osd_plb.add_u64_counter(l_osd_rep_batch_timeout, "rep_batch_timeout"); // batches sent on osd_rep_batch_delay
+
   osd_plb.add_u64_counter(l_osd_push_in,    "push_in");        // inbound push messages
   osd_plb.add_u64_counter(l_osd_push_inb,   "push_in_bytes");  // inbound pushed bytes
 
   osd_plb.add_u64_counter(l_osd_rop, "recovery_ops");       // recovery ops (started)
 
+  osd_plb.add_u64_counter(l_osd_obc_hit, "object_context_cache_hit");   // object/snapset contexts found in memory
+  osd_plb.add_u64_counter(l_osd_obc_miss, "object_context_cache_miss"); // ... read from disk
+
   osd_plb.add_u64(l_osd_loadavg, "loadavg");
   osd_plb.add_u64(l_osd_buf, "buffer_bytes");       // total ceph::buffer bytes
 
@@ -1003,12 +1083,18 @@ void OSD::create_logger()
   osd_plb.add_u64(l_osd_pg_primary, "numpg_primary"); // num primary pgs
   osd_plb.add_u64(l_osd_pg_replica, "numpg_replica"); // num replica pgs
   osd_plb.add_u64(l_osd_pg_stray, "numpg_stray");   // num stray pgs
+  osd_plb.add_u64(l_osd_pg_log_entries, "pg_log_entries");  // entries held in pg logs
+  osd_plb.add_u64(l_osd_pg_log_bytes, "pg_log_bytes");      // approx memory held by pg logs
+  osd_plb.add_time_avg(l_osd_pg_log_load_lat, "pg_log_load_latency");  // reading a pg log at startup
   osd_plb.add_u64(l_osd_hb_to, "heartbeat_to_peers");     // heartbeat peers we send to
   osd_plb.add_u64(l_osd_hb_from, "heartbeat_from_peers"); // heartbeat peers we recv from
   osd_plb.add_u64_counter(l_osd_map, "map_messages");           // osdmap messages
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
 
+  osd_plb.add_u64_counter(l_osd_fast_dispatch, "fast_dispatch"); // ops dispatched without osd_lock
+  osd_plb.add_u64_counter(l_osd_slow_dispatch, "slow_dispatch"); // ops that needed osd_lock
+
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -1025,6 +1111,7 @@ void OSD::suicide(int exitcode)
 
   derr << " pausing thread pools" << dendl;
   op_tp.pause();
+  op_sharded_tp.pause();
   disk_tp.pause();
   recovery_tp.pause();
   command_tp.pause();
@@ -1051,6 +1138,7 @@ int OSD::shutdown()
   derr << "shutdown" << dendl;
 
   state = STATE_STOPPING;
+  service.publish_state(false, up_epoch);
 
   timer.shutdown();
 
@@ -1058,6 +1146,10 @@ int OSD::shutdown()
   service.backfill_request_timer.shutdown();
   service.backfill_request_lock.Unlock();
 
+  service.rep_batch_lock.Lock();
+  service.rep_batch_timer.shutdown();
+  service.rep_batch_lock.Unlock();
+
   heartbeat_lock.Lock();
   heartbeat_stop = true;
   heartbeat_cond.Signal();
@@ -1071,15 +1163,20 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_object_context_cache");
   delete admin_ops_hook;
   delete historic_ops_hook;
+  delete context_cache_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  context_cache_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
   op_tp.stop();
   dout(10) << "op tp stopped" << dendl;
+  op_sharded_tp.stop();
+  dout(10) << "op sharded tp stopped" << dendl;
 
   // pause _new_ disk work first (to avoid racing with thread pool),
   disk_tp.pause_new();
@@ -1144,6 +1241,7 @@ int OSD::shutdown()
   clear_pg_stat_queue();
 
   // close pgs
+  pg_map_lock.get_write();
   for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
        p != pg_map.end();
        p++) {
@@ -1151,6 +1249,7 @@ int OSD::shutdown()
     pg->put();
   }
   pg_map.clear();
+  pg_map_lock.put_write();
 
   client_messenger->shutdown();
   cluster_messenger->shutdown();
@@ -1284,7 +1383,9 @@ PG *OSD::_open_lock_pg(
     assert(0);
 
   assert(pg_map.count(pgid) == 0);
+  pg_map_lock.get_write();
   pg_map[pgid] = pg;
+  pg_map_lock.put_write();
 
   if (hold_map_lock)
     pg->lock_with_map_lock_held(no_lockdep_check);
@@ -1341,6 +1442,17 @@ PG *OSD::_lookup_pg(pg_t pgid)
   return pg;
 }
 
+PGRef OSD::_fast_lookup_pg(pg_t pgid)
+{
+  PGRef pg;
+  pg_map_lock.get_read();
+  hash_map<pg_t, PG*>::iterator p = pg_map.find(pgid);
+  if (p != pg_map.end())
+    pg = p->second;
+  pg_map_lock.put_read();
+  return pg;
+}
+
 PG *OSD::_lookup_lock_pg_with_map_lock_held(pg_t pgid)
 {
   assert(osd_lock.is_locked());
@@ -2154,6 +2266,7 @@ void OSD::tick()
   if (!dispatch_running) {
     dispatch_running = true;
     do_waiters();
+    update_ops_parked();
     dispatch_running = false;
     dispatch_cond.Signal();
   }
@@ -2361,6 +2474,21 @@ bool OSD::ms_handle_reset(Connection *con)
   return true;
 }
 
+bool OSD::ms_get_data_buffer(Connection *con, const ceph_msg_header& header,
+			     bufferlist& data)
+{
+  // write data for client ops and replica sub ops ends up in the
+  // journal and the object files; give it page-aligned memory so
+  // neither has to copy it to get alignment.
+  uint64_t min = g_conf->osd_page_aligned_rx_min_bytes;
+  if (!min || header.data_len < min)
+    return false;
+  if (header.type != CEPH_MSG_OSD_OP && header.type != MSG_OSD_SUBOP)
+    return false;
+  Messenger::alloc_page_aligned_buffer(data, header.data_len, header.data_off);
+  return true;
+}
+
 void OSD::handle_notify_timeout(void *_notif)
 {
   assert(service.watch_lock.is_locked());
@@ -3074,6 +3202,9 @@ bool OSD::heartbeat_dispatch(Message *m)
 
 bool OSD::ms_dispatch(Message *m)
 {
+  if (fast_dispatch(m))
+    return true;
+
   // lock!
 
   osd_lock.Lock();
@@ -3087,6 +3218,7 @@ bool OSD::ms_dispatch(Message *m)
   do_waiters();
   _dispatch(m);
   do_waiters();
+  update_ops_parked();
 
   dispatch_running = false;
   dispatch_cond.Signal();
@@ -3096,6 +3228,121 @@ bool OSD::ms_dispatch(Message *m)
   return true;
 }
 
+bool OSD::fast_dispatch(Message *m)
+{
+  switch (m->get_type()) {
+  case CEPH_MSG_OSD_OP:
+  case MSG_OSD_SUBOP:
+  case MSG_OSD_SUBOPREPLY:
+    break;
+  default:
+    return false;
+  }
+  if (!g_conf->osd_fast_dispatch)
+    return false;
+  if (!_fast_dispatch(m)) {
+    logger->inc(l_osd_slow_dispatch);
+    return false;
+  }
+  logger->inc(l_osd_fast_dispatch);
+  return true;
+}
+
+/*
+ * The common case of handle_op(), handle_sub_op() and
+ * handle_sub_op_reply(), checked against the published map: the sender
+ * has our map, so there is nothing to share or wait for, and we have
+ * the pg.  Returns false, having changed nothing that matters, for
+ * anything else.
+ */
+bool OSD::_fast_dispatch(Message *m)
+{
+  if (ops_parked.read())
+    return false;
+  // state, up_epoch and osdmap belong to osd_lock; use what was published
+  bool active;
+  epoch_t up;
+  OSDMapRef curmap = service.get_osdmap(&active, &up);
+  if (!active || !curmap)
+    return false;
+  epoch_t epoch;
+  pg_t pgid;
+
+  if (m->get_type() == CEPH_MSG_OSD_OP) {
+    MOSDOp *op = static_cast<MOSDOp*>(m);
+    epoch = op->get_map_epoch();
+    if (epoch != curmap->get_epoch() || epoch < up)
+      return false;
+    if (op_is_discardable(op) ||
+	op->get_oid().name.size() > MAX_CEPH_OBJECT_NAME_LEN ||
+	curmap->is_blacklisted(op->get_source_addr()) ||
+	g_conf->osd_debug_drop_op_probability > 0)
+      return false;
+    if (init_op_flags(op))
+      return false;
+    if (op->may_write() &&
+	((curmap->test_flag(CEPH_OSDMAP_FULL) && !op->get_source().is_mds()) ||
+	 op->get_snapid() != CEPH_NOSNAP ||
+	 (g_conf->osd_max_write_size &&
+	  op->get_data_len() > g_conf->osd_max_write_size << 20)))
+      return false;
+    pgid = op->get_pg();
+    if ((op->get_flags() & CEPH_OSD_FLAG_PGOP) == 0 &&
+	curmap->have_pg_pool(pgid.pool()))
+      pgid = curmap->raw_pg_to_pg(pgid);
+  } else {
+    if (m->get_type() == MSG_OSD_SUBOP) {
+      MOSDSubOp *op = static_cast<MOSDSubOp*>(m);
+      epoch = op->map_epoch;
+      pgid = op->pgid;
+    } else {
+      MOSDSubOpReply *op = static_cast<MOSDSubOpReply*>(m);
+      epoch = op->get_map_epoch();
+      pgid = op->get_pg();
+    }
+    if (epoch != curmap->get_epoch() || epoch < up)
+      return false;
+    if (!m->get_connection()->peer_is_osd())
+      return false;
+    int from = m->get_source().num();
+    if (!curmap->have_inst(from) ||
+	curmap->get_cluster_addr(from) != m->get_source_inst().addr)
+      return false;
+    // as _share_map_incoming() would; they have our map, so no sharing
+    if (curmap->is_up(from))
+      note_peer_epoch(from, epoch);
+  }
+
+  PGRef pg = _fast_lookup_pg(pgid);
+  if (!pg)
+    return false;
+
+  dout(20) << "fast_dispatch " << m << " " << *m << dendl;
+  if (m->get_type() == CEPH_MSG_OSD_OP) {
+    // we don't need encoded payload anymore
+    m->clear_payload();
+  }
+  OpRequestRef op = op_tracker.create_request(m);
+  enqueue_op(pg.get(), op);
+  return true;
+}
+
+/*
+ * Clear ops_parked once nothing is parked; called with osd_lock, after
+ * do_waiters().
+ */
+void OSD::update_ops_parked()
+{
+  assert(osd_lock.is_locked());
+  if (!ops_parked.read())
+    return;
+  if (!waiting_for_osdmap.empty() || !waiting_for_pg.empty())
+    return;
+  Mutex::Locker l(finished_lock);
+  if (finished.empty())
+    ops_parked.set(0);
+}
+
 bool OSD::ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new)
 {
   dout(10) << "OSD::ms_get_authorizer type=" << ceph_entity_type_name(dest_type) << dendl;
@@ -3326,7 +3573,7 @@ void OSD::_dispatch(Message *m)
       // no map?  starting up?
       if (!osdmap) {
         dout(7) << "no OSDMap, not booted" << dendl;
-        waiting_for_osdmap.push_back(op);
+        park_op(waiting_for_osdmap, op);
         break;
       }
       
@@ -3516,7 +3763,7 @@ void OSD::wait_for_new_map(OpRequestRef op)
     monc->renew_subs();
   }
   
-  waiting_for_osdmap.push_back(op);
+  park_op(waiting_for_osdmap, op);
   op->mark_delayed();
 }
 
@@ -3717,6 +3964,7 @@ void OSD::handle_osd_map(MOSDMap *m)
     if (is_booting()) {
       dout(1) << "state: booting -> active" << dendl;
       state = STATE_ACTIVE;
+      service.publish_state(true, up_epoch);
     }
   }
 
@@ -3749,6 +3997,7 @@ void OSD::handle_osd_map(MOSDMap *m)
       
       state = STATE_BOOTING;
       up_epoch = 0;
+      service.publish_state(false, 0);
       do_restart = true;
       bind_epoch = osdmap->get_epoch();
 
@@ -3891,6 +4140,7 @@ void OSD::advance_map(ObjectStore::Transaction& t, C_Contexts *tfin)
       osdmap->get_inst(whoami) == client_messenger->get_myinst()) {
     up_epoch = osdmap->get_epoch();
     dout(10) << "up_epoch is " << up_epoch << dendl;
+    service.publish_state(is_active(), up_epoch);
     if (!boot_epoch) {
       boot_epoch = osdmap->get_epoch();
       dout(10) << "boot_epoch is " << boot_epoch << dendl;
@@ -4422,6 +4672,7 @@ void OSD::split_pg(PG *parent, map<pg_t,PG*>& children, ObjectStore::Transaction
   }
 
   // split log
+  parent->load_log_tail();
   parent->log.index();
   dout(20) << " parent " << parent->info.pgid << " log was ";
   parent->log.print(*_dout);
@@ -5281,7 +5532,9 @@ void OSD::_remove_pg(PG *pg)
   pg->deleting = true;
 
   // remove from map
+  pg_map_lock.get_write();
   pg_map.erase(pg->info.pgid);
+  pg_map_lock.put_write();
   pg->put(); // since we've taken it out of map
 
   service.unreg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
@@ -5586,7 +5839,7 @@ void OSD::handle_op(OpRequestRef op)
 
     if (osdmap->get_pg_acting_role(pgid, whoami) >= 0) {
       dout(7) << "we are valid target for op, waiting" << dendl;
-      waiting_for_pg[pgid].push_back(op);
+      park_op(waiting_for_pg[pgid], op);
       op->mark_delayed();
       return;
     }
@@ -5704,7 +5957,7 @@ bool OSD::op_is_discardable(MOSDOp *op)
 }
 
 /*
- * enqueue called with osd_lock held
+ * enqueue called with osd_lock held, or from fast_dispatch()
  */
 void OSD::enqueue_op(PG *pg, OpRequestRef op)
 {
@@ -5712,69 +5965,76 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
   op_wq.queue(make_pair(PGRef(pg), op));
 }
 
-void OSD::OpWQ::_enqueue(pair<PGRef, OpRequestRef> item)
+void OSD::OpWQ::_enqueue(unsigned shard, pair<PGRef, OpRequestRef> item)
 {
+  ShardData *sdata = shard_data[shard];
   unsigned priority = item.second->request->get_priority();
   unsigned cost = item.second->request->get_data().length();
   if (priority >= CEPH_MSG_PRIO_LOW)
-    pqueue.enqueue_strict(
+    sdata->pqueue.enqueue_strict(
       item.second->request->get_source_inst(),
       priority, item);
   else
-    pqueue.enqueue(item.second->request->get_source_inst(),
+    sdata->pqueue.enqueue(item.second->request->get_source_inst(),
       priority, cost, item);
-  osd->logger->set(l_osd_opq, pqueue.length());
+  osd->logger->set(l_osd_opq, queued.inc());
 }
 
-void OSD::OpWQ::_enqueue_front(pair<PGRef, OpRequestRef> item)
+void OSD::OpWQ::_enqueue_front(unsigned shard, pair<PGRef, OpRequestRef> item)
 {
-  {
-    Mutex::Locker l(qlock);
-    if (pg_for_processing.count(&*(item.first))) {
-      pg_for_processing[&*(item.first)].push_front(item.second);
-      item.second = pg_for_processing[&*(item.first)].back();
-      pg_for_processing[&*(item.first)].pop_back();
-    }
+  ShardData *sdata = shard_data[shard];
+  if (sdata->pg_for_processing.count(&*(item.first))) {
+    sdata->pg_for_processing[&*(item.first)].push_front(item.second);
+    item.second = sdata->pg_for_processing[&*(item.first)].back();
+    sdata->pg_for_processing[&*(item.first)].pop_back();
   }
   unsigned priority = item.second->request->get_priority();
   unsigned cost = item.second->request->get_data().length();
   if (priority >= CEPH_MSG_PRIO_LOW)
-    pqueue.enqueue_strict_front(
+    sdata->pqueue.enqueue_strict_front(
       item.second->request->get_source_inst(),
       priority, item);
   else
-    pqueue.enqueue_front(item.second->request->get_source_inst(),
+    sdata->pqueue.enqueue_front(item.second->request->get_source_inst(),
       priority, cost, item);
-  osd->logger->set(l_osd_opq, pqueue.length());
+  osd->logger->set(l_osd_opq, queued.inc());
 }
 
-PGRef OSD::OpWQ::_dequeue()
+PGRef OSD::OpWQ::_dequeue(unsigned shard)
 {
-  assert(!pqueue.empty());
-  PGRef pg;
-  {
-    Mutex::Locker l(qlock);
-    pair<PGRef, OpRequestRef> ret = pqueue.dequeue();
-    pg = ret.first;
-    pg_for_processing[&*pg].push_back(ret.second);
-  }
-  osd->logger->set(l_osd_opq, pqueue.length());
+  ShardData *sdata = shard_data[shard];
+  assert(!sdata->pqueue.empty());
+  pair<PGRef, OpRequestRef> ret = sdata->pqueue.dequeue();
+  PGRef pg = ret.first;
+  sdata->pg_for_processing[&*pg].push_back(ret.second);
+  osd->logger->set(l_osd_opq, queued.dec());
   return pg;
 }
 
-void OSD::OpWQ::_process(PGRef pg)
+void OSD::OpWQ::dequeue(PG *pg)
 {
+  unsigned shard = shard_of(pg);
+  ShardData *sdata = shard_data[shard];
+  lock(shard);
+  unsigned before = sdata->pqueue.length();
+  sdata->pqueue.remove_by_filter(Pred(pg));
+  queued.sub(before - sdata->pqueue.length());
+  unlock(shard);
+}
+
+void OSD::OpWQ::_process(unsigned shard, PGRef pg)
+{
+  ShardData *sdata = shard_data[shard];
   pg->lock();
   OpRequestRef op;
-  {
-    Mutex::Locker l(qlock);
-    assert(pg_for_processing.count(&*pg));
-    assert(pg_for_processing[&*pg].size());
-    op = pg_for_processing[&*pg].front();
-    pg_for_processing[&*pg].pop_front();
-    if (!(pg_for_processing[&*pg].size()))
-      pg_for_processing.erase(&*pg);
-  }
+  lock(shard);
+  assert(sdata->pg_for_processing.count(&*pg));
+  assert(sdata->pg_for_processing[&*pg].size());
+  op = sdata->pg_for_processing[&*pg].front();
+  sdata->pg_for_processing[&*pg].pop_front();
+  if (!(sdata->pg_for_processing[&*pg].size()))
+    sdata->pg_for_processing.erase(&*pg);
+  unlock(shard);
   osd->dequeue_op(pg, op);
   pg->unlock();
 }
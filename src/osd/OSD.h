@@ -27,6 +27,7 @@
 #include "common/WorkQueue.h"
 #include "common/LogClient.h"
 #include "common/AsyncReserver.h"
+#include "include/atomic.h"
 
 #include "os/ObjectStore.h"
 #include "OSDCap.h"
@@ -89,16 +90,22 @@ enum {
   l_osd_sop_push,
   l_osd_sop_push_inb,
   l_osd_sop_push_lat,
+  l_osd_sop_batch,
 
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_rep_batch,
+  l_osd_rep_batch_timeout,
 
   l_osd_push_in,
   l_osd_push_inb,
 
   l_osd_rop,
 
+  l_osd_obc_hit,
+  l_osd_obc_miss,
+
   l_osd_loadavg,
   l_osd_buf,
 
@@ -106,12 +113,18 @@ enum {
   l_osd_pg_primary,
   l_osd_pg_replica,
   l_osd_pg_stray,
+  l_osd_pg_log_entries,
+  l_osd_pg_log_bytes,
+  l_osd_pg_log_load_lat,
   l_osd_hb_to,
   l_osd_hb_from,
   l_osd_map,
   l_osd_mape,
   l_osd_mape_dup,
 
+  l_osd_fast_dispatch,
+  l_osd_slow_dispatch,
+
   l_osd_last,
 };
 
@@ -133,6 +146,7 @@ class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
 class HistoricOpsSocketHook;
+class ContextCacheSocketHook;
 
 extern const coll_t meta_coll;
 
@@ -174,7 +188,7 @@ private:
 public:
   PerfCounters *&logger;
   MonClient   *&monc;
-  ThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>, PGRef> &op_wq;
+  ShardedThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>, PGRef> &op_wq;
   ThreadPool::BatchWorkQueue<PG> &peering_wq;
   ThreadPool::WorkQueue<PG> &recovery_wq;
   ThreadPool::WorkQueue<PG> &snap_trim_wq;
@@ -207,6 +221,21 @@ public:
     osdmap = map;
   }
 
+  // OSD state that fast dispatch checks without osd_lock
+  bool active;
+  epoch_t up_epoch;
+  void publish_state(bool a, epoch_t up) {
+    Mutex::Locker l(publish_lock);
+    active = a;
+    up_epoch = up;
+  }
+  OSDMapRef get_osdmap(bool *a, epoch_t *up) {
+    Mutex::Locker l(publish_lock);
+    *a = active;
+    *up = up_epoch;
+    return osdmap;
+  }
+
   /*
    * osdmap - current published amp
    * next_osdmap - pre_published map that is about to be published.
@@ -286,6 +315,10 @@ public:
   Mutex backfill_request_lock;
   SafeTimer backfill_request_timer;
 
+  // -- Replication batching --
+  Mutex rep_batch_lock;
+  SafeTimer rep_batch_timer;  ///< flushes ReplicatedPG::rep_batches
+
   // -- tids --
   // for ops i issue
   tid_t last_tid;
@@ -404,6 +437,28 @@ protected:
   void _dispatch(Message *m);
   void dispatch_op(OpRequestRef op);
 
+  // -- fast dispatch --
+  /*
+   * Client ops and sub-ops are dispatched without osd_lock when they
+   * need nothing but the published map and a PG lookup: see
+   * fast_dispatch().  Anything else (a map to share or wait for, a
+   * missing pg, an error to reply with) goes through _dispatch() as
+   * before.
+   *
+   * A connection's ops must reach their pg in the order it sent them,
+   * so while any op is parked on an osd_lock list (waiting_for_osdmap,
+   * waiting_for_pg, finished) ops_parked is set and everything takes
+   * the slow path, behind do_waiters().
+   */
+  atomic_t ops_parked;
+  bool fast_dispatch(Message *m);
+  bool _fast_dispatch(Message *m);
+  void park_op(list<OpRequestRef>& ls, OpRequestRef op) {
+    ops_parked.set(1);
+    ls.push_back(op);
+  }
+  void update_ops_parked();
+
   void check_osdmap_features();
 
 public:
@@ -470,6 +525,7 @@ public:
 private:
 
   ThreadPool op_tp;
+  ShardedThreadPool op_sharded_tp;
   ThreadPool recovery_tp;
   ThreadPool disk_tp;
   ThreadPool command_tp;
@@ -601,26 +657,52 @@ private:
   }
   friend class OpsFlightSocketHook;
   friend class HistoricOpsSocketHook;
+  friend class ContextCacheSocketHook;
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
+  ContextCacheSocketHook *context_cache_hook;
+  /// sum the pgs' object context cache stats by pool
+  void dump_context_cache_stats(Formatter *f);
 
   // -- op queue --
 
-  struct OpWQ: public ThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>,
-					       PGRef > {
-    Mutex qlock;
-    map<PG*, list<OpRequestRef> > pg_for_processing;
+  /*
+   * Ops are queued to one of op_sharded_tp's shards by pg, so ops on
+   * pgs in different shards never contend for a queue lock, and a
+   * shard's threads only wait for that shard's ops.  Each shard has
+   * its own PrioritizedQueue and pg_for_processing, protected by the
+   * shard's lock.
+   */
+  struct OpWQ: public ShardedThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>,
+						      PGRef > {
+    struct ShardData {
+      map<PG*, list<OpRequestRef> > pg_for_processing;
+      PrioritizedQueue<pair<PGRef, OpRequestRef>, entity_inst_t > pqueue;
+    };
+    vector<ShardData*> shard_data;
+    atomic_t queued;  ///< ops in all shards, for l_osd_opq
     OSD *osd;
-    PrioritizedQueue<pair<PGRef, OpRequestRef>, entity_inst_t > pqueue;
-    OpWQ(OSD *o, time_t ti, ThreadPool *tp)
-      : ThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>, PGRef >(
+    OpWQ(OSD *o, time_t ti, ShardedThreadPool *tp)
+      : ShardedThreadPool::WorkQueueVal<pair<PGRef, OpRequestRef>, PGRef >(
 	"OSD::OpWQ", ti, ti*10, tp),
-	qlock("OpWQ::qlock"),
-	osd(o) {}
+	osd(o) {
+      for (unsigned i = 0; i < get_num_shards(); i++)
+	shard_data.push_back(new ShardData);
+    }
+    ~OpWQ() {
+      for (unsigned i = 0; i < shard_data.size(); i++)
+	delete shard_data[i];
+    }
 
-    void _enqueue_front(pair<PGRef, OpRequestRef> item);
-    void _enqueue(pair<PGRef, OpRequestRef> item);
-    PGRef _dequeue();
+    unsigned shard_of(PG *pg) {
+      return __gnu_cxx::hash<pg_t>()(pg->info.pgid) % get_num_shards();
+    }
+    unsigned _shard(const pair<PGRef, OpRequestRef> &item) {
+      return shard_of(&*item.first);
+    }
+    void _enqueue_front(unsigned shard, pair<PGRef, OpRequestRef> item);
+    void _enqueue(unsigned shard, pair<PGRef, OpRequestRef> item);
+    PGRef _dequeue(unsigned shard);
 
     struct Pred {
       PG *pg;
@@ -629,15 +711,11 @@ private:
 	return op.first == pg;
       }
     };
-    void dequeue(PG *pg) {
-      lock();
-      pqueue.remove_by_filter(Pred(pg));
-      unlock();
-    }
-    bool _empty() {
-      return pqueue.empty();
+    void dequeue(PG *pg);
+    bool _empty(unsigned shard) {
+      return shard_data[shard]->pqueue.empty();
     }
-    void _process(PGRef pg);
+    void _process(unsigned shard, PGRef pg);
   } op_wq;
 
   void enqueue_op(PG *pg, OpRequestRef op);
@@ -783,7 +861,12 @@ private:
 
 protected:
   // -- placement groups --
+  /*
+   * pg_map is read under osd_lock, or under pg_map_lock by
+   * fast_dispatch(); changing it takes both.
+   */
   hash_map<pg_t, PG*> pg_map;
+  RWLock pg_map_lock;
   map<pg_t, list<OpRequestRef> > waiting_for_pg;
   PGRecoveryStats pg_recovery_stats;
 
@@ -804,6 +887,8 @@ protected:
 			pg_interval_map_t& pi,
 			ObjectStore::Transaction& t);
   PG   *_lookup_qlock_pg(pg_t pgid);
+  /// get a ref to the pg without osd_lock, or NULL
+  PGRef _fast_lookup_pg(pg_t pgid);
 
   PG *lookup_lock_raw_pg(pg_t pgid);
 
@@ -1326,6 +1411,8 @@ protected:
   void ms_handle_connect(Connection *con);
   bool ms_handle_reset(Connection *con);
   void ms_handle_remote_reset(Connection *con) {}
+  bool ms_get_data_buffer(Connection *con, const ceph_msg_header& header,
+			  bufferlist& data);
 
  public:
   /* internal and external can point to the same messenger, they will still
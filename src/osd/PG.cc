@@ -64,6 +64,7 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   osd(o), osdmap_ref(curmap), pool(_pool),
   _lock("PG::_lock"),
   ref(0), deleting(false), dirty_info(false), dirty_log(false),
+  log_entries_reported(0), log_bytes_reported(0),
   info(p), coll(p), log_oid(loid), biginfo_oid(ioid),
   recovery_item(this), scrub_item(this), scrub_finalize_item(this), snap_trim_item(this), stat_queue_item(this),
   recovery_ops_active(0),
@@ -89,6 +90,8 @@ PG::PG(OSDService *o, OSDMapRef curmap,
 
 PG::~PG()
 {
+  osd->logger->dec(l_osd_pg_log_entries, log_entries_reported);
+  osd->logger->dec(l_osd_pg_log_bytes, log_bytes_reported);
 }
 
 void PG::lock(bool no_lockdep)
@@ -154,6 +157,10 @@ void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s)
     log.pop_front();    // from log
   }
 
+  // anything left on disk is trimmed too?
+  if (cold_to <= s)
+    cold_to = eversion_t();
+
   // raise tail?
   if (tail < s)
     tail = s;
@@ -216,6 +223,8 @@ void PG::proc_replica_log(ObjectStore::Transaction& t,
     if (oe.version <= log.tail)
       break;
 
+    if (!log.objects.count(oe.soid) && log.has_cold_tail())
+      load_log_tail();   // it may only be in the ondisk log
     if (!log.objects.count(oe.soid)) {
       dout(10) << " had " << oe << " new dne : divergent, ignoring" << dendl;
       ++pp;
@@ -432,6 +441,7 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
 {
   dout(10) << "rewind_divergent_log truncate divergent future " << newhead << dendl;
   assert(newhead > log.tail);
+  load_log_tail();
 
   list<pg_log_entry_t>::iterator p = log.log.end();
   list<pg_log_entry_t> divergent;
@@ -483,6 +493,10 @@ void PG::merge_log(ObjectStore::Transaction& t,
     dout(20) << "pg_missing_t sobject: " << i->first << dendl;
   }
 
+  // the tail and divergent entry handling below need the whole log
+  if (olog.tail < log.tail || olog.head != log.head)
+    load_log_tail();
+
   bool changed = false;
 
   // extend on tail?
@@ -597,6 +611,7 @@ void PG::merge_log(ObjectStore::Transaction& t,
   if (changed) {
     dirty_info = true;
     dirty_log = true;
+    update_log_stats();
   }
 }
 
@@ -1358,6 +1373,10 @@ void PG::activate(ObjectStore::Transaction& t,
 {
   assert(!is_active());
 
+  // we rewrite the log below, and recovery and the peers' logs may need
+  // any part of it
+  load_log_tail();
+
   // -- crash recovery?
   if (is_primary() &&
       pool.info.crash_replay_interval > 0 &&
@@ -2164,12 +2183,32 @@ void PG::write_info(ObjectStore::Transaction& t)
   t.write(coll_t::META_COLL, biginfo_oid, 0, bigbl.length(), bigbl);
 
   dirty_info = false;
+
+  // the log has usually changed too
+  update_log_stats();
+}
+
+void PG::update_log_stats()
+{
+  if (log.num_entries > log_entries_reported)
+    osd->logger->inc(l_osd_pg_log_entries, log.num_entries - log_entries_reported);
+  else
+    osd->logger->dec(l_osd_pg_log_entries, log_entries_reported - log.num_entries);
+  if (log.bytes > log_bytes_reported)
+    osd->logger->inc(l_osd_pg_log_bytes, log.bytes - log_bytes_reported);
+  else
+    osd->logger->dec(l_osd_pg_log_bytes, log_bytes_reported - log.bytes);
+  log_entries_reported = log.num_entries;
+  log_bytes_reported = log.bytes;
 }
 
 void PG::write_log(ObjectStore::Transaction& t)
 {
   dout(10) << "write_log" << dendl;
 
+  // we rewrite all of it
+  load_log_tail();
+
   // assemble buffer
   bufferlist bl;
 
@@ -2226,11 +2265,18 @@ void PG::trim(ObjectStore::Transaction& t, eversion_t trim_to)
     log.trim(t, trim_to);
     info.log_tail = log.tail;
     trim_ondisklog(t);
+    update_log_stats();
   }
 }
 
 void PG::trim_ondisklog(ObjectStore::Transaction& t) 
 {
+  if (log.has_cold_tail()) {
+    dout(15) << "trim_ondisklog tail " << ondisklog.tail << ", entries through "
+	     << log.cold_to << " are only on disk" << dendl;
+    return;
+  }
+
   uint64_t new_tail;
   if (log.empty()) {
     new_tail = ondisklog.head;
@@ -2326,11 +2372,93 @@ void PG::append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStor
   dout(10) << "append_log  now " << ondisklog.tail << "~" << ondisklog.length() << dendl;
 
   trim(t, trim_to);
+  shed_log_tail();
 
   // update the local pg, pg log
   write_info(t);
 }
 
+/**
+ * drop the oldest entries from memory, leaving them in the ondisk log
+ *
+ * We keep osd_min_pg_log_entries, and everything we (or, on the
+ * primary, a replica) may still need for recovery.
+ */
+void PG::shed_log_tail()
+{
+  // offsets aren't valid until a dirty log is written
+  if (!g_conf->osd_pg_log_cold_tail || dirty_log)
+    return;
+
+  eversion_t limit = info.last_complete;
+  if (is_primary() && min_last_complete_ondisk < limit)
+    limit = min_last_complete_ondisk;
+  uint64_t keep = MAX(1, g_conf->osd_min_pg_log_entries);
+
+  unsigned n = 0;
+  while (log.num_entries > keep &&
+	 log.log.begin() != log.complete_to &&
+	 log.log.front().version <= limit) {
+    pg_log_entry_t &e = log.log.front();
+    log.cold_to = e.version;
+    log.unindex(e);
+    log.log.pop_front();
+    n++;
+  }
+  if (n) {
+    dout(15) << "shed_log_tail " << n << " entries, on disk through "
+	     << log.cold_to << dendl;
+    update_log_stats();
+  }
+}
+
+static bool log_entry_version_lt(const pg_log_entry_t& a, const pg_log_entry_t& b)
+{
+  return a.version < b.version;
+}
+
+/**
+ * read the entries shed_log_tail() or read_log() left on disk back
+ * into the log
+ */
+void PG::load_log_tail()
+{
+  if (!log.has_cold_tail())
+    return;
+
+  uint64_t end = log.log.front().offset;
+  dout(10) << "load_log_tail " << ondisklog.tail << "~" << (end - ondisklog.tail)
+	   << " through " << log.cold_to << dendl;
+
+  // the log writes we queued must land before we read them back
+  osr->flush();
+
+  bufferlist bl;
+  osd->store->read(coll_t::META_COLL, log_oid, ondisklog.tail, end - ondisklog.tail, bl);
+  assert(bl.length() == end - ondisklog.tail);
+
+  list<pg_log_entry_t> ls;
+  vector<hobject_t> objects;
+  bool reorder = decode_log_entries(osd->store, bl, ondisklog.tail, ls, objects);
+  if (!ls.empty() &&
+      ls.back().version.version == log.log.front().version.version) {
+    dout(0) << "load_log_tail  got dup " << log.log.front().version
+	    << " (last was " << ls.back().version << ", dropping that one)" << dendl;
+    ls.pop_back();
+  }
+  if (!ls.empty() && ls.back().version > log.log.front().version)
+    reorder = true;
+
+  log.log.splice(log.log.begin(), ls);
+  if (reorder) {
+    dout(0) << "load_log_tail reordering log" << dendl;
+    log.log.sort(log_entry_version_lt);  // keeps complete_to valid
+  }
+  log.cold_to = eversion_t();
+  log.index();
+  update_log_stats();
+}
+
 void PG::read_log(ObjectStore *store)
 {
   // load bounds
@@ -2344,10 +2472,10 @@ void PG::read_log(ObjectStore *store)
   dout(10) << "read_log " << ondisklog.tail << "~" << ondisklog.length() << dendl;
 
   log.tail = info.log_tail;
+  log.cold_to = eversion_t();
 
   // In case of sobject_t based encoding, may need to list objects in the store
   // to find hashes
-  bool listed_collection = false;
   vector<hobject_t> ls;
   
   if (ondisklog.head > 0) {
@@ -2361,99 +2489,58 @@ void PG::read_log(ObjectStore *store)
 	  << ondisklog.length();
       throw read_log_error(oss.str().c_str());
     }
-    
-    pg_log_entry_t e;
-    bufferlist::iterator p = bl.begin();
     assert(log.empty());
-    eversion_t last;
-    bool reorder = false;
-    while (!p.end()) {
-      uint64_t pos = ondisklog.tail + p.get_off();
-      if (ondisklog.has_checksums) {
-	bufferlist ebl;
-	::decode(ebl, p);
-	__u32 crc;
-	::decode(crc, p);
-	
-	__u32 got = ebl.crc32c(0);
-	if (crc == got) {
-	  bufferlist::iterator q = ebl.begin();
-	  ::decode(e, q);
-	} else {
-	  std::ostringstream oss;
-	  oss << "read_log " << pos << " bad crc got " << got << " expected" << crc;
-	  throw read_log_error(oss.str().c_str());
-	}
-      } else {
-	::decode(e, p);
-      }
-      dout(20) << "read_log " << pos << " " << e << dendl;
-
-      // [repair] in order?
-      if (e.version < last) {
-	dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
-	osd->clog.error() << info.pgid << " log has out of order entry "
-	      << e << " following " << last << "\n";
-	reorder = true;
-      }
 
-      if (e.version <= log.tail) {
-	dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
-	continue;
-      }
-      if (last.version == e.version.version) {
-	dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
-	log.log.pop_back();
-	osd->clog.error() << info.pgid << " read_log got dup "
-	      << e.version << " after " << last << "\n";
-      }
-
-      if (e.invalid_hash) {
-	// We need to find the object in the store to get the hash
-	if (!listed_collection) {
-	  store->collection_list(coll, ls);
-	  listed_collection = true;
-	}
-	bool found = false;
-	for (vector<hobject_t>::iterator i = ls.begin();
-	     i != ls.end();
-	     ++i) {
-	  if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
-	    e.soid = *i;
-	    found = true;
-	    break;
-	  }
-	}
-	if (!found) {
-	  // Didn't find the correct hash
-	  std::ostringstream oss;
-	  oss << "Could not find hash for hoid " << e.soid << std::endl;
-	  throw read_log_error(oss.str().c_str());
+    // find the entries without decoding them, so we can leave the
+    // older complete ones on disk
+    vector<unsigned> starts;
+    if (ondisklog.has_checksums && g_conf->osd_pg_log_cold_tail) {
+      bufferlist::iterator q = bl.begin();
+      try {
+	while (!q.end()) {
+	  starts.push_back(q.get_off());
+	  __u32 len;
+	  ::decode(len, q);
+	  q.advance(len + sizeof(__u32));  // entry and crc
 	}
       }
-
-      if (e.invalid_pool) {
-	e.soid.pool = info.pgid.pool();
+      catch (const buffer::error &e) {
+	// gunk at the end?  decode all of it and let the repair below sort it out
+	dout(0) << "read_log can't find entries past " << starts.back() << dendl;
+	starts.clear();
       }
+    }
 
-      e.offset = pos;
-      uint64_t endpos = ondisklog.tail + p.get_off();
-      log.log.push_back(e);
-      last = e.version;
-
-      // [repair] at end of log?
-      if (!p.end() && e.version == info.last_update) {
-	osd->clog.error() << info.pgid << " log has extra data at "
-	   << endpos << "~" << (ondisklog.head-endpos) << " after "
-	   << info.last_update << "\n";
-
-	dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
-	        << "adjusting ondisklog.head" << dendl;
-	ondisklog.head = endpos;
+    // decode the newest entries, back far enough to cover last_complete
+    unsigned n = MAX(1, g_conf->osd_min_pg_log_entries);
+    unsigned first = starts.size() > n ? starts.size() - n : 0;
+    bool reorder;
+    while (true) {
+      unsigned off = first ? starts[first] : 0;
+      bufferlist ebl;
+      ebl.substr_of(bl, off, bl.length() - off);
+      reorder = decode_log_entries(store, ebl, ondisklog.tail + off, log.log, ls);
+      if (first == 0 ||
+	  (!reorder && (log.empty() || log.log.front().version <= info.last_complete)))
 	break;
+      log.log.clear();
+      first = reorder || first < n ? 0 : first - n;
+      n *= 2;
+    }
+
+    if (first > 0 && !log.empty()) {
+      // the entry before the ones we decoded is the newest one we leave
+      list<pg_log_entry_t> prev;
+      bufferlist ebl;
+      ebl.substr_of(bl, starts[first - 1], starts[first] - starts[first - 1]);
+      decode_log_entries(store, ebl, ondisklog.tail + starts[first - 1], prev, ls);
+      if (!prev.empty()) {
+	log.cold_to = prev.back().version;
+	dout(10) << "read_log leaving " << first << " entries through " << log.cold_to
+		 << " on disk" << dendl;
       }
     }
-  
+
     if (reorder) {
       dout(0) << "read_log reordering log" << dendl;
       map<eversion_t, pg_log_entry_t> m;
@@ -2528,6 +2615,108 @@ void PG::read_log(ObjectStore *store)
   dout(10) << "read_log done" << dendl;
 }
 
+/**
+ * decode ondisk log entries onto the end of ls
+ *
+ * @param bl entries read from the ondisk log
+ * @param off ondisk offset of bl
+ * @param objects the collection listing, if we needed it already
+ * @return true if the entries are out of order
+ */
+bool PG::decode_log_entries(ObjectStore *store, bufferlist& bl, uint64_t off,
+			    list<pg_log_entry_t>& ls, vector<hobject_t>& objects)
+{
+  pg_log_entry_t e;
+  bufferlist::iterator p = bl.begin();
+  eversion_t last;
+  bool reorder = false;
+  while (!p.end()) {
+    uint64_t pos = off + p.get_off();
+    if (ondisklog.has_checksums) {
+      bufferlist ebl;
+      ::decode(ebl, p);
+      __u32 crc;
+      ::decode(crc, p);
+      
+      __u32 got = ebl.crc32c(0);
+      if (crc == got) {
+	bufferlist::iterator q = ebl.begin();
+	::decode(e, q);
+      } else {
+	std::ostringstream oss;
+	oss << "read_log " << pos << " bad crc got " << got << " expected" << crc;
+	throw read_log_error(oss.str().c_str());
+      }
+    } else {
+      ::decode(e, p);
+    }
+    dout(20) << "read_log " << pos << " " << e << dendl;
+
+    // [repair] in order?
+    if (e.version < last) {
+      dout(0) << "read_log " << pos << " out of order entry " << e << " follows " << last << dendl;
+      osd->clog.error() << info.pgid << " log has out of order entry "
+	    << e << " following " << last << "\n";
+      reorder = true;
+    }
+
+    if (e.version <= log.tail) {
+      dout(20) << "read_log  ignoring entry at " << pos << " below log.tail" << dendl;
+      continue;
+    }
+    if (last.version == e.version.version) {
+      dout(0) << "read_log  got dup " << e.version << " (last was " << last << ", dropping that one)" << dendl;
+      ls.pop_back();
+      osd->clog.error() << info.pgid << " read_log got dup "
+	    << e.version << " after " << last << "\n";
+    }
+
+    if (e.invalid_hash) {
+      // We need to find the object in the store to get the hash
+      if (objects.empty())
+	store->collection_list(coll, objects);
+      bool found = false;
+      for (vector<hobject_t>::iterator i = objects.begin();
+	   i != objects.end();
+	   ++i) {
+	if (i->oid == e.soid.oid && i->snap == e.soid.snap) {
+	  e.soid = *i;
+	  found = true;
+	  break;
+	}
+      }
+      if (!found) {
+	// Didn't find the correct hash
+	std::ostringstream oss;
+	oss << "Could not find hash for hoid " << e.soid << std::endl;
+	throw read_log_error(oss.str().c_str());
+      }
+    }
+
+    if (e.invalid_pool) {
+      e.soid.pool = info.pgid.pool();
+    }
+
+    e.offset = pos;
+    uint64_t endpos = off + p.get_off();
+    ls.push_back(e);
+    last = e.version;
+
+    // [repair] at end of log?
+    if (!p.end() && e.version == info.last_update) {
+      osd->clog.error() << info.pgid << " log has extra data at "
+	 << endpos << "~" << (ondisklog.head-endpos) << " after "
+	 << info.last_update << "\n";
+
+      dout(0) << "read_log " << endpos << " *** extra gunk at end of log, "
+	      << "adjusting ondisklog.head" << dendl;
+      ondisklog.head = endpos;
+      break;
+    }
+  }
+  return reorder;
+}
+
 bool PG::check_log_for_corruption(ObjectStore *store)
 {
   OndiskLog bounds;
@@ -2654,6 +2843,7 @@ void PG::read_state(ObjectStore *store)
       ::decode(info, p);
   }
 
+  utime_t start = ceph_clock_now(g_ceph_context);
   try {
     read_log(store);
   }
@@ -2683,6 +2873,8 @@ void PG::read_state(ObjectStore *store)
     info.last_backfill = hobject_t();
     info.stats.stats.clear();
   }
+  osd->logger->tinc(l_osd_pg_log_load_lat, ceph_clock_now(g_ceph_context) - start);
+  update_log_stats();
 
   // log any weirdness
   log_weirdness();
@@ -3220,6 +3412,7 @@ void PG::build_inc_scrub_map(ScrubMap &map, eversion_t v)
   map.incr_since = v;
   vector<hobject_t> ls;
   list<pg_log_entry_t>::iterator p;
+  load_log_after(v);
   if (v == log.tail) {
     p = log.log.begin();
   } else if (v > log.tail) {
@@ -3713,6 +3906,8 @@ void PG::chunky_scrub() {
           if (p->soid >= scrubber.start && p->soid < scrubber.end)
             scrubber.subset_last_update = p->version;
         }
+        if (scrubber.subset_last_update == eversion_t())
+          scrubber.subset_last_update = log.cold_to;  // may be on disk only
 
         // ask replicas to wait until last_update_applied >= scrubber.subset_last_update and then scan
         scrubber.waiting_on_whom.insert(osd->whoami);
@@ -4170,6 +4365,7 @@ void PG::share_pg_log()
     pg_info_t& pinfo(peer_info[peer]);
 
     MOSDPGLog *m = new MOSDPGLog(info.last_update.epoch, info);
+    load_log_after(pinfo.last_update);
     m->log.copy_after(log, pinfo.last_update);
 
     for (list<pg_log_entry_t>::const_iterator i = m->log.log.begin();
@@ -4216,6 +4412,7 @@ void PG::fulfill_log(int from, const pg_query_t &query, epoch_t query_epoch)
   if (query.type == pg_query_t::LOG) {
     dout(10) << " sending info+missing+log since " << query.since
 	     << dendl;
+    load_log_after(query.since);
     if (query.since != eversion_t() && query.since < log.tail) {
       osd->clog.error() << info.pgid << " got broken pg_query_t::LOG since " << query.since
 			<< " when my log.tail is " << log.tail
@@ -4226,6 +4423,7 @@ void PG::fulfill_log(int from, const pg_query_t &query, epoch_t query_epoch)
   }
   else if (query.type == pg_query_t::FULLLOG) {
     dout(10) << " sending info+missing+full log" << dendl;
+    load_log_tail();
     mlog->log = log;
   }
 
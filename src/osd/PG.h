@@ -170,19 +170,75 @@ public:
     list<pg_log_entry_t>::iterator complete_to;  // not inclusive of referenced item
     version_t last_requested;           // last object requested by primary
 
+    // newest entry left only in the ondisk log, if any.  it and everything
+    // older (down to tail) is not in log or the indexes, see
+    // PG::load_log_tail().  dup op detection covers what is in memory,
+    // which is at least osd_min_pg_log_entries.
+    eversion_t cold_to;
+
+    // what the indexed entries cost us, roughly
+    uint64_t num_entries;
+    uint64_t bytes;
+
     /****/
-    IndexedLog() : last_requested(0) {}
+    IndexedLog() : last_requested(0), num_entries(0), bytes(0) {}
+
+    bool has_cold_tail() const {
+      return cold_to != eversion_t();
+    }
+
+    static uint64_t entry_bytes(const pg_log_entry_t& e) {
+      // entry + list node; the object name is counted with its objects node
+      return sizeof(e) + 2 * sizeof(void*) + e.snaps.length();
+    }
+    static uint64_t name_bytes(const hobject_t& o) {
+      // objects node + the name and key, once per object
+      return sizeof(pair<const hobject_t,pg_log_entry_t*>) + 2 * sizeof(void*) +
+	o.oid.name.length() + o.get_key().length();
+    }
+
+    /**
+     * find or add e's object in objects, and give e the key's copy of
+     * its name
+     *
+     * We trim from the tail, so the key outlives every entry for its
+     * object.  With reference counted strings the entries then share
+     * the key's characters.
+     */
+    hash_map<hobject_t,pg_log_entry_t*>::iterator index_name(pg_log_entry_t& e) {
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(e.soid);
+      if (p == objects.end()) {
+	p = objects.insert(make_pair(e.soid, (pg_log_entry_t*)NULL)).first;
+	bytes += name_bytes(e.soid);
+      } else {
+	e.soid = p->first;
+      }
+      return p;
+    }
+
+    /**
+     * copy e's snaps out of the larger buffer they were decoded from, so
+     * the log doesn't pin a whole ondisk log read or message payload
+     */
+    static void compact(pg_log_entry_t& e) {
+      if (e.snaps.length() &&
+	  (e.snaps.buffers().size() > 1 ||
+	   e.snaps.buffers().front().raw_length() > e.snaps.length()))
+	e.snaps.rebuild();
+    }
 
     void claim_log(const pg_log_t& o) {
       log = o.log;
       head = o.head;
       tail = o.tail;
+      cold_to = eversion_t();
       index();
     }
 
     void zero() {
       unindex();
       pg_log_t::clear();
+      cold_to = eversion_t();
       reset_recovery_pointers();
     }
     void reset_recovery_pointers() {
@@ -206,10 +262,15 @@ public:
     void index() {
       objects.clear();
       caller_ops.clear();
+      num_entries = 0;
+      bytes = 0;
       for (list<pg_log_entry_t>::iterator i = log.begin();
            i != log.end();
            i++) {
-        objects[i->soid] = &(*i);
+	compact(*i);
+	num_entries++;
+	bytes += entry_bytes(*i);
+        index_name(*i)->second = &(*i);
 	if (i->reqid_is_indexed()) {
 	  //assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	  caller_ops[i->reqid] = &(*i);
@@ -218,9 +279,13 @@ public:
     }
 
     void index(pg_log_entry_t& e) {
-      if (objects.count(e.soid) == 0 || 
-          objects[e.soid]->version < e.version)
-        objects[e.soid] = &e;
+      compact(e);
+      num_entries++;
+      bytes += entry_bytes(e);
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = index_name(e);
+      if (p->second == NULL ||
+          p->second->version < e.version)
+        p->second = &e;
       if (e.reqid_is_indexed()) {
 	//assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
 	caller_ops[e.reqid] = &e;
@@ -229,11 +294,19 @@ public:
     void unindex() {
       objects.clear();
       caller_ops.clear();
+      num_entries = 0;
+      bytes = 0;
     }
     void unindex(pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
-      if (objects.count(e.soid) && objects[e.soid]->version == e.version)
-        objects.erase(e.soid);
+      assert(num_entries > 0);
+      num_entries--;
+      bytes -= entry_bytes(e);
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = objects.find(e.soid);
+      if (p != objects.end() && p->second->version == e.version) {
+	bytes -= name_bytes(p->first);
+        objects.erase(p);
+      }
       if (e.reqid_is_indexed() &&
 	  caller_ops.count(e.reqid) &&  // divergent merge_log indexes new before unindexing old
 	  caller_ops[e.reqid] == &e)
@@ -253,6 +326,8 @@ public:
     
     // actors
     void add(pg_log_entry_t& e) {
+      hash_map<hobject_t,pg_log_entry_t*>::iterator p = index_name(e);
+
       // add to log
       log.push_back(e);
       assert(e.version > head);
@@ -260,8 +335,10 @@ public:
       head = e.version;
 
       // to our index
-      objects[e.soid] = &(log.back());
+      p->second = &(log.back());
       caller_ops[e.reqid] = &(log.back());
+      num_entries++;
+      bytes += entry_bytes(e);
     }
 
     void trim(ObjectStore::Transaction &t, eversion_t s);
@@ -414,6 +491,10 @@ public:
 
   bool dirty_info, dirty_log;
 
+  // what we last added to the osd's pg log perf counters
+  uint64_t log_entries_reported, log_bytes_reported;
+  void update_log_stats();
+
 public:
   // pg state
   pg_info_t        info;
@@ -1694,6 +1775,14 @@ public:
   void append_log(vector<pg_log_entry_t>& logv, eversion_t trim_to, ObjectStore::Transaction &t);
 
   void read_log(ObjectStore *store);
+  bool decode_log_entries(ObjectStore *store, bufferlist& bl, uint64_t off,
+			  list<pg_log_entry_t>& ls, vector<hobject_t>& objects);
+  void load_log_tail();
+  void load_log_after(eversion_t v) {
+    if (log.has_cold_tail() && v < log.log.front().version)
+      load_log_tail();
+  }
+  void shed_log_tail();
   bool check_log_for_corruption(ObjectStore *store);
   void trim(ObjectStore::Transaction& t, eversion_t v);
   void trim_ondisklog(ObjectStore::Transaction& t);
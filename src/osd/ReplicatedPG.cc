@@ -281,6 +281,11 @@ int ReplicatedPG::do_command(vector<string>& cmd, ostream& ss,
     jsf.open_object_section("info");
     info.dump(&jsf);
     jsf.close_section();
+    jsf.open_object_section("log");
+    jsf.dump_unsigned("entries", log.num_entries);
+    jsf.dump_unsigned("objects", log.objects.size());
+    jsf.dump_unsigned("bytes", log.bytes);
+    jsf.close_section();
 
     jsf.open_array_section("recovery_state");
     handle_query_state(&jsf);
@@ -570,6 +575,12 @@ void ReplicatedPG::calc_trim_to()
       size_t num_to_trim = log.approx_size() - g_conf->osd_min_pg_log_entries;
       list<pg_log_entry_t>::const_iterator it = log.log.begin();
       eversion_t new_trim_to;
+      if (log.has_cold_tail()) {
+	// we hold at least osd_min_pg_log_entries in memory; trim what
+	// is only on disk
+	new_trim_to = MIN(log.cold_to, min_last_complete_ondisk);
+	num_to_trim = 0;
+      }
       for (size_t i = 0; i < num_to_trim; ++i) {
 	new_trim_to = it->version;
 	++it;
@@ -1421,6 +1432,7 @@ ReplicatedPG::RepGather *ReplicatedPG::trim_object(const hobject_t &coid,
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::MODIFY, coid, coi.version, coi.prior_version,
 				  osd_reqid_t(), ctx->mtime));
     ::encode(coi, ctx->log.back().snaps);
+    ctx->log.back().snaps.rebuild();  // don't pin an append page in the log
     ctx->at_version.version++;
   }
 
@@ -3276,6 +3288,7 @@ void ReplicatedPG::make_writeable(OpContext *ctx)
     ctx->log.push_back(pg_log_entry_t(pg_log_entry_t::CLONE, coid, ctx->at_version,
 				  ctx->obs->oi.version, ctx->reqid, ctx->new_obs.oi.mtime));
     ::encode(snaps, ctx->log.back().snaps);
+    ctx->log.back().snaps.rebuild();  // don't pin an append page in the log
 
     ctx->at_version.version++;
   }
@@ -3988,7 +4001,7 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
     }
     
     wr->pg_trim_to = pg_trim_to;
-    osd->send_message_osd_cluster(peer, wr, get_osdmap()->get_epoch());
+    send_repop(peer, wr);
 
     // keep peer_info up to date
     if (pinfo.last_complete == pinfo.last_update)
@@ -3997,6 +4010,98 @@ void ReplicatedPG::issue_repop(RepGather *repop, utime_t now,
   }
 }
 
+bool ReplicatedPG::can_batch_repops(int peer)
+{
+  if (g_conf->osd_rep_batch_max_ops <= 1)
+    return false;
+  // backfill decides what to send by backfill_pos as it goes
+  if (peer == backfill_target)
+    return false;
+  ConnectionRef con = osd->get_con_osd_cluster(peer, get_osdmap()->get_epoch());
+  return con && (con->features & CEPH_FEATURE_OSD_REPOP_BATCH);
+}
+
+void ReplicatedPG::send_repop(int peer, MOSDSubOp *wr)
+{
+  map<int, RepBatch>::iterator p = rep_batches.find(peer);
+  if (p == rep_batches.end()) {
+    // nothing else in flight, or no batching: send now
+    if (repop_queue.size() <= 1 || !can_batch_repops(peer)) {
+      osd->send_message_osd_cluster(peer, wr, get_osdmap()->get_epoch());
+      return;
+    }
+    dout(15) << "send_repop starting batch for osd." << peer
+	     << " with " << wr->version << dendl;
+    RepBatch &b = rep_batches[peer];
+    b.m = wr;
+    b.bytes = wr->get_data().length() + wr->logbl.length();
+    b.flush_event = new C_FlushRepBatch(this, peer);
+    Mutex::Locker l(osd->rep_batch_lock);
+    osd->rep_batch_timer.add_event_after(g_conf->osd_rep_batch_delay,
+					 b.flush_event);
+    return;
+  }
+
+  RepBatch &b = p->second;
+  dout(15) << "send_repop adding " << wr->version << " to batch for osd."
+	   << peer << dendl;
+  b.m->batch.push_back(MOSDSubOp::batch_item_t(wr->reqid, wr->poid,
+					       wr->get_tid(), wr->version));
+  b.bytes += wr->get_data().length() + wr->logbl.length();
+  b.m->get_data().claim_append(wr->get_data());
+  b.m->logbl.claim_append(wr->logbl);
+  b.m->pg_stats = wr->pg_stats;
+  b.m->pg_trim_to = wr->pg_trim_to;
+  wr->put();
+
+  if (b.m->batch.size() + 1 >= (unsigned)g_conf->osd_rep_batch_max_ops ||
+      b.bytes >= g_conf->osd_rep_batch_max_bytes)
+    flush_rep_batch(peer);
+}
+
+void ReplicatedPG::flush_rep_batch(int peer)
+{
+  map<int, RepBatch>::iterator p = rep_batches.find(peer);
+  assert(p != rep_batches.end());
+  RepBatch &b = p->second;
+  if (b.flush_event) {
+    // if it already fired, rep_batch_timeout() will find it stale
+    Mutex::Locker l(osd->rep_batch_lock);
+    osd->rep_batch_timer.cancel_event(b.flush_event);
+  }
+  dout(15) << "flush_rep_batch osd." << peer << " " << (b.m->batch.size() + 1)
+	   << " repops, " << b.bytes << " bytes" << dendl;
+  osd->logger->inc(l_osd_rep_batch, b.m->batch.size() + 1);
+  osd->send_message_osd_cluster(peer, b.m, get_osdmap()->get_epoch());
+  rep_batches.erase(p);
+}
+
+void ReplicatedPG::rep_batch_timeout(int peer, Context *c)
+{
+  map<int, RepBatch>::iterator p = rep_batches.find(peer);
+  if (p == rep_batches.end() || p->second.flush_event != c)
+    return;  // flushed or dropped since
+  p->second.flush_event = NULL;
+  osd->logger->inc(l_osd_rep_batch_timeout);
+  flush_rep_batch(peer);
+}
+
+void ReplicatedPG::drop_rep_batches()
+{
+  for (map<int, RepBatch>::iterator p = rep_batches.begin();
+       p != rep_batches.end();
+       ++p) {
+    dout(10) << "drop_rep_batches dropping " << (p->second.m->batch.size() + 1)
+	     << " repops for osd." << p->first << dendl;
+    if (p->second.flush_event) {
+      Mutex::Locker l(osd->rep_batch_lock);
+      osd->rep_batch_timer.cancel_event(p->second.flush_event);
+    }
+    p->second.m->put();
+  }
+  rep_batches.clear();
+}
+
 ReplicatedPG::RepGather *ReplicatedPG::new_repop(OpContext *ctx, ObjectContext *obc,
 						 tid_t rep_tid)
 {
@@ -4223,9 +4328,16 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
   ObjectContext *obc;
   if (p != object_contexts.end()) {
     obc = p->second;
+    if (obc->lru_item.is_on_list()) {
+      obc->lru_item.remove_myself();
+      note_context_lookup(false, true);
+    }
     dout(10) << "get_object_context " << obc << " " << soid << " " << obc->ref
 	     << " -> " << (obc->ref+1) << dendl;
   } else {
+    note_context_lookup(false, false);
+    trim_context_cache(g_conf->osd_pg_object_context_cache_count);
+
     // check disk
     bufferlist bv;
     int r = osd->store->getattr(coll, soid, OI_ATTR, bv);
@@ -4268,6 +4380,99 @@ ReplicatedPG::ObjectContext *ReplicatedPG::get_object_context(const hobject_t& s
 void ReplicatedPG::context_registry_on_change()
 {
   remove_watchers_and_notifies();
+  clear_context_cache();
+}
+
+void ReplicatedPG::note_context_lookup(bool snapset, bool hit)
+{
+  osd->logger->inc(hit ? l_osd_obc_hit : l_osd_obc_miss);
+  if (snapset) {
+    if (hit)
+      context_cache_stats.ssc_hits++;
+    else
+      context_cache_stats.ssc_misses++;
+  } else {
+    if (hit)
+      context_cache_stats.obc_hits++;
+    else
+      context_cache_stats.obc_misses++;
+  }
+}
+
+void ReplicatedPG::evict_object_context(ObjectContext *obc)
+{
+  dout(15) << "evict_object_context " << obc << " " << obc->obs.oi.soid << dendl;
+  assert(obc->ref == 0);
+  obc->lru_item.remove_myself();
+  object_contexts.erase(obc->obs.oi.soid);
+  if (obc->ssc)
+    put_snapset_context(obc->ssc);
+  delete obc;
+}
+
+void ReplicatedPG::evict_snapset_context(SnapSetContext *ssc)
+{
+  dout(15) << "evict_snapset_context " << ssc << " " << ssc->oid << dendl;
+  assert(ssc->ref == 0);
+  ssc->lru_item.remove_myself();
+  snapset_contexts.erase(ssc->oid);
+  delete ssc;
+}
+
+/*
+ * Trim the idle contexts down to max.  This is only done before a new
+ * context is registered (and on interval change), never from
+ * put_object_context(), so that putting a ref can't pull a context out
+ * from under someone walking object_contexts.
+ */
+void ReplicatedPG::trim_context_cache(unsigned max)
+{
+  while ((unsigned)obc_lru.size() > max) {
+    ObjectContext *obc = obc_lru.back();
+    if (obc->ref) {
+      // got a ref without going through get_object_context; it is
+      // requeued when that is put.
+      obc->lru_item.remove_myself();
+      continue;
+    }
+    evict_object_context(obc);
+  }
+  while ((unsigned)ssc_lru.size() > max) {
+    SnapSetContext *ssc = ssc_lru.back();
+    if (ssc->ref) {
+      ssc->lru_item.remove_myself();
+      continue;
+    }
+    evict_snapset_context(ssc);
+  }
+}
+
+/*
+ * Drop any idle contexts for soid, and for its snapset, before the
+ * object is rewritten behind the op path's back (i.e., recovered).
+ */
+void ReplicatedPG::invalidate_object_context(const hobject_t& soid)
+{
+  ObjectContext *obc = _lookup_object_context(soid);
+  if (obc && obc->ref == 0)
+    evict_object_context(obc);
+
+  map<object_t, SnapSetContext*>::iterator p = snapset_contexts.find(soid.oid);
+  if (p == snapset_contexts.end())
+    return;
+
+  // idle clones may still be holding the snapset
+  SnapSetContext *ssc = p->second;
+  for (xlist<ObjectContext*>::iterator i = obc_lru.begin(); !i.end(); ) {
+    ObjectContext *o = *i;
+    ++i;
+    if (o->ssc == ssc && o->ref == 0)
+      evict_object_context(o);
+  }
+
+  p = snapset_contexts.find(soid.oid);
+  if (p != snapset_contexts.end() && p->second->ref == 0)
+    evict_snapset_context(p->second);
 }
 
 
@@ -4382,6 +4587,13 @@ void ReplicatedPG::put_object_context(ObjectContext *obc)
 
   --obc->ref;
   if (obc->ref == 0) {
+    if (obc->registered && obc->obs.exists && can_cache_contexts()) {
+      // keep it (and its snapset) for the next op
+      obc_lru.push_front(&obc->lru_item);
+      return;
+    }
+    obc->lru_item.remove_myself();
+
     if (obc->ssc)
       put_snapset_context(obc->ssc);
 
@@ -4460,7 +4672,14 @@ ReplicatedPG::SnapSetContext *ReplicatedPG::get_snapset_context(const object_t&
   map<object_t, SnapSetContext*>::iterator p = snapset_contexts.find(oid);
   if (p != snapset_contexts.end()) {
     ssc = p->second;
+    if (ssc->lru_item.is_on_list()) {
+      ssc->lru_item.remove_myself();
+      note_context_lookup(true, true);
+    }
   } else {
+    note_context_lookup(true, false);
+    trim_context_cache(g_conf->osd_pg_object_context_cache_count);
+
     bufferlist bv;
     hobject_t head(oid, key, CEPH_NOSNAP, seed,
 		   info.pgid.pool());
@@ -4494,6 +4713,14 @@ void ReplicatedPG::put_snapset_context(SnapSetContext *ssc)
 
   --ssc->ref;
   if (ssc->ref == 0) {
+    if (ssc->registered &&
+	(ssc->snapset.head_exists || !ssc->snapset.clones.empty()) &&
+	can_cache_contexts()) {
+      ssc_lru.push_front(&ssc->lru_item);
+      return;
+    }
+    ssc->lru_item.remove_myself();
+
     if (ssc->registered)
       snapset_contexts.erase(ssc->oid);
     delete ssc;
@@ -4523,6 +4750,7 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
 	   << (m->noop ? " NOOP" : "")
 	   << (m->logbl.length() ? " (transaction)" : " (parallel exec")
 	   << " " << m->logbl.length()
+	   << " + " << m->batch.size() << " batched"
 	   << dendl;  
 
   // sanity checks
@@ -4532,6 +4760,10 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
   
   // we better not be missing this.
   assert(!missing.is_missing(soid));
+  for (vector<MOSDSubOp::batch_item_t>::iterator i = m->batch.begin();
+       i != m->batch.end();
+       ++i)
+    assert(!missing.is_missing(i->poid));
 
   int ackerosd = acting[0];
   
@@ -4554,8 +4786,25 @@ void ReplicatedPG::sub_op_modify(OpRequestRef op)
       bufferlist::iterator p = m->get_data().begin();
 
       ::decode(rm->opt, p);
+      // batched repops' transactions follow, and are applied as one
+      for (unsigned i = 0; i < m->batch.size(); ++i) {
+	ObjectStore::Transaction t;
+	::decode(t, p);
+	rm->opt.append(t);
+      }
       p = m->logbl.begin();
       ::decode(log, p);
+      for (unsigned i = 0; i < m->batch.size(); ++i) {
+	vector<pg_log_entry_t> more;
+	::decode(more, p);
+	log.insert(log.end(), more.begin(), more.end());
+      }
+      // don't let the log pin the message payload
+      for (vector<pg_log_entry_t>::iterator i = log.begin();
+	   i != log.end();
+	   ++i)
+	IndexedLog::compact(*i);
+      osd->logger->inc(l_osd_sop_batch, m->batch.size() + 1);
       if (m->hobject_incorrect_pool) {
 	for (vector<pg_log_entry_t>::iterator i = log.begin();
 	     i != log.end();
@@ -4641,11 +4890,12 @@ void ReplicatedPG::sub_op_modify_applied(RepModify *rm)
       osd->send_message_osd_cluster(rm->ackerosd, ack, get_osdmap()->get_epoch());
     }
     
-    assert(info.last_update >= m->version);
+    assert(info.last_update >= m->get_last_version());
     assert(last_update_applied < m->version);
-    last_update_applied = m->version;
+    last_update_applied = m->get_last_version();
     if (scrubber.active_rep_scrub) {
-      if (last_update_applied == scrubber.active_rep_scrub->scrub_to) {
+      // a batch may take us past scrub_to
+      if (last_update_applied >= scrubber.active_rep_scrub->scrub_to) {
 	osd->rep_scrub_wq.queue(scrubber.active_rep_scrub);
 	scrubber.active_rep_scrub = 0;
       }
@@ -4718,6 +4968,19 @@ void ReplicatedPG::sub_op_modify_reply(OpRequestRef op)
 	      fromosd, 
 	      r->get_last_complete_ondisk());
   }
+  for (vector<tid_t>::iterator p = r->batch_tids.begin();
+       p != r->batch_tids.end();
+       ++p) {
+    if (repop_map.count(*p))
+      repop_ack(repop_map[*p],
+		r->get_result(), r->ack_type,
+		fromosd,
+		r->get_last_complete_ondisk());
+  }
+
+  // the replica has room for more
+  if (rep_batches.count(fromosd))
+    flush_rep_batch(fromosd);
 }
 
 
@@ -5322,6 +5585,7 @@ void ReplicatedPG::handle_pull_response(OpRequestRef op)
   if (complete) {
     submit_push_complete(pi.recovery_info, t);
 
+    invalidate_object_context(hoid);
     SnapSetContext *ssc;
     if (hoid.snap == CEPH_NOSNAP || hoid.snap == CEPH_SNAPDIR) {
       ssc = create_snapset_context(hoid.oid);
@@ -5473,21 +5737,20 @@ int ReplicatedPG::send_push(int prio, int peer,
 
   uint64_t available = g_conf->osd_recovery_max_chunk;
   if (!progress.omap_complete) {
-    ObjectMap::ObjectMapIterator iter =
-      osd->store->get_omap_iterator(coll,
-				    recovery_info.soid);
-    for (iter->upper_bound(progress.omap_recovered_to);
-	 iter->valid();
-	 iter->next()) {
-      if (available < (iter->key().size() + iter->value().length()))
-	break;
-      subop->omap_entries.insert(make_pair(iter->key(), iter->value()));
-      available -= (iter->key().size() + iter->value().length());
-    }
-    if (!iter->valid())
+    bool more = false;
+    osd->store->omap_get_vals_range(coll, recovery_info.soid,
+				    progress.omap_recovered_to, available,
+				    &subop->omap_entries, &more);
+    for (map<string, bufferlist>::iterator i = subop->omap_entries.begin();
+	 i != subop->omap_entries.end();
+	 ++i) {
+      uint64_t len = i->first.size() + i->second.length();
+      available -= MIN(available, len);
+    }
+    if (!more)
       new_progress.omap_complete = true;
     else
-      new_progress.omap_recovered_to = iter->key();
+      new_progress.omap_recovered_to = subop->omap_entries.rbegin()->first;
   }
 
   subop->data_included.span_of(recovery_info.copy_subset,
@@ -6114,13 +6377,16 @@ void ReplicatedPG::on_removal()
   dout(10) << "on_removal" << dendl;
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  clear_context_cache();
 }
 
 void ReplicatedPG::on_shutdown()
 {
   dout(10) << "on_shutdown" << dendl;
+  drop_rep_batches();
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
+  clear_context_cache();
 }
 
 void ReplicatedPG::on_activate()
@@ -6162,6 +6428,9 @@ void ReplicatedPG::on_change()
   requeue_ops(waiting_for_all_missing);
   waiting_for_all_missing.clear();
 
+  // the repops still batched are requeued along with the rest
+  drop_rep_batches();
+
   // this will requeue ops we were working on but didn't finish, and
   // any dups
   apply_and_flush_repops(is_primary());
@@ -100,10 +100,27 @@ public:
     int ref;
     bool registered; 
     SnapSet snapset;
+    xlist<SnapSetContext*>::item lru_item;  // on ssc_lru while idle
 
-    SnapSetContext(const object_t& o) : oid(o), ref(0), registered(false) { }
+    SnapSetContext(const object_t& o) : oid(o), ref(0), registered(false),
+					lru_item(this) { }
   };
 
+  /// object context cache lookups, kept under the pg lock
+  struct ContextCacheStats {
+    uint64_t obc_hits, obc_misses;
+    uint64_t ssc_hits, ssc_misses;
+    ContextCacheStats()
+      : obc_hits(0), obc_misses(0), ssc_hits(0), ssc_misses(0) {}
+    void add(const ContextCacheStats& o) {
+      obc_hits += o.obc_hits;
+      obc_misses += o.obc_misses;
+      ssc_hits += o.ssc_hits;
+      ssc_misses += o.ssc_misses;
+    }
+  };
+  ContextCacheStats context_cache_stats;
+
   struct ObjectState {
     object_info_t oi;
     bool exists;
@@ -283,11 +300,13 @@ public:
     map<entity_name_t, Watch::C_WatchTimeout *> unconnected_watchers;
     map<Watch::Notification *, bool> notifs;
 
+    xlist<ObjectContext*>::item lru_item;  // on obc_lru while idle
+
     ObjectContext(const object_info_t &oi_, bool exists_, SnapSetContext *ssc_)
       : ref(0), registered(false), obs(oi_, exists_), ssc(ssc_),
 	lock("ReplicatedPG::ObjectContext::lock"),
 	unstable_writes(0), readers(0), writers_waiting(0), readers_waiting(0),
-	blocked_by(0) {}
+	blocked_by(0), lru_item(this) {}
     
     void get() { ++ref; }
 
@@ -484,6 +503,39 @@ protected:
                  int result, int ack_type,
                  int fromosd, eversion_t pg_complete_thru=eversion_t(0,0));
 
+  // -- replication batching --
+  /*
+   * While other repops are in flight, the repops for a replica are
+   * collected into one MOSDSubOp (see MOSDSubOp::batch), which is sent
+   * when the replica next replies, when it is full, or after
+   * osd_rep_batch_delay, so that a burst of small writes costs the
+   * replica one message, journal entry and reply.
+   */
+  struct RepBatch {
+    MOSDSubOp *m;
+    uint64_t bytes;
+    Context *flush_event;  ///< on osd->rep_batch_timer
+    RepBatch() : m(NULL), bytes(0), flush_event(NULL) {}
+  };
+  map<int, RepBatch> rep_batches;  ///< by replica
+
+  struct C_FlushRepBatch : public Context {
+    PGRef pg;
+    int peer;
+    C_FlushRepBatch(ReplicatedPG *pg, int peer) : pg(pg), peer(peer) {}
+    void finish(int r) {
+      pg->lock();
+      static_cast<ReplicatedPG*>(pg.get())->rep_batch_timeout(peer, this);
+      pg->unlock();
+    }
+  };
+
+  bool can_batch_repops(int peer);
+  void send_repop(int peer, MOSDSubOp *wr);
+  void flush_rep_batch(int peer);
+  void rep_batch_timeout(int peer, Context *c);
+  void drop_rep_batches();
+
   /// true if we can send an ondisk/commit for v
   bool already_complete(eversion_t v) {
     for (xlist<RepGather*>::iterator i = repop_queue.begin();
@@ -516,6 +568,25 @@ protected:
   map<hobject_t, ObjectContext*> object_contexts;
   map<object_t, SnapSetContext*> snapset_contexts;
 
+  // contexts whose last ref was put stay registered here, hottest first,
+  // so the next op on the object needn't reread its attrs.  they may
+  // carry projected state, so they are dropped on interval change.
+  xlist<ObjectContext*> obc_lru;
+  xlist<SnapSetContext*> ssc_lru;
+  /// counts only lookups that found an idle context as hits
+  void note_context_lookup(bool snapset, bool hit);
+  bool can_cache_contexts() {
+    return is_primary() && is_active() &&
+      g_conf->osd_pg_object_context_cache_count > 0;
+  }
+  void evict_object_context(ObjectContext *obc);
+  void evict_snapset_context(SnapSetContext *ssc);
+  void trim_context_cache(unsigned max);
+  void clear_context_cache() {
+    trim_context_cache(0);
+  }
+  void invalidate_object_context(const hobject_t& soid);
+
   void populate_obc_watchers(ObjectContext *obc);
   void register_unconnected_watcher(void *obc,
 				    entity_name_t entity,
@@ -529,6 +600,7 @@ protected:
   ObjectContext *lookup_object_context(const hobject_t& soid) {
     if (object_contexts.count(soid)) {
       ObjectContext *obc = object_contexts[soid];
+      obc->lru_item.remove_myself();
       obc->ref++;
       return obc;
     }
@@ -943,7 +1015,9 @@ public:
   ReplicatedPG(OSDService *o, OSDMapRef curmap,
 	       const PGPool &_pool, pg_t p, const hobject_t& oid,
 	       const hobject_t& ioid);
-  ~ReplicatedPG() {}
+  ~ReplicatedPG() {
+    clear_context_cache();
+  }
 
   int do_command(vector<string>& cmd, ostream& ss, bufferlist& idata, bufferlist& odata);
 
@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include "os/FileStore.h"
+#include "common/ceph_argparse.h"
+#include "common/errno.h"
+#include "global/global_init.h"
+
+/*
+ * Split the directories of a new pool's PGs up front, so they don't
+ * get split again and again as the pool fills.  Run it against a
+ * stopped OSD once the pool's PGs have been created.
+ */
+int presplit(FileStore *store, int64_t pool, uint64_t objects)
+{
+  int r = store->mount();
+  if (r < 0) {
+    cerr << "unable to mount: " << cpp_strerror(r) << std::endl;
+    return 1;
+  }
+
+  vector<coll_t> collections;
+  store->list_collections(collections);
+  int split = 0, skipped = 0;
+  for (vector<coll_t>::iterator p = collections.begin();
+       p != collections.end();
+       ++p) {
+    pg_t pgid;
+    snapid_t snap;
+    if (!p->is_pg(pgid, snap) || snap != CEPH_NOSNAP ||
+	(int64_t)pgid.pool() != pool)
+      continue;
+    r = store->pre_split_collection(*p, objects);
+    if (r == -ENOTEMPTY) {
+      cout << *p << " is not empty, skipping" << std::endl;
+      skipped++;
+      continue;
+    }
+    if (r < 0) {
+      cerr << "error splitting " << *p << ": " << cpp_strerror(r) << std::endl;
+      store->umount();
+      return 1;
+    }
+    split++;
+  }
+  cout << "split " << split << " collections, skipped " << skipped
+       << std::endl;
+
+  store->umount();
+  return 0;
+}
+
+void usage()
+{
+  cerr << "usage: presplit <osd data> <osd journal> <pool id> <objects per pg>"
+       << std::endl;
+  exit(0);
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  if (args.size() != 4)
+    usage();
+
+  FileStore store(args[0], args[1]);
+  return presplit(&store, atoll(args[2]), strtoull(args[3], NULL, 10));
+}
@@ -19,6 +19,10 @@ public:
   KeyValueDBMemory(KeyValueDBMemory *db) : db(db->db) { }
   virtual ~KeyValueDBMemory() { }
 
+  virtual int init(ostream &out) {
+    return 0;
+  }
+
   int get(
     const string &prefix,
     const std::set<string> &key,
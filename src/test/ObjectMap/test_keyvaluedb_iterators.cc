@@ -27,6 +27,7 @@
 using namespace std;
 
 string store_path;
+string store_backend = "leveldb";
 
 class IteratorTest : public ::testing::Test
 {
@@ -37,7 +38,9 @@ public:
   virtual void SetUp() {
     assert(!store_path.empty());
 
-    LevelDBStore *db_ptr = new LevelDBStore(store_path);
+    KeyValueDB *db_ptr = KeyValueDB::create(g_ceph_context, store_backend,
+					    store_path);
+    assert(db_ptr);
     assert(!db_ptr->init(std::cerr));
     db.reset(db_ptr);
     mock.reset(new KeyValueDBMemory());
@@ -1779,10 +1782,13 @@ int main(int argc, char *argv[])
 
   if (argc < 2) {
     std::cerr << "Usage: " << argv[0]
-	      << "[ceph_options] [gtest_options] <store_path>" << std::endl;
+	      << "[ceph_options] [gtest_options] <store_path> [leveldb|memdb]"
+	      << std::endl;
     return 1;
   }
   store_path = string(argv[1]);
+  if (argc > 2)
+    store_backend = string(argv[2]);
 
   return RUN_ALL_TESTS();
 }
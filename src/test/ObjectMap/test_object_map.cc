@@ -10,10 +10,13 @@
 #include "os/DBObjectMap.h"
 #include "os/HashIndex.h"
 #include "os/LevelDBStore.h"
+#include "os/MemDBStore.h"
+#include "common/Thread.h"
 #include <sys/types.h>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
 #include <dirent.h>
+#include <errno.h>
 
 #include "gtest/gtest.h"
 #include "stdlib.h"
@@ -509,16 +512,20 @@ public:
   ObjectMapTester tester;
   virtual void SetUp() {
     char *path = getenv("OBJECT_MAP_PATH");
-    if (!path) {
+    char *backend = getenv("OBJECT_MAP_BACKEND");
+    if (!path && !backend) {
       db.reset(new DBObjectMap(new KeyValueDBMemory()));
       tester.db = db.get();
       return;
     }
 
-    string strpath(path);
+    // memdb works without a path; leveldb needs one
+    string strpath(path ? path : "");
+    string type(backend ? backend : "leveldb");
 
-    cerr << "using path " << strpath << std::endl;;
-    LevelDBStore *store = new LevelDBStore(strpath);
+    cerr << "using " << type << " at path " << strpath << std::endl;;
+    KeyValueDB *store = KeyValueDB::create(g_ceph_context, type, strpath);
+    assert(store);
     assert(!store->init(cerr));
 
     db.reset(new DBObjectMap(store));
@@ -747,3 +754,207 @@ TEST_F(ObjectMapTest, RandomTest) {
     }
   }
 }
+
+TEST_F(ObjectMapTest, GetValuesCloneChain) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  hobject_t hoid3(sobject_t("foo3", CEPH_NOSNAP));
+
+  for (unsigned i = 0; i < 100; ++i) {
+    tester.set_key(hoid, "foo" + num_str(i), "bar" + num_str(i));
+  }
+  db->clone(hoid, hoid2);
+  for (unsigned i = 0; i < 100; i += 3) {
+    tester.set_key(hoid, "foo" + num_str(i), "baz" + num_str(i));
+  }
+  set<string> to_remove;
+  for (unsigned i = 0; i < 100; i += 5) {
+    to_remove.insert("foo" + num_str(i));
+  }
+  db->rm_keys(hoid, to_remove);
+  db->clone(hoid, hoid3);
+
+  set<string> to_get;
+  for (unsigned i = 0; i < 110; ++i) {
+    to_get.insert("foo" + num_str(i));
+  }
+  map<string, bufferlist> got;
+  ASSERT_EQ(0, db->get_values(hoid, to_get, &got));
+  set<string> present;
+  ASSERT_EQ(0, db->check_keys(hoid, to_get, &present));
+  ASSERT_EQ(got.size(), present.size());
+  for (unsigned i = 0; i < 110; ++i) {
+    string key = "foo" + num_str(i);
+    if (i >= 100 || !(i % 5)) {
+      ASSERT_EQ(0u, got.count(key));
+      continue;
+    }
+    ASSERT_EQ(1u, got.count(key));
+    ASSERT_EQ(1u, present.count(key));
+    string expected = ((i % 3) ? "bar" : "baz") + num_str(i);
+    ASSERT_EQ(expected, string(got[key].c_str(), got[key].length()));
+  }
+
+  got.clear();
+  ASSERT_EQ(0, db->get_values(hoid2, to_get, &got));
+  ASSERT_EQ(100u, got.size());
+  string key = "foo" + num_str(3);
+  ASSERT_EQ("bar" + num_str(3), string(got[key].c_str(), got[key].length()));
+
+  db->clear(hoid);
+  db->clear(hoid2);
+  db->clear(hoid3);
+}
+
+TEST_F(ObjectMapTest, GetValsRange) {
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+
+  // keys and values are 13 bytes each
+  for (unsigned i = 0; i < 100; ++i) {
+    tester.set_key(hoid, "key" + num_str(i), "val" + num_str(i));
+  }
+  db->clone(hoid, hoid2);
+  tester.remove_key(hoid2, "key" + num_str(50));
+
+  set<string> keys;
+  string after;
+  bool more = true;
+  while (more) {
+    map<string, bufferlist> got;
+    ASSERT_EQ(0, db->get_vals_range(hoid2, after, 130, &got, &more));
+    ASSERT_TRUE(got.size() > 0);
+    ASSERT_TRUE(got.size() <= 5);
+    ASSERT_TRUE(got.begin()->first > after);
+    for (map<string, bufferlist>::iterator i = got.begin();
+	 i != got.end();
+	 ++i)
+      keys.insert(i->first);
+    after = got.rbegin()->first;
+  }
+  ASSERT_EQ(99u, keys.size());
+  ASSERT_EQ(0u, keys.count("key" + num_str(50)));
+
+  // always make progress
+  map<string, bufferlist> got;
+  ASSERT_EQ(0, db->get_vals_range(hoid, "", 1, &got, &more));
+  ASSERT_EQ(1u, got.size());
+  ASSERT_TRUE(more);
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
+TEST_F(ObjectMapTest, Flatten) {
+  DBObjectMap *dbomap = static_cast<DBObjectMap*>(db.get());
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t hoid2(sobject_t("foo2", CEPH_NOSNAP));
+  hobject_t hoid3(sobject_t("foo3", CEPH_NOSNAP));
+
+  for (unsigned i = 0; i < 100; ++i) {
+    tester.set_key(hoid, "foo" + num_str(i), "bar" + num_str(i));
+  }
+  tester.set_header(hoid, "header");
+  db->clone(hoid, hoid2);
+  tester.set_key(hoid, "foo" + num_str(0), "baz");
+  tester.remove_key(hoid, "foo" + num_str(1));
+  db->clone(hoid, hoid3);
+  tester.set_key(hoid, "foo" + num_str(100), "bar" + num_str(100));
+
+  map<string, bufferlist> before, before2, after;
+  bufferlist header;
+  db->get(hoid, &header, &before);
+  db->get(hoid2, &header, &before2);
+  ASSERT_EQ(100u, before.size());
+
+  // too big to flatten under this limit; left as it was
+  ASSERT_EQ(-E2BIG, dbomap->flatten(hoid, 50));
+  after.clear();
+  db->get(hoid, &header, &after);
+  ASSERT_EQ(before.size(), after.size());
+  after.clear();
+
+  ASSERT_EQ(0, dbomap->flatten(hoid, 1000));
+  // already flat
+  ASSERT_EQ(0, dbomap->flatten(hoid));
+  ASSERT_EQ(-ENOENT, dbomap->flatten(hobject_t(sobject_t("none", CEPH_NOSNAP))));
+
+  header.clear();
+  db->get(hoid, &header, &after);
+  ASSERT_EQ(before.size(), after.size());
+  for (map<string, bufferlist>::iterator i = before.begin();
+       i != before.end();
+       ++i) {
+    ASSERT_EQ(1u, after.count(i->first));
+    ASSERT_TRUE(i->second.contents_equal(after[i->first]));
+  }
+  string result;
+  ASSERT_EQ(0, tester.get_header(hoid, &result));
+  ASSERT_EQ("header", result);
+
+  // the other clones still see their ancestors
+  after.clear();
+  db->get(hoid2, &header, &after);
+  ASSERT_EQ(before2.size(), after.size());
+  ASSERT_EQ(1, tester.get_key(hoid3, "foo" + num_str(0), &result));
+  ASSERT_EQ("baz", result);
+  ASSERT_EQ(0, tester.get_key(hoid3, "foo" + num_str(1), &result));
+
+  ASSERT_EQ(0, dbomap->flatten(hoid2));
+  ASSERT_EQ(0, dbomap->flatten(hoid3));
+  ASSERT_EQ(1, tester.get_key(hoid2, "foo" + num_str(1), &result));
+  ASSERT_EQ("bar" + num_str(1), result);
+
+  db->clear(hoid);
+  db->clear(hoid2);
+  db->clear(hoid3);
+}
+
+class FlattenThread : public Thread {
+  DBObjectMap *dbomap;
+  hobject_t hoid;
+public:
+  int r;
+  FlattenThread(DBObjectMap *dbomap, const hobject_t &hoid)
+    : dbomap(dbomap), hoid(hoid), r(0) {}
+  void *entry() {
+    r = dbomap->flatten(hoid);
+    return 0;
+  }
+};
+
+TEST(DBObjectMap, FlattenRacesSiblings) {
+  // The flattener runs outside the FileStore sequencers, so it may flatten
+  // an object while the object's siblings are cleared
+  KeyValueDB *store = new MemDBStore("");
+  ASSERT_EQ(0, store->init(cerr));
+  DBObjectMap dbomap(store);
+  hobject_t hoid(sobject_t("foo", CEPH_NOSNAP));
+  hobject_t clone1(sobject_t("foo", 1));
+  hobject_t clone2(sobject_t("foo", 2));
+
+  for (unsigned n = 0; n < 1000; ++n) {
+    map<string, bufferlist> to_set;
+    for (unsigned i = 0; i < 10; ++i)
+      to_set["foo" + num_str(i)].append("bar" + num_str(i));
+    ASSERT_EQ(0, dbomap.set_keys(hoid, to_set));
+    // clone1 and hoid's next header share a parent, whose last child
+    // is clone2
+    ASSERT_EQ(0, dbomap.clone(hoid, clone1));
+    ASSERT_EQ(0, dbomap.clone(hoid, clone2));
+
+    FlattenThread t(&dbomap, clone1);
+    t.create();
+    ASSERT_EQ(0, dbomap.clear(hoid));
+    ASSERT_EQ(0, dbomap.clear(clone2));
+    t.join();
+    ASSERT_TRUE(t.r == 0 || t.r == -EBUSY);
+    ASSERT_TRUE(dbomap.check(cerr));
+
+    ASSERT_EQ(0, dbomap.clear(clone1));
+    // no header outlives its last child
+    KeyValueDB::WholeSpaceIterator iter = store->get_iterator();
+    for (iter->seek_to_first(); iter->valid(); iter->next())
+      ASSERT_NE(0u, iter->raw_key().first.find(DBObjectMap::USER_PREFIX));
+  }
+}
@@ -0,0 +1,102 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+
+#include <boost/program_options/option.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "include/crc32c.h"
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+/*
+ * Measure crc32c throughput of each implementation that can run on this
+ * cpu, for a range of buffer sizes.
+ */
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void run(const char *name, ceph_crc32c_func_t f,
+		unsigned char *buf, unsigned size, uint64_t total)
+{
+  uint64_t iters = total / size;
+  if (iters == 0)
+    iters = 1;
+  uint32_t crc = 0;
+  double start = now();
+  for (uint64_t i = 0; i < iters; ++i)
+    crc = f(crc, buf, size);
+  double elapsed = now() - start;
+  double gbps = (double)(iters * size) / elapsed / (1024.0 * 1024.0 * 1024.0);
+  cout << name << "\t" << size << "\t" << gbps << " GB/s"
+       << "\t(crc " << hex << crc << dec << ")" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "produce help message")
+    ("sizes", po::value<string>()->default_value("64,512,4096,65536,4194304"),
+     "comma separated list of buffer sizes")
+    ("total-mb", po::value<unsigned>()->default_value(1024),
+     "megabytes to checksum per implementation and size")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    cout << desc << std::endl;
+    return 1;
+  }
+
+  vector<unsigned> sizes;
+  unsigned max = 0;
+  {
+    stringstream ss(vm["sizes"].as<string>());
+    string s;
+    while (getline(ss, s, ',')) {
+      unsigned size = strtoul(s.c_str(), NULL, 10);
+      if (!size) {
+	cerr << "bad size '" << s << "'" << std::endl;
+	return 1;
+      }
+      sizes.push_back(size);
+      if (size > max)
+	max = size;
+    }
+  }
+  uint64_t total = (uint64_t)vm["total-mb"].as<unsigned>() << 20;
+
+  unsigned char *buf = new unsigned char[max];
+  for (unsigned i = 0; i < max; ++i)
+    buf[i] = rand();
+
+  for (vector<unsigned>::iterator p = sizes.begin(); p != sizes.end(); ++p) {
+    run("sctp", ceph_crc32c_sctp, buf, *p, total);
+    if (ceph_crc32c_intel_baseline_exists())
+      run("intel_baseline", ceph_crc32c_intel_baseline, buf, *p, total);
+    if (ceph_crc32c_intel_fast_exists())
+      run("intel_fast", ceph_crc32c_intel_fast, buf, *p, total);
+    run("dispatch", ceph_crc32c_le, buf, *p, total);
+  }
+
+  delete[] buf;
+  return 0;
+}
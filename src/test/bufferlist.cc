@@ -5,6 +5,8 @@
 
 #include "gtest/gtest.h"
 #include "stdlib.h"
+#include <stdio.h>
+#include <unistd.h>
 
 
 #define MAX_TEST 1000000
@@ -75,3 +77,86 @@ TEST(BufferList, TestCopyAll) {
   bl2.copy(0, BIG_SZ, (char*)big2);
   ASSERT_EQ(memcmp(big.get(), big2, BIG_SZ), 0);
 }
+
+TEST(BufferList, CachedCrc) {
+  const unsigned len = 1 << 16;
+  char *data = new char[len];
+  for (unsigned i = 0; i < len; ++i)
+    data[i] = random();
+
+  bufferptr a(data, len / 2);
+  bufferptr b(data + len / 2, len / 2);
+  bufferlist bl;
+  bl.append(a);
+  bl.append(b);
+  bufferlist sub;
+  sub.substr_of(bl, 100, len - 200);
+
+  uint32_t expect0 = ceph_crc32c_le(0, (unsigned char*)data, len);
+  uint32_t expect1 = ceph_crc32c_le(1234, (unsigned char*)data, len);
+  uint32_t expect_sub = ceph_crc32c_le(0, (unsigned char*)data + 100, len - 200);
+
+  // first pass fills the cache, later passes hit it, with the same or
+  // a different seed
+  ASSERT_EQ(expect0, bl.crc32c(0));
+  ASSERT_EQ(expect0, bl.crc32c(0));
+  ASSERT_EQ(expect1, bl.crc32c(1234));
+  ASSERT_EQ(expect_sub, sub.crc32c(0));
+  ASSERT_EQ(expect_sub, sub.crc32c(0));
+
+  // writes must throw the cached values away
+  data[10] ^= 0xff;
+  bl.copy_in(10, 1, data + 10);
+  ASSERT_EQ(ceph_crc32c_le(0, (unsigned char*)data, len), bl.crc32c(0));
+  ASSERT_EQ(ceph_crc32c_le(0, (unsigned char*)data + 100, len - 200), sub.crc32c(0));
+
+  memset(data + len / 2, 0, 4);
+  b.zero(0, 4);  // shares its raw buffer with bl
+  ASSERT_EQ(ceph_crc32c_le(7, (unsigned char*)data, len), bl.crc32c(7));
+
+  // ... including ones made directly through c_str()
+  data[len - 1] ^= 0xff;
+  bl.c_str()[len - 1] ^= 0xff;
+  bl.invalidate_crc();
+  ASSERT_EQ(ceph_crc32c_le(7, (unsigned char*)data, len), bl.crc32c(7));
+
+  delete[] data;
+}
+
+TEST(BufferList, WriteFdOffset) {
+  FILE *f = tmpfile();
+  ASSERT_TRUE(f != NULL);
+  int fd = fileno(f);
+
+  bufferlist bl;
+  bl.push_back(buffer::copy("abc", 3));
+  bl.push_back(buffer::copy("defg", 4));
+  ASSERT_EQ(0, bl.write_fd(fd, 10));
+  ASSERT_EQ(0, ::lseek(fd, 0, SEEK_CUR));  // offset untouched
+
+  char buf[17];
+  ASSERT_EQ(17, ::pread(fd, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(buf + 10, "abcdefg", 7));
+  for (int i = 0; i < 10; i++)
+    ASSERT_EQ(0, buf[i]);
+  fclose(f);
+}
+
+TEST(BufferList, CachedCrcManyRanges) {
+  // more ranges of one raw buffer than it will cache, some of them too
+  // small to cache at all
+  const unsigned len = 1 << 16;
+  bufferptr p(len);
+  for (unsigned i = 0; i < len; ++i)
+    p[i] = random();
+
+  for (int pass = 0; pass < 3; ++pass) {
+    for (unsigned off = 0; off < len; off += 2048) {
+      unsigned l = (off / 2048) % 2 ? 100 : len - off;
+      bufferlist bl;
+      bl.append(p, off, l);
+      ASSERT_EQ(ceph_crc32c_le(pass, (unsigned char*)p.c_str() + off, l),
+		bl.crc32c(pass));
+    }
+  }
+}
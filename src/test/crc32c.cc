@@ -0,0 +1,91 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/crc32c.h"
+#include "common/crc32c_intel.h"
+#include "common/sctp_crc32.h"
+
+#include "gtest/gtest.h"
+
+TEST(Crc32c, Small) {
+  const char *a = "foo bar baz";
+  const char *b = "whiz bang boom";
+  ASSERT_EQ(4119623852u, ceph_crc32c_le(0, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(881700046u, ceph_crc32c_le(1234, (unsigned char *)a, strlen(a)));
+  ASSERT_EQ(2360230088u, ceph_crc32c_le(0, (unsigned char *)b, strlen(b)));
+  ASSERT_EQ(3743019208u, ceph_crc32c_le(5678, (unsigned char *)b, strlen(b)));
+}
+
+TEST(Crc32c, Chained) {
+  unsigned len = 1 << 16;
+  unsigned char *buf = new unsigned char[len];
+  for (unsigned i = 0; i < len; i++)
+    buf[i] = rand();
+  uint32_t whole = ceph_crc32c_le(42, buf, len);
+  uint32_t split = ceph_crc32c_le(42, buf, 1000);
+  split = ceph_crc32c_le(split, buf + 1000, len - 1000);
+  ASSERT_EQ(whole, split);
+  delete[] buf;
+}
+
+static void check_impl(ceph_crc32c_func_t f)
+{
+  unsigned max = 1 << 20;
+  unsigned char *buf = new unsigned char[max + 64];
+  for (unsigned i = 0; i < max + 64; i++)
+    buf[i] = rand();
+  for (int i = 0; i < 2000; i++) {
+    // plenty of short lengths, plus enough long ones to take the
+    // interleaved paths
+    unsigned len = (i < 1000) ? rand() % 2048 : rand() % max;
+    unsigned off = rand() % 64;
+    uint32_t seed = rand();
+    ASSERT_EQ(ceph_crc32c_sctp(seed, buf + off, len), f(seed, buf + off, len))
+      << "len " << len << " off " << off << " seed " << seed;
+  }
+  delete[] buf;
+}
+
+TEST(Crc32c, Dispatch) {
+  check_impl(ceph_crc32c_le);
+}
+
+TEST(Crc32c, IntelBaseline) {
+  if (!ceph_crc32c_intel_baseline_exists()) {
+    std::cout << "no sse4.2 crc32 instruction, skipping" << std::endl;
+    return;
+  }
+  check_impl(ceph_crc32c_intel_baseline);
+}
+
+TEST(Crc32c, IntelFast) {
+  if (!ceph_crc32c_intel_fast_exists()) {
+    std::cout << "no sse4.2 crc32 and pclmulqdq, skipping" << std::endl;
+    return;
+  }
+  check_impl(ceph_crc32c_intel_fast);
+}
+
+TEST(Crc32c, Zeros) {
+  unsigned max = 1 << 16;
+  unsigned char *zeros = new unsigned char[max];
+  memset(zeros, 0, max);
+  for (int i = 0; i < 1000; i++) {
+    unsigned len = rand() % max;
+    uint32_t seed = rand();
+    ASSERT_EQ(ceph_crc32c_le(seed, zeros, len), ceph_crc32c_zeros(seed, len));
+  }
+  delete[] zeros;
+}
@@ -0,0 +1,78 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/lzf.h"
+
+#include "gtest/gtest.h"
+
+static void roundtrip(const unsigned char *in, unsigned len)
+{
+  unsigned char *c = new unsigned char[len + len / 16 + 64];
+  unsigned char *d = new unsigned char[len];
+  unsigned clen = ceph_lzf_compress(in, len, c, len + len / 16 + 64);
+  ASSERT_NE(0u, clen);
+  ASSERT_EQ(len, ceph_lzf_decompress(c, clen, d, len));
+  ASSERT_EQ(0, memcmp(in, d, len));
+
+  // an output buffer that is too small fails cleanly
+  if (clen > 1) {
+    ASSERT_EQ(0u, ceph_lzf_compress(in, len, c, clen - 1));
+  }
+  if (len > 1) {
+    ASSERT_EQ(0u, ceph_lzf_decompress(c, clen, d, len - 1));
+  }
+
+  delete[] c;
+  delete[] d;
+}
+
+TEST(LZF, Random) {
+  unsigned len = 1 << 17;
+  unsigned char *buf = new unsigned char[len];
+  for (unsigned i = 0; i < len; i++)
+    buf[i] = rand();
+  roundtrip(buf, len);
+  roundtrip(buf, 1);
+  roundtrip(buf, 37);
+  delete[] buf;
+}
+
+TEST(LZF, Redundant) {
+  unsigned len = 1 << 17;
+  unsigned char *buf = new unsigned char[len];
+  const char *words = "omap_key_0123_bucket_index_entry";
+  for (unsigned i = 0; i < len; i++)
+    buf[i] = words[(i + i / 1000) % strlen(words)];
+  unsigned char *c = new unsigned char[len];
+  unsigned clen = ceph_lzf_compress(buf, len, c, len);
+  ASSERT_NE(0u, clen);
+  ASSERT_LT(clen, len / 4);
+  roundtrip(buf, len);
+
+  memset(buf, 0, len);
+  roundtrip(buf, len);
+  delete[] c;
+  delete[] buf;
+}
+
+TEST(LZF, Corrupt) {
+  unsigned char out[64];
+  // back reference before the start of the output
+  unsigned char bad_ref[] = { 0x20, 0x05 };
+  ASSERT_EQ(0u, ceph_lzf_decompress(bad_ref, sizeof(bad_ref), out, sizeof(out)));
+  // literal run longer than the input
+  unsigned char short_lit[] = { 0x1f, 'a', 'b' };
+  ASSERT_EQ(0u, ceph_lzf_decompress(short_lit, sizeof(short_lit), out, sizeof(out)));
+}
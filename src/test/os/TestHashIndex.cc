@@ -0,0 +1,257 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/config.h"
+#include "os/IndexManager.h"
+#include "os/HashIndex.h"
+#include "os/chain_xattr.h"
+#include "test/unit.h"
+
+/*
+ * A collection in a scratch directory, with merges at 1 object and
+ * splits at 16 (inline at 32).
+ */
+class HashIndexTest : public ::testing::Test {
+public:
+  char base[64];
+  coll_t cid;
+  IndexManager *manager;
+  Index index;
+
+  HashIndexTest() : cid("0.0_head"), manager(NULL) {}
+
+  virtual void SetUp() {
+    g_ceph_context->_conf->set_val("filestore_merge_threshold", "1");
+    g_ceph_context->_conf->set_val("filestore_split_multiple", "1");
+    g_ceph_context->_conf->set_val("filestore_split_rate", "0");
+    g_ceph_context->_conf->apply_changes(NULL);
+
+    strcpy(base, "/tmp/test_hashindex.XXXXXX");
+    ASSERT_TRUE(mkdtemp(base) != NULL);
+    manager = new IndexManager(false);
+    ASSERT_LE(0, manager->init_index(cid, base, 0));
+  }
+
+  virtual void TearDown() {
+    index.reset();
+    manager->stop_splitter();
+    delete manager;
+    string cmd = string("rm -rf ") + base;
+    ASSERT_EQ(0, system(cmd.c_str()));
+  }
+
+  void get_index() {
+    ASSERT_EQ(0, manager->get_index(cid, base, &index));
+  }
+  HashIndex *hindex() {
+    return dynamic_cast<HashIndex*>(index.get());
+  }
+
+  static hobject_t obj(int i, uint32_t hash) {
+    char name[16];
+    snprintf(name, sizeof(name), "obj%d", i);
+    return hobject_t(object_t(name), "", CEPH_NOSNAP, hash, 0);
+  }
+
+  void create(const hobject_t &hoid) {
+    CollectionIndex::IndexedPath path;
+    int exists;
+    ASSERT_EQ(0, index->lookup(hoid, &path, &exists));
+    ASSERT_FALSE(exists);
+    int fd = ::open(path->path(), O_CREAT|O_WRONLY, 0644);
+    ASSERT_LE(0, fd);
+    ::close(fd);
+    ASSERT_EQ(0, index->created(hoid, path->path()));
+  }
+
+  /// true if hoid is found, and its file is where lookup says
+  bool found(const hobject_t &hoid) {
+    CollectionIndex::IndexedPath path;
+    int exists;
+    if (index->lookup(hoid, &path, &exists) < 0 || !exists)
+      return false;
+    struct stat st;
+    return ::stat(path->path(), &st) == 0;
+  }
+
+  /// encoding version of a directory's subdir info
+  int info_version(const string &rel) {
+    char buf[64];
+    int r = chain_getxattr((string(base) + "/" + rel).c_str(),
+			   "user.cephos.phash.contents", buf, sizeof(buf));
+    return r > 0 ? buf[0] : r;
+  }
+
+  bool dir_exists(const string &rel) {
+    struct stat st;
+    return ::stat((string(base) + "/" + rel).c_str(), &st) == 0;
+  }
+
+  /// list the collection a page at a time
+  void list_partial(int page, vector<hobject_t> *ls) {
+    hobject_t next;
+    while (!next.is_max()) {
+      vector<hobject_t> got;
+      ASSERT_EQ(0, index->collection_list_partial(next, page, page, 0,
+						  &got, &next));
+      ls->insert(ls->end(), got.begin(), got.end());
+    }
+  }
+};
+
+TEST_F(HashIndexTest, SplitStep) {
+  manager->start_splitter(NULL);
+  // the splitter can't take the index from us, so the split crossing
+  // 16 objects queues is left for us to step through
+  get_index();
+  set<hobject_t> objects;
+  for (int i = 0; i < 20; ++i) {
+    hobject_t hoid = obj(i, i % 4);
+    create(hoid);
+    objects.insert(hoid);
+  }
+  ASSERT_FALSE(dir_exists("DIR_0"));
+
+  vector<string> root;
+  int moved;
+  bool done;
+  ASSERT_EQ(0, hindex()->split_step(root, 8, &moved, &done));
+  ASSERT_EQ(8, moved);
+  ASSERT_FALSE(done);
+  ASSERT_TRUE(dir_exists("DIR_0"));
+  ASSERT_TRUE(dir_exists("DIR_1"));
+  vector<string> splitting;
+  ASSERT_TRUE(manager->get_migration(cid, &splitting));
+  ASSERT_EQ(root, splitting);
+
+  do {
+    ASSERT_EQ(0, hindex()->split_step(root, 8, &moved, &done));
+  } while (!done);
+  ASSERT_FALSE(manager->get_migration(cid, &splitting));
+  for (set<hobject_t>::iterator p = objects.begin(); p != objects.end(); ++p)
+    ASSERT_TRUE(found(*p));
+  ASSERT_TRUE(dir_exists("DIR_3"));
+  ASSERT_FALSE(dir_exists("DIR_4"));
+
+  // nothing left to split
+  ASSERT_EQ(0, hindex()->split_step(root, 8, &moved, &done));
+  ASSERT_EQ(0, moved);
+  ASSERT_TRUE(done);
+}
+
+TEST_F(HashIndexTest, HalfMigrated) {
+  manager->start_splitter(NULL);
+  get_index();
+  set<hobject_t> objects;
+  for (int i = 0; i < 20; ++i) {
+    hobject_t hoid = obj(i, i % 4);
+    create(hoid);
+    objects.insert(hoid);
+  }
+
+  // DIR_0 is done and DIR_1 is part way
+  vector<string> root;
+  int moved;
+  bool done;
+  ASSERT_EQ(0, hindex()->split_step(root, 8, &moved, &done));
+  ASSERT_FALSE(done);
+
+  for (set<hobject_t>::iterator p = objects.begin(); p != objects.end(); ++p)
+    ASSERT_TRUE(found(*p));
+
+  // objects created and removed meanwhile
+  hobject_t added = obj(100, 1);
+  create(added);
+  objects.insert(added);
+  ASSERT_TRUE(found(added));
+  hobject_t removed = obj(0, 0);
+  ASSERT_EQ(0, index->unlink(removed));
+  objects.erase(removed);
+  ASSERT_FALSE(found(removed));
+
+  vector<hobject_t> ls;
+  ASSERT_EQ(0, index->collection_list(&ls));
+  ASSERT_EQ(objects, set<hobject_t>(ls.begin(), ls.end()));
+  ASSERT_EQ(objects.size(), ls.size());
+
+  ls.clear();
+  list_partial(3, &ls);
+  ASSERT_EQ(objects, set<hobject_t>(ls.begin(), ls.end()));
+  ASSERT_EQ(objects.size(), ls.size());
+  for (unsigned i = 1; i < ls.size(); ++i)
+    ASSERT_TRUE(ls[i - 1] < ls[i]);
+
+  do {
+    ASSERT_EQ(0, hindex()->split_step(root, 8, &moved, &done));
+  } while (!done);
+  for (set<hobject_t>::iterator p = objects.begin(); p != objects.end(); ++p)
+    ASSERT_TRUE(found(*p));
+  ls.clear();
+  list_partial(3, &ls);
+  ASSERT_EQ(objects.size(), ls.size());
+}
+
+TEST_F(HashIndexTest, PreSplit) {
+  get_index();
+  // 16 leaves of 16 objects
+  ASSERT_EQ(0, index->pre_split(200));
+  for (int i = 0; i < 16; ++i) {
+    char name[8];
+    snprintf(name, sizeof(name), "DIR_%X", i);
+    ASSERT_TRUE(dir_exists(name));
+  }
+  ASSERT_FALSE(dir_exists("DIR_0/DIR_0"));
+
+  // the leaves are empty, but removing from them doesn't merge them
+  hobject_t hoid = obj(0, 5);
+  create(hoid);
+  ASSERT_EQ(0, index->unlink(hoid));
+  ASSERT_TRUE(dir_exists("DIR_5"));
+  create(hoid);
+  ASSERT_TRUE(found(hoid));
+  CollectionIndex::IndexedPath path;
+  int exists;
+  ASSERT_EQ(0, index->lookup(hoid, &path, &exists));
+  string dir = string(base) + "/DIR_5/";
+  ASSERT_EQ(dir, string(path->path()).substr(0, dir.size()));
+
+  // only an empty collection can be pre-split
+  ASSERT_EQ(-ENOTEMPTY, index->pre_split(200));
+
+  // only the pre-split dirs need the newer encoding
+  ASSERT_EQ(2, info_version("DIR_5"));
+  ASSERT_EQ(1, info_version(""));
+}
+
+TEST_F(HashIndexTest, SplitMergesBack) {
+  // without pre_split, subdirs that empty out merge back into the parent
+  get_index();
+  set<hobject_t> objects;
+  for (int i = 0; i < 17; ++i) {
+    hobject_t hoid = obj(i, i % 2);
+    create(hoid);
+    objects.insert(hoid);
+  }
+  ASSERT_TRUE(dir_exists("DIR_1"));
+  // readable by code from before pre-splitting
+  ASSERT_EQ(1, info_version(""));
+  ASSERT_EQ(1, info_version("DIR_1"));
+  for (int i = 1; i < 17; i += 2)
+    ASSERT_EQ(0, index->unlink(obj(i, 1)));
+  ASSERT_FALSE(dir_exists("DIR_1"));
+}
@@ -0,0 +1,177 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/Clock.h"
+#include "os/ReplayPool.h"
+#include "test/unit.h"
+
+/*
+ * Records what it is asked to apply.  The entry with seq == hold isn't
+ * let through until release().
+ */
+class TestPool : public ReplayPool {
+public:
+  Mutex lock;
+  Cond cond;
+  uint64_t hold;
+  bool released;
+  vector<uint64_t> started, finished;
+  uint64_t applied;
+
+  TestPool(uint64_t h)
+    : ReplayPool(4, 16), lock("TestPool::lock"),
+      hold(h), released(false), applied(0) {}
+
+  void _apply(uint64_t seq, list<ObjectStore::Transaction*>& tls) {
+    Mutex::Locker l(lock);
+    started.push_back(seq);
+    cond.SignalAll();
+    while (seq == hold && !released)
+      cond.Wait(lock);
+    finished.push_back(seq);
+    cond.SignalAll();
+  }
+  void _finish(uint64_t a) {
+    Mutex::Locker l(lock);
+    assert(a >= applied);
+    applied = a;
+  }
+
+  void release() {
+    Mutex::Locker l(lock);
+    released = true;
+    cond.SignalAll();
+  }
+  /// wait up to secs for seq to be started (or finished)
+  bool wait_for(const vector<uint64_t>& v, uint64_t seq, double secs) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(g_ceph_context);
+    until += secs;
+    while (find(v.begin(), v.end(), seq) == v.end()) {
+      if (ceph_clock_now(g_ceph_context) >= until)
+	return false;
+      cond.WaitUntil(lock, until);
+    }
+    return true;
+  }
+  uint64_t get_applied() {
+    Mutex::Locker l(lock);
+    return applied;
+  }
+
+  void queue(uint64_t seq, ObjectStore::Transaction *t) {
+    list<ObjectStore::Transaction*> tls;
+    tls.push_back(t);
+    queue_entry(seq, tls);
+  }
+};
+
+static const coll_t pg_coll("0.0_head");
+static const coll_t snap_coll("0.0_1");
+static const coll_t meta_coll("meta");  // coll_t::META_COLL lives in the osd
+
+static ObjectStore::Transaction *write(coll_t cid, const hobject_t& oid) {
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  bufferlist bl;
+  bl.append("foo");
+  t->write(cid, oid, 0, bl.length(), bl);
+  return t;
+}
+
+/*
+ * Runs the second of two entries while the first is held, and checks
+ * whether the second got to start.
+ */
+static bool runs_concurrently(ObjectStore::Transaction *first,
+			      ObjectStore::Transaction *second)
+{
+  TestPool pool(1);
+  pool.start();
+  pool.queue(1, first);
+  pool.queue(2, second);
+  EXPECT_TRUE(pool.wait_for(pool.started, 1, 10));
+  bool concurrent = pool.wait_for(pool.started, 2, 1);
+  if (concurrent) {
+    // applied only counts the prefix of the journal that's done
+    EXPECT_TRUE(pool.wait_for(pool.finished, 2, 10));
+    EXPECT_EQ(0u, pool.get_applied());
+  }
+  pool.release();
+  pool.stop();
+  EXPECT_EQ(2u, pool.finished.size());
+  EXPECT_EQ(2u, pool.get_applied());
+  if (!concurrent) {
+    EXPECT_EQ(1u, pool.started[0]);
+    EXPECT_EQ(2u, pool.started[1]);
+  }
+  return concurrent;
+}
+
+TEST(ReplayPool, IndependentObjects) {
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  ASSERT_TRUE(runs_concurrently(write(pg_coll, obj_a),
+				write(pg_coll, obj_b)));
+}
+
+TEST(ReplayPool, IndependentMetaObjects) {
+  // every pg writes its log and info into the meta collection
+  hobject_t obj_pglog_0_0(sobject_t("pglog_0.0", CEPH_NOSNAP));
+  hobject_t obj_pginfo_0_0(sobject_t("pginfo_0.0", CEPH_NOSNAP));
+  hobject_t obj_pglog_0_1(sobject_t("pglog_0.1", CEPH_NOSNAP));
+  hobject_t obj_pginfo_0_1(sobject_t("pginfo_0.1", CEPH_NOSNAP));
+  bufferlist bl;
+  ObjectStore::Transaction *first = write(meta_coll, obj_pglog_0_0);
+  first->write(meta_coll, obj_pginfo_0_0, 0, 0, bl);
+  first->collection_setattr(coll_t("0.0_head"), "info", bl);
+  ObjectStore::Transaction *second = write(meta_coll, obj_pglog_0_1);
+  second->write(meta_coll, obj_pginfo_0_1, 0, 0, bl);
+  second->collection_setattr(coll_t("0.1_head"), "info", bl);
+  ASSERT_TRUE(runs_concurrently(first, second));
+}
+
+TEST(ReplayPool, SameObject) {
+  hobject_t obj_pglog_0_0(sobject_t("pglog_0.0", CEPH_NOSNAP));
+  ASSERT_FALSE(runs_concurrently(write(meta_coll, obj_pglog_0_0),
+				 write(meta_coll, obj_pglog_0_0)));
+}
+
+TEST(ReplayPool, LinkedObject) {
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  // linked in this part of the journal
+  ObjectStore::Transaction *link = new ObjectStore::Transaction;
+  link->collection_add(snap_coll, pg_coll, obj_a);
+  ASSERT_FALSE(runs_concurrently(link, write(snap_coll, obj_a)));
+
+  // or before it: the name is the same in both collections
+  ASSERT_FALSE(runs_concurrently(write(pg_coll, obj_a),
+				 write(snap_coll, obj_a)));
+}
+
+TEST(ReplayPool, Collection) {
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  ObjectStore::Transaction *mkcoll = new ObjectStore::Transaction;
+  mkcoll->create_collection(pg_coll);
+  ASSERT_FALSE(runs_concurrently(mkcoll, write(pg_coll, obj_a)));
+
+  bufferlist bl;
+  ObjectStore::Transaction *setattr = new ObjectStore::Transaction;
+  setattr->collection_setattr(pg_coll, "info", bl);
+  ASSERT_TRUE(runs_concurrently(setattr, write(pg_coll, obj_a)));
+}
+
+TEST(ReplayPool, Barrier) {
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  ObjectStore::Transaction *sync = new ObjectStore::Transaction;
+  sync->start_sync();
+  ASSERT_FALSE(runs_concurrently(write(pg_coll, obj_a), sync));
+}
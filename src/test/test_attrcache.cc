@@ -0,0 +1,137 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/AttrCache.h"
+
+#include "gtest/gtest.h"
+
+static map<string, bufferptr> attrs(const char *k, const char *v)
+{
+  map<string, bufferptr> m;
+  m[k] = buffer::copy(v, strlen(v));
+  return m;
+}
+
+static void load(AttrCache &c, const coll_t& cid, const hobject_t& oid,
+		 const map<string, bufferptr>& aset)
+{
+  c.finish_load(cid, oid, aset, c.begin_load(oid));
+}
+
+static string get(AttrCache &c, const coll_t& cid, const hobject_t& oid,
+		  const char *name)
+{
+  bufferptr bp;
+  bool exists;
+  if (!c.lookup(cid, oid, name, &bp, &exists))
+    return "<miss>";
+  if (!exists)
+    return "<enodata>";
+  return string(bp.c_str(), bp.length());
+}
+
+TEST(AttrCache, Basic) {
+  AttrCache c(1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "_"));
+  // writes don't populate
+  c.set(cid, obj_a, attrs("_", "oi"));
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "_"));
+
+  load(c, cid, obj_a, attrs("_", "oi"));
+  ASSERT_EQ("oi", get(c, cid, obj_a, "_"));
+  ASSERT_EQ("<enodata>", get(c, cid, obj_a, "snapset"));
+  ASSERT_EQ("<miss>", get(c, coll_t("1.1_head"), obj_a, "_"));
+
+  c.set(cid, obj_a, attrs("snapset", "ss"));
+  ASSERT_EQ("ss", get(c, cid, obj_a, "snapset"));
+  ASSERT_EQ("oi", get(c, cid, obj_a, "_"));
+
+  c.rm(cid, obj_a, "_");
+  ASSERT_EQ("<enodata>", get(c, cid, obj_a, "_"));
+
+  map<string, bufferptr> all;
+  ASSERT_TRUE(c.lookup(cid, obj_a, &all));
+  ASSERT_EQ(1u, all.size());
+  ASSERT_TRUE(all.count("snapset"));
+
+  c.rm_all(cid, obj_a);
+  ASSERT_EQ("<enodata>", get(c, cid, obj_a, "snapset"));
+
+  c.invalidate(cid, obj_a);
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "snapset"));
+  ASSERT_EQ(0u, c.get_bytes());
+}
+
+TEST(AttrCache, LoadRace) {
+  AttrCache c(1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  // a write landing between the disk read and the insert wins
+  uint64_t token = c.begin_load(obj_a);
+  c.set(cid, obj_a, attrs("_", "new"));
+  c.finish_load(cid, obj_a, attrs("_", "old"), token);
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "_"));
+
+  load(c, cid, obj_a, attrs("_", "new"));
+  ASSERT_EQ("new", get(c, cid, obj_a, "_"));
+}
+
+TEST(AttrCache, Aliases) {
+  AttrCache c(1 << 20);
+  coll_t head("1.0_head"), snap("1.0_4");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  // a clone linked into two collections
+  load(c, head, obj_a, attrs("_", "v1"));
+  load(c, snap, obj_a, attrs("_", "v1"));
+  c.set(head, obj_a, attrs("_", "v2"));
+  ASSERT_EQ("v2", get(c, head, obj_a, "_"));
+  ASSERT_EQ("<miss>", get(c, snap, obj_a, "_"));
+
+  load(c, snap, obj_a, attrs("_", "v2"));
+  c.invalidate(head, obj_a);
+  ASSERT_EQ("<miss>", get(c, head, obj_a, "_"));
+  ASSERT_EQ("<miss>", get(c, snap, obj_a, "_"));
+}
+
+TEST(AttrCache, Trim) {
+  AttrCache c(1 << 20);
+  coll_t cid("1.0_head"), other("1.1_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  hobject_t obj_c(sobject_t("c", CEPH_NOSNAP));
+
+  load(c, cid, obj_a, attrs("_", "a"));
+  load(c, cid, obj_b, attrs("_", "b"));
+  load(c, other, obj_c, attrs("_", "c"));
+  size_t one = c.get_bytes() / 3;
+
+  ASSERT_EQ("a", get(c, cid, obj_a, "_"));  // a is now the hottest
+  c.set_max_bytes(2 * one);
+  ASSERT_EQ("a", get(c, cid, obj_a, "_"));
+  ASSERT_EQ("c", get(c, other, obj_c, "_"));
+  ASSERT_EQ("<miss>", get(c, cid, obj_b, "_"));
+
+  c.clear_collection(cid);
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "_"));
+  ASSERT_EQ("c", get(c, other, obj_c, "_"));
+
+  // disabled caches don't fill
+  c.set_max_bytes(0);
+  ASSERT_FALSE(c.enabled());
+  load(c, cid, obj_a, attrs("_", "a"));
+  ASSERT_EQ("<miss>", get(c, cid, obj_a, "_"));
+}
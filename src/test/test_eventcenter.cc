@@ -0,0 +1,352 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Throttle.h"
+#include "common/config.h"
+#include "messages/MPing.h"
+#include "msg/EventCenter.h"
+#include "msg/SimpleMessenger.h"
+#include "test/unit.h"
+
+/*
+ * Counts its invocations, and optionally appends its id to a shared
+ * list so that the order callbacks ran in can be checked.
+ */
+class TestCallback : public EventCallback {
+  Mutex lock;
+  Cond cond;
+  int count;
+  int last_fd;
+  int id;
+  Mutex *order_lock;
+  list<int> *order;
+
+public:
+  TestCallback(int i = 0, Mutex *ol = NULL, list<int> *o = NULL)
+    : lock("TestCallback::lock"), count(0), last_fd(-2),
+      id(i), order_lock(ol), order(o) {}
+
+  void do_request(int fd) {
+    if (order) {
+      Mutex::Locker l(*order_lock);
+      order->push_back(id);
+    }
+    Mutex::Locker l(lock);
+    count++;
+    last_fd = fd;
+    cond.Signal();
+  }
+
+  int get_count() {
+    Mutex::Locker l(lock);
+    return count;
+  }
+  int get_last_fd() {
+    Mutex::Locker l(lock);
+    return last_fd;
+  }
+
+  /// wait up to 10 seconds for at least n invocations
+  bool wait_for(int n) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(g_ceph_context);
+    until += 10.0;
+    while (count < n) {
+      if (cond.WaitUntil(lock, until) == ETIMEDOUT)
+	break;
+    }
+    return count >= n;
+  }
+};
+
+static void poke(int fd)
+{
+  char c = 0;
+  ASSERT_EQ(1, write(fd, &c, 1));
+}
+
+static void drain(int fd)
+{
+  char buf[16];
+  ASSERT_TRUE(read(fd, buf, sizeof(buf)) > 0);
+}
+
+TEST(EventCenter, FileEvent) {
+  EventCenter center(g_ceph_context, 2);
+  ASSERT_EQ(0, center.init());
+  center.start();
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  TestCallback cb;
+  ASSERT_EQ(0, center.create_file_event(fds[0], &cb));
+  usleep(100000);
+  ASSERT_EQ(0, cb.get_count());  // nothing to read yet
+
+  poke(fds[1]);
+  ASSERT_TRUE(cb.wait_for(1));
+  ASSERT_EQ(fds[0], cb.get_last_fd());
+
+  // one-shot: more data doesn't fire it again
+  poke(fds[1]);
+  usleep(100000);
+  ASSERT_EQ(1, cb.get_count());
+  ASSERT_FALSE(center.delete_file_event(fds[0]));
+
+  // registering again fires right away, since there is unread data
+  ASSERT_EQ(0, center.create_file_event(fds[0], &cb));
+  ASSERT_TRUE(cb.wait_for(2));
+  drain(fds[0]);
+
+  // a hangup counts as readable
+  ASSERT_EQ(0, center.create_file_event(fds[0], &cb));
+  close(fds[1]);
+  ASSERT_TRUE(cb.wait_for(3));
+
+  center.stop();
+  close(fds[0]);
+}
+
+TEST(EventCenter, DeleteFileEvent) {
+  EventCenter center(g_ceph_context, 1);
+  ASSERT_EQ(0, center.init());
+  center.start();
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  TestCallback cb;
+  ASSERT_EQ(0, center.create_file_event(fds[0], &cb));
+  ASSERT_TRUE(center.delete_file_event(fds[0]));
+  ASSERT_FALSE(center.delete_file_event(fds[0]));
+
+  poke(fds[1]);
+  usleep(100000);
+  ASSERT_EQ(0, cb.get_count());
+
+  center.stop();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(EventCenter, RegisterBeforeStart) {
+  EventCenter center(g_ceph_context, 1);
+  ASSERT_EQ(0, center.init());
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  TestCallback cb;
+  ASSERT_EQ(0, center.create_file_event(fds[0], &cb));
+  poke(fds[1]);
+  center.start();
+  ASSERT_TRUE(cb.wait_for(1));
+
+  center.stop();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(EventCenter, DispatchExternal) {
+  EventCenter center(g_ceph_context, 3);
+  ASSERT_EQ(0, center.init());
+  center.start();
+
+  // the workers are idle in epoll_wait; dispatching must wake them
+  usleep(100000);
+  TestCallback cb;
+  center.dispatch_event_external(&cb, 7);
+  ASSERT_TRUE(cb.wait_for(1));
+  ASSERT_EQ(-1, cb.get_last_fd());
+
+  // events with the same hint run in order
+  Mutex order_lock("order_lock");
+  list<int> order;
+  vector<TestCallback*> cbs;
+  for (int i = 0; i < 100; i++)
+    cbs.push_back(new TestCallback(i, &order_lock, &order));
+  for (int i = 0; i < 100; i++)
+    center.dispatch_event_external(cbs[i], 7);
+  ASSERT_TRUE(cbs[99]->wait_for(1));
+  for (int i = 0; i < 100; i++)
+    ASSERT_TRUE(cbs[i]->wait_for(1));
+
+  center.stop();
+
+  ASSERT_EQ(100u, order.size());
+  int expect = 0;
+  for (list<int>::iterator p = order.begin(); p != order.end(); ++p)
+    ASSERT_EQ(expect++, *p);
+  for (int i = 0; i < 100; i++)
+    delete cbs[i];
+}
+
+
+/*
+ * Holds on to everything from hold_type, so that its policy throttle
+ * stays full, and counts what arrives from each peer type.
+ */
+class HoldDispatcher : public Dispatcher {
+  Mutex lock;
+  Cond cond;
+  int hold_type;
+  list<Message*> held;
+  map<int, int> got;
+
+public:
+  HoldDispatcher(CephContext *cct, int t)
+    : Dispatcher(cct), lock("HoldDispatcher::lock"), hold_type(t) {}
+
+  bool ms_dispatch(Message *m) {
+    Mutex::Locker l(lock);
+    got[m->get_source().type()]++;
+    if (m->get_source().type() == hold_type)
+      held.push_back(m);
+    else
+      m->put();
+    cond.Signal();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+  bool ms_verify_authorizer(Connection *con, int peer_type,
+			    int protocol, bufferlist& authorizer, bufferlist& authorizer_reply,
+			    bool& isvalid, CryptoKey& session_key) {
+    isvalid = true;
+    return true;
+  }
+
+  int get_count(int type) {
+    Mutex::Locker l(lock);
+    return got[type];
+  }
+
+  /// wait up to 10 seconds for at least n messages from type
+  bool wait_for(int type, int n) {
+    Mutex::Locker l(lock);
+    utime_t until = ceph_clock_now(g_ceph_context);
+    until += 10.0;
+    while (got[type] < n) {
+      if (cond.WaitUntil(lock, until) == ETIMEDOUT)
+	break;
+    }
+    return got[type] >= n;
+  }
+
+  /// drop what we hold, and stop holding
+  void release() {
+    Mutex::Locker l(lock);
+    hold_type = -1;
+    while (!held.empty()) {
+      held.front()->put();
+      held.pop_front();
+    }
+  }
+};
+
+class NullDispatcher : public Dispatcher {
+public:
+  NullDispatcher(CephContext *cct) : Dispatcher(cct) {}
+  bool ms_dispatch(Message *m) {
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) { return false; }
+  void ms_handle_remote_reset(Connection *con) {}
+};
+
+static Message *new_ping(unsigned len)
+{
+  MPing *m = new MPing;
+  bufferptr bp(len);
+  bp.zero();
+  bufferlist bl;
+  bl.append(bp);
+  m->set_data(bl);
+  return m;
+}
+
+static Messenger *start_client(entity_name_t name, uint64_t nonce, Dispatcher *d)
+{
+  Messenger *msgr = new SimpleMessenger(g_ceph_context, name, "client", nonce);
+  msgr->set_default_policy(Messenger::Policy::lossy_client(0, 0));
+  msgr->add_dispatcher_head(d);
+  msgr->start();
+  return msgr;
+}
+
+static void stop_messenger(Messenger *msgr)
+{
+  msgr->shutdown();
+  msgr->wait();
+  delete msgr;
+}
+
+TEST(SimpleMessenger, ParkedThrottledPipe) {
+  // one worker, and pipes that park after a second of idleness
+  g_ceph_context->_conf->set_val("ms_park_idle_pipes", "true");
+  g_ceph_context->_conf->set_val("ms_park_threads", "1");
+  g_ceph_context->_conf->set_val("ms_park_idle_time", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  HoldDispatcher sd(g_ceph_context, CEPH_ENTITY_TYPE_CLIENT);
+  Throttle throttle(g_ceph_context, "test_eventmessenger_client", 100);
+  SimpleMessenger *server = new SimpleMessenger(g_ceph_context, entity_name_t::OSD(0),
+						"server", getpid());
+  server->set_default_policy(Messenger::Policy::stateless_server(0, 0));
+  server->set_policy(CEPH_ENTITY_TYPE_CLIENT, Messenger::Policy::stateless_server(0, 0));
+  server->set_policy_throttler(CEPH_ENTITY_TYPE_CLIENT, &throttle);
+  entity_addr_t addr;
+  ASSERT_TRUE(addr.parse("127.0.0.1:0"));
+  ASSERT_EQ(0, server->bind(addr));
+  server->add_dispatcher_head(&sd);
+  server->start();
+  entity_inst_t dest = server->get_myinst();
+
+  NullDispatcher cd(g_ceph_context);
+  Messenger *a = start_client(entity_name_t::CLIENT(1), getpid() + 1, &cd);
+  Messenger *b = start_client(entity_name_t::MDS(2), getpid() + 2, &cd);
+
+  a->send_message(new_ping(10), dest);
+  b->send_message(new_ping(10), dest);
+  ASSERT_TRUE(sd.wait_for(CEPH_ENTITY_TYPE_CLIENT, 1));
+  ASSERT_TRUE(sd.wait_for(CEPH_ENTITY_TYPE_MDS, 1));
+
+  // let both pipes park on the (only) worker
+  sleep(3);
+
+  // a's messages are held, so the second of these blocks the reader of
+  // a's pipe on the throttle
+  for (int i = 0; i < 3; i++)
+    a->send_message(new_ping(80), dest);
+  ASSERT_TRUE(sd.wait_for(CEPH_ENTITY_TYPE_CLIENT, 2));
+  usleep(500000);
+  ASSERT_EQ(2, sd.get_count(CEPH_ENTITY_TYPE_CLIENT));
+
+  // b is still serviced
+  b->send_message(new_ping(10), dest);
+  ASSERT_TRUE(sd.wait_for(CEPH_ENTITY_TYPE_MDS, 2));
+  ASSERT_EQ(2, sd.get_count(CEPH_ENTITY_TYPE_CLIENT));
+
+  sd.release();
+  ASSERT_TRUE(sd.wait_for(CEPH_ENTITY_TYPE_CLIENT, 4));
+
+  stop_messenger(a);
+  stop_messenger(b);
+  stop_messenger(server);
+}
@@ -0,0 +1,138 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "os/FDCache.h"
+
+#include "gtest/gtest.h"
+
+static int open_tmp()
+{
+  FILE *f = tmpfile();
+  assert(f);
+  int fd = dup(fileno(f));
+  fclose(f);
+  return fd;
+}
+
+static bool is_open(int fd)
+{
+  return fcntl(fd, F_GETFD) >= 0;
+}
+
+TEST(FDCache, Basic) {
+  FDCache c(10, 1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  ASSERT_EQ(-1, c.lookup(cid, obj_a));
+  int fd = open_tmp();
+  ASSERT_EQ(fd, c.add(cid, obj_a, fd));
+  ASSERT_TRUE(c.put(fd));
+
+  ASSERT_EQ(fd, c.lookup(cid, obj_a));
+  ASSERT_TRUE(c.put(fd));
+  ASSERT_EQ(-1, c.lookup(coll_t("1.1_head"), obj_a));
+  ASSERT_EQ(1u, c.get_num_cached());
+
+  // not ours
+  int other = open_tmp();
+  ASSERT_FALSE(c.put(other));
+  close(other);
+
+  c.clear(cid, obj_a);
+  ASSERT_FALSE(is_open(fd));
+  ASSERT_EQ(-1, c.lookup(cid, obj_a));
+  ASSERT_EQ(0u, c.get_num_cached());
+}
+
+TEST(FDCache, ClearWhileHeld) {
+  FDCache c(10, 1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  int fd = c.add(cid, obj_a, open_tmp());
+  c.clear(cid, obj_a);
+  ASSERT_TRUE(is_open(fd));
+  ASSERT_EQ(-1, c.lookup(cid, obj_a));
+  ASSERT_TRUE(c.put(fd));
+  ASSERT_FALSE(is_open(fd));
+}
+
+TEST(FDCache, AddRace) {
+  FDCache c(10, 1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+
+  int fd1 = c.add(cid, obj_a, open_tmp());
+  int fd2 = open_tmp();
+  ASSERT_EQ(fd1, c.add(cid, obj_a, fd2));
+  ASSERT_FALSE(is_open(fd2));
+  ASSERT_TRUE(c.put(fd1));
+  ASSERT_TRUE(c.put(fd1));
+  ASSERT_TRUE(is_open(fd1));
+}
+
+TEST(FDCache, Trim) {
+  FDCache c(2, 1 << 20);
+  coll_t cid("1.0_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  hobject_t obj_d(sobject_t("d", CEPH_NOSNAP));
+
+  int a = c.add(cid, obj_a, open_tmp());
+  c.put(a);
+  int b = c.add(cid, obj_b, open_tmp());
+  c.put(b);
+  ASSERT_EQ(a, c.lookup(cid, obj_a));  // a is now the hottest
+  c.put(a);
+  int d = c.add(cid, obj_d, open_tmp());
+  c.put(d);
+
+  ASSERT_EQ(2u, c.get_num_cached());
+  ASSERT_FALSE(is_open(b));
+  ASSERT_EQ(-1, c.lookup(cid, obj_b));
+
+  // the byte limit trims too
+  c.set_limits(10, 1);
+  ASSERT_EQ(0u, c.get_num_cached());
+  ASSERT_EQ(0u, c.get_bytes());
+  ASSERT_FALSE(is_open(a));
+  ASSERT_FALSE(is_open(d));
+}
+
+TEST(FDCache, ClearCollection) {
+  FDCache c(10, 1 << 20);
+  coll_t cid("1.0_head"), other("1.1_head");
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+
+  int a = c.add(cid, obj_a, open_tmp());
+  int b = c.add(cid, obj_b, open_tmp());
+  int o = c.add(other, obj_a, open_tmp());
+  c.put(a);
+  c.put(o);
+
+  c.clear_collection(cid);
+  ASSERT_FALSE(is_open(a));
+  ASSERT_TRUE(is_open(b));  // still held
+  ASSERT_EQ(-1, c.lookup(cid, obj_a));
+  ASSERT_EQ(-1, c.lookup(cid, obj_b));
+  ASSERT_EQ(o, c.lookup(other, obj_a));
+  c.put(o);
+  c.put(b);
+  ASSERT_FALSE(is_open(b));
+  ASSERT_EQ(1u, c.get_num_cached());
+}
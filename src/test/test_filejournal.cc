@@ -272,6 +272,172 @@ TEST(TestFileJournal, ReplayCorrupt) {
   j.close();
 }
 
+TEST(TestFileJournal, ReplayCompressed) {
+  g_ceph_context->_conf->set_val("journal_compress", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&lock, &cond, &done));
+
+  // one entry that compresses well, one that is too small to bother
+  string big;
+  while (big.length() < 100000)
+    big += "omap key for an rgw bucket index entry ";
+  bufferlist bl;
+  bl.append(big);
+  j.submit_entry(1, bl, 0, gb.new_sub());
+  bl.append("small");
+  j.submit_entry(2, bl, 0, gb.new_sub());
+
+  // one made of segments like an encoded transaction's: small encoded
+  // ops around large data buffers, one of which doesn't compress
+  bufferlist segs;
+  segs.append("ops");
+  segs.append(buffer::copy(big.c_str(), big.length()));
+  segs.append("more ops");
+  bufferptr noise(70000);
+  for (unsigned i = 0; i < noise.length(); ++i)
+    noise.c_str()[i] = rand();
+  segs.append(noise);
+  segs.append("trailer");
+  string segs_str;
+  segs.copy(0, segs.length(), segs_str);
+  j.submit_entry(3, segs, 0, gb.new_sub());
+  gb.activate();
+  wait();
+
+  j.close();
+
+  g_ceph_context->_conf->set_val("journal_compress", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  // the journal header, not the config, says how to read it back
+  j.open(0);
+
+  bufferlist inbl;
+  string v;
+  uint64_t seq = 0;
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 1ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ(big, v);
+  inbl.clear();
+  v.clear();
+
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 2ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ("small", v);
+  inbl.clear();
+  v.clear();
+
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 3ull);
+  inbl.copy(0, inbl.length(), v);
+  ASSERT_EQ(segs_str, v);
+  inbl.clear();
+
+  ASSERT_TRUE(!j.read_entry(inbl, seq));
+
+  j.make_writeable();
+  j.close();
+}
+
+TEST(TestFileJournal, CompressedRefusedByOldReaders) {
+  g_ceph_context->_conf->set_val("journal_compress", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+
+  g_ceph_context->_conf->set_val("journal_compress", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  // decode the header the way code from before v3 did
+  int fd = ::open(path, O_RDONLY);
+  ASSERT_TRUE(fd >= 0);
+  bufferptr bp(4096);
+  ASSERT_EQ(4096, safe_pread(fd, bp.c_str(), bp.length(), 0));
+  ::close(fd);
+  bufferlist hbl;
+  hbl.push_back(bp);
+  bufferlist::iterator p = hbl.begin();
+  __u32 v;
+  ::decode(v, p);
+  ASSERT_EQ(4u, v);
+  bufferlist em;
+  ASSERT_THROW(::decode(em, p), buffer::error);
+
+  // while we read it fine
+  ASSERT_EQ(0, j.open(0));
+  ASSERT_TRUE(j.header.flags & FileJournal::header_t::FLAG_COMPRESS);
+  j.make_writeable();
+  j.close();
+}
+
+TEST(TestFileJournal, ReplayV2IgnoresCompressFlag) {
+  fsid.generate_random();
+  FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
+  ASSERT_EQ(0, j.create());
+  j.make_writeable();
+
+  C_GatherBuilder gb(g_ceph_context, new C_SafeCond(&lock, &cond, &done));
+
+  bufferlist bl;
+  bl.append("small");
+  j.submit_entry(1, bl, 0, gb.new_sub());
+  gb.activate();
+  wait();
+
+  j.close();
+
+  // turn the header into a v2 one with the compress bit set, like the
+  // uninitialized flags of an old journal might have
+  int fd = ::open(path, O_RDWR);
+  ASSERT_TRUE(fd >= 0);
+  bufferptr bp(4096);
+  ASSERT_EQ(4096, safe_pread(fd, bp.c_str(), bp.length(), 0));
+  bufferlist hbl;
+  hbl.push_back(bp);
+  bufferlist::iterator p = hbl.begin();
+  FileJournal::header_t h;
+  ::decode(h, p);
+  ASSERT_EQ(3u, h.version);
+
+  bufferlist em;
+  ::encode(h.flags | FileJournal::header_t::FLAG_COMPRESS, em);
+  ::encode(h.fsid, em);
+  ::encode(h.block_size, em);
+  ::encode(h.alignment, em);
+  ::encode(h.max_size, em);
+  ::encode(h.start, em);
+  bufferlist old;
+  __u32 v = 2;
+  ::encode(v, old);
+  ::encode(em, old);
+  ASSERT_EQ(0, safe_pwrite(fd, old.c_str(), old.length(), 0));
+  ::close(fd);
+
+  // the entry was written uncompressed, and must read back as such
+  j.open(0);
+
+  bufferlist inbl;
+  string s;
+  uint64_t seq = 0;
+  ASSERT_EQ(true, j.read_entry(inbl, seq));
+  ASSERT_EQ(seq, 1ull);
+  inbl.copy(0, inbl.length(), s);
+  ASSERT_EQ("small", s);
+
+  j.make_writeable();
+  j.close();
+}
+
 TEST(TestFileJournal, WriteTrim) {
   fsid.generate_random();
   FileJournal j(fsid, finisher, &sync_cond, path, directio, aio);
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/ListingCache.h"
+
+#include "gtest/gtest.h"
+
+static vector<string> dir(const char *a = NULL, const char *b = NULL)
+{
+  vector<string> path;
+  if (a)
+    path.push_back(a);
+  if (b)
+    path.push_back(b);
+  return path;
+}
+
+static ListingCache::ListingRef listing(int objects, int subdirs = 0)
+{
+  ListingCache::Listing *l = new ListingCache::Listing;
+  for (int i = 0; i < objects; ++i) {
+    char name[16];
+    snprintf(name, sizeof(name), "obj%d", i);
+    l->objects.push_back(hobject_t(sobject_t(object_t(name), CEPH_NOSNAP)));
+  }
+  for (int i = 0; i < subdirs; ++i) {
+    char name[2];
+    snprintf(name, sizeof(name), "%X", i);
+    l->subdirs.insert(name);
+  }
+  return ListingCache::ListingRef(l);
+}
+
+TEST(ListingCache, Basic) {
+  ListingCache c(100);
+  coll_t cid("1.0_head");
+
+  ASSERT_FALSE(c.lookup(cid, dir("A")));
+  c.add(cid, dir("A"), listing(10));
+  c.add(cid, dir(), listing(0, 16));
+  ListingCache::ListingRef l = c.lookup(cid, dir("A"));
+  ASSERT_TRUE(l);
+  ASSERT_EQ(10u, l->objects.size());
+  ASSERT_EQ(16u, c.lookup(cid, dir())->subdirs.size());
+  ASSERT_FALSE(c.lookup(coll_t("1.1_head"), dir("A")));
+  ASSERT_EQ(2u, c.get_hits());
+  ASSERT_EQ(2u, c.get_misses());
+
+  c.invalidate(cid, dir("A"));
+  ASSERT_FALSE(c.lookup(cid, dir("A")));
+  ASSERT_TRUE(c.lookup(cid, dir()));
+  // a listing handed out stays valid
+  ASSERT_EQ(10u, l->objects.size());
+}
+
+TEST(ListingCache, ClearCollection) {
+  ListingCache c(100);
+  coll_t a("1.0_head"), b("1.1_head");
+
+  c.add(a, dir(), listing(0, 2));
+  c.add(a, dir("0"), listing(5));
+  c.add(a, dir("0", "F"), listing(5));
+  c.add(b, dir(), listing(0, 1));
+  c.add(b, dir("0"), listing(5));
+  c.clear_collection(a);
+  ASSERT_FALSE(c.lookup(a, dir()));
+  ASSERT_FALSE(c.lookup(a, dir("0")));
+  ASSERT_FALSE(c.lookup(a, dir("0", "F")));
+  ASSERT_TRUE(c.lookup(b, dir()));
+  ASSERT_TRUE(c.lookup(b, dir("0")));
+
+  c.clear_all();
+  ASSERT_FALSE(c.lookup(b, dir("0")));
+}
+
+TEST(ListingCache, Trim) {
+  // each directory counts one more than its objects
+  ListingCache c(30);
+  coll_t cid("1.0_head");
+
+  c.add(cid, dir("0"), listing(9));
+  c.add(cid, dir("1"), listing(9));
+  c.add(cid, dir("2"), listing(9));
+  // touch 0 so 1 is coldest
+  ASSERT_TRUE(c.lookup(cid, dir("0")));
+  c.add(cid, dir("3"), listing(9));
+  ASSERT_FALSE(c.lookup(cid, dir("1")));
+  ASSERT_TRUE(c.lookup(cid, dir("0")));
+  ASSERT_TRUE(c.lookup(cid, dir("2")));
+  ASSERT_TRUE(c.lookup(cid, dir("3")));
+
+  // too big to cache at all
+  c.add(cid, dir("4"), listing(30));
+  ASSERT_FALSE(c.lookup(cid, dir("4")));
+  ASSERT_TRUE(c.lookup(cid, dir("3")));
+
+  // replacing an entry doesn't count it twice
+  c.add(cid, dir("3"), listing(9));
+  ASSERT_TRUE(c.lookup(cid, dir("0")));
+
+  c.set_max_objects(10);
+  ASSERT_FALSE(c.lookup(cid, dir("2")));
+  ASSERT_FALSE(c.lookup(cid, dir("3")));
+  ASSERT_TRUE(c.lookup(cid, dir("0")));
+
+  c.set_max_objects(0);
+  ASSERT_FALSE(c.enabled());
+  ASSERT_FALSE(c.lookup(cid, dir("0")));
+}
@@ -0,0 +1,147 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include "os/MemDBStore.h"
+
+#include "gtest/gtest.h"
+
+static bufferlist val(const char *s)
+{
+  bufferlist bl;
+  bl.append(s);
+  return bl;
+}
+
+static string str(bufferlist bl)
+{
+  return string(bl.c_str(), bl.length());
+}
+
+static void put(KeyValueDB &db, const char *prefix, const char *key,
+		const char *v)
+{
+  KeyValueDB::Transaction t = db.get_transaction();
+  t->set(prefix, key, val(v));
+  db.submit_transaction(t);
+}
+
+/// every key, in iteration order, as "prefix/key"
+static string keys(KeyValueDB::WholeSpaceIterator it)
+{
+  string out;
+  for (it->seek_to_first(); it->valid(); it->next())
+    out += it->raw_key().first + "/" + it->raw_key().second + " ";
+  return out;
+}
+
+TEST(MemDBStore, Transaction) {
+  MemDBStore db("", 4);
+  put(db, "a", "1", "x");
+  put(db, "b", "1", "y");
+
+  KeyValueDB::Transaction t = db.get_transaction();
+  t->rmkeys_by_prefix("a");
+  t->set("a", "2", val("z"));
+  t->rmkey("b", "1");
+  t->set("c", "1", val("w"));
+  db.submit_transaction(t);
+
+  std::set<string> want;
+  want.insert("1");
+  want.insert("2");
+  std::map<string, bufferlist> got;
+  db.get("a", want, &got);
+  ASSERT_EQ(1u, got.size());
+  ASSERT_EQ("z", str(got["2"]));
+  got.clear();
+  db.get("b", want, &got);
+  ASSERT_TRUE(got.empty());
+  ASSERT_EQ("a/2 c/1 ", keys(db.get_iterator()));
+}
+
+TEST(MemDBStore, Iterator) {
+  // more prefixes than stripes, so iteration has to merge them
+  MemDBStore db("", 3);
+  const char *prefixes[] = { "e", "b", "d", "a", "c", "f", "ab" };
+  for (unsigned i = 0; i < 7; ++i) {
+    put(db, prefixes[i], "k1", "v");
+    put(db, prefixes[i], "k2", "v");
+  }
+  ASSERT_EQ("a/k1 a/k2 ab/k1 ab/k2 b/k1 b/k2 c/k1 c/k2 d/k1 d/k2 "
+	    "e/k1 e/k2 f/k1 f/k2 ", keys(db.get_iterator()));
+
+  KeyValueDB::WholeSpaceIterator it = db.get_iterator();
+  it->seek_to_last();
+  ASSERT_EQ(make_pair(string("f"), string("k2")), it->raw_key());
+  it->seek_to_last("a");
+  ASSERT_EQ(make_pair(string("a"), string("k2")), it->raw_key());
+  it->prev();
+  it->prev();
+  ASSERT_FALSE(it->valid());
+  it->upper_bound("b", "k2");
+  ASSERT_EQ(make_pair(string("c"), string("k1")), it->raw_key());
+  it->lower_bound("c", "k2");
+  ASSERT_EQ(make_pair(string("c"), string("k2")), it->raw_key());
+  it->seek_to_first("cc");
+  ASSERT_EQ(make_pair(string("d"), string("k1")), it->raw_key());
+
+  // removing the current key doesn't lose our place
+  KeyValueDB::Transaction t = db.get_transaction();
+  t->rmkeys_by_prefix("d");
+  db.submit_transaction(t);
+  it->next();
+  ASSERT_EQ(make_pair(string("e"), string("k1")), it->raw_key());
+
+  KeyValueDB::Iterator pit = db.get_iterator("ab");
+  pit->seek_to_first();
+  ASSERT_EQ("k1", pit->key());
+  pit->next();
+  pit->next();
+  ASSERT_FALSE(pit->valid());
+}
+
+TEST(MemDBStore, Snapshot) {
+  MemDBStore db("", 4);
+  put(db, "a", "1", "old");
+  KeyValueDB::WholeSpaceIterator snap = db.get_snapshot_iterator();
+  put(db, "a", "1", "new");
+  put(db, "b", "1", "new");
+
+  ASSERT_EQ("a/1 ", keys(snap));
+  snap->seek_to_first();
+  ASSERT_EQ("old", str(snap->value()));
+  ASSERT_EQ("a/1 b/1 ", keys(db.get_iterator()));
+}
+
+TEST(MemDBStore, Persist) {
+  char dir[] = "/tmp/test_memdb.XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  std::stringstream err;
+  {
+    MemDBStore db(dir);
+    ASSERT_EQ(0, db.init(err));
+    put(db, "a", "1", "synced");
+    KeyValueDB::Transaction t = db.get_transaction();
+    t->set("b", "1", val("synced"));
+    ASSERT_EQ(0, db.submit_transaction_sync(t));
+  }
+  {
+    MemDBStore db(dir, 5);
+    ASSERT_EQ(0, db.init(err));
+    ASSERT_EQ("a/1 b/1 ", keys(db.get_iterator()));
+  }
+  unlink((string(dir) + "/memdb.snap").c_str());
+  rmdir(dir);
+}
@@ -58,6 +58,97 @@ TEST(WorkQueue, Resize)
 }
 
 
+typedef pair<unsigned, int> item_t;  // (key, value)
+
+struct ShardedTestWQ :
+  public ShardedThreadPool::WorkQueueVal<item_t, item_t> {
+  // per shard queues, and the values processed for each key
+  vector<list<item_t> > queues;
+  Mutex done_lock;
+  map<unsigned, vector<int> > done;
+  set<unsigned> key_shards[4];
+
+  ShardedTestWQ(ShardedThreadPool *tp)
+    : ShardedThreadPool::WorkQueueVal<item_t, item_t>(
+      "ShardedTestWQ", 60, 0, tp),
+      done_lock("ShardedTestWQ::done_lock") {
+    queues.resize(get_num_shards());
+  }
+
+  unsigned _shard(const item_t &item) {
+    return item.first % get_num_shards();
+  }
+  void _enqueue(unsigned shard, item_t item) {
+    queues[shard].push_back(item);
+  }
+  void _enqueue_front(unsigned shard, item_t item) {
+    queues[shard].push_front(item);
+  }
+  bool _empty(unsigned shard) {
+    return queues[shard].empty();
+  }
+  item_t _dequeue(unsigned shard) {
+    item_t item = queues[shard].front();
+    queues[shard].pop_front();
+    return item;
+  }
+  void _process(unsigned shard, item_t item) {
+    Mutex::Locker l(done_lock);
+    done[item.first].push_back(item.second);
+    key_shards[shard].insert(item.first);
+  }
+};
+
+TEST(ShardedThreadPool, StartStop)
+{
+  ShardedThreadPool tp(g_ceph_context, "foo", 3, 2);
+
+  tp.start();
+  tp.pause();
+  tp.unpause();
+  tp.drain();
+  tp.stop();
+}
+
+TEST(ShardedThreadPool, Process)
+{
+  ShardedThreadPool tp(g_ceph_context, "bar", 4, 1);
+  ShardedTestWQ wq(&tp);
+
+  tp.start();
+  tp.pause();
+  for (int i = 0; i < 100; i++)
+    for (unsigned key = 0; key < 8; key++)
+      wq.queue(make_pair(key, i));
+  wq.queue_front(make_pair(3u, -1));
+  tp.unpause();
+  wq.drain();
+
+  Mutex::Locker l(wq.done_lock);
+  ASSERT_EQ(8u, wq.done.size());
+  for (unsigned key = 0; key < 8; key++) {
+    vector<int> &v = wq.done[key];
+    unsigned off = 0;
+    if (key == 3) {
+      ASSERT_EQ(-1, v[0]);
+      off = 1;
+    }
+    ASSERT_EQ(100u + off, v.size());
+    // one thread per shard keeps each key's items in order
+    for (int i = 0; i < 100; i++)
+      ASSERT_EQ(i, v[i + off]);
+  }
+  for (unsigned shard = 0; shard < 4; shard++) {
+    ASSERT_EQ(2u, wq.key_shards[shard].size());
+    for (set<unsigned>::iterator p = wq.key_shards[shard].begin();
+	 p != wq.key_shards[shard].end();
+	 ++p)
+      ASSERT_EQ(shard, *p % 4);
+  }
+  tp.stop();
+}
+
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,122 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/WritebackController.h"
+
+#include "gtest/gtest.h"
+
+TEST(WritebackController, Watermarks) {
+  WritebackController w(100, 20, 0, 10);
+  coll_t cid("1.0_head");
+  bool commit = false;
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  hobject_t obj_c(sobject_t("c", CEPH_NOSNAP));
+
+  ASSERT_FALSE(w.dirtied(cid, obj_a, 0, 40, &commit));
+  ASSERT_FALSE(w.dirtied(cid, obj_b, 0, 40, &commit));
+  ASSERT_FALSE(w.should_flush());
+  // merges into a's extent
+  ASSERT_TRUE(w.dirtied(cid, obj_a, 100, 40, &commit));
+  ASSERT_TRUE(w.should_flush());
+  ASSERT_FALSE(commit);
+
+  WritebackController::Extent e;
+  ASSERT_TRUE(w.get_next(&e));
+  ASSERT_EQ(obj_a, e.oid);
+  ASSERT_EQ(0u, e.off);
+  ASSERT_EQ(140u, e.len);
+  ASSERT_EQ(80u, e.bytes);
+  // 40 pending is still above the target
+  ASSERT_TRUE(w.get_next(&e));
+  ASSERT_EQ(obj_b, e.oid);
+  ASSERT_FALSE(w.get_next(&e));
+  ASSERT_FALSE(w.should_flush());
+
+  // written back is still dirty until a commit covers it
+  ASSERT_EQ(120u, w.get_dirty_bytes());
+  ASSERT_EQ(120u, w.get_written_back());
+  w.commit_start();
+  ASSERT_FALSE(w.dirtied(cid, obj_c, 0, 10, &commit));
+  ASSERT_EQ(130u, w.get_dirty_bytes());
+  w.commit_finish();
+  ASSERT_EQ(10u, w.get_dirty_bytes());
+}
+
+TEST(WritebackController, StopsAtTarget) {
+  WritebackController w(100, 50, 0, 10);
+  coll_t cid("1.0_head");
+  bool commit = false;
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  hobject_t obj_c(sobject_t("c", CEPH_NOSNAP));
+
+  w.dirtied(cid, obj_a, 0, 30, &commit);
+  w.dirtied(cid, obj_b, 0, 30, &commit);
+  ASSERT_TRUE(w.dirtied(cid, obj_c, 0, 40, &commit));
+
+  WritebackController::Extent e;
+  ASSERT_TRUE(w.get_next(&e));
+  ASSERT_TRUE(w.get_next(&e));   // 40 left <= 50
+  ASSERT_FALSE(w.get_next(&e));
+  ASSERT_FALSE(w.should_flush());
+}
+
+TEST(WritebackController, CommitEarly) {
+  WritebackController w(0, 0, 100, 10);
+  coll_t cid("1.0_head");
+  bool commit = false;
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+  hobject_t obj_c(sobject_t("c", CEPH_NOSNAP));
+  hobject_t obj_d(sobject_t("d", CEPH_NOSNAP));
+
+  // early writeback is off
+  ASSERT_FALSE(w.dirtied(cid, obj_a, 0, 60, &commit));
+  ASSERT_FALSE(commit);
+  ASSERT_FALSE(w.dirtied(cid, obj_b, 0, 60, &commit));
+  ASSERT_TRUE(commit);
+  ASSERT_FALSE(w.should_flush());
+
+  // only ask once per commit
+  commit = false;
+  w.dirtied(cid, obj_c, 0, 60, &commit);
+  ASSERT_FALSE(commit);
+  w.commit_start();
+
+  // what the running commit covers doesn't count towards the next one
+  w.dirtied(cid, obj_c, 0, 60, &commit);
+  ASSERT_FALSE(commit);
+  w.dirtied(cid, obj_d, 0, 60, &commit);
+  ASSERT_TRUE(commit);
+  ASSERT_EQ(2u, w.get_early_commits());
+  ASSERT_EQ(300u, w.get_dirty_bytes());
+}
+
+TEST(WritebackController, MaxObjects) {
+  WritebackController w(10, 0, 0, 1);
+  coll_t cid("1.0_head");
+  bool commit = false;
+  hobject_t obj_a(sobject_t("a", CEPH_NOSNAP));
+  hobject_t obj_b(sobject_t("b", CEPH_NOSNAP));
+
+  w.dirtied(cid, obj_a, 0, 5, &commit);
+  // no room in the queue; only the commit will write b
+  ASSERT_FALSE(w.dirtied(cid, obj_b, 0, 50, &commit));
+  ASSERT_TRUE(w.dirtied(cid, obj_a, 5, 5, &commit));
+
+  WritebackController::Extent e;
+  ASSERT_TRUE(w.get_next(&e));
+  ASSERT_EQ(obj_a, e.oid);
+  ASSERT_FALSE(w.get_next(&e));
+  ASSERT_EQ(60u, w.get_dirty_bytes());
+}